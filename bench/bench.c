@@ -0,0 +1,678 @@
+/*  pardu-bench:
+ *    runs the benchmark suite against synthetic target processes and writes
+ *    the results as JSON, one object per benchmark and parameter set. every
+ *    benchmark does one untimed warm-up run and reports the minimum and
+ *    median of the timed repeats.
+ *
+ *    usage: pardu-bench -x bench_target [-o out.json] [-r repeats]
+ *                       [-s heap MiB] [-t threads] [-w writes/ms]
+ *                       [-d dummy processes]
+ */
+#define _GNU_SOURCE
+
+#include "asm.h"
+#include "entropy.h"
+#include "hostutil.h"
+#include "mem.h"
+#include "proc.h"
+#include "scan.h"
+#include "stats.h"
+
+#include <dirent.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#ifndef BENCH_REV
+#define BENCH_REV "unknown"
+#endif
+
+#define MAX_REPEATS   64
+#define READ_BATCH    (4 * 1024 * 1024)   /* bytes per mem_read_batch call */
+#define KERNEL_CHUNK  (1024 * 1024)       /* bytes per scan kernel call    */
+#define PLANT_VALUE   0x13371337          /* see target.c                  */
+
+
+/*  _bench_target:
+ *    a running bench_target process.
+ */
+typedef struct _bench_target
+{
+  pid_t pid;
+  void *heap;
+  size_t heap_len;
+} bench_target;
+
+
+/*  _bench_output:
+ *    the JSON results array being written.
+ */
+typedef struct _bench_output
+{
+  FILE *f;
+  int count;                        /* results written so far */
+} bench_output;
+
+
+/* configuration, see usage */
+static const char *target_path;
+static int repeats = 5, threads = 4, churn = 0, dummies = 2000;
+static size_t heap_mb = 256;
+
+static const char *type_names[SCAN_TYPES] = {
+  "int8", "int16", "int32", "int64", "float", "double",
+};
+
+
+
+/*  _now_ns:
+ *    monotonic time in nanoseconds.
+ */
+static inline uint64_t
+_now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+static int
+_cmp_u64(const void *a, const void *b)
+{
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+/*  _spawn_target:
+ *    starts bench_target with the given shape and waits until it reports
+ *    its heap. returns 0 on success.
+ *
+ *    bench_target *t:  receives the process
+ *    int mappings:     extra single page mappings to create
+ *    size_t mb:        heap size in MiB
+ *    int nthreads:     writer threads
+ *    int writes:       writes per millisecond per thread
+ */
+static int
+_spawn_target(bench_target *t, int mappings, size_t mb, int nthreads,
+              int writes)
+{
+  int fds[2];
+  char a_m[16], a_s[24], a_t[16], a_w[16];
+  FILE *f;
+
+  snprintf(a_m, sizeof(a_m), "%d", mappings);
+  snprintf(a_s, sizeof(a_s), "%zu", mb);
+  snprintf(a_t, sizeof(a_t), "%d", nthreads);
+  snprintf(a_w, sizeof(a_w), "%d", writes);
+
+  if (pipe(fds) < 0)
+    return -1;
+
+  t->pid = fork();
+  if (t->pid < 0)
+    return -1;
+
+  if (t->pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    execl(target_path, target_path, "-m", a_m, "-s", a_s, "-t", a_t,
+          "-w", a_w, (char *) NULL);
+    _exit(127);
+  }
+
+  close(fds[1]);
+  f = fdopen(fds[0], "r");
+  if (fscanf(f, "ready %p %zu", &t->heap, &t->heap_len) != 2) {
+    fclose(f);
+    kill(t->pid, SIGKILL);
+    waitpid(t->pid, NULL, 0);
+    return -1;
+  }
+
+  fclose(f);
+  return 0;
+}
+
+
+static void
+_kill_target(bench_target *t)
+{
+  kill(t->pid, SIGKILL);
+  waitpid(t->pid, NULL, 0);
+}
+
+
+/*  _emit:
+ *    writes one result object. samples are sorted in place. work is the
+ *    amount of units processed per run, throughput is reported in units per
+ *    second (or GB/s for the "GB/s" unit, where work is in bytes).
+ *
+ *    bench_output *o:      output to append to
+ *    const char *name:     benchmark name
+ *    const char *params:   JSON object members describing the parameters
+ *    uint64_t *samples:    run times in nanoseconds
+ *    int n:                amount of samples
+ *    double work:          units processed per run
+ *    const char *unit:     name of the unit
+ */
+static void
+_emit(bench_output *o, const char *name, const char *params,
+      uint64_t *samples, int n, double work, const char *unit)
+{
+  double median, rate;
+
+  qsort(samples, n, sizeof(uint64_t), _cmp_u64);
+  median = n % 2 ? samples[n/2] : (samples[n/2-1] + samples[n/2]) / 2.0;
+
+  rate = median > 0 ? work / median : 0;
+  if (strcmp(unit, "GB/s") != 0)
+    rate *= 1e9;
+
+  fprintf(o->f, "%s\n    {\"name\": \"%s\", \"params\": {%s}, "
+          "\"repeats\": %d, \"min_ns\": %llu, \"median_ns\": %.0f, "
+          "\"throughput\": %.3f, \"unit\": \"%s\"}",
+          o->count ? "," : "", name, params, n,
+          (unsigned long long) samples[0], median, rate, unit);
+  o->count++;
+  fflush(o->f);
+}
+
+
+/*  bench_maps:
+ *    parse_proc_maps on targets with about 100, 10k and 60k mappings.
+ */
+static void
+bench_maps(bench_output *o)
+{
+  static const int sizes[] = { 100, 10000, 60000 };
+  int i, r, n;
+  uint64_t t0, samples[MAX_REPEATS];
+  char params[64];
+  ll_memmap_file *maps, *mmf;
+  bench_target t;
+
+  for (i = 0; i < (int) (sizeof(sizes) / sizeof(sizes[0])); i++)
+  {
+    if (_spawn_target(&t, sizes[i], 1, 0, 0) < 0) {
+      fprintf(stderr, "bench_maps: couldn't start %s\n", target_path);
+      continue;
+    }
+
+    maps = parse_proc_maps(t.pid);
+    for (n = 0, mmf = maps; mmf != NULL; mmf = mmf->next)
+      n++;
+    free_proc_maps(maps);
+
+    for (r = 0; r < repeats; r++)
+    {
+      t0 = _now_ns();
+      free_proc_maps(parse_proc_maps(t.pid));
+      samples[r] = _now_ns() - t0;
+    }
+
+    snprintf(params, sizeof(params), "\"mappings\": %d", n);
+    _emit(o, "parse_proc_maps", params, samples, repeats, n, "mappings/s");
+    _kill_target(&t);
+  }
+}
+
+
+/*  bench_lookup:
+ *    lookup_pid for a name that doesn't exist, so every /proc entry is
+ *    checked, with dummies extra processes alive.
+ */
+static void
+bench_lookup(bench_output *o)
+{
+  int i, r, n = 0, started;
+  uint64_t t0, samples[MAX_REPEATS];
+  char params[64];
+  pid_t *pids;
+  DIR *d;
+  struct dirent *e;
+
+  pids = malloc((dummies ? dummies : 1) * sizeof(pid_t));
+
+  for (started = 0; started < dummies; started++)
+  {
+    pids[started] = fork();
+    if (pids[started] < 0)
+      break;
+
+    if (pids[started] == 0) {
+      prctl(PR_SET_PDEATHSIG, SIGKILL);
+      pause();
+      _exit(0);
+    }
+  }
+
+  if ((d = opendir("/proc")) != NULL) {
+    while ((e = readdir(d)) != NULL)
+      if (e->d_name[0] >= '0' && e->d_name[0] <= '9')
+        n++;
+    closedir(d);
+  }
+
+  lookup_pid("pardu-bench-nonexistent");
+  for (r = 0; r < repeats; r++)
+  {
+    t0 = _now_ns();
+    lookup_pid("pardu-bench-nonexistent");
+    samples[r] = _now_ns() - t0;
+  }
+
+  snprintf(params, sizeof(params), "\"processes\": %d", n);
+  _emit(o, "lookup_pid", params, samples, repeats, n, "processes/s");
+
+  for (i = 0; i < started; i++)
+    kill(pids[i], SIGKILL);
+  for (i = 0; i < started; i++)
+    waitpid(pids[i], NULL, 0);
+
+  free(pids);
+}
+
+
+/*  _read_all:
+ *    reads the whole target heap in chunk sized requests.
+ */
+static void
+_read_all(mem_reader *rd, const bench_target *t, size_t chunk,
+          mem_readreq *reqs, uint8_t *buf)
+{
+  int n;
+  size_t off, per = READ_BATCH / chunk;
+
+  for (off = 0; off < t->heap_len; )
+  {
+    for (n = 0; n < (int) per && off < t->heap_len; n++, off += chunk)
+    {
+      reqs[n].addr = (uint8_t *) t->heap + off;
+      reqs[n].buf = buf + (size_t) n * chunk;
+      reqs[n].len = t->heap_len - off < chunk ? t->heap_len - off : chunk;
+    }
+
+    mem_read_batch(rd, reqs, n);
+  }
+}
+
+
+/*  bench_read:
+ *    memory read throughput of every backend, with page sized and large
+ *    requests.
+ */
+static void
+bench_read(bench_output *o, const bench_target *t)
+{
+  static const char *names[] = { "vm_readv", "procfs", "io_uring" };
+  static const size_t chunks[] = { 4096, 1024 * 1024 };
+  int b, c, r;
+  uint64_t t0, samples[MAX_REPEATS];
+  char params[96];
+  uint8_t *buf;
+  mem_readreq *reqs;
+  mem_reader rd;
+
+  buf = malloc(READ_BATCH);
+  reqs = malloc(READ_BATCH / 4096 * sizeof(mem_readreq));
+
+  for (b = MEM_BACKEND_VM_READV; b <= MEM_BACKEND_URING; b++)
+    for (c = 0; c < 2; c++)
+    {
+      mem_reader_init(&rd, t->pid, b);
+      _read_all(&rd, t, chunks[c], reqs, buf);
+
+      for (r = 0; r < repeats; r++)
+      {
+        t0 = _now_ns();
+        _read_all(&rd, t, chunks[c], reqs, buf);
+        samples[r] = _now_ns() - t0;
+      }
+
+      /* a fallback would make the numbers meaningless */
+      if (rd.backend != b)
+        fprintf(stderr, "bench_read: %s unavailable, measured %s\n",
+                names[b], names[rd.backend]);
+
+      snprintf(params, sizeof(params), "\"backend\": \"%s\", "
+               "\"request\": %zu, \"bytes\": %zu", names[b], chunks[c],
+               t->heap_len);
+      _emit(o, "mem_read", params, samples, repeats, t->heap_len, "GB/s");
+      mem_reader_close(&rd);
+    }
+
+  free(reqs);
+  free(buf);
+}
+
+
+/*  _scan_params_for:
+ *    exact scan parameters for the planted value in the given type.
+ */
+static void
+_scan_params_for(scan_params *p, int type, int aligned)
+{
+  memset(p, 0, sizeof(*p));
+  p->type = type;
+  p->cmp = SCAN_EXACT;
+  p->aligned = aligned;
+
+  switch (type)
+  {
+    case SCAN_INT8:   p->lo.i8 = (int8_t) PLANT_VALUE; break;
+    case SCAN_INT16:  p->lo.i16 = (int16_t) PLANT_VALUE; break;
+    case SCAN_INT32:  p->lo.i32 = PLANT_VALUE; break;
+    case SCAN_INT64:  p->lo.i64 = PLANT_VALUE; break;
+    case SCAN_FLOAT:  p->lo.f32 = 1.5f; break;
+    case SCAN_DOUBLE: p->lo.f64 = 1.5; break;
+  }
+}
+
+
+/*  bench_scan:
+ *    scan throughput per value type, both end to end through scan_first and
+ *    for the kernel alone over a local copy of the heap.
+ */
+static void
+bench_scan(bench_output *o, const bench_target *t)
+{
+  int type, aligned, r, hits;
+  uint64_t t0, samples[MAX_REPEATS];
+  size_t off, len;
+  char params[128];
+  uint8_t *copy;
+  uint32_t *out;
+  mem_reader rd;
+  mem_range range;
+  scan_params p;
+  scan_kernel k;
+  scan_results res;
+
+  range.start = t->heap;
+  range.end = (uint8_t *) t->heap + t->heap_len;
+  mem_reader_init(&rd, t->pid, MEM_BACKEND_VM_READV);
+
+  copy = malloc(t->heap_len);
+  out = malloc(KERNEL_CHUNK * sizeof(uint32_t));
+  mem_read(&rd, t->heap, copy, t->heap_len);
+
+  for (type = 0; type < SCAN_TYPES; type++)
+    for (aligned = 1; aligned >= 0; aligned--)
+    {
+      _scan_params_for(&p, type, aligned);
+
+      hits = 0;
+      for (r = -1; r < repeats; r++)
+      {
+        scan_results_init(&res);
+        t0 = _now_ns();
+        hits = scan_first(&res, &rd, &p, &range, 1);
+        if (r >= 0)
+          samples[r] = _now_ns() - t0;
+        scan_results_free(&res);
+      }
+
+      snprintf(params, sizeof(params), "\"type\": \"%s\", \"aligned\": %s, "
+               "\"bytes\": %zu, \"hits\": %d", type_names[type],
+               aligned ? "true" : "false", t->heap_len, hits);
+      _emit(o, "scan", params, samples, repeats, t->heap_len, "GB/s");
+
+      k = scan_kernel_select(&p);
+      for (r = -1; r < repeats; r++)
+      {
+        t0 = _now_ns();
+        for (off = 0; off < t->heap_len; off += len)
+        {
+          len = t->heap_len - off < KERNEL_CHUNK ? t->heap_len - off
+                                                 : KERNEL_CHUNK;
+          k(copy + off, len, &p, out);
+        }
+        if (r >= 0)
+          samples[r] = _now_ns() - t0;
+      }
+
+      snprintf(params, sizeof(params), "\"type\": \"%s\", \"aligned\": %s, "
+               "\"bytes\": %zu", type_names[type],
+               aligned ? "true" : "false", t->heap_len);
+      _emit(o, "scan_kernel", params, samples, repeats, t->heap_len, "GB/s");
+    }
+
+  free(out);
+  free(copy);
+  mem_reader_close(&rd);
+}
+
+
+/*  bench_entropy:
+ *    entropy map throughput over the target's heap, end to end with one
+ *    and all worker threads and for the window kernel alone.
+ */
+static void
+bench_entropy(bench_output *o, const bench_target *t)
+{
+  static const int workers[] = { 1, 0 };
+  ll_memmap_file heap;
+  ent_map m;
+  ent_window w;
+  uint64_t t0, samples[MAX_REPEATS];
+  size_t off;
+  char params[96];
+  uint8_t *copy;
+  mem_reader rd;
+  int i, r;
+
+  memset(&heap, 0, sizeof(heap));
+  heap.start_addr = t->heap;
+  heap.end_addr = (uint8_t *) t->heap + t->heap_len;
+  heap.mode = MODE_READ | MODE_WRITE;
+
+  for (i = 0; i < 2; i++)
+  {
+    for (r = -1; r < repeats; r++)
+    {
+      t0 = _now_ns();
+      ent_map_build(&m, t->pid, &heap, MODE_READ, ENT_WINDOW, workers[i]);
+      if (r >= 0)
+        samples[r] = _now_ns() - t0;
+      ent_map_free(&m);
+    }
+
+    snprintf(params, sizeof(params), "\"window\": %d, \"threads\": %d, "
+             "\"bytes\": %zu", ENT_WINDOW,
+             workers[i] ? workers[i] : host_get_info()->cpus, t->heap_len);
+    _emit(o, "entropy", params, samples, repeats, t->heap_len, "GB/s");
+  }
+
+  copy = malloc(t->heap_len);
+  mem_reader_init(&rd, t->pid, MEM_BACKEND_VM_READV);
+  mem_read(&rd, t->heap, copy, t->heap_len);
+  mem_reader_close(&rd);
+
+  for (r = -1; r < repeats; r++)
+  {
+    t0 = _now_ns();
+    for (off = 0; off + ENT_WINDOW <= t->heap_len; off += ENT_WINDOW)
+      ent_window_stats(copy + off, ENT_WINDOW, &w);
+    if (r >= 0)
+      samples[r] = _now_ns() - t0;
+  }
+
+  snprintf(params, sizeof(params), "\"window\": %d, \"bytes\": %zu",
+           ENT_WINDOW, t->heap_len);
+  _emit(o, "entropy_kernel", params, samples, repeats, t->heap_len, "GB/s");
+  free(copy);
+}
+
+
+/*  bench_disasm:
+ *    finds the basic blocks of the bench's own libc text, the work done
+ *    per module when coverage breakpoints are placed.
+ */
+static void
+bench_disasm(bench_output *o)
+{
+  ll_memmap_file *maps, *mmf, *code = NULL;
+  uint64_t t0, samples[MAX_REPEATS], insns = 0;
+  uint32_t *blocks;
+  uint8_t *buf;
+  size_t len, nblocks = 0;
+  char params[128];
+  stat_totals before, after;
+  int r;
+
+  maps = parse_proc_maps(getpid());
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+    if ((mmf->mode & MODE_EXECUTE) && mmf->fpath != NULL
+        && (code == NULL || strstr(mmf->fpath, "libc") != NULL))
+      code = mmf;
+
+  if (code == NULL) {
+    fprintf(stderr, "no executable mapping to disassemble\n");
+    free_proc_maps(maps);
+    return;
+  }
+
+  len = (uint8_t *) code->end_addr - (uint8_t *) code->start_addr;
+  buf = malloc(len);
+  memcpy(buf, code->start_addr, len);
+
+  for (r = -1; r < repeats; r++)
+  {
+    /* the warm-up run counts the instructions asm_blocks decodes, every
+     * run decodes the same */
+    if (r < 0)
+      stats_collect(&before);
+
+    t0 = _now_ns();
+    nblocks = asm_blocks(buf, len, (uintptr_t) code->start_addr, NULL, 0,
+                         &blocks);
+    if (r >= 0)
+      samples[r] = _now_ns() - t0;
+    free(blocks);
+
+    if (r < 0) {
+      stats_collect(&after);
+      insns = after.counters[STAT_DECODE_INSNS]
+              - before.counters[STAT_DECODE_INSNS];
+    }
+  }
+
+  snprintf(params, sizeof(params), "\"bytes\": %zu, \"blocks\": %zu", len,
+           nblocks);
+  _emit(o, "disasm", params, samples, repeats, insns, "insns/s");
+
+  free(buf);
+  free_proc_maps(maps);
+}
+
+
+/*  _emit_header:
+ *    writes the suite, host and configuration members.
+ */
+static void
+_emit_header(FILE *f)
+{
+  static const struct { int flag; const char *name; } features[] = {
+    { HOST_SSE2, "sse2" }, { HOST_SSE42, "sse4.2" }, { HOST_AVX2, "avx2" },
+    { HOST_AVX512BW, "avx512bw" }, { HOST_BMI2, "bmi2" },
+  };
+  const host_info *hi = host_get_info();
+  size_t i;
+  int n = 0;
+
+  fprintf(f, "{\n  \"suite\": \"pardu-bench\",\n  \"version\": 1,\n"
+          "  \"revision\": \"%s\",\n", BENCH_REV);
+
+  fprintf(f, "  \"host\": {\"arch\": \"%s\", \"model\": \"%s\", "
+          "\"cpus\": %d, \"cores\": %d, \"l1d\": %zu, \"l2\": %zu, "
+          "\"l3\": %zu, \"features\": [", hi->arch ? hi->arch : "",
+          hi->model, hi->cpus, hi->cores, hi->l1d, hi->l2, hi->l3);
+  for (i = 0; i < sizeof(features) / sizeof(features[0]); i++)
+    if (hi->features & features[i].flag)
+      fprintf(f, "%s\"%s\"", n++ ? ", " : "", features[i].name);
+  fprintf(f, "]},\n");
+
+  fprintf(f, "  \"config\": {\"repeats\": %d, \"heap_mb\": %zu, "
+          "\"threads\": %d, \"churn\": %d, \"dummies\": %d},\n"
+          "  \"results\": [", repeats, heap_mb, threads, churn, dummies);
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  int opt;
+  const char *out_path = NULL;
+  bench_output o = { stdout, 0 };
+  bench_target t;
+
+  host_init();
+
+  while ((opt = getopt(argc, argv, "x:o:r:s:t:w:d:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'x': target_path = optarg; break;
+      case 'o': out_path = optarg; break;
+      case 'r': repeats = atoi(optarg); break;
+      case 's': heap_mb = strtoul(optarg, NULL, 10); break;
+      case 't': threads = atoi(optarg); break;
+      case 'w': churn = atoi(optarg); break;
+      case 'd': dummies = atoi(optarg); break;
+      default: target_path = NULL; optind = argc; break;
+    }
+  }
+
+  if (target_path == NULL) {
+    fprintf(stderr, "usage: %s -x bench_target [-o out.json] [-r repeats] "
+            "[-s heap MiB] [-t threads] [-w writes/ms] [-d dummies]\n",
+            argv[0]);
+    return 1;
+  }
+
+  if (repeats < 1)
+    repeats = 1;
+  if (repeats > MAX_REPEATS)
+    repeats = MAX_REPEATS;
+
+  if (out_path != NULL && (o.f = fopen(out_path, "w")) == NULL) {
+    perror(out_path);
+    return 1;
+  }
+
+  _emit_header(o.f);
+
+  bench_maps(&o);
+  bench_lookup(&o);
+
+  if (_spawn_target(&t, 0, heap_mb, threads, churn) == 0) {
+    bench_read(&o, &t);
+    bench_scan(&o, &t);
+    bench_entropy(&o, &t);
+    _kill_target(&t);
+  } else {
+    fprintf(stderr, "couldn't start %s\n", target_path);
+  }
+
+  bench_disasm(&o);
+
+  fprintf(o.f, "\n  ]\n}\n");
+  if (o.f != stdout)
+    fclose(o.f);
+
+  return 0;
+}
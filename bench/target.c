@@ -0,0 +1,174 @@
+/*  bench_target:
+ *    synthetic process for the benchmark suite. it creates a configurable
+ *    number of mappings and a heap filled with deterministic data, starts
+ *    worker threads that keep writing into the heap, reports where the heap
+ *    is and then waits to be killed.
+ *
+ *    usage: bench_target [-m mappings] [-s heap MiB] [-t threads]
+ *                        [-w writes per ms per thread]
+ */
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+
+#define PAGE_SIZE 4096
+
+/* value planted once per page so scans always have some hits */
+#define PLANT_VALUE 0x13371337
+
+
+static uint64_t *heap;
+static size_t heap_words;
+static int churn;
+
+
+/*  _xorshift:
+ *    small deterministic prng so every run produces the same heap.
+ */
+static inline uint64_t
+_xorshift(uint64_t *s)
+{
+  *s ^= *s << 13;
+  *s ^= *s >> 7;
+  *s ^= *s << 17;
+  return *s;
+}
+
+
+/*  _make_mappings:
+ *    creates n single page mappings. one region is reserved and every other
+ *    page made writable, so the kernel can't merge neighbours and every
+ *    page shows up as its own line in /proc/<pid>/maps.
+ *
+ *    int n:  amount of mappings to create
+ */
+static int
+_make_mappings(int n)
+{
+  int i;
+  uint8_t *p;
+
+  if (n <= 0)
+    return 0;
+
+  p = mmap(NULL, (size_t) n * PAGE_SIZE, PROT_READ,
+           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED)
+    return -1;
+
+  for (i = 1; i < n; i += 2)
+    if (mprotect(p + (size_t) i * PAGE_SIZE, PAGE_SIZE,
+                 PROT_READ | PROT_WRITE) < 0)
+      return -1;
+
+  return 0;
+}
+
+
+/*  _fill_heap:
+ *    fills the heap with mostly small integers, like typical process data,
+ *    and plants PLANT_VALUE at the start of every page.
+ */
+static void
+_fill_heap(void)
+{
+  size_t i;
+  uint64_t s = 0x9e3779b97f4a7c15ULL;
+
+  for (i = 0; i < heap_words; i++)
+    heap[i] = _xorshift(&s) & 0x0000ffff0000ffffULL;
+
+  for (i = 0; i < heap_words; i += PAGE_SIZE / sizeof(uint64_t))
+    heap[i] = PLANT_VALUE;
+}
+
+
+/*  _churn_main:
+ *    writes churn random words into the heap every millisecond, or just
+ *    sleeps if churn is 0.
+ */
+static void *
+_churn_main(void *arg)
+{
+  int i;
+  uint64_t s = 0x2545f4914f6cdd1dULL + (uintptr_t) arg;
+  struct timespec ms = { 0, 1000000 };
+
+  for (;;)
+  {
+    if (churn == 0) {
+      pause();
+      continue;
+    }
+
+    for (i = 0; i < churn; i++)
+      heap[_xorshift(&s) % heap_words] = s;
+
+    nanosleep(&ms, NULL);
+  }
+
+  return NULL;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+  int opt, i, mappings = 0, threads = 0;
+  size_t heap_mb = 64;
+  pthread_t tid;
+
+  while ((opt = getopt(argc, argv, "m:s:t:w:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'm': mappings = atoi(optarg); break;
+      case 's': heap_mb = strtoul(optarg, NULL, 10); break;
+      case 't': threads = atoi(optarg); break;
+      case 'w': churn = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: %s [-m mappings] [-s heap MiB] [-t threads] "
+                "[-w writes/ms]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if (_make_mappings(mappings) < 0) {
+    perror("bench_target: mappings");
+    return 1;
+  }
+
+  heap_words = heap_mb * 1024 * 1024 / sizeof(uint64_t);
+  if (heap_words == 0)
+    heap_words = PAGE_SIZE / sizeof(uint64_t);
+
+  heap = mmap(NULL, heap_words * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+  if (heap == MAP_FAILED) {
+    perror("bench_target: heap");
+    return 1;
+  }
+
+  _fill_heap();
+
+  for (i = 0; i < threads; i++)
+    if (pthread_create(&tid, NULL, _churn_main, (void *) (uintptr_t) i) != 0)
+      break;
+
+  /* tell the bench runner where to look */
+  printf("ready %p %zu\n", (void *) heap, heap_words * sizeof(uint64_t));
+  fflush(stdout);
+
+  for (;;)
+    pause();
+
+  return 0;
+}
@@ -1,3 +1,430 @@
 #include "asm.h"
+#include "stats.h"
 
+#include <stdlib.h>
+#include <string.h>
 
+
+/* opcode table flags */
+#define M   0x01                    /* has a modrm byte                    */
+#define B   0x02                    /* 8-bit immediate                     */
+#define Z   0x04                    /* 16 or 32-bit immediate by operand
+                                     * size                                */
+#define W   0x08                    /* 16-bit immediate                    */
+#define X   0x10                    /* invalid in 64-bit mode              */
+#define MB  (M | B)
+#define MZ  (M | Z)
+
+#define BIT_SET(map, i)   ((map)[(i) >> 3] |= 1u << ((i) & 7))
+#define BIT_CLR(map, i)   ((map)[(i) >> 3] &= ~(1u << ((i) & 7)))
+#define BIT_GET(map, i)   ((map)[(i) >> 3] >> ((i) & 7) & 1)
+
+
+/* one byte opcodes. prefixes, 0f and the vex and evex escapes are handled
+ * before the table is used */
+static const uint8_t op1[256] = {
+  M,  M,  M,  M,  B,  Z,  X,  X,  M,  M,  M,  M,  B,  Z,  X,  0,
+  M,  M,  M,  M,  B,  Z,  X,  X,  M,  M,  M,  M,  B,  Z,  X,  X,
+  M,  M,  M,  M,  B,  Z,  0,  X,  M,  M,  M,  M,  B,  Z,  0,  X,
+  M,  M,  M,  M,  B,  Z,  0,  X,  M,  M,  M,  M,  B,  Z,  0,  X,
+  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+  X,  X,  X,  M,  0,  0,  0,  0,  Z,  MZ, B,  MB, 0,  0,  0,  0,
+  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,  B,
+  MB, MZ, X,  MB, M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  X,  0,  0,  0,  0,  0,
+  0,  0,  0,  0,  0,  0,  0,  0,  B,  Z,  0,  0,  0,  0,  0,  0,
+  B,  B,  B,  B,  B,  B,  B,  B,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,
+  MB, MB, W,  0,  X,  X,  MB, MZ, 0,  0,  W,  0,  0,  B,  X,  0,
+  M,  M,  M,  M,  X,  X,  X,  0,  M,  M,  M,  M,  M,  M,  M,  M,
+  B,  B,  B,  B,  B,  B,  B,  B,  Z,  Z,  X,  B,  0,  0,  0,  0,
+  0,  0,  0,  0,  0,  0,  M,  M,  0,  0,  0,  0,  0,  0,  M,  M,
+};
+
+/* two byte opcodes, 0f xx */
+static const uint8_t op2[256] = {
+  M,  M,  M,  M,  X,  0,  0,  0,  0,  0,  X,  0,  X,  M,  0,  MB,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+  M,  M,  M,  M,  X,  X,  X,  X,  M,  M,  M,  M,  M,  M,  M,  M,
+  0,  0,  0,  0,  0,  0,  X,  0,  0,  X,  0,  X,  X,  X,  X,  X,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+  MB, MB, MB, MB, M,  M,  M,  0,  M,  M,  X,  X,  M,  M,  M,  M,
+  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,  Z,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+  0,  0,  0,  M,  MB, M,  X,  X,  0,  0,  0,  M,  MB, M,  M,  M,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  MB, M,  M,  M,  M,  M,
+  M,  M,  MB, M,  MB, MB, MB, M,  0,  0,  0,  0,  0,  0,  0,  0,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,  M,
+};
+
+
+
+/*  _modrm_len:
+ *    amount of bytes taken by a modrm byte with its sib and displacement,
+ *    or 0 if they don't fit in avail.
+ */
+static size_t
+_modrm_len(const uint8_t *p, size_t avail)
+{
+  uint8_t mod, rm;
+  size_t len = 1;
+
+  if (avail < 1)
+    return 0;
+
+  mod = p[0] >> 6;
+  rm = p[0] & 7;
+
+  if (mod != 3 && rm == 4) {
+    if (avail < 2)
+      return 0;
+
+    len++;
+    if (mod == 0 && (p[1] & 7) == 5)
+      len += 4;
+  } else if (mod == 0 && rm == 5) {
+    len += 4;                       /* rip relative */
+  }
+
+  if (mod == 1)
+    len += 1;
+  else if (mod == 2)
+    len += 4;
+
+  return len <= avail ? len : 0;
+}
+
+
+/*  _vex_imm:
+ *    whether a vex or evex encoded opcode takes an 8-bit immediate.
+ */
+static int
+_vex_imm(int map, uint8_t op)
+{
+  return map == 3 || (map == 1 && ((op >= 0x70 && op <= 0x73)
+                                   || op == 0xc2
+                                   || (op >= 0xc4 && op <= 0xc6)));
+}
+
+
+/*  asm_decode:
+ *    decodes the length and control flow of the x86-64 instruction at code.
+ *    operands aren't decoded, only as much as needed to find the length.
+ *    returns the length, or -1 with insn->flow set to ASM_INVALID if the
+ *    bytes aren't a valid instruction or it doesn't fit in avail.
+ *
+ *    const uint8_t *code:  instruction bytes
+ *    size_t avail:         bytes readable at code
+ *    uintptr_t addr:       address of the instruction, for branch targets
+ *    asm_insn *insn:       receives the result
+ */
+int
+asm_decode(const uint8_t *code, size_t avail, uintptr_t addr, asm_insn *insn)
+{
+  size_t i = 0, n, modrm = 0;
+  int opsize16 = 0, addr32 = 0, rexw = 0, map = 0, imm = 0, rel = 0;
+  int evex;
+  uint8_t op, flags = 0;
+
+  insn->len = 0;
+  insn->flow = ASM_INVALID;
+  insn->target = 0;
+
+  if (avail > ASM_MAX_LEN)
+    avail = ASM_MAX_LEN;
+
+  /* legacy prefixes, then rex which has to come last */
+  for (; i < avail; i++)
+  {
+    op = code[i];
+    if (op == 0x66)
+      opsize16 = 1;
+    else if (op == 0x67)
+      addr32 = 1;
+    else if (op != 0xf0 && op != 0xf2 && op != 0xf3 && op != 0x2e
+             && op != 0x36 && op != 0x3e && op != 0x26 && op != 0x64
+             && op != 0x65)
+      break;
+  }
+
+  if (i < avail && (code[i] & 0xf0) == 0x40) {
+    rexw = code[i] & 0x08;
+    i++;
+  }
+
+  if (i >= avail)
+    return -1;
+
+  op = code[i++];
+
+  if (op == 0xc4 || op == 0xc5 || op == 0x62) {
+    /* vex and evex, every opcode but vzeroupper and vzeroall has modrm */
+    evex = op == 0x62;
+    n = op == 0xc5 ? 1 : op == 0xc4 ? 2 : 3;
+    if (i + n >= avail)
+      return -1;
+
+    map = op == 0xc5 ? 1 : op == 0xc4 ? code[i] & 0x1f : code[i] & 7;
+    if (map < 1 || map > 6 || (!evex && map > 3))
+      return -1;
+
+    i += n;
+    op = code[i++];
+    if (!evex && map == 1 && op == 0x77)
+      flags = 0;
+    else
+      flags = M | (_vex_imm(map, op) ? B : 0);
+  } else if (op == 0x0f) {
+    if (i >= avail)
+      return -1;
+
+    op = code[i++];
+    if (op == 0x38 || op == 0x3a) {
+      if (i >= avail)
+        return -1;
+      flags = M | (op == 0x3a ? B : 0);
+      op = code[i++];
+      map = 2;
+    } else {
+      flags = op2[op];
+      map = 1;
+
+      if (op >= 0x80 && op <= 0x8f) {
+        flags = 0;
+        rel = 4;
+      }
+    }
+  } else {
+    flags = op1[op];
+
+    if ((op >= 0x70 && op <= 0x7f) || (op >= 0xe0 && op <= 0xe3)
+        || op == 0xeb) {
+      flags = 0;
+      rel = 1;
+    } else if (op == 0xe8 || op == 0xe9) {
+      flags = 0;
+      rel = 4;
+    }
+  }
+
+  if (flags & X)
+    return -1;
+
+  if (flags & M) {
+    n = _modrm_len(code + i, avail - i);
+    if (n == 0)
+      return -1;
+
+    /* test takes an immediate, the other f6 and f7 group members don't */
+    if (map == 0 && (op == 0xf6 || op == 0xf7) && (code[i] & 0x38) < 0x10)
+      flags |= op == 0xf6 ? B : Z;
+
+    /* 8f with reg != 0 is an amd xop prefix */
+    if (map == 0 && op == 0x8f && (code[i] & 0x38) != 0)
+      return -1;
+
+    modrm = i;
+    i += n;
+  }
+
+  if (flags & B)
+    imm += 1;
+  if (flags & W)
+    imm += 2;
+  if (flags & Z)
+    imm += opsize16 && !rexw ? 2 : 4;
+
+  if (map == 0) {
+    if (op >= 0xa0 && op <= 0xa3)
+      imm = addr32 ? 4 : 8;         /* moffs */
+    else if (op >= 0xb8 && op <= 0xbf && rexw)
+      imm = 8;                      /* movabs */
+    else if (op == 0xc8)
+      imm = 3;                      /* enter */
+  }
+
+  if (i + imm + rel > avail)
+    return -1;
+
+  i += imm + rel;
+  insn->len = (uint8_t) i;
+  insn->flow = ASM_NEXT;
+
+  if (rel) {
+    insn->target = addr + i + (rel == 1 ? (intptr_t) (int8_t) code[i - 1]
+                               : (intptr_t) (int32_t) (code[i - 4]
+                                 | code[i - 3] << 8 | code[i - 2] << 16
+                                 | (uint32_t) code[i - 1] << 24));
+    insn->flow = op == 0xe8 ? ASM_CALL
+               : (op == 0xe9 || op == 0xeb) && map == 0 ? ASM_JUMP
+               : ASM_BRANCH;
+  } else if (map == 0) {
+    if (op == 0xc2 || op == 0xc3 || op == 0xca || op == 0xcb || op == 0xcf)
+      insn->flow = ASM_RET;
+    else if (op == 0xcc || op == 0xf4)
+      insn->flow = ASM_STOP;
+    else if (op == 0xff) {
+      switch ((code[modrm] >> 3) & 7)
+      {
+        case 2: case 3: insn->flow = ASM_CALL_INDIRECT; break;
+        case 4: case 5: insn->flow = ASM_JUMP_INDIRECT; break;
+      }
+    }
+  } else if (map == 1 && (op == 0x0b || op == 0xb9 || op == 0xff)) {
+    insn->flow = ASM_STOP;          /* ud2, ud1, ud0 */
+  }
+
+  return i;
+}
+
+
+/*  _is_nop:
+ *    whether an instruction is padding, nop or the long 0f 1f forms.
+ */
+static int
+_is_nop(const uint8_t *p, size_t len)
+{
+  size_t i = 0;
+
+  while (i < len && (p[i] == 0x66 || p[i] == 0x2e))
+    i++;
+
+  return i < len && (p[i] == 0x90 || (p[i] == 0x0f && i + 1 < len
+                                      && p[i + 1] == 0x1f));
+}
+
+
+/*  _sweep:
+ *    decodes code[start, end) linearly, marking instruction boundaries and
+ *    block starts and collecting branch targets. if decoding fails or runs
+ *    past end the run wasn't code or got out of sync, and everything after
+ *    its last terminator is dropped, usually only padding.
+ */
+static void
+_sweep(const uint8_t *code, size_t start, size_t end, uintptr_t base,
+       uint8_t *insns, uint8_t *starts, uintptr_t **targets, size_t *ntargets,
+       size_t *cap, uint64_t *ndecoded)
+{
+  size_t pos = start, keep = start, i, tkeep = *ntargets;
+  int pending = 1, len;
+  asm_insn in;
+
+  while (pos < end)
+  {
+    len = asm_decode(code + pos, end - pos, base + pos, &in);
+    (*ndecoded)++;
+
+    if (len < 0) {
+      /* drop what follows the last terminator */
+      for (i = keep; i < pos; i++)
+      {
+        BIT_CLR(insns, i);
+        BIT_CLR(starts, i);
+      }
+      *ntargets = tkeep;
+      return;
+    }
+
+    BIT_SET(insns, pos);
+    if (pending && code[pos] != 0xcc && !_is_nop(code + pos, len)) {
+      BIT_SET(starts, pos);
+      pending = 0;
+    }
+
+    if (in.flow == ASM_JUMP || in.flow == ASM_BRANCH
+        || in.flow == ASM_CALL) {
+      if (*ntargets == *cap) {
+        *cap = *cap ? *cap * 2 : 1024;
+        *targets = realloc(*targets, *cap * sizeof(uintptr_t));
+      }
+      (*targets)[(*ntargets)++] = in.target;
+    }
+
+    pos += len;
+
+    switch (in.flow)
+    {
+      case ASM_JUMP: case ASM_BRANCH: case ASM_JUMP_INDIRECT:
+      case ASM_RET: case ASM_STOP:
+        pending = 1;
+        keep = pos;
+        tkeep = *ntargets;
+        break;
+    }
+  }
+}
+
+
+/*  asm_blocks:
+ *    finds the basic block starts of a run of x86-64 code by linear sweep.
+ *    blocks start at the beginning of the code, at every sync point, after
+ *    every jump, branch, return or trap and at every direct branch target
+ *    inside the code, padding excluded. sync points are known instruction
+ *    starts such as function symbols, the sweep restarts at each of them
+ *    so data or padding can't desync it for long. returns the amount of
+ *    blocks, their offsets from code are stored sorted in *out, which the
+ *    caller frees.
+ *
+ *    const uint8_t *code:      the code
+ *    size_t len:               its length
+ *    uintptr_t base:           address of code in the process
+ *    const uintptr_t *syncs:   sorted sync point addresses, may be NULL
+ *    size_t nsyncs:            number of entries in syncs
+ *    uint32_t **out:           receives the block offsets
+ */
+size_t
+asm_blocks(const uint8_t *code, size_t len, uintptr_t base,
+           const uintptr_t *syncs, size_t nsyncs, uint32_t **out)
+{
+  uint8_t *insns, *starts;
+  uintptr_t *targets = NULL, t;
+  size_t ntargets = 0, cap = 0, s, from, to, i, n = 0;
+  uint64_t ndecoded = 0, start = stat_now();
+
+  insns = calloc(len / 8 + 1, 1);
+  starts = calloc(len / 8 + 1, 1);
+
+  /* sweep every run between two sync points on its own */
+  from = 0;
+  for (s = 0; s <= nsyncs; s++)
+  {
+    if (s < nsyncs && (syncs[s] < base || syncs[s] - base <= from))
+      continue;
+
+    to = s < nsyncs && syncs[s] - base < len ? syncs[s] - base : len;
+    _sweep(code, from, to, base, insns, starts, &targets, &ntargets, &cap,
+           &ndecoded);
+
+    from = to;
+    if (from >= len)
+      break;
+  }
+
+  /* branch targets only count if the sweep decoded an instruction there */
+  for (i = 0; i < ntargets; i++)
+  {
+    t = targets[i] - base;
+    if (targets[i] >= base && t < len && BIT_GET(insns, t))
+      BIT_SET(starts, t);
+  }
+
+  for (i = 0; i < len; i++)
+    n += BIT_GET(starts, i);
+
+  *out = malloc((n ? n : 1) * sizeof(uint32_t));
+  for (i = 0, n = 0; i < len; i++)
+    if (BIT_GET(starts, i))
+      (*out)[n++] = (uint32_t) i;
+
+  free(targets);
+  free(insns);
+  free(starts);
+
+  stat_add(STAT_DECODE_INSNS, ndecoded);
+  stat_time(STAT_T_DECODE, start);
+  return n;
+}
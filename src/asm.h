@@ -1,6 +1,40 @@
 #ifndef __ASM_H
 #define __ASM_H
 
+#include <stddef.h>
+#include <stdint.h>
 
+#define ASM_MAX_LEN 15              /* longest x86-64 instruction */
+
+/* how an instruction passes control on */
+enum asm_flow {
+  ASM_NEXT = 0,                     /* falls through to the next one      */
+  ASM_JUMP,                         /* jumps to target                    */
+  ASM_BRANCH,                       /* jumps to target or falls through   */
+  ASM_CALL,                         /* calls target                       */
+  ASM_JUMP_INDIRECT,                /* jumps through a register or memory */
+  ASM_CALL_INDIRECT,                /* calls through a register or memory */
+  ASM_RET,
+  ASM_STOP,                         /* traps or halts, e.g. ud2 or int3   */
+  ASM_INVALID,                      /* not a valid instruction            */
+};
+
+
+/*  _asm_instruction:
+ *    what the length decoder knows about an instruction. target is only
+ *    set for direct jumps, branches and calls.
+ */
+typedef struct _asm_instruction
+{
+  uint8_t len;
+  uint8_t flow;                     /* enum asm_flow */
+  uintptr_t target;
+} asm_insn;
+
+
+/* function definitions */
+int    asm_decode(const uint8_t*, size_t, uintptr_t, asm_insn*);
+size_t asm_blocks(const uint8_t*, size_t, uintptr_t, const uintptr_t*,
+                  size_t, uint32_t**);
 
 #endif /* __ASM_H */
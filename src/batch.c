@@ -0,0 +1,1573 @@
+#include "batch.h"
+#include "dedup.h"
+#include "entropy.h"
+#include "heap.h"
+#include "hostutil.h"
+#include "scan.h"
+#include "stacks.h"
+#include "strscan.h"
+#include "symbols.h"
+
+#include <ctype.h>
+#include <regex.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define MAX_ARGS      64
+#define SIG_MAX       256             /* longest signature in bytes        */
+#define SIG_CHUNK     (1024 * 1024)   /* bytes searched per read           */
+#define TEXT_MAX      1024            /* longest string text written       */
+#define HEAP_LARGEST  10              /* largest allocations reported      */
+
+
+static const char *type_names[SCAN_TYPES] = {
+  "int8", "int16", "int32", "int64", "float", "double",
+};
+
+
+/*  _batch_query:
+ *    state of the query being run, passed to the result callbacks.
+ */
+struct _batch_query
+{
+  batch_session *s;
+  multi_target *t;                  /* target records are written for */
+  long q;
+  const char *op;
+  long count;
+  int type;                         /* enum scan_type of a scan */
+  const char *substr;               /* strings filters, or NULL */
+  const regex_t *re;
+  uint8_t text[TEXT_MAX];
+};
+
+
+
+/*  batch_open:
+ *    attaches a session to one or more processes. processes whose maps
+ *    can't be read are skipped. returns 0 on success, -1 if none could be
+ *    attached.
+ *
+ *    batch_session *s:   session to initialize
+ *    const int *pids:    processes to attach to
+ *    int n:              number of entries in pids
+ *    ndj_writer *out:    writer results are streamed to
+ */
+int
+batch_open(batch_session *s, const int *pids, int n, ndj_writer *out)
+{
+  s->out = out;
+  s->nthreads = 0;
+  s->smaps = NULL;
+  s->snaps = NULL;
+  memset(&s->sess, 0, sizeof(scan_session));
+  s->hists = NULL;
+  s->integ = NULL;
+
+  if (multi_attach(&s->m, pids, n, MEM_BACKEND_VM_READV) == 0) {
+    multi_detach(&s->m);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+/*  _release:
+ *    drops the captures of every target, reads go to the live processes
+ *    again.
+ */
+static void
+_release(batch_session *s)
+{
+  multi_target *t;
+  int i;
+
+  for (i = 0; s->snaps != NULL && i < s->m.count; i++)
+  {
+    t = &s->m.targets[i];
+    mem_reader_close(&t->reader);
+    mem_reader_init(&t->reader, t->pid, s->m.backend);
+    snap_free(&s->snaps[i]);
+  }
+
+  free(s->snaps);
+  s->snaps = NULL;
+}
+
+
+/*  batch_close:
+ *    releases everything held by the session and flushes its output.
+ */
+void
+batch_close(batch_session *s)
+{
+  int i;
+
+  for (i = 0; s->smaps != NULL && i < s->m.count; i++)
+    smaps_close(&s->smaps[i]);
+  free(s->smaps);
+
+  _release(s);
+  sess_free(&s->sess);
+
+  for (i = 0; s->hists != NULL && i < s->m.count; i++)
+    if (s->hists[i] != NULL)
+      history_close(s->hists[i]);
+  free(s->hists);
+
+  if (s->integ != NULL)
+    integ_cache_free(s->integ);
+
+  multi_detach(&s->m);
+  ndj_flush(s->out);
+}
+
+
+/*  _begin:
+ *    starts a result record of the current query, for the current target
+ *    if there is one.
+ */
+static void
+_begin(struct _batch_query *bq)
+{
+  ndj_begin(bq->s->out);
+  ndj_u64(bq->s->out, NDJ_Q, bq->q);
+  ndj_str(bq->s->out, NDJ_OP, bq->op);
+  if (bq->t != NULL)
+    ndj_u64(bq->s->out, NDJ_PID, bq->t->pid);
+}
+
+
+/*  _finish:
+ *    writes the closing record of a query and flushes, so every query's
+ *    output is complete once its done record is seen.
+ */
+static int
+_finish(struct _batch_query *bq, const char *err)
+{
+  bq->t = NULL;
+  _begin(bq);
+  if (err != NULL)
+    ndj_str(bq->s->out, NDJ_ERROR, err);
+  else
+    ndj_u64(bq->s->out, NDJ_COUNT, bq->count);
+  ndj_raw(bq->s->out, NDJ_DONE, "true");
+  ndj_end(bq->s->out);
+  ndj_flush(bq->s->out);
+
+  return err != NULL ? -1 : 0;
+}
+
+
+/*  _op_maps:
+ *    maps: one record per mapping.
+ */
+static int
+_op_maps(struct _batch_query *bq)
+{
+  ndj_writer *w = bq->s->out;
+  ll_memmap_file *mmf;
+  char perms[5], dev[8];
+  int i;
+
+  for (i = 0; i < bq->s->m.count; i++)
+  {
+    bq->t = &bq->s->m.targets[i];
+
+    for (mmf = bq->t->maps; mmf != NULL; mmf = mmf->next)
+    {
+      perms[0] = mmf->mode & MODE_READ ? 'r' : '-';
+      perms[1] = mmf->mode & MODE_WRITE ? 'w' : '-';
+      perms[2] = mmf->mode & MODE_EXECUTE ? 'x' : '-';
+      perms[3] = mmf->mode & MODE_PRIVATE ? 'p' : 's';
+      perms[4] = '\0';
+      snprintf(dev, sizeof(dev), "%02x:%02x", mmf->dev_major,
+               mmf->dev_minor);
+
+      _begin(bq);
+      ndj_hex(w, NDJ_ADDR, (uintptr_t) mmf->start_addr);
+      ndj_hex(w, NDJ_END, (uintptr_t) mmf->end_addr);
+      ndj_str(w, NDJ_PERMS, perms);
+      ndj_hex(w, NDJ_OFFSET, mmf->offset);
+      ndj_str(w, NDJ_DEV, dev);
+      ndj_u64(w, NDJ_INODE, (unsigned int) mmf->inode);
+      ndj_str(w, NDJ_PATH, mmf->fpath ? mmf->fpath : "");
+      ndj_end(w);
+      bq->count++;
+    }
+  }
+
+  return _finish(bq, NULL);
+}
+
+
+/*  _op_refresh:
+ *    refresh: parses the maps again, e.g. after the target mapped more
+ *    memory, drops captures and moves the session's candidates to the
+ *    new layout.
+ */
+static int
+_op_refresh(struct _batch_query *bq)
+{
+  ll_memmap_file *mmf;
+  int i;
+
+  _release(bq->s);
+  multi_refresh(&bq->s->m);
+  sess_rebase(&bq->s->sess, &bq->s->m);
+
+  for (i = 0; i < bq->s->m.count; i++)
+    for (mmf = bq->s->m.targets[i].maps; mmf != NULL; mmf = mmf->next)
+      bq->count++;
+
+  return _finish(bq, NULL);
+}
+
+
+/*  _parse_value:
+ *    parses a number into the member of v used by type.
+ */
+static int
+_parse_value(int type, const char *s, scan_value *v)
+{
+  char *end;
+  long long i;
+  double d;
+
+  if (type == SCAN_FLOAT || type == SCAN_DOUBLE) {
+    d = strtod(s, &end);
+    if (type == SCAN_FLOAT)
+      v->f32 = (float) d;
+    else
+      v->f64 = d;
+  } else {
+    i = strtoll(s, &end, 0);
+    switch (type)
+    {
+      case SCAN_INT8:  v->i8 = (int8_t) i; break;
+      case SCAN_INT16: v->i16 = (int16_t) i; break;
+      case SCAN_INT32: v->i32 = (int32_t) i; break;
+      case SCAN_INT64: v->i64 = i; break;
+    }
+  }
+
+  return *s != '\0' && *end == '\0';
+}
+
+
+/*  _scan_args:
+ *    parses <type> <value> [<max>] [unaligned] from argv[1] on. returns
+ *    NULL or what's wrong with them.
+ */
+static const char*
+_scan_args(int argc, char **argv, scan_params *p)
+{
+  int i, nvals = 0;
+
+  memset(p, 0, sizeof(scan_params));
+  p->aligned = 1;
+  p->type = -1;
+
+  for (i = 0; i < SCAN_TYPES; i++)
+    if (strcmp(argv[1], type_names[i]) == 0)
+      p->type = i;
+  if (p->type < 0)
+    return "unknown type";
+
+  for (i = 2; i < argc; i++)
+  {
+    if (strcmp(argv[i], "unaligned") == 0)
+      p->aligned = 0;
+    else if (nvals < 2
+             && _parse_value(p->type, argv[i], nvals ? &p->hi : &p->lo))
+      nvals++;
+    else
+      return "invalid value";
+  }
+
+  p->cmp = nvals == 2 ? SCAN_RANGE : SCAN_EXACT;
+  return NULL;
+}
+
+
+/*  _scan_cb:
+ *    writes the hits of one scanned chunk. called by the scan workers one
+ *    at a time.
+ */
+static void
+_scan_cb(const multi_target *t, const scan_results *res, void *arg)
+{
+  struct _batch_query *bq = arg;
+  size_t h;
+
+  bq->t = (multi_target *) t;
+  for (h = 0; h < res->count; h++)
+  {
+    _begin(bq);
+    ndj_hex(bq->s->out, NDJ_ADDR, scan_results_get(res, h));
+    ndj_str(bq->s->out, NDJ_TYPE, type_names[bq->type]);
+    ndj_end(bq->s->out);
+  }
+
+  bq->count += res->count;
+  ndj_flush(bq->s->out);
+}
+
+
+/*  _op_scan:
+ *    scan <type> <value> [<max>] [unaligned]: value scan over all readable
+ *    memory, an exact scan or a range scan if max is given. all targets
+ *    are scanned at once, hits are written after every scanned chunk.
+ */
+static int
+_op_scan(struct _batch_query *bq, int argc, char **argv)
+{
+  const char *err;
+  scan_params p;
+
+  if (argc < 3)
+    return _finish(bq, "usage: scan <type> <value> [<max>] [unaligned]");
+  if ((err = _scan_args(argc, argv, &p)) != NULL)
+    return _finish(bq, err);
+
+  bq->type = p.type;
+
+  multi_scan(&bq->s->m, &p, MODE_READ, bq->s->nthreads, _scan_cb, bq);
+  return _finish(bq, NULL);
+}
+
+
+/*  _parse_sig:
+ *    parses hex byte pairs into pat and mask, "??" or "?" is a wildcard.
+ *    spaces between bytes are optional. returns the length or -1.
+ */
+static int
+_parse_sig(int argc, char **argv, uint8_t *pat, uint8_t *mask)
+{
+  int i, len = 0;
+  const char *c;
+  char hex[3] = { 0 };
+
+  for (i = 1; i < argc; i++)
+    for (c = argv[i]; *c; )
+    {
+      if (len == SIG_MAX)
+        return -1;
+
+      if (*c == '?') {
+        pat[len] = mask[len] = 0;
+        len++;
+        c += c[1] == '?' ? 2 : 1;
+        continue;
+      }
+
+      if (!isxdigit((unsigned char) c[0]) || !isxdigit((unsigned char) c[1]))
+        return -1;
+
+      hex[0] = c[0];
+      hex[1] = c[1];
+      pat[len] = (uint8_t) strtoul(hex, NULL, 16);
+      mask[len] = 0xff;
+      len++;
+      c += 2;
+    }
+
+  return len;
+}
+
+
+/*  _sig_target:
+ *    signature search over the executable memory of the current target.
+ */
+static void
+_sig_target(struct _batch_query *bq, const uint8_t *pat, const uint8_t *mask,
+            int plen, uint8_t *buf)
+{
+  int i, n;
+  const uint8_t *hit;
+  uintptr_t addr, end;
+  ssize_t got;
+  size_t want, pos;
+  mem_range *ranges;
+
+  n = mem_ranges_from_maps(bq->t->maps, MODE_READ | MODE_EXECUTE, &ranges);
+
+  for (i = 0; i < n; i++)
+  {
+    end = (uintptr_t) ranges[i].end;
+
+    /* chunks overlap by plen - 1, matches are only taken if they start
+     * in the chunk itself so none are reported twice */
+    for (addr = (uintptr_t) ranges[i].start; addr < end; addr += SIG_CHUNK)
+    {
+      want = end - addr < SIG_CHUNK + plen - 1 ? end - addr
+                                               : SIG_CHUNK + plen - 1;
+      got = mem_read(&bq->t->reader, (void *) addr, buf, want);
+      if (got < plen)
+        continue;
+
+      for (pos = 0; pos < SIG_CHUNK && pos + plen <= (size_t) got; )
+      {
+        hit = hostk.search(buf + pos, got - pos, pat, mask, plen);
+        if (hit == NULL || hit - buf >= SIG_CHUNK)
+          break;
+
+        _begin(bq);
+        ndj_hex(bq->s->out, NDJ_ADDR, addr + (hit - buf));
+        ndj_end(bq->s->out);
+        bq->count++;
+
+        pos = hit - buf + 1;
+      }
+    }
+
+    ndj_flush(bq->s->out);
+  }
+
+  free(ranges);
+}
+
+
+/*  _op_sig:
+ *    sig <bytes>: signature search over executable memory, e.g.
+ *    "sig 48 8b 05 ?? ?? ?? ?? c3". hits are written after every chunk.
+ */
+static int
+_op_sig(struct _batch_query *bq, int argc, char **argv)
+{
+  int t, plen;
+  uint8_t pat[SIG_MAX], mask[SIG_MAX], *buf;
+
+  plen = _parse_sig(argc, argv, pat, mask);
+  if (plen <= 0)
+    return _finish(bq, "usage: sig <hex bytes, ?? for wildcards>");
+
+  buf = malloc(SIG_CHUNK + SIG_MAX);
+
+  for (t = 0; t < bq->s->m.count; t++)
+  {
+    bq->t = &bq->s->m.targets[t];
+    _sig_target(bq, pat, mask, plen, buf);
+  }
+
+  free(buf);
+  return _finish(bq, NULL);
+}
+
+
+/*  _strings_cb:
+ *    writes a batch of string records, reading the text only if the text
+ *    field is selected.
+ */
+static void
+_strings_cb(const str_record *found, size_t n, void *arg)
+{
+  struct _batch_query *bq = arg;
+  ndj_writer *w = bq->s->out;
+  const str_record *recs = found;
+  str_record *kept = NULL;
+  size_t i, j, len;
+  ssize_t got;
+  const char *enc;
+
+  if (bq->substr != NULL || bq->re != NULL) {
+    kept = malloc((n + 1) * sizeof(str_record));
+    memcpy(kept, found, n * sizeof(str_record));
+    n = str_filter(&bq->t->reader, kept, n, bq->substr, bq->re);
+    recs = kept;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    enc = recs[i].encoding == STR_UTF16LE ? "utf16le"
+        : recs[i].encoding == STR_UTF8 ? "utf8" : "ascii";
+
+    _begin(bq);
+    ndj_hex(w, NDJ_ADDR, recs[i].addr);
+    ndj_u64(w, NDJ_LEN, recs[i].len);
+    ndj_str(w, NDJ_ENCODING, enc);
+
+    if (w->fields & (1u << NDJ_TEXT)) {
+      len = recs[i].len < TEXT_MAX ? recs[i].len : TEXT_MAX;
+      got = mem_read(&bq->t->reader, (void *) recs[i].addr, bq->text, len);
+      len = got > 0 ? (size_t) got : 0;
+
+      /* utf-16 strings only hold ascii code units, drop the high bytes */
+      if (recs[i].encoding == STR_UTF16LE) {
+        for (j = 0; j * 2 < len; j++)
+          bq->text[j] = bq->text[j * 2];
+        len = j;
+      }
+
+      ndj_bytes(w, NDJ_TEXT, bq->text, len);
+    }
+
+    ndj_end(w);
+  }
+
+  bq->count += n;
+  ndj_flush(w);
+  free(kept);
+}
+
+
+/*  _op_strings:
+ *    strings [<min length>] [ascii] [utf8] [utf16] [contains <text>]
+ *    [match <regex>]: string extraction over writable memory, all
+ *    encodings unless some are named. only strings containing text and
+ *    matching the extended regex are written if given.
+ */
+static int
+_op_strings(struct _batch_query *bq, int argc, char **argv)
+{
+  int i, t, n;
+  str_params p = { 4, 0 };
+  mem_range *ranges;
+  regex_t re;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "contains") == 0 && i + 1 < argc)
+      bq->substr = argv[++i];
+    else if (strcmp(argv[i], "match") == 0 && i + 1 < argc
+             && bq->re == NULL) {
+      if (regcomp(&re, argv[++i], REG_EXTENDED | REG_NOSUB) != 0)
+        return _finish(bq, "invalid regex");
+      bq->re = &re;
+    }
+    else if (strcmp(argv[i], "ascii") == 0)
+      p.encodings |= STR_ASCII;
+    else if (strcmp(argv[i], "utf8") == 0)
+      p.encodings |= STR_UTF8;
+    else if (strcmp(argv[i], "utf16") == 0)
+      p.encodings |= STR_UTF16LE;
+    else if (atoi(argv[i]) > 0)
+      p.min_len = atoi(argv[i]);
+    else {
+      if (bq->re != NULL)
+        regfree(&re);
+      return _finish(bq, "usage: strings [min] [ascii] [utf8] [utf16]"
+                         " [contains <text>] [match <regex>]");
+    }
+  }
+
+  if (p.encodings == 0)
+    p.encodings = STR_ASCII | STR_UTF8 | STR_UTF16LE;
+
+  for (t = 0; t < bq->s->m.count; t++)
+  {
+    bq->t = &bq->s->m.targets[t];
+    n = mem_ranges_from_maps(bq->t->maps, MODE_READ | MODE_WRITE, &ranges);
+    str_extract(&bq->t->reader, ranges, n, &p, _strings_cb, bq);
+    free(ranges);
+  }
+
+  if (bq->re != NULL)
+    regfree(&re);
+  return _finish(bq, NULL);
+}
+
+
+/*  _symbols_cb:
+ *    writes a single symbol record.
+ */
+static void
+_symbols_cb(const sym_record *rec, void *arg)
+{
+  struct _batch_query *bq = arg;
+  ndj_writer *w = bq->s->out;
+
+  _begin(bq);
+  ndj_hex(w, NDJ_ADDR, rec->addr);
+  ndj_u64(w, NDJ_SIZE, rec->size);
+  ndj_str(w, NDJ_TYPE, rec->type == SYM_FUNC ? "func" : "object");
+  ndj_str(w, NDJ_NAME, rec->name);
+  ndj_str(w, NDJ_MODULE, rec->module->fpath);
+  ndj_end(w);
+}
+
+
+/*  _op_symbols:
+ *    symbols [<substring>]: symbols of every mapped module. modules shared
+ *    by several targets are only parsed once.
+ */
+static int
+_op_symbols(struct _batch_query *bq, int argc, char **argv)
+{
+  int t;
+
+  for (t = 0; t < bq->s->m.count; t++)
+  {
+    bq->t = &bq->s->m.targets[t];
+    bq->count += sym_enumerate(bq->t->maps, bq->s->m.modules,
+                               argc > 1 ? argv[1] : NULL, _symbols_cb, bq);
+  }
+
+  return _finish(bq, NULL);
+}
+
+
+/*  _heap_target:
+ *    writes the records of a walked heap.
+ */
+static void
+_heap_target(struct _batch_query *bq, const heap_table *t, size_t nlargest)
+{
+  ndj_writer *w = bq->s->out;
+  heap_summary sum;
+  heap_chunk *largest;
+  char frag[32];
+  size_t n, i;
+  int a, b;
+
+  heap_summarize(t, &sum);
+
+  for (a = 0; a < t->narenas; a++)
+  {
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "arena");
+    ndj_hex(w, NDJ_ADDR, t->arenas[a].addr);
+    ndj_u64(w, NDJ_SIZE, t->arenas[a].system_mem);
+    ndj_u64(w, NDJ_LEN, t->arenas[a].top_size);
+    ndj_end(w);
+  }
+
+  for (b = 0; b < HEAP_BUCKETS; b++)
+  {
+    if (sum.count[0][b] + sum.count[1][b] == 0)
+      continue;
+
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "bucket");
+    ndj_u64(w, NDJ_SIZE, 16ULL << b);
+    ndj_u64(w, NDJ_USED, sum.bytes[0][b]);
+    ndj_u64(w, NDJ_FREE, sum.bytes[1][b]);
+    ndj_u64(w, NDJ_COUNT, sum.count[0][b] + sum.count[1][b]);
+    ndj_end(w);
+  }
+
+  largest = malloc((nlargest ? nlargest : 1) * sizeof(heap_chunk));
+  n = heap_largest(t, largest, nlargest);
+  for (i = 0; i < n; i++)
+  {
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "largest");
+    ndj_hex(w, NDJ_ADDR, largest[i].addr);
+    ndj_u64(w, NDJ_SIZE, largest[i].size);
+    ndj_end(w);
+  }
+  free(largest);
+
+  snprintf(frag, sizeof(frag), "%.4f", sum.fragmentation);
+  _begin(bq);
+  ndj_str(w, NDJ_TYPE, "summary");
+  ndj_u64(w, NDJ_USED, sum.used_bytes);
+  ndj_u64(w, NDJ_FREE, sum.free_bytes);
+  ndj_raw(w, NDJ_FRAG, frag);
+  ndj_u64(w, NDJ_LEN, sum.top_bytes);
+  ndj_u64(w, NDJ_COUNT, sum.used_count + sum.free_count);
+  ndj_end(w);
+}
+
+
+/*  _op_heap:
+ *    heap [largest]: walks the glibc malloc heap of every target. writes
+ *    a record per arena with its system memory as size and its top chunk
+ *    as len, per size bucket with used and free bytes, per largest chunk
+ *    in use and a summary. chunk sizes include their header.
+ */
+static int
+_op_heap(struct _batch_query *bq, int argc, char **argv)
+{
+  heap_table t;
+  size_t nlargest = HEAP_LARGEST;
+  int i, found = 0;
+
+  if (argc > 1)
+    nlargest = strtoul(argv[1], NULL, 0);
+
+  for (i = 0; i < bq->s->m.count; i++)
+  {
+    bq->t = &bq->s->m.targets[i];
+    if (heap_walk(&t, bq->t->pid, bq->t->maps, bq->s->nthreads) < 0)
+      continue;
+
+    _heap_target(bq, &t, nlargest);
+    heap_table_free(&t);
+    bq->count++;
+    found++;
+  }
+
+  return _finish(bq, found ? NULL : "no glibc heap found");
+}
+
+
+/*  _smaps_counts:
+ *    writes accounting fields, converted from kB to bytes.
+ */
+static void
+_smaps_counts(ndj_writer *w, const smaps_counts *c)
+{
+  ndj_u64(w, NDJ_RSS, c->rss * 1024);
+  ndj_u64(w, NDJ_PSS, c->pss * 1024);
+  ndj_u64(w, NDJ_SWAP, c->swap * 1024);
+  ndj_u64(w, NDJ_HUGE, c->anon_huge * 1024);
+  ndj_u64(w, NDJ_DIRTY, (c->shared_dirty + c->private_dirty) * 1024);
+}
+
+
+/*  _op_smaps:
+ *    smaps [all]: memory accounting of every target, a record per mapped
+ *    path, largest pss first, with the bytes mapped as size and the
+ *    mappings as count, followed by the process' totals. smaps is only
+ *    read again when the totals changed since the last query, all reads
+ *    it regardless.
+ */
+static int
+_op_smaps(struct _batch_query *bq, int argc, char **argv)
+{
+  ndj_writer *w = bq->s->out;
+  smaps_session *sm;
+  const smaps_module *m;
+  size_t j;
+  int i, force = argc > 1 && strcmp(argv[1], "all") == 0, found = 0;
+
+  if (bq->s->smaps == NULL) {
+    bq->s->smaps = calloc(bq->s->m.count, sizeof(smaps_session));
+    for (i = 0; i < bq->s->m.count; i++)
+      smaps_open(&bq->s->smaps[i], bq->s->m.targets[i].pid);
+  }
+
+  for (i = 0; i < bq->s->m.count; i++)
+  {
+    bq->t = &bq->s->m.targets[i];
+    sm = &bq->s->smaps[i];
+    if (smaps_refresh(sm, force) < 0)
+      continue;
+
+    for (j = 0; j < sm->nmodules; j++)
+    {
+      m = &sm->modules[j];
+      _begin(bq);
+      ndj_str(w, NDJ_TYPE, "module");
+      ndj_str(w, NDJ_PATH, m->path);
+      ndj_u64(w, NDJ_SIZE, m->size);
+      ndj_u64(w, NDJ_COUNT, m->nregions);
+      _smaps_counts(w, &m->c);
+      ndj_end(w);
+      bq->count++;
+    }
+
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "total");
+    _smaps_counts(w, &sm->total);
+    ndj_end(w);
+    found++;
+  }
+
+  return _finish(bq, found ? NULL : "smaps not readable");
+}
+
+
+/*  _entropy_run:
+ *    writes a run of windows of the same class.
+ */
+static void
+_entropy_run(struct _batch_query *bq, const ent_map *m, const ent_region *r,
+             size_t first, size_t last, uint64_t sum)
+{
+  ndj_writer *w = bq->s->out;
+  uintptr_t end = r->start + last * m->window;
+  char bits[16];
+
+  snprintf(bits, sizeof(bits), "%.2f",
+           (double) sum / (last - first) / ENT_SCALE);
+
+  _begin(bq);
+  ndj_str(w, NDJ_TYPE, ent_class_names[ent_classify(&r->windows[first])]);
+  ndj_hex(w, NDJ_ADDR, r->start + first * m->window);
+  ndj_u64(w, NDJ_LEN, (end < r->end ? end : r->end)
+                      - (r->start + first * m->window));
+  ndj_u64(w, NDJ_COUNT, last - first);
+  ndj_raw(w, NDJ_ENTROPY, bits);
+  ndj_str(w, NDJ_PATH, r->mmf->fpath ? r->mmf->fpath : "");
+  ndj_end(w);
+  bq->count++;
+}
+
+
+/*  _op_entropy:
+ *    entropy [window]: entropy map of every readable mapping, one record
+ *    per run of consecutive windows of the same class, typed by the class
+ *    and with their mean entropy.
+ */
+static int
+_op_entropy(struct _batch_query *bq, int argc, char **argv)
+{
+  ent_map m;
+  const ent_region *r;
+  size_t window = argc > 1 ? strtoul(argv[1], NULL, 0) : 0, i, j, first;
+  uint64_t sum;
+  int t;
+
+  for (t = 0; t < bq->s->m.count; t++)
+  {
+    bq->t = &bq->s->m.targets[t];
+    ent_map_build(&m, bq->t->pid, bq->t->maps, MODE_READ, window,
+                  bq->s->nthreads);
+
+    for (i = 0; i < m.nregions; i++)
+    {
+      r = &m.regions[i];
+
+      for (j = first = 0, sum = 0; j < r->count; j++)
+      {
+        if (ent_classify(&r->windows[j])
+            != ent_classify(&r->windows[first])) {
+          _entropy_run(bq, &m, r, first, j, sum);
+          first = j;
+          sum = 0;
+        }
+
+        if (r->windows[j].entropy != ENT_UNREADABLE)
+          sum += r->windows[j].entropy;
+      }
+
+      if (r->count)
+        _entropy_run(bq, &m, r, first, r->count, sum);
+    }
+
+    ent_map_free(&m);
+  }
+
+  return _finish(bq, NULL);
+}
+
+
+/*  _stack_group:
+ *    writes a group of identical stacks, its tids as text, followed by a
+ *    record per frame.
+ */
+static void
+_stack_group(struct _batch_query *bq, const stk_dump *d, const stk_group *g)
+{
+  ndj_writer *w = bq->s->out;
+  const stk_thread *t = d->order[g->first];
+  const char *mod;
+  char *tids, desc[256];
+  size_t len = 0;
+  int i;
+
+  tids = malloc(g->count * 12 + 1);
+  tids[0] = '\0';
+  for (i = 0; i < g->count; i++)
+    len += sprintf(tids + len, i ? ",%d" : "%d", d->order[g->first + i]->tid);
+
+  _begin(bq);
+  ndj_str(w, NDJ_TYPE, "stack");
+  ndj_str(w, NDJ_NAME, t->name);
+  ndj_u64(w, NDJ_LEN, t->depth);
+  ndj_str(w, NDJ_TEXT, tids);
+  ndj_u64(w, NDJ_COUNT, g->count);
+  ndj_end(w);
+  free(tids);
+
+  for (i = 0; i < t->depth; i++)
+  {
+    mod = stk_describe(d, t->frames[i], i, desc, sizeof(desc));
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "frame");
+    ndj_hex(w, NDJ_ADDR, t->frames[i]);
+    ndj_str(w, NDJ_NAME, desc);
+    ndj_str(w, NDJ_MODULE, mod ? mod : "");
+    ndj_end(w);
+  }
+}
+
+
+/*  _op_stacks:
+ *    stacks [bytes]: backtraces of every thread of every target, taken
+ *    while all its threads are stopped. a stop record with the time the
+ *    process was stopped comes first, then every group of threads with
+ *    identical stacks, largest first, with its frames. bytes is the stack
+ *    copied per thread.
+ */
+static int
+_op_stacks(struct _batch_query *bq, int argc, char **argv)
+{
+  ndj_writer *w = bq->s->out;
+  stk_dump d;
+  size_t bytes = argc > 1 ? strtoul(argv[1], NULL, 0) : 0;
+  int t, g, found = 0;
+
+  for (t = 0; t < bq->s->m.count; t++)
+  {
+    bq->t = &bq->s->m.targets[t];
+    if (stk_capture(&d, bq->t->pid, bq->t->maps, bytes,
+                    bq->s->nthreads) < 0)
+      continue;
+
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "stop");
+    ndj_u64(w, NDJ_NS, d.stop_ns);
+    ndj_u64(w, NDJ_COUNT, d.nthreads);
+    ndj_end(w);
+
+    for (g = 0; g < d.ngroups; g++)
+      _stack_group(bq, &d, &d.groups[g]);
+
+    bq->count += d.ngroups;
+    stk_free(&d);
+    found++;
+  }
+
+  return _finish(bq, found ? NULL : "couldn't attach");
+}
+
+
+/*  _op_capture:
+ *    capture [rw|all] [auto|freezer|stop]: pauses every target just long
+ *    enough to copy its writable, or all readable, mappings, and serves
+ *    the reads of scan, sig and strings from the copies until the next
+ *    refresh. the freezer pauses the target's whole cgroup. writes a pause
+ *    record per target with the time it was paused.
+ */
+static int
+_op_capture(struct _batch_query *bq, int argc, char **argv)
+{
+  ndj_writer *w = bq->s->out;
+  uint8_t mask = MODE_READ | MODE_WRITE;
+  int i, method = SNAP_AUTO, found = 0;
+  snapshot *sn;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "rw") == 0)
+      mask = MODE_READ | MODE_WRITE;
+    else if (strcmp(argv[i], "all") == 0)
+      mask = MODE_READ;
+    else {
+      for (method = 0; method < SNAP_METHODS; method++)
+        if (strcmp(argv[i], snap_method_names[method]) == 0)
+          break;
+      if (method == SNAP_METHODS)
+        return _finish(bq, "usage: capture [rw|all] [auto|freezer|stop]");
+    }
+  }
+
+  _release(bq->s);
+  bq->s->snaps = calloc(bq->s->m.count, sizeof(snapshot));
+
+  for (i = 0; i < bq->s->m.count; i++)
+  {
+    bq->t = &bq->s->m.targets[i];
+    sn = &bq->s->snaps[i];
+    if (snap_capture(sn, bq->t->pid, bq->t->maps, mask, method,
+                     bq->s->nthreads) < 0)
+      continue;
+
+    mem_reader_snapshot(&bq->t->reader, sn);
+
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "pause");
+    ndj_str(w, NDJ_NAME, snap_method_names[sn->method]);
+    ndj_u64(w, NDJ_NS, sn->pause_ns);
+    ndj_u64(w, NDJ_SIZE, sn->size);
+    ndj_u64(w, NDJ_LEN, sn->copied);
+    ndj_u64(w, NDJ_COUNT, sn->nregions);
+    ndj_end(w);
+    bq->count++;
+    found++;
+  }
+
+  return _finish(bq, found ? NULL : "couldn't pause");
+}
+
+
+/*  _region_path:
+ *    the path of a scanned mapping, [anon] for anonymous ones.
+ */
+static const char*
+_region_path(const dup_region *r)
+{
+  return r->mmf->fpath && *r->mmf->fpath ? r->mmf->fpath : "[anon]";
+}
+
+
+static int
+_cmp_region_path(const void *a, const void *b)
+{
+  return strcmp(_region_path(*(dup_region * const *) a),
+                _region_path(*(dup_region * const *) b));
+}
+
+
+static int
+_cmp_module_dup(const void *a, const void *b)
+{
+  const dup_region *x = *(dup_region * const *) a;
+  const dup_region *y = *(dup_region * const *) b;
+
+  return (x->dup < y->dup) - (x->dup > y->dup);
+}
+
+
+/*  _dup_modules:
+ *    writes a module record per mapped path over every target, most
+ *    duplicated bytes first. the regions are summed into the first of
+ *    each path.
+ */
+static void
+_dup_modules(struct _batch_query *bq, dup_scan *s)
+{
+  ndj_writer *w = bq->s->out;
+  dup_region **order, *m;
+  size_t i, j, n = 0, *counts;
+
+  order = malloc((s->nregions + 1) * sizeof(dup_region*));
+  counts = malloc((s->nregions + 1) * sizeof(size_t));
+  for (i = 0; i < s->nregions; i++)
+    order[i] = &s->regions[i];
+  qsort(order, s->nregions, sizeof(dup_region*), _cmp_region_path);
+
+  for (i = 0; i < s->nregions; i = j)
+  {
+    m = order[i];
+    for (j = i + 1; j < s->nregions
+         && _cmp_region_path(&order[i], &order[j]) == 0; j++)
+    {
+      m->resident += order[j]->resident;
+      m->dup += order[j]->dup;
+    }
+    counts[m - s->regions] = j - i;
+    order[n++] = m;
+  }
+  qsort(order, n, sizeof(dup_region*), _cmp_module_dup);
+
+  for (i = 0; i < n && order[i]->dup > 0; i++)
+  {
+    m = order[i];
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "module");
+    ndj_str(w, NDJ_PATH, _region_path(m));
+    ndj_u64(w, NDJ_RSS, m->resident);
+    ndj_u64(w, NDJ_DUP, m->dup);
+    ndj_u64(w, NDJ_COUNT, counts[m - s->regions]);
+    ndj_end(w);
+    bq->count++;
+  }
+
+  free(counts);
+  free(order);
+}
+
+
+/*  _op_dups:
+ *    dups [top]: pages with identical contents that aren't shared, over
+ *    every target together. writes a summary with the bytes hashed and
+ *    the bytes that merging the copies would free, the zero filled bytes,
+ *    a module record per path holding copies, and the top contents held
+ *    by the most frames with one place they're mapped at. without access
+ *    to frame numbers only pages mapped once are compared.
+ */
+static int
+_op_dups(struct _batch_query *bq, int argc, char **argv)
+{
+  ndj_writer *w = bq->s->out;
+  size_t top = argc > 1 ? strtoul(argv[1], NULL, 0) : 10, n, i;
+  ll_memmap_file **maps;
+  const dup_region *r;
+  dup_group *groups;
+  dup_scan s;
+  int *pids, t, found;
+
+  pids = malloc((bq->s->m.count + 1) * sizeof(int));
+  maps = malloc((bq->s->m.count + 1) * sizeof(ll_memmap_file*));
+  for (t = 0; t < bq->s->m.count; t++)
+  {
+    pids[t] = bq->s->m.targets[t].pid;
+    maps[t] = bq->s->m.targets[t].maps;
+  }
+
+  dup_scan_run(&s, pids, maps, bq->s->m.count, bq->s->nthreads);
+
+  _begin(bq);
+  ndj_str(w, NDJ_TYPE, "summary");
+  ndj_u64(w, NDJ_RSS, s.resident);
+  ndj_u64(w, NDJ_DUP, s.reclaimable);
+  ndj_u64(w, NDJ_SIZE, s.skipped);
+  ndj_u64(w, NDJ_COUNT, s.index.count);
+  ndj_end(w);
+
+  _begin(bq);
+  ndj_str(w, NDJ_TYPE, "zero");
+  ndj_u64(w, NDJ_RSS, s.zero);
+  ndj_end(w);
+
+  _dup_modules(bq, &s);
+
+  groups = malloc((top + 1) * sizeof(dup_group));
+  n = dup_top(&s, groups, top);
+  for (i = 0; i < n; i++)
+  {
+    if (groups[i].region == (size_t) -1)
+      continue;
+
+    r = &s.regions[groups[i].region];
+    bq->t = &bq->s->m.targets[r->target];
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "content");
+    ndj_hex(w, NDJ_ADDR, groups[i].addr);
+    ndj_str(w, NDJ_PATH, _region_path(r));
+    ndj_u64(w, NDJ_DUP, (uint64_t) (groups[i].frames - 1) * DUP_PAGE);
+    ndj_u64(w, NDJ_COUNT, groups[i].frames);
+    ndj_end(w);
+    bq->count++;
+  }
+
+  found = s.resident > 0;
+  free(groups);
+  dup_scan_free(&s);
+  free(maps);
+  free(pids);
+
+  return _finish(bq, found ? NULL : "no pages readable");
+}
+
+
+/*  _op_integrity:
+ *    integrity: compares the code of every target against its backing
+ *    files, a record per patched range with its kind and module. pages
+ *    found clean are remembered for every later query and target.
+ */
+static int
+_op_integrity(struct _batch_query *bq)
+{
+  static const char *kinds[] = { "modified", "breakpoint", "hook", "stale" };
+  ndj_writer *w = bq->s->out;
+  integ_report rep;
+  const integ_patch *p;
+  size_t j;
+  int i;
+
+  if (bq->s->integ == NULL)
+    bq->s->integ = integ_cache_new();
+
+  for (i = 0; i < bq->s->m.count; i++)
+  {
+    bq->t = &bq->s->m.targets[i];
+    memset(&rep, 0, sizeof(rep));
+    integ_scan(bq->t->pid, bq->t->maps, bq->s->integ, bq->s->nthreads,
+               &rep);
+
+    for (j = 0; j < rep.count; j++)
+    {
+      p = &rep.patches[j];
+      _begin(bq);
+      ndj_hex(w, NDJ_ADDR, p->addr);
+      ndj_u64(w, NDJ_LEN, p->len);
+      ndj_str(w, NDJ_TYPE, kinds[p->kind]);
+      ndj_str(w, NDJ_PATH, p->map->fpath);
+      ndj_end(w);
+      bq->count++;
+    }
+
+    integ_report_free(&rep);
+  }
+
+  return _finish(bq, NULL);
+}
+
+
+/*  _op_snap:
+ *    snap [rw|all] [<spill file>]: adds a snapshot of the writable, or all
+ *    readable, memory of every target to its history. identical pages are
+ *    stored once, and a snapshot only keeps the pages that changed. the
+ *    first snap may name a file page data is spilled to instead of being
+ *    kept in memory, suffixed with the pid if several targets are
+ *    attached. writes a record per target with the snapshot's number as
+ *    count and the page data stored so far as size.
+ */
+static int
+_op_snap(struct _batch_query *bq, int argc, char **argv)
+{
+  ndj_writer *w = bq->s->out;
+  uint8_t mask = MODE_READ | MODE_WRITE;
+  const char *spill = NULL;
+  char path[4096];
+  mem_range *ranges;
+  int i, n, snap;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "rw") == 0)
+      mask = MODE_READ | MODE_WRITE;
+    else if (strcmp(argv[i], "all") == 0)
+      mask = MODE_READ;
+    else
+      spill = argv[i];
+  }
+
+  if (bq->s->hists == NULL)
+    bq->s->hists = calloc(bq->s->m.count, sizeof(history*));
+
+  for (i = 0; i < bq->s->m.count; i++)
+  {
+    bq->t = &bq->s->m.targets[i];
+    if (bq->s->hists[i] == NULL) {
+      if (spill != NULL && bq->s->m.count > 1)
+        snprintf(path, sizeof(path), "%s.%d", spill, bq->t->pid);
+      else if (spill != NULL)
+        snprintf(path, sizeof(path), "%s", spill);
+
+      bq->s->hists[i] = history_open(spill ? path : NULL);
+      if (bq->s->hists[i] == NULL)
+        return _finish(bq, "couldn't open the spill file");
+    }
+
+    n = mem_ranges_from_maps(bq->t->maps, mask, &ranges);
+    snap = history_snapshot(bq->s->hists[i], &bq->t->reader, ranges, n);
+    free(ranges);
+
+    _begin(bq);
+    ndj_str(w, NDJ_TYPE, "snapshot");
+    ndj_u64(w, NDJ_SIZE,
+            (uint64_t) bq->s->hists[i]->npages * HIST_PAGE_SIZE);
+    ndj_u64(w, NDJ_COUNT, snap);
+    ndj_end(w);
+    bq->count++;
+  }
+
+  return _finish(bq, NULL);
+}
+
+
+/*  _diff_cb:
+ *    writes a changed range.
+ */
+static void
+_diff_cb(uintptr_t addr, size_t len, int kind, void *arg)
+{
+  static const char *kinds[] = { "changed", "mapped", "unmapped" };
+  struct _batch_query *bq = arg;
+
+  _begin(bq);
+  ndj_hex(bq->s->out, NDJ_ADDR, addr);
+  ndj_u64(bq->s->out, NDJ_LEN, len);
+  ndj_str(bq->s->out, NDJ_TYPE, kinds[kind]);
+  ndj_end(bq->s->out);
+  bq->count++;
+}
+
+
+/*  _op_diff:
+ *    diff <from> <to>: every range that changed between two snapshots of
+ *    each target, as changed, mapped or unmapped.
+ */
+static int
+_op_diff(struct _batch_query *bq, int argc, char **argv)
+{
+  int i, from, to, found = 0;
+
+  if (argc != 3)
+    return _finish(bq, "usage: diff <from> <to>");
+  if (bq->s->hists == NULL)
+    return _finish(bq, "no snapshots, run snap");
+
+  from = atoi(argv[1]);
+  to = atoi(argv[2]);
+
+  for (i = 0; i < bq->s->m.count; i++)
+  {
+    bq->t = &bq->s->m.targets[i];
+    if (bq->s->hists[i] != NULL
+        && history_diff(bq->s->hists[i], from, to, _diff_cb, bq) == 0)
+      found++;
+  }
+
+  return _finish(bq, found ? NULL : "no such snapshots");
+}
+
+
+/*  _op_first:
+ *    first <type> <value> [<max>] [unaligned]: starts a session with a
+ *    scan like scan, keeping the hits as candidates with their values
+ *    instead of writing them. the done record counts the candidates.
+ */
+static int
+_op_first(struct _batch_query *bq, int argc, char **argv)
+{
+  const char *err;
+  scan_params p;
+  long n;
+
+  if (argc < 3)
+    return _finish(bq, "usage: first <type> <value> [<max>] [unaligned]");
+  if ((err = _scan_args(argc, argv, &p)) != NULL)
+    return _finish(bq, err);
+
+  n = sess_first(&bq->s->sess, &bq->s->m, &p, MODE_READ, bq->s->nthreads);
+  if (n < 0)
+    return _finish(bq, "invalid scan");
+
+  bq->count = n;
+  return _finish(bq, NULL);
+}
+
+
+/*  _op_next:
+ *    next <value> [<max>] | changed | unchanged | increased | decreased:
+ *    keeps the candidates of the session whose value now matches, or
+ *    compares to the value each had at the last scan. the done record
+ *    counts the candidates left.
+ */
+static int
+_op_next(struct _batch_query *bq, int argc, char **argv)
+{
+  static const char *cmps[SESS_CMPS] = {
+    "", "changed", "unchanged", "increased", "decreased",
+  };
+  scan_session *sess = &bq->s->sess;
+  scan_params p;
+  int cmp, i;
+  long n;
+
+  if (sess->hdr == NULL)
+    return _finish(bq, "no session, run first or load");
+  if (argc < 2 || argc > 3)
+    return _finish(bq, "usage: next <value> [<max>] | changed | unchanged"
+                       " | increased | decreased");
+
+  memset(&p, 0, sizeof(p));
+  p.type = sess->hdr->params.type;
+  p.aligned = sess->hdr->params.aligned;
+
+  for (cmp = SESS_CMPS - 1; cmp > SESS_VALUE; cmp--)
+    if (strcmp(argv[1], cmps[cmp]) == 0)
+      break;
+
+  for (i = 1; cmp == SESS_VALUE && i < argc; i++)
+    if (!_parse_value(p.type, argv[i], i == 1 ? &p.lo : &p.hi))
+      return _finish(bq, "invalid value");
+  p.cmp = argc == 3 ? SCAN_RANGE : SCAN_EXACT;
+
+  n = sess_next(sess, &bq->s->m, cmp, &p, bq->s->nthreads);
+  if (n < 0)
+    return _finish(bq, "invalid scan");
+
+  bq->count = n;
+  return _finish(bq, NULL);
+}
+
+
+/*  _format_value:
+ *    prints a candidate's value of the given type.
+ */
+static void
+_format_value(int type, const uint8_t *v, char *buf, size_t len)
+{
+  scan_value x;
+
+  memcpy(&x, v, scan_type_size(type));
+  switch (type)
+  {
+    case SCAN_INT8:   snprintf(buf, len, "%d", x.i8); break;
+    case SCAN_INT16:  snprintf(buf, len, "%d", x.i16); break;
+    case SCAN_INT32:  snprintf(buf, len, "%d", x.i32); break;
+    case SCAN_INT64:  snprintf(buf, len, "%lld", (long long) x.i64); break;
+    case SCAN_FLOAT:  snprintf(buf, len, "%.9g", x.f32); break;
+    case SCAN_DOUBLE: snprintf(buf, len, "%.17g", x.f64); break;
+  }
+}
+
+
+/*  _op_results:
+ *    results [max]: the session's candidates with the value each had at
+ *    the last scan, up to max, 1000 by default.
+ */
+static int
+_op_results(struct _batch_query *bq, int argc, char **argv)
+{
+  ndj_writer *w = bq->s->out;
+  scan_session *sess = &bq->s->sess;
+  const sess_region *r;
+  unsigned long max = argc > 1 ? strtoul(argv[1], NULL, 0) : 1000;
+  uint64_t i, k;
+  int type;
+  char text[32];
+
+  if (sess->hdr == NULL)
+    return _finish(bq, "no session, run first or load");
+
+  type = sess->hdr->params.type;
+  for (i = 0; i < sess->hdr->nregions && (unsigned long) bq->count < max;
+       i++)
+  {
+    r = &sess->regions[i];
+    bq->t = &bq->s->m.targets[r->target];
+
+    for (k = 0; k < r->count && (unsigned long) bq->count < max; k++)
+    {
+      _format_value(type, sess->values
+                          + (r->first + k) * sess->hdr->value_size,
+                    text, sizeof(text));
+      _begin(bq);
+      ndj_hex(w, NDJ_ADDR, r->start + sess->offsets[r->first + k]);
+      ndj_str(w, NDJ_TYPE, type_names[type]);
+      ndj_str(w, NDJ_TEXT, text);
+      ndj_end(w);
+      bq->count++;
+    }
+  }
+
+  return _finish(bq, NULL);
+}
+
+
+/*  _op_save:
+ *    save <file>: writes the session to a file that load maps again.
+ */
+static int
+_op_save(struct _batch_query *bq, int argc, char **argv)
+{
+  if (argc != 2)
+    return _finish(bq, "usage: save <file>");
+  if (bq->s->sess.hdr == NULL)
+    return _finish(bq, "no session, run first or load");
+  if (sess_save(&bq->s->sess, argv[1]) < 0)
+    return _finish(bq, "couldn't write the session");
+
+  bq->count = bq->s->sess.hdr->count;
+  return _finish(bq, NULL);
+}
+
+
+/*  _op_load:
+ *    load <file>: maps a saved session and moves its candidates to where
+ *    their modules are now, so next continues where it was left off
+ *    after the targets or pardu were restarted. regions belong to the
+ *    targets by the order they were attached in. the done record counts
+ *    the candidates that were found again.
+ */
+static int
+_op_load(struct _batch_query *bq, int argc, char **argv)
+{
+  if (argc != 2)
+    return _finish(bq, "usage: load <file>");
+  if (sess_load(&bq->s->sess, argv[1]) < 0)
+    return _finish(bq, "not a session file");
+
+  bq->count = sess_rebase(&bq->s->sess, &bq->s->m);
+  return _finish(bq, NULL);
+}
+
+
+/*  batch_query:
+ *    runs a single query and streams its results, followed by a record with
+ *    done set and either the result count or an error. line is modified.
+ *    returns 0 on success, -1 if the query failed.
+ *
+ *    batch_session *s:   attached session
+ *    long q:             query number, copied into every record
+ *    char *line:         operation and its arguments, whitespace separated
+ */
+int
+batch_query(batch_session *s, long q, char *line)
+{
+  int argc = 0;
+  char *argv[MAX_ARGS], *tok, *save;
+  struct _batch_query bq;
+
+  for (tok = strtok_r(line, " \t\r\n", &save); tok && argc < MAX_ARGS;
+       tok = strtok_r(NULL, " \t\r\n", &save))
+    argv[argc++] = tok;
+
+  if (argc == 0)
+    return 0;
+
+  memset(&bq, 0, sizeof(bq));
+  bq.s = s;
+  bq.q = q;
+  bq.op = argv[0];
+
+  if (strcmp(argv[0], "maps") == 0)
+    return _op_maps(&bq);
+  if (strcmp(argv[0], "refresh") == 0)
+    return _op_refresh(&bq);
+  if (strcmp(argv[0], "scan") == 0)
+    return _op_scan(&bq, argc, argv);
+  if (strcmp(argv[0], "sig") == 0)
+    return _op_sig(&bq, argc, argv);
+  if (strcmp(argv[0], "strings") == 0)
+    return _op_strings(&bq, argc, argv);
+  if (strcmp(argv[0], "symbols") == 0)
+    return _op_symbols(&bq, argc, argv);
+  if (strcmp(argv[0], "heap") == 0)
+    return _op_heap(&bq, argc, argv);
+  if (strcmp(argv[0], "smaps") == 0)
+    return _op_smaps(&bq, argc, argv);
+  if (strcmp(argv[0], "entropy") == 0)
+    return _op_entropy(&bq, argc, argv);
+  if (strcmp(argv[0], "stacks") == 0)
+    return _op_stacks(&bq, argc, argv);
+  if (strcmp(argv[0], "capture") == 0)
+    return _op_capture(&bq, argc, argv);
+  if (strcmp(argv[0], "dups") == 0)
+    return _op_dups(&bq, argc, argv);
+  if (strcmp(argv[0], "integrity") == 0)
+    return _op_integrity(&bq);
+  if (strcmp(argv[0], "snap") == 0)
+    return _op_snap(&bq, argc, argv);
+  if (strcmp(argv[0], "diff") == 0)
+    return _op_diff(&bq, argc, argv);
+  if (strcmp(argv[0], "first") == 0)
+    return _op_first(&bq, argc, argv);
+  if (strcmp(argv[0], "next") == 0)
+    return _op_next(&bq, argc, argv);
+  if (strcmp(argv[0], "results") == 0)
+    return _op_results(&bq, argc, argv);
+  if (strcmp(argv[0], "save") == 0)
+    return _op_save(&bq, argc, argv);
+  if (strcmp(argv[0], "load") == 0)
+    return _op_load(&bq, argc, argv);
+
+  return _finish(&bq, "unknown operation");
+}
+
+
+/*  batch_serve:
+ *    runs one query per line of in until end of file or a "quit" line.
+ *    empty lines and lines starting with '#' are skipped, queries are
+ *    numbered by line. returns the amount of failed queries.
+ *
+ *    batch_session *s:   attached session
+ *    FILE *in:           query source, usually stdin
+ */
+int
+batch_serve(batch_session *s, FILE *in)
+{
+  char *line = NULL, *p;
+  size_t cap = 0;
+  long q = 0;
+  int failed = 0;
+
+  while (getline(&line, &cap, in) > 0)
+  {
+    q++;
+
+    for (p = line; isspace((unsigned char) *p); p++)
+      ;
+    if (*p == '\0' || *p == '#')
+      continue;
+    if (strncmp(p, "quit", 4) == 0 && (p[4] == '\0' || isspace(p[4])))
+      break;
+
+    if (batch_query(s, q, p) < 0)
+      failed++;
+  }
+
+  free(line);
+  return failed;
+}
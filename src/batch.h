@@ -0,0 +1,42 @@
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include "history.h"
+#include "integrity.h"
+#include "multi.h"
+#include "ndjson.h"
+#include "session.h"
+#include "smaps.h"
+#include "snapshot.h"
+
+#include <stdio.h>
+
+/*  _batch_session:
+ *    processes attached for headless queries. the maps are parsed once and
+ *    reused by every query until a refresh query. every query runs over
+ *    all attached processes, records carry the pid they belong to.
+ */
+typedef struct _batch_session
+{
+  multi_session m;
+  ndj_writer *out;
+  int nthreads;                     /* scan workers, 0 for one per cpu */
+  smaps_session *smaps;             /* per target, opened by the first smaps
+                                     * query */
+  snapshot *snaps;                  /* per target, reads are served from
+                                     * these after a capture query */
+  scan_session sess;                /* candidates of first and next */
+  integ_cache *integ;               /* clean code pages, shared by every
+                                     * integrity query */
+  history **hists;                  /* per target, made by the first snap
+                                     * query */
+} batch_session;
+
+
+/* function definitions */
+int  batch_open(batch_session*, const int*, int, ndj_writer*);
+void batch_close(batch_session*);
+int  batch_query(batch_session*, long, char*);
+int  batch_serve(batch_session*, FILE*);
+
+#endif /* __BATCH_H */
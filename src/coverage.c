@@ -0,0 +1,1141 @@
+#include "coverage.h"
+#include "asm.h"
+#include "symbols.h"
+
+#include <dirent.h>
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#define COV_PAGE      4096
+#define INT3          0xcc
+#define TRACE_OPTS    (PTRACE_O_TRACECLONE | PTRACE_O_TRACEEXEC \
+                       | PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK)
+
+
+/*  _cov_thread:
+ *    a traced thread. threads reporting a stop are left stopped until the
+ *    writes their stop needs are done, then _resume_all continues them.
+ */
+struct _cov_thread
+{
+  int tid;
+  int stopped;                      /* in a stop that wasn't resumed yet */
+  int group;                        /* the stop is a group stop          */
+  int sig;                          /* signal to deliver when resumed    */
+  int child;                        /* a forked process, CHILD_*         */
+};
+
+
+/* a child whose stop came before its fork event is held until the event
+ * says whether it shares the address space. a vfork child does, its hits
+ * are the parent's and it's traced until it execs or exits */
+#define CHILD_HELD    1
+#define CHILD_VFORK   2
+
+
+/*  _cov_hit:
+ *    a block hit whose breakpoint wasn't removed yet.
+ */
+struct _cov_hit
+{
+  int module;
+  uint32_t block;
+};
+
+
+/*  _cov_range:
+ *    an executable section inside a module mapping, as offsets from its
+ *    start.
+ */
+struct _cov_range
+{
+  size_t from, to;
+};
+
+
+/*  _cov_syncs:
+ *    function start addresses of every module, the decoder's sync points.
+ */
+struct _cov_syncs
+{
+  uintptr_t *addrs;
+  size_t count, cap;
+};
+
+
+
+#if defined(__x86_64__)
+/*  _get_pc:
+ *    reads a stopped thread's instruction pointer.
+ */
+static int
+_get_pc(int tid, uintptr_t *pc)
+{
+  struct user_regs_struct regs;
+
+  if (ptrace(PTRACE_GETREGS, tid, NULL, &regs) < 0)
+    return -1;
+
+  *pc = regs.rip;
+  return 0;
+}
+
+
+/*  _set_pc:
+ *    moves a stopped thread's instruction pointer.
+ */
+static int
+_set_pc(int tid, uintptr_t pc)
+{
+  struct user_regs_struct regs;
+
+  if (ptrace(PTRACE_GETREGS, tid, NULL, &regs) < 0)
+    return -1;
+
+  regs.rip = pc;
+  return ptrace(PTRACE_SETREGS, tid, NULL, &regs) < 0 ? -1 : 0;
+}
+#else
+/* only x86-64 code is decoded, nothing to read registers for elsewhere */
+static int
+_get_pc(int tid, uintptr_t *pc)
+{
+  (void) tid;
+  (void) pc;
+  return -1;
+}
+
+
+static int
+_set_pc(int tid, uintptr_t pc)
+{
+  (void) tid;
+  (void) pc;
+  return -1;
+}
+#endif
+
+
+/*  _thread:
+ *    finds a traced thread, adding it if add is set. returns NULL if it
+ *    isn't known and add isn't set.
+ */
+static struct _cov_thread *
+_thread(cov_session *s, int tid, int add)
+{
+  int i;
+  struct _cov_thread *t;
+
+  for (i = 0; i < s->nthreads; i++)
+    if (s->threads[i].tid == tid)
+      return &s->threads[i];
+
+  if (!add)
+    return NULL;
+
+  if (s->nthreads == s->cap_threads) {
+    s->cap_threads = s->cap_threads ? s->cap_threads * 2 : 16;
+    s->threads = realloc(s->threads,
+                         s->cap_threads * sizeof(struct _cov_thread));
+  }
+
+  t = &s->threads[s->nthreads++];
+  memset(t, 0, sizeof(*t));
+  t->tid = tid;
+  return t;
+}
+
+
+static void
+_thread_remove(cov_session *s, int tid)
+{
+  int i;
+
+  for (i = 0; i < s->nthreads; i++)
+    if (s->threads[i].tid == tid) {
+      s->threads[i] = s->threads[--s->nthreads];
+      return;
+    }
+}
+
+
+/*  _is_task:
+ *    tells if tid is a thread of process pid.
+ */
+static int
+_is_task(int pid, int tid)
+{
+  char path[48];
+
+  snprintf(path, sizeof(path), "/proc/%d/task/%d", pid, tid);
+  return access(path, F_OK) == 0;
+}
+
+
+/*  _find_block:
+ *    finds the block starting at addr in a live module. returns 0 if no
+ *    block starts there.
+ */
+static int
+_find_block(const cov_session *s, uintptr_t addr, int *mod, uint32_t *block)
+{
+  const cov_module *m;
+  size_t lo, hi, mid;
+  int i;
+
+  for (i = 0; i < s->nmodules; i++)
+  {
+    m = &s->modules[i];
+    if (!m->live || addr < m->start || addr >= m->end)
+      continue;
+
+    for (lo = 0, hi = m->nblocks; lo < hi; )
+    {
+      mid = (lo + hi) / 2;
+      if (m->blocks[mid] < addr - m->start)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+    if (lo < m->nblocks && m->blocks[lo] == addr - m->start) {
+      *mod = i;
+      *block = (uint32_t) lo;
+      return 1;
+    }
+    return 0;
+  }
+
+  return 0;
+}
+
+
+/*  _write_blocks:
+ *    writes the bytes of the given blocks from the module's code to a
+ *    process. blocks on the same or neighbouring pages go out in a single
+ *    write, pages without blocks are never touched so they stay shared
+ *    with the file. returns -1 if a write failed.
+ *
+ *    int fd:                 /proc/<pid>/mem of the process
+ *    const cov_module *m:    module holding the bytes to write
+ *    const uint32_t *offs:   sorted offsets from the module start
+ *    size_t n:               number of entries in offs
+ */
+static int
+_write_blocks(int fd, const cov_module *m, const uint32_t *offs, size_t n)
+{
+  size_t i, j, from, to;
+  int ret = 0;
+
+  for (i = 0; i < n; i = j)
+  {
+    for (j = i + 1; j < n && offs[j] / COV_PAGE <= offs[j - 1] / COV_PAGE + 1;
+         j++)
+      ;
+
+    from = offs[i];
+    to = offs[j - 1] + 1;
+    if (pwrite(fd, m->code + from, to - from, m->start + from)
+        != (ssize_t) (to - from))
+      ret = -1;
+  }
+
+  return ret;
+}
+
+
+static int
+_cmp_hit(const void *a, const void *b)
+{
+  const struct _cov_hit *x = a, *y = b;
+
+  if (x->module != y->module)
+    return x->module - y->module;
+  return x->block < y->block ? -1 : x->block > y->block;
+}
+
+
+/*  _write_pending:
+ *    removes the breakpoints of the blocks hit since the last call, with
+ *    one batch of writes per module.
+ */
+static void
+_write_pending(cov_session *s)
+{
+  size_t i, j, k;
+  uint32_t *offs;
+  cov_module *m;
+
+  if (s->npending == 0)
+    return;
+
+  qsort(s->pending, s->npending, sizeof(struct _cov_hit), _cmp_hit);
+  offs = malloc(s->npending * sizeof(uint32_t));
+
+  for (i = 0; i < s->npending; i = j)
+  {
+    m = &s->modules[s->pending[i].module];
+
+    for (j = i, k = 0; j < s->npending
+                       && s->pending[j].module == s->pending[i].module; j++)
+    {
+      offs[k] = m->blocks[s->pending[j].block];
+      m->code[offs[k]] = m->orig[s->pending[j].block];
+      k++;
+    }
+
+    _write_blocks(s->mem_fd, m, offs, k);
+    s->armed -= k;
+  }
+
+  free(offs);
+  s->npending = 0;
+}
+
+
+/*  _hit:
+ *    records a block hit. a block can be hit by several threads before its
+ *    breakpoint is removed, only the first hit counts.
+ */
+static void
+_hit(cov_session *s, int mod, uint32_t block)
+{
+  cov_module *m = &s->modules[mod];
+
+  if (m->hits[block >> 3] & (1u << (block & 7)))
+    return;
+
+  m->hits[block >> 3] |= 1u << (block & 7);
+  m->nhits++;
+
+  if (s->npending == s->cap_pending) {
+    s->cap_pending = s->cap_pending ? s->cap_pending * 2 : 256;
+    s->pending = realloc(s->pending,
+                         s->cap_pending * sizeof(struct _cov_hit));
+  }
+  s->pending[s->npending].module = mod;
+  s->pending[s->npending].block = block;
+  s->npending++;
+}
+
+
+/*  _open_mem:
+ *    opens the process' memory for writing. the fd stays bound to the
+ *    address space it was opened on, so it's opened again after exec.
+ */
+static int
+_open_mem(cov_session *s)
+{
+  char path[32];
+
+  if (s->mem_fd >= 0)
+    close(s->mem_fd);
+
+  snprintf(path, sizeof(path), "/proc/%d/mem", s->pid);
+  s->mem_fd = open(path, O_RDWR | O_CLOEXEC);
+  return s->mem_fd;
+}
+
+
+/*  _entry_point:
+ *    the program entry of a process, taken from its auxiliary vector.
+ *    returns 0 if it can't be read.
+ */
+static uintptr_t
+_entry_point(int pid)
+{
+  char path[32];
+  uint64_t av[2];
+  uintptr_t entry = 0;
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/auxv", pid);
+  if ((f = fopen(path, "r")) == NULL)
+    return 0;
+
+  while (fread(av, sizeof(av), 1, f) == 1 && av[0] != AT_NULL)
+    if (av[0] == AT_ENTRY) {
+      entry = av[1];
+      break;
+    }
+
+  fclose(f);
+  return entry;
+}
+
+
+/*  _exec_stop:
+ *    the process replaced its image. the old breakpoints went with it, the
+ *    modules are kept for the report. the new image's libraries are only
+ *    mapped once the dynamic loader is done, so a breakpoint is put on the
+ *    entry point and the modules are armed when it's reached.
+ */
+static void
+_exec_stop(cov_session *s, int tid)
+{
+  int i;
+  uint8_t int3 = INT3;
+
+  for (i = 0; i < s->nmodules; i++)
+    s->modules[i].live = 0;
+  s->armed = 0;
+  s->npending = 0;
+
+  /* every other thread is gone, the one left takes the leader's id */
+  s->nthreads = 0;
+  _thread(s, tid, 1)->stopped = 1;
+
+  s->entry = 0;
+  if (_open_mem(s) < 0 || (s->entry = _entry_point(s->pid)) == 0)
+    return;
+
+  if (mem_read(&s->reader, (void *) s->entry, &s->entry_orig, 1) != 1
+      || pwrite(s->mem_fd, &int3, 1, s->entry) != 1)
+    s->entry = 0;
+}
+
+
+/*  _release_child:
+ *    a forked child got a copy of every breakpoint still in place. the
+ *    original bytes are put back in its memory and it runs on untraced,
+ *    the parent's copy of the code is left as it was.
+ */
+static void
+_release_child(cov_session *s, int pid)
+{
+  char path[32];
+  uint32_t *offs;
+  size_t b, n;
+  int i, fd;
+  cov_module *m;
+
+  snprintf(path, sizeof(path), "/proc/%d/mem", pid);
+  fd = open(path, O_RDWR | O_CLOEXEC);
+
+  for (i = 0; fd >= 0 && i < s->nmodules; i++)
+  {
+    m = &s->modules[i];
+    if (!m->live || m->nblocks == 0)
+      continue;
+
+    /* pending hits still hold int3 too, code tells what's in memory */
+    offs = malloc(m->nblocks * sizeof(uint32_t));
+    for (b = 0, n = 0; b < m->nblocks; b++)
+      if (m->code[m->blocks[b]] != m->orig[b]) {
+        m->code[m->blocks[b]] = m->orig[b];
+        offs[n++] = (uint32_t) b;
+      }
+
+    for (b = 0; b < n; b++)
+      offs[b] = m->blocks[offs[b]];
+    _write_blocks(fd, m, offs, n);
+
+    for (b = 0; b < n; b++)
+      m->code[offs[b]] = INT3;
+    free(offs);
+  }
+
+  if (fd >= 0 && s->entry != 0)
+    pwrite(fd, &s->entry_orig, 1, s->entry);
+  if (fd >= 0)
+    close(fd);
+
+  ptrace(PTRACE_DETACH, pid, NULL, NULL);
+  _thread_remove(s, pid);
+}
+
+
+/*  _fork_stop:
+ *    a thread forked. the child is attached by the kernel and stops on
+ *    its own, that stop may have been reported already. a vfork child
+ *    shares the parent's memory and is traced like its threads, any other
+ *    child is released.
+ */
+static void
+_fork_stop(cov_session *s, int tid, int pid, int vfork)
+{
+  struct _cov_thread *t;
+  int status;
+
+  _thread(s, tid, 1)->stopped = 1;
+
+  if ((t = _thread(s, pid, 0)) == NULL) {
+    while (waitpid(pid, &status, __WALL) < 0 && errno == EINTR)
+      ;
+    if (!WIFSTOPPED(status))
+      return;
+
+    t = _thread(s, pid, 1);
+    t->stopped = 1;
+  }
+
+  if (vfork)
+    t->child = CHILD_VFORK;
+  else
+    _release_child(s, pid);
+}
+
+
+/*  _event:
+ *    records a stop or exit reported by waitpid. breakpoint hits are moved
+ *    back onto the block start and queued for removal.
+ */
+static void
+_event(cov_session *s, int tid, int status)
+{
+  struct _cov_thread *t;
+  unsigned long msg;
+  int sig, mod;
+  uint32_t block;
+  uintptr_t pc;
+
+  if (WIFEXITED(status) || WIFSIGNALED(status)) {
+    _thread_remove(s, tid);
+    return;
+  }
+
+  if (!WIFSTOPPED(status))
+    return;
+
+  sig = WSTOPSIG(status);
+
+  switch (status >> 16)
+  {
+    case PTRACE_EVENT_CLONE:
+      if (ptrace(PTRACE_GETEVENTMSG, tid, NULL, &msg) == 0)
+        _thread(s, (int) msg, 1);
+      _thread(s, tid, 1)->stopped = 1;
+      return;
+
+    case PTRACE_EVENT_FORK:
+    case PTRACE_EVENT_VFORK:
+      if (ptrace(PTRACE_GETEVENTMSG, tid, NULL, &msg) == 0)
+        _fork_stop(s, tid, (int) msg, status >> 16 == PTRACE_EVENT_VFORK);
+      else
+        _thread(s, tid, 1)->stopped = 1;
+      return;
+
+    case PTRACE_EVENT_EXEC:
+      /* a vfork child left the parent's memory, nothing of it is ours */
+      if ((t = _thread(s, tid, 0)) != NULL && t->child) {
+        ptrace(PTRACE_DETACH, tid, NULL, NULL);
+        _thread_remove(s, tid);
+        return;
+      }
+      _exec_stop(s, tid);
+      return;
+
+    case PTRACE_EVENT_STOP:
+      /* interrupts and new threads stop with SIGTRAP, group stops with
+       * the stop signal. a new process that isn't one of ours is a child
+       * whose fork event is still to come */
+      if ((t = _thread(s, tid, 0)) == NULL) {
+        t = _thread(s, tid, 1);
+        t->child = _is_task(s->pid, tid) ? 0 : CHILD_HELD;
+      }
+      t->stopped = 1;
+      t->group = sig != SIGTRAP;
+      return;
+  }
+
+  t = _thread(s, tid, 1);
+  t->stopped = 1;
+  t->group = 0;
+  t->sig = sig;
+
+  if (sig != SIGTRAP || _get_pc(tid, &pc) < 0)
+    return;
+
+  if (s->entry != 0 && pc - 1 == s->entry) {
+    _set_pc(tid, s->entry);
+    pwrite(s->mem_fd, &s->entry_orig, 1, s->entry);
+    s->entry = 0;
+    s->rearm = 1;
+    t->sig = 0;
+  } else if (_find_block(s, pc - 1, &mod, &block)) {
+    _set_pc(tid, pc - 1);
+    _hit(s, mod, block);
+    t->sig = 0;
+  }
+}
+
+
+/*  _resume_all:
+ *    continues every stopped thread, delivering the signal it stopped
+ *    with. group stopped threads are left stopped but keep reporting.
+ */
+static void
+_resume_all(cov_session *s)
+{
+  int i;
+  struct _cov_thread *t;
+
+  for (i = 0; i < s->nthreads; i++)
+  {
+    t = &s->threads[i];
+    if (!t->stopped || t->child == CHILD_HELD)
+      continue;
+
+    if (t->group)
+      ptrace(PTRACE_LISTEN, t->tid, NULL, NULL);
+    else
+      ptrace(PTRACE_CONT, t->tid, NULL, (void *) (long) t->sig);
+
+    t->stopped = t->sig = 0;
+  }
+}
+
+
+/*  _stop_all:
+ *    interrupts every running thread and waits until all are stopped.
+ *    anything reported meanwhile is handled as usual.
+ */
+static void
+_stop_all(cov_session *s)
+{
+  int i, tid, status, running;
+
+  for (i = 0; i < s->nthreads; i++)
+    if (!s->threads[i].stopped)
+      ptrace(PTRACE_INTERRUPT, s->threads[i].tid, NULL, NULL);
+
+  for (;;)
+  {
+    for (i = 0, running = 0; i < s->nthreads; i++)
+      running += !s->threads[i].stopped;
+    if (running == 0)
+      break;
+
+    tid = waitpid(-1, &status, __WALL);
+    if (tid < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    _event(s, tid, status);
+  }
+}
+
+
+/*  _sync_cb:
+ *    collects function starts as decoder sync points.
+ */
+static void
+_sync_cb(const sym_record *rec, void *arg)
+{
+  struct _cov_syncs *syncs = arg;
+
+  if (rec->type != SYM_FUNC)
+    return;
+
+  if (syncs->count == syncs->cap) {
+    syncs->cap = syncs->cap ? syncs->cap * 2 : 4096;
+    syncs->addrs = realloc(syncs->addrs, syncs->cap * sizeof(uintptr_t));
+  }
+  syncs->addrs[syncs->count++] = rec->addr;
+}
+
+
+static int
+_cmp_addr(const void *a, const void *b)
+{
+  uintptr_t x = *(const uintptr_t *) a, y = *(const uintptr_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+static int
+_cmp_range(const void *a, const void *b)
+{
+  const struct _cov_range *x = a, *y = b;
+
+  return x->from < y->from ? -1 : x->from > y->from;
+}
+
+
+/*  _exec_sections:
+ *    finds the executable sections of a module's backing file inside the
+ *    mapping, so headers and data sharing the mapping are never decoded.
+ *    returns the amount of sections, -1 if the file can't be used.
+ */
+static int
+_exec_sections(const ll_memmap_file *map, size_t len,
+               struct _cov_range **out)
+{
+  const Elf64_Ehdr *eh;
+  const Elf64_Shdr *sh;
+  struct stat st;
+  uint8_t *f;
+  uint64_t lo, hi;
+  int fd, i, n = -1;
+
+  *out = NULL;
+
+  fd = open(map->fpath, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  if (fstat(fd, &st) < 0 || (int) st.st_ino != map->inode
+      || st.st_size < (off_t) sizeof(Elf64_Ehdr)
+      || (f = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+         == MAP_FAILED) {
+    close(fd);
+    return -1;
+  }
+
+  eh = (const Elf64_Ehdr *) f;
+  if (memcmp(f, ELFMAG, SELFMAG) != 0 || f[EI_CLASS] != ELFCLASS64
+      || eh->e_shoff == 0
+      || eh->e_shoff + (uint64_t) eh->e_shnum * sizeof(Elf64_Shdr)
+         > (uint64_t) st.st_size)
+    goto exec_sections_end;
+
+  sh = (const Elf64_Shdr *) (f + eh->e_shoff);
+  *out = malloc((eh->e_shnum + 1) * sizeof(struct _cov_range));
+  n = 0;
+
+  for (i = 0; i < eh->e_shnum; i++)
+  {
+    if (sh[i].sh_type != SHT_PROGBITS || !(sh[i].sh_flags & SHF_EXECINSTR))
+      continue;
+
+    lo = sh[i].sh_offset > map->offset ? sh[i].sh_offset : map->offset;
+    hi = sh[i].sh_offset + sh[i].sh_size;
+    if (hi > map->offset + len)
+      hi = map->offset + len;
+    if (lo >= hi)
+      continue;
+
+    (*out)[n].from = lo - map->offset;
+    (*out)[n].to = hi - map->offset;
+    n++;
+  }
+
+  qsort(*out, n, sizeof(struct _cov_range), _cmp_range);
+
+exec_sections_end:
+  munmap(f, st.st_size);
+  close(fd);
+  return n;
+}
+
+
+/*  _module_free:
+ *    frees what a module holds.
+ */
+static void
+_module_free(cov_module *m)
+{
+  free(m->path);
+  free(m->code);
+  free(m->blocks);
+  free(m->orig);
+  free(m->hits);
+}
+
+
+/*  _module_add:
+ *    finds the blocks of an executable mapping and puts a breakpoint on
+ *    each, with a single batch of writes. every thread has to be stopped.
+ */
+static void
+_module_add(cov_session *s, const ll_memmap_file *map,
+            const struct _cov_syncs *syncs)
+{
+  cov_module m;
+  struct _cov_range *secs;
+  uint32_t *offs;
+  size_t len, i, j, n, k, cap = 0;
+  int nsecs, sec;
+
+  memset(&m, 0, sizeof(m));
+  m.start = (uintptr_t) map->start_addr;
+  m.end = (uintptr_t) map->end_addr;
+  m.offset = map->offset;
+  m.path = strdup(map->fpath);
+  m.live = 1;
+
+  len = m.end - m.start;
+  m.code = malloc(len);
+  if (mem_read(&s->reader, map->start_addr, m.code, len) != (ssize_t) len
+      || (nsecs = _exec_sections(map, len, &secs)) <= 0)
+    goto module_add_fail;
+
+  for (sec = 0; sec < nsecs; sec++)
+  {
+    /* only the sync points inside the section */
+    for (k = 0; k < syncs->count
+                && syncs->addrs[k] < m.start + secs[sec].from; k++)
+      ;
+
+    n = asm_blocks(m.code + secs[sec].from, secs[sec].to - secs[sec].from,
+                   m.start + secs[sec].from, syncs->addrs + k,
+                   syncs->count - k, &offs);
+
+    if (m.nblocks + n > cap) {
+      cap = (m.nblocks + n) * 2;
+      m.blocks = realloc(m.blocks, cap * sizeof(uint32_t));
+    }
+
+    /* existing int3 bytes aren't ours to take over */
+    for (i = 0; i < n; i++)
+      if (m.code[secs[sec].from + offs[i]] != INT3)
+        m.blocks[m.nblocks++] = secs[sec].from + offs[i];
+
+    free(offs);
+  }
+
+  free(secs);
+  if (m.nblocks == 0)
+    goto module_add_fail;
+
+  m.orig = malloc(m.nblocks);
+  m.hits = calloc(m.nblocks / 8 + 1, 1);
+
+  for (i = 0; i < m.nblocks; i++)
+  {
+    m.orig[i] = m.code[m.blocks[i]];
+    m.code[m.blocks[i]] = INT3;
+  }
+
+  if (_write_blocks(s->mem_fd, &m, m.blocks, m.nblocks) < 0) {
+    /* put back whatever made it */
+    for (j = 0; j < m.nblocks; j++)
+      m.code[m.blocks[j]] = m.orig[j];
+    _write_blocks(s->mem_fd, &m, m.blocks, m.nblocks);
+    goto module_add_fail;
+  }
+
+  s->modules = realloc(s->modules, (s->nmodules + 1) * sizeof(cov_module));
+  s->modules[s->nmodules++] = m;
+  s->armed += m.nblocks;
+  return;
+
+module_add_fail:
+  _module_free(&m);
+}
+
+
+/*  _arm:
+ *    puts breakpoints on every executable file mapping not covered yet
+ *    whose path matches the filter. every thread has to be stopped.
+ */
+static void
+_arm(cov_session *s)
+{
+  ll_memmap_file *maps, *mmf;
+  struct _cov_syncs syncs;
+  int i;
+
+  memset(&syncs, 0, sizeof(syncs));
+  maps = parse_proc_maps(s->pid);
+  if (maps == NULL)
+    return;
+
+  sym_enumerate(maps, NULL, NULL, _sync_cb, &syncs);
+  qsort(syncs.addrs, syncs.count, sizeof(uintptr_t), _cmp_addr);
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    if (!(mmf->mode & MODE_EXECUTE) || mmf->fpath == NULL
+        || mmf->fpath[0] != '/'
+        || (s->filter != NULL && strstr(mmf->fpath, s->filter) == NULL))
+      continue;
+
+    for (i = 0; i < s->nmodules; i++)
+      if (s->modules[i].live
+          && s->modules[i].start == (uintptr_t) mmf->start_addr)
+        break;
+
+    if (i == s->nmodules)
+      _module_add(s, mmf, &syncs);
+  }
+
+  free(syncs.addrs);
+  free_proc_maps(maps);
+}
+
+
+/*  _init:
+ *    prepares a session for a process.
+ */
+static void
+_init(cov_session *s, int pid, const char *filter)
+{
+  memset(s, 0, sizeof(cov_session));
+  s->pid = pid;
+  s->mem_fd = -1;
+  s->filter = filter;
+  mem_reader_init(&s->reader, pid, MEM_BACKEND_VM_READV);
+}
+
+
+/*  cov_attach:
+ *    attaches to every thread of a running process and puts a breakpoint
+ *    on every basic block of its executable file mappings. returns 0 on
+ *    success, -1 if the process can't be traced.
+ *
+ *    cov_session *s:       session to initialize
+ *    int pid:              process to attach to
+ *    const char *filter:   only cover modules whose path contains this,
+ *                          NULL for all
+ */
+int
+cov_attach(cov_session *s, int pid, const char *filter)
+{
+  char path[32];
+  DIR *dir;
+  struct dirent *ent;
+  int tid, added;
+
+  _init(s, pid, filter);
+  if (_open_mem(s) < 0)
+    return -1;
+
+  /* threads can be started while attaching, list them until no new one
+   * shows up. threads started by attached ones are attached by the
+   * kernel */
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  do {
+    added = 0;
+    if ((dir = opendir(path)) == NULL)
+      break;
+
+    while ((ent = readdir(dir)) != NULL)
+    {
+      tid = atoi(ent->d_name);
+      if (tid <= 0 || _thread(s, tid, 0) != NULL)
+        continue;
+
+      if (ptrace(PTRACE_SEIZE, tid, NULL, (void *) (long) TRACE_OPTS) == 0) {
+        _thread(s, tid, 1);
+        added++;
+      }
+    }
+
+    closedir(dir);
+  } while (added);
+
+  if (s->nthreads == 0) {
+    cov_free(s);
+    return -1;
+  }
+
+  _stop_all(s);
+  _arm(s);
+  _write_pending(s);
+  _resume_all(s);
+
+  return 0;
+}
+
+
+/*  cov_launch:
+ *    starts a program under tracing. its modules are armed once its entry
+ *    point is reached, when the dynamic loader mapped the libraries. the
+ *    program is killed if pardu exits without detaching. returns 0 on
+ *    success, -1 if it couldn't be started.
+ *
+ *    cov_session *s:       session to initialize
+ *    char *const argv[]:   program and its arguments, NULL terminated
+ *    const char *filter:   only cover modules whose path contains this,
+ *                          NULL for all
+ */
+int
+cov_launch(cov_session *s, char *const argv[], const char *filter)
+{
+  int pid, status;
+
+  pid = fork();
+  if (pid < 0)
+    return -1;
+
+  if (pid == 0) {
+    /* wait to be attached, the exec is what's traced */
+    raise(SIGSTOP);
+    execvp(argv[0], argv);
+    _exit(127);
+  }
+
+  if (waitpid(pid, &status, WUNTRACED) != pid || !WIFSTOPPED(status)
+      || ptrace(PTRACE_SEIZE, pid, NULL,
+                (void *) (long) (TRACE_OPTS | PTRACE_O_EXITKILL)) < 0) {
+    kill(pid, SIGKILL);
+    waitpid(pid, &status, 0);
+    return -1;
+  }
+
+  _init(s, pid, filter);
+  _thread(s, pid, 1);
+  kill(pid, SIGCONT);
+
+  return 0;
+}
+
+
+/*  cov_run:
+ *    handles the traced threads until the process exits or *stop is set,
+ *    usually by a signal handler. stops that are already queued are taken
+ *    together, so the breakpoints they hit are removed with one batch of
+ *    writes. returns 0 if the process exited, 1 if stopped.
+ *
+ *    cov_session *s:               attached or launched session
+ *    volatile sig_atomic_t *stop:  set to end tracing
+ */
+int
+cov_run(cov_session *s, volatile sig_atomic_t *stop)
+{
+  int tid, status;
+
+  while (s->nthreads > 0 && !*stop)
+  {
+    tid = waitpid(-1, &status, __WALL);
+    if (tid < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    do {
+      _event(s, tid, status);
+    } while ((tid = waitpid(-1, &status, __WALL | WNOHANG)) > 0);
+
+    if (s->rearm) {
+      s->rearm = 0;
+      _stop_all(s);
+      _arm(s);
+    }
+
+    _write_pending(s);
+    _resume_all(s);
+  }
+
+  return s->nthreads > 0;
+}
+
+
+/*  _restore_module:
+ *    puts the original bytes back on every block that wasn't hit, blocks
+ *    that were hit already hold theirs.
+ */
+static void
+_restore_module(cov_session *s, cov_module *m)
+{
+  uint32_t *offs;
+  size_t b, n = 0;
+
+  offs = malloc((m->nblocks ? m->nblocks : 1) * sizeof(uint32_t));
+
+  for (b = 0; b < m->nblocks; b++)
+    if (!(m->hits[b >> 3] & (1u << (b & 7)))) {
+      m->code[m->blocks[b]] = m->orig[b];
+      offs[n++] = m->blocks[b];
+    }
+
+  _write_blocks(s->mem_fd, m, offs, n);
+  s->armed -= n;
+  free(offs);
+}
+
+
+/*  cov_detach:
+ *    removes every breakpoint left and lets the process run on untraced.
+ *    the modules stay around for cov_report.
+ */
+void
+cov_detach(cov_session *s)
+{
+  int i;
+  cov_module *m;
+
+  if (s->nthreads > 0) {
+    _stop_all(s);
+
+    for (i = s->nthreads; i-- > 0;)
+      if (s->threads[i].child == CHILD_HELD)
+        _release_child(s, s->threads[i].tid);
+
+    _write_pending(s);
+
+    for (i = 0; i < s->nmodules; i++)
+    {
+      m = &s->modules[i];
+      if (!m->live)
+        continue;
+
+      _restore_module(s, m);
+    }
+
+    if (s->entry != 0)
+      pwrite(s->mem_fd, &s->entry_orig, 1, s->entry);
+
+    for (i = 0; i < s->nthreads; i++)
+      ptrace(PTRACE_DETACH, s->threads[i].tid, NULL,
+             (void *) (long) (s->threads[i].group ? 0 : s->threads[i].sig));
+  }
+
+  s->nthreads = 0;
+  s->armed = 0;
+  s->entry = 0;
+}
+
+
+/*  cov_report:
+ *    writes the block counts of every module, followed by the file offset
+ *    of every block that was hit. file offsets stay the same from run to
+ *    run, unlike addresses.
+ */
+void
+cov_report(const cov_session *s, FILE *f)
+{
+  int i;
+  size_t b;
+  const cov_module *m;
+
+  for (i = 0; i < s->nmodules; i++)
+  {
+    m = &s->modules[i];
+    fprintf(f, "module %s %#lx-%#lx offset %#lx blocks %zu hit %zu\n",
+            m->path, (unsigned long) m->start, (unsigned long) m->end,
+            (unsigned long) m->offset, m->nblocks, m->nhits);
+
+    for (b = 0; b < m->nblocks; b++)
+      if (m->hits[b >> 3] & (1u << (b & 7)))
+        fprintf(f, "  %#lx\n", (unsigned long) (m->offset + m->blocks[b]));
+  }
+}
+
+
+/*  cov_free:
+ *    frees everything held by a detached session.
+ */
+void
+cov_free(cov_session *s)
+{
+  int i;
+
+  for (i = 0; i < s->nmodules; i++)
+    _module_free(&s->modules[i]);
+
+  if (s->mem_fd >= 0)
+    close(s->mem_fd);
+  mem_reader_close(&s->reader);
+
+  free(s->modules);
+  free(s->threads);
+  free(s->pending);
+  memset(s, 0, sizeof(cov_session));
+  s->mem_fd = -1;
+}
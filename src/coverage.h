@@ -0,0 +1,62 @@
+#ifndef __COVERAGE_H
+#define __COVERAGE_H
+
+#include "mem.h"
+
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*  _coverage_module:
+ *    an executable file mapping with a one-shot breakpoint on every basic
+ *    block start. code is the mapping as it was last written, with int3 on
+ *    every block not hit yet.
+ */
+typedef struct _coverage_module
+{
+  char *path;
+  uintptr_t start, end;
+  uint64_t offset;                  /* file offset of start */
+  uint8_t *code;
+  uint32_t *blocks;                 /* block offsets from start, sorted */
+  uint8_t *orig;                    /* original first byte of each block */
+  uint8_t *hits;                    /* one bit per block */
+  size_t nblocks, nhits;
+  int live;                         /* 0 once the process replaced its
+                                     * image with exec */
+} cov_module;
+
+
+/*  _coverage_session:
+ *    a traced process and the breakpoints placed in it.
+ */
+typedef struct _coverage_session
+{
+  int pid;
+  int mem_fd;                       /* /proc/<pid>/mem opened for writing */
+  mem_reader reader;
+  const char *filter;               /* module path substring or NULL */
+  struct _cov_thread *threads;
+  int nthreads, cap_threads;
+  cov_module *modules;
+  int nmodules;
+  size_t armed;                     /* breakpoints still in place */
+  uintptr_t entry;                  /* entry breakpoint after an exec */
+  uint8_t entry_orig;
+  int rearm;                        /* the entry was reached, modules are
+                                     * to be armed */
+  struct _cov_hit *pending;         /* hits not written back yet */
+  size_t npending, cap_pending;
+} cov_session;
+
+
+/* function definitions */
+int  cov_attach(cov_session*, int, const char*);
+int  cov_launch(cov_session*, char *const*, const char*);
+int  cov_run(cov_session*, volatile sig_atomic_t*);
+void cov_detach(cov_session*);
+void cov_report(const cov_session*, FILE*);
+void cov_free(cov_session*);
+
+#endif /* __COVERAGE_H */
@@ -0,0 +1,662 @@
+#include "dedup.h"
+#include "hostutil.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <linux/fs.h>
+
+
+/* /proc/<pid>/pagemap entry bits */
+#define PM_PRESENT    (1ULL << 63)
+#define PM_EXCLUSIVE  (1ULL << 56)    /* mapped by this process only      */
+#define PM_PFN        ((1ULL << 55) - 1)
+
+#define INDEX_MIN     (1 << 16)       /* initial index slots              */
+#define CHECK_MUL     0xff51afd7ed558ccdULL
+#define SCAN_RUNS     64              /* present runs per PAGEMAP_SCAN    */
+
+
+/*  _dup_item:
+ *    a run of resident pages of one region handled by a single worker.
+ */
+struct _dup_item
+{
+  size_t region, first, count;
+};
+
+
+/*  _dup_job:
+ *    shared state of the parallel hashing.
+ */
+struct _dup_job
+{
+  dup_scan *s;
+  struct _dup_item *items;
+  const int *pids;
+  int *pm_fds;                      /* pagemap per target */
+  mem_reader *readers;              /* one per worker */
+  uint8_t **bufs;                   /* one per worker, allocated on use */
+};
+
+
+/*  _dup_frames:
+ *    a bit per physical frame seen, grown to the highest frame number.
+ */
+struct _dup_frames
+{
+  uint64_t *bits;
+  size_t nwords;
+};
+
+
+static const uint8_t zero_page[DUP_PAGE];
+
+
+
+/*  _pfns_readable:
+ *    whether pagemap entries carry frame numbers, which takes
+ *    CAP_SYS_ADMIN.
+ */
+static int
+_pfns_readable(void)
+{
+  volatile uint64_t probe = 1;
+  uint64_t entry = 0;
+  int fd;
+
+  fd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+
+  pread(fd, &entry, sizeof(entry),
+        (off_t) ((uintptr_t) &probe / DUP_PAGE * sizeof(entry)));
+  close(fd);
+
+  return (entry & PM_PRESENT) && (entry & PM_PFN) != 0 && probe;
+}
+
+
+/*  _append:
+ *    adds a resident page to a region.
+ */
+static void
+_append(dup_region *r, uintptr_t addr, uint64_t pm)
+{
+  if (r->npages == r->cap) {
+    r->cap = r->cap ? r->cap * 2 : 64;
+    r->addr = realloc(r->addr, r->cap * sizeof(uintptr_t));
+    r->pm = realloc(r->pm, r->cap * sizeof(uint64_t));
+  }
+
+  r->addr[r->npages] = addr;
+  r->pm[r->npages++] = pm;
+}
+
+
+/*  _collect_range:
+ *    reads the pagemap of from to to and adds the present pages to a
+ *    region.
+ */
+static void
+_collect_range(dup_region *r, int fd, uintptr_t from, uintptr_t to)
+{
+  uint64_t pm[DUP_ITEM_PAGES];
+  size_t i, k, got;
+  ssize_t n;
+
+  for (; from < to; from += k * DUP_PAGE)
+  {
+    k = (to - from) / DUP_PAGE;
+    if (k > DUP_ITEM_PAGES)
+      k = DUP_ITEM_PAGES;
+
+    n = pread(fd, pm, k * sizeof(uint64_t),
+              (off_t) (from / DUP_PAGE * sizeof(uint64_t)));
+    if (n <= 0)
+      return;
+
+    got = n / sizeof(uint64_t);
+    for (i = 0; i < got; i++)
+      if (pm[i] & PM_PRESENT)
+        _append(r, from + i * DUP_PAGE, pm[i]);
+  }
+}
+
+
+/*  _collect_worker:
+ *    finds the resident pages of one region. where the kernel has
+ *    PAGEMAP_SCAN only the runs of present pages are read from pagemap,
+ *    large reserved mappings cost no more than their resident part.
+ */
+static void
+_collect_worker(int item, int worker, void *arg)
+{
+  struct _dup_job *job = arg;
+  dup_region *r = &job->s->regions[item];
+  int fd = job->pm_fds[r->target];
+  uintptr_t from = r->start;
+#ifdef PAGEMAP_SCAN
+  struct page_region runs[SCAN_RUNS];
+  struct pm_scan_arg scan;
+  long i, n;
+#endif
+
+  (void) worker;
+
+  if (fd < 0)
+    return;
+
+#ifdef PAGEMAP_SCAN
+  while (from < r->end)
+  {
+    memset(&scan, 0, sizeof(scan));
+    scan.size = sizeof(scan);
+    scan.start = from;
+    scan.end = r->end;
+    scan.vec = (uintptr_t) runs;
+    scan.vec_len = SCAN_RUNS;
+    scan.category_mask = PAGE_IS_PRESENT;
+    scan.return_mask = PAGE_IS_PRESENT;
+
+    /* not supported, read the rest of the pagemap */
+    if ((n = ioctl(fd, PAGEMAP_SCAN, &scan)) < 0 || scan.walk_end <= from)
+      break;
+
+    for (i = 0; i < n; i++)
+      _collect_range(r, fd, runs[i].start, runs[i].end);
+    from = scan.walk_end;
+  }
+#endif
+
+  _collect_range(r, fd, from, r->end);
+}
+
+
+/*  _page_check:
+ *    a second hash of a page, for telling contents apart next to
+ *    hostk.hash. it's built unlike that one: four lanes xor in a word each
+ *    and multiply, so two pages only share a slot if both hashes collide.
+ */
+static uint64_t
+_page_check(const uint8_t *page)
+{
+  uint64_t l[4] = { 1, 2, 3, 4 }, w, h;
+  size_t i, k;
+
+  for (i = 0; i < DUP_PAGE; i += sizeof(l))
+    for (k = 0; k < 4; k++)
+    {
+      memcpy(&w, page + i + k * sizeof(w), sizeof(w));
+      l[k] = (l[k] ^ w) * CHECK_MUL;
+      l[k] ^= l[k] >> 31;
+    }
+
+  for (h = l[0], k = 1; k < 4; k++)
+  {
+    h = (h ^ l[k]) * CHECK_MUL;
+    h ^= h >> 29;
+  }
+
+  return h;
+}
+
+
+/*  _dup_worker:
+ *    reads every resident page of an item worth hashing in one batch, with
+ *    runs of adjacent pages merged into a single request. without frame
+ *    numbers, pages mapped more than once are left out, their copies can't
+ *    be told from the mappings of one shared frame.
+ */
+static void
+_dup_worker(int item, int worker, void *arg)
+{
+  struct _dup_job *job = arg;
+  struct _dup_item *it = &job->items[item];
+  dup_region *r = &job->s->regions[it->region];
+  mem_reader *rd = &job->readers[worker];
+  mem_readreq reqs[DUP_ITEM_PAGES];
+  uint64_t *pm = r->pm + it->first, h;
+  uintptr_t *addr = r->addr + it->first;
+  uint8_t *buf;
+  size_t i, k, idx, got, nreqs = 0;
+  int pid = job->pids[r->target];
+
+  if (job->bufs[worker] == NULL)
+    job->bufs[worker] = malloc(DUP_ITEM_PAGES * DUP_PAGE);
+  buf = job->bufs[worker];
+
+  if (rd->pid != pid) {
+    mem_reader_close(rd);
+    mem_reader_init(rd, pid, MEM_BACKEND_VM_READV);
+  }
+
+  for (i = 0; i < it->count; i++)
+  {
+    if (!job->s->pfns && !(pm[i] & PM_EXCLUSIVE))
+      continue;
+
+    if (nreqs > 0 && (uint8_t *) reqs[nreqs-1].buf + reqs[nreqs-1].len
+                     == buf + i * DUP_PAGE
+        && (uintptr_t) reqs[nreqs-1].addr + reqs[nreqs-1].len == addr[i]) {
+      reqs[nreqs-1].len += DUP_PAGE;
+      continue;
+    }
+
+    reqs[nreqs].addr = (void *) addr[i];
+    reqs[nreqs].buf = buf + i * DUP_PAGE;
+    reqs[nreqs++].len = DUP_PAGE;
+  }
+
+  mem_read_batch(rd, reqs, (int) nreqs);
+
+  for (i = 0; i < nreqs; i++)
+  {
+    got = reqs[i].nread > 0 ? (size_t) reqs[i].nread / DUP_PAGE : 0;
+    idx = ((uint8_t *) reqs[i].buf - buf) / DUP_PAGE;
+
+    for (k = 0; k < reqs[i].len / DUP_PAGE; k++, idx++)
+    {
+      /* a page gone meanwhile isn't counted at all */
+      if (k >= got) {
+        pm[idx] = 0;
+        continue;
+      }
+
+      h = hostk.hash(buf + idx * DUP_PAGE, DUP_PAGE);
+      r->hash[it->first + idx] = h ? h : 1;
+      r->check[it->first + idx] = _page_check(buf + idx * DUP_PAGE);
+    }
+  }
+}
+
+
+/*  _index_add:
+ *    the slot of a content, created empty if it's new.
+ */
+static dup_slot*
+_index_add(dup_index *x, uint64_t hash, uint64_t check)
+{
+  dup_slot *old = x->slots;
+  size_t cap = x->cap, i, j;
+
+  if ((x->count + 1) * 10 > x->cap * 7) {
+    x->cap = x->cap ? x->cap * 2 : INDEX_MIN;
+    x->slots = calloc(x->cap, sizeof(dup_slot));
+
+    for (i = 0; i < cap; i++)
+    {
+      if (old[i].pages == 0)
+        continue;
+
+      for (j = old[i].hash & (x->cap - 1); x->slots[j].pages != 0;
+           j = (j + 1) & (x->cap - 1))
+        ;
+      x->slots[j] = old[i];
+    }
+    free(old);
+  }
+
+  for (i = hash & (x->cap - 1);
+       x->slots[i].pages != 0
+       && (x->slots[i].hash != hash || x->slots[i].check != check);
+       i = (i + 1) & (x->cap - 1))
+    ;
+
+  if (x->slots[i].pages == 0) {
+    x->slots[i].hash = hash;
+    x->slots[i].check = check;
+    x->count++;
+  }
+
+  return &x->slots[i];
+}
+
+
+/*  dup_index_find:
+ *    the slot of a content or NULL.
+ */
+const dup_slot*
+dup_index_find(const dup_index *x, uint64_t hash, uint64_t check)
+{
+  size_t i;
+
+  if (x->cap == 0)
+    return NULL;
+
+  for (i = hash & (x->cap - 1); x->slots[i].pages != 0;
+       i = (i + 1) & (x->cap - 1))
+    if (x->slots[i].hash == hash && x->slots[i].check == check)
+      return &x->slots[i];
+
+  return NULL;
+}
+
+
+/*  _frame_seen:
+ *    marks a physical frame, returns whether it was marked already.
+ */
+static int
+_frame_seen(struct _dup_frames *f, uint64_t pfn)
+{
+  size_t w = pfn / 64, n;
+  uint64_t bit = 1ULL << (pfn % 64);
+
+  if (w >= f->nwords) {
+    n = f->nwords * 2 > w + 1 ? f->nwords * 2 : w + 1;
+    f->bits = realloc(f->bits, n * sizeof(uint64_t));
+    memset(f->bits + f->nwords, 0, (n - f->nwords) * sizeof(uint64_t));
+    f->nwords = n;
+  }
+
+  if (f->bits[w] & bit)
+    return 1;
+
+  f->bits[w] |= bit;
+  return 0;
+}
+
+
+/*  _index_build:
+ *    adds every hashed page to the index. a mapping of a frame that was
+ *    seen before only adds to the content's pages, not its frames.
+ */
+static void
+_index_build(dup_scan *s)
+{
+  struct _dup_frames frames = { NULL, 0 };
+  dup_region *r;
+  dup_slot *slot;
+  size_t i, p;
+  int fresh;
+
+  for (i = 0; i < s->nregions; i++)
+  {
+    r = &s->regions[i];
+
+    for (p = 0; p < r->npages; p++)
+    {
+      if (r->hash[p] == 0) {
+        if (r->pm[p] & PM_PRESENT)
+          s->skipped += DUP_PAGE;
+        r->pm[p] = 0;
+        continue;
+      }
+
+      fresh = !s->pfns || !_frame_seen(&frames, r->pm[p] & PM_PFN);
+      slot = _index_add(&s->index, r->hash[p], r->check[p]);
+      slot->pages++;
+      slot->frames += fresh;
+
+      r->pm[p] = fresh;
+      r->resident += DUP_PAGE;
+    }
+
+    s->resident += r->resident;
+  }
+
+  free(frames.bits);
+}
+
+
+/*  _attribute:
+ *    charges every frame whose content another frame holds too to its
+ *    region, and sums up the reclaimable bytes.
+ */
+static void
+_attribute(dup_scan *s)
+{
+  const dup_slot *slot;
+  dup_region *r;
+  uint64_t zero = hostk.hash(zero_page, DUP_PAGE);
+  uint64_t zero_check = _page_check(zero_page);
+  size_t i, p;
+
+  for (i = 0; i < s->nregions; i++)
+  {
+    r = &s->regions[i];
+
+    for (p = 0; p < r->npages; p++)
+      if (r->pm[p]
+          && (slot = dup_index_find(&s->index, r->hash[p],
+                                    r->check[p])) != NULL
+          && slot->frames > 1)
+        r->dup += DUP_PAGE;
+
+    free(r->pm);
+    r->pm = NULL;
+  }
+
+  for (i = 0; i < s->index.cap; i++)
+  {
+    slot = &s->index.slots[i];
+    if (slot->frames > 1)
+      s->reclaimable += (uint64_t) (slot->frames - 1) * DUP_PAGE;
+    if (slot->pages != 0 && slot->hash == (zero ? zero : 1)
+        && slot->check == zero_check)
+      s->zero += (uint64_t) slot->frames * DUP_PAGE;
+  }
+}
+
+
+/*  dup_scan_run:
+ *    hashes every resident page of a set of processes on the worker
+ *    threads and indexes the contents. the index is built on a single
+ *    thread afterwards, it needs 24 bytes per distinct content; the scan
+ *    holds 24 bytes per resident page until it's freed. returns the
+ *    amount of distinct contents.
+ *
+ *    dup_scan *s:              receives the scan, free with dup_scan_free
+ *    const int *pids:          processes to scan
+ *    ll_memmap_file **maps:    the maps of each
+ *    int n:                    amount of processes
+ *    int nthreads:             worker threads, 0 for one per cpu
+ */
+int
+dup_scan_run(dup_scan *s, const int *pids, ll_memmap_file **maps, int n,
+             int nthreads)
+{
+  ll_memmap_file *mmf;
+  dup_region *r;
+  struct _dup_job job;
+  char path[32];
+  size_t i, p, nitems = 0, total = 0;
+  int t;
+
+  memset(s, 0, sizeof(dup_scan));
+  memset(&job, 0, sizeof(job));
+  s->pfns = _pfns_readable();
+
+  for (t = 0; t < n; t++)
+    for (mmf = maps[t]; mmf != NULL; mmf = mmf->next)
+    {
+      /* the vdso data and vsyscall pages can't be read */
+      if (!(mmf->mode & MODE_READ) || (mmf->fpath != NULL
+          && (strncmp(mmf->fpath, "[vvar", 5) == 0
+              || strcmp(mmf->fpath, "[vsyscall]") == 0)))
+        continue;
+
+      s->regions = realloc(s->regions,
+                           (s->nregions + 1) * sizeof(dup_region));
+      r = &s->regions[s->nregions++];
+      memset(r, 0, sizeof(dup_region));
+      r->target = t;
+      r->start = (uintptr_t) mmf->start_addr;
+      r->end = (uintptr_t) mmf->end_addr;
+      r->mmf = mmf;
+    }
+
+  job.s = s;
+  job.pids = pids;
+  job.pm_fds = malloc((n + 1) * sizeof(int));
+  for (t = 0; t < n; t++)
+  {
+    snprintf(path, sizeof(path), "/proc/%d/pagemap", pids[t]);
+    job.pm_fds[t] = open(path, O_RDONLY | O_CLOEXEC);
+  }
+
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+
+  /* which pages are resident first, only those are kept and read */
+  parallel_for((int) s->nregions, nthreads, _collect_worker, &job);
+
+  for (i = 0; i < s->nregions; i++)
+  {
+    r = &s->regions[i];
+    r->hash = calloc(r->npages ? r->npages : 1, sizeof(uint64_t));
+    r->check = calloc(r->npages ? r->npages : 1, sizeof(uint64_t));
+    total += (r->npages + DUP_ITEM_PAGES - 1) / DUP_ITEM_PAGES;
+  }
+
+  job.items = malloc((total + 1) * sizeof(struct _dup_item));
+  for (i = 0; i < s->nregions; i++)
+    for (p = 0; p < s->regions[i].npages; p += DUP_ITEM_PAGES)
+    {
+      job.items[nitems].region = i;
+      job.items[nitems].first = p;
+      job.items[nitems++].count = s->regions[i].npages - p < DUP_ITEM_PAGES
+                                  ? s->regions[i].npages - p
+                                  : DUP_ITEM_PAGES;
+    }
+
+  job.readers = malloc(nthreads * sizeof(mem_reader));
+  job.bufs = calloc(nthreads, sizeof(uint8_t*));
+  for (t = 0; t < nthreads; t++)
+    mem_reader_init(&job.readers[t], 0, MEM_BACKEND_VM_READV);
+
+  parallel_for((int) nitems, nthreads, _dup_worker, &job);
+
+  for (t = 0; t < nthreads; t++)
+  {
+    mem_reader_close(&job.readers[t]);
+    free(job.bufs[t]);
+  }
+  for (t = 0; t < n; t++)
+    if (job.pm_fds[t] >= 0)
+      close(job.pm_fds[t]);
+
+  free(job.readers);
+  free(job.bufs);
+  free(job.pm_fds);
+  free(job.items);
+
+  _index_build(s);
+  _attribute(s);
+
+  return (int) s->index.count;
+}
+
+
+static int
+_cmp_group_hash(const void *a, const void *b)
+{
+  const dup_group *x = a, *y = b;
+
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  return x->check < y->check ? -1 : x->check > y->check;
+}
+
+
+static int
+_cmp_group_frames(const void *a, const void *b)
+{
+  const dup_group *x = a, *y = b;
+
+  if (x->frames != y->frames)
+    return x->frames < y->frames ? 1 : -1;
+  return (x->pages < y->pages) - (x->pages > y->pages);
+}
+
+
+/*  dup_top:
+ *    the contents held by the most frames, most first, each with one
+ *    place it's mapped at. returns the amount of groups written.
+ *
+ *    const dup_scan *s:  a finished scan
+ *    dup_group *out:     receives up to n groups
+ *    size_t n:           groups wanted
+ */
+size_t
+dup_top(const dup_scan *s, dup_group *out, size_t n)
+{
+  const dup_slot *slot;
+  const dup_region *r;
+  dup_group key, *g;
+  size_t i, j, p, count = 0;
+
+  if (n == 0)
+    return 0;
+
+  /* kept sorted, the smallest last */
+  for (i = 0; i < s->index.cap; i++)
+  {
+    slot = &s->index.slots[i];
+    if (slot->frames < 2
+        || (count == n && slot->frames <= out[n-1].frames))
+      continue;
+
+    for (j = count < n ? count++ : n - 1;
+         j > 0 && out[j-1].frames < slot->frames; j--)
+      out[j] = out[j-1];
+
+    memset(&out[j], 0, sizeof(dup_group));
+    out[j].hash = slot->hash;
+    out[j].check = slot->check;
+    out[j].pages = slot->pages;
+    out[j].frames = slot->frames;
+    out[j].region = (size_t) -1;
+  }
+
+  /* one pass over every page finds a place for each */
+  qsort(out, count, sizeof(dup_group), _cmp_group_hash);
+  for (i = 0; i < s->nregions; i++)
+  {
+    r = &s->regions[i];
+
+    for (p = 0; p < r->npages; p++)
+    {
+      key.hash = r->hash[p];
+      key.check = r->check[p];
+      if (key.hash == 0
+          || (g = bsearch(&key, out, count, sizeof(dup_group),
+                          _cmp_group_hash)) == NULL
+          || g->region != (size_t) -1)
+        continue;
+
+      g->region = i;
+      g->addr = r->addr[p];
+    }
+  }
+
+  qsort(out, count, sizeof(dup_group), _cmp_group_frames);
+  return count;
+}
+
+
+/*  dup_scan_free:
+ *    frees a scan filled by dup_scan_run.
+ */
+void
+dup_scan_free(dup_scan *s)
+{
+  size_t i;
+
+  for (i = 0; i < s->nregions; i++)
+  {
+    free(s->regions[i].addr);
+    free(s->regions[i].hash);
+    free(s->regions[i].check);
+    free(s->regions[i].pm);
+  }
+
+  free(s->regions);
+  free(s->index.slots);
+  memset(s, 0, sizeof(dup_scan));
+}
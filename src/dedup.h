@@ -0,0 +1,97 @@
+#ifndef __DEDUP_H
+#define __DEDUP_H
+
+#include "mem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DUP_PAGE        4096
+#define DUP_ITEM_PAGES  1024        /* pages per work item               */
+
+
+/*  _dedup_slot:
+ *    a distinct page content in the index, told apart by two hashes built
+ *    unlike each other. frames counts the physical pages holding it, pages
+ *    every mapping of them.
+ */
+typedef struct _dedup_slot
+{
+  uint64_t hash, check;
+  uint32_t pages;                   /* 0 for an empty slot */
+  uint32_t frames;
+} dup_slot;
+
+
+/*  _dedup_index:
+ *    open addressing table of page contents, by content hash and check.
+ *    linear probing on the hash, grown at 70% load.
+ */
+typedef struct _dedup_index
+{
+  dup_slot *slots;
+  size_t cap, count;
+} dup_index;
+
+
+/*  _dedup_region:
+ *    a mapping of one of the scanned processes, its resident pages and the
+ *    content hash and check of each, a hash of 0 for pages that weren't
+ *    hashed.
+ */
+typedef struct _dedup_region
+{
+  int target;                       /* index into the scanned pids */
+  uintptr_t start, end;
+  const ll_memmap_file *mmf;
+  uintptr_t *addr;                  /* of every resident page */
+  uint64_t *hash;
+  uint64_t *check;
+  uint64_t *pm;                     /* pagemap entries while scanning,
+                                     * then 1 for pages that are the first
+                                     * mapping of their frame */
+  size_t npages, cap;               /* resident pages, allocated */
+  size_t resident;                  /* bytes hashed */
+  size_t dup;                       /* bytes whose content is also held
+                                     * by another frame */
+} dup_region;
+
+
+/*  _dedup_group:
+ *    a content held by several frames, and where one of them is mapped.
+ */
+typedef struct _dedup_group
+{
+  uint64_t hash, check;
+  uint32_t pages, frames;
+  size_t region;
+  uintptr_t addr;
+} dup_group;
+
+
+/*  _dedup_scan:
+ *    the page contents of a set of processes.
+ */
+typedef struct _dedup_scan
+{
+  dup_region *regions;
+  size_t nregions;
+  dup_index index;
+  int pfns;                         /* physical frames were readable */
+  uint64_t resident;                /* bytes hashed */
+  uint64_t skipped;                 /* bytes of pages mapped more than once
+                                     * that weren't hashed, without pfns */
+  uint64_t zero;                    /* bytes of zero filled frames */
+  uint64_t reclaimable;             /* bytes of frames that duplicate
+                                     * another one */
+} dup_scan;
+
+
+/* function definitions */
+int             dup_scan_run(dup_scan*, const int*, ll_memmap_file**, int,
+                             int);
+const dup_slot* dup_index_find(const dup_index*, uint64_t, uint64_t);
+size_t          dup_top(const dup_scan*, dup_group*, size_t);
+void            dup_scan_free(dup_scan*);
+
+#endif /* __DEDUP_H */
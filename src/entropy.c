@@ -0,0 +1,304 @@
+#include "entropy.h"
+#include "hostutil.h"
+#include "util.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define ENT_ITEM      (1024 * 1024)   /* bytes per work item             */
+
+
+const char *ent_class_names[ENT_CLASSES] = {
+  "unreadable", "zero", "text", "data", "packed",
+};
+
+
+/* x * log2(x) for every possible bin count, built once */
+static float xlogx[ENT_WINDOW_MAX + 1];
+static pthread_once_t xlogx_once = PTHREAD_ONCE_INIT;
+
+/* compared against to find zeroed windows */
+static const uint8_t zeroes[ENT_WINDOW_MAX];
+
+
+/*  _ent_item:
+ *    a run of windows of one region handled by a single worker.
+ */
+struct _ent_item
+{
+  size_t region, first, count;
+};
+
+
+/*  _ent_job:
+ *    shared state of a parallel ent_map_build.
+ */
+struct _ent_job
+{
+  ent_map *m;
+  int pid;
+  struct _ent_item *items;
+  mem_reader *readers;              /* one per worker */
+  uint8_t **bufs;                   /* one per worker, allocated on use */
+};
+
+
+
+static void
+_xlogx_init(void)
+{
+  int i;
+
+  for (i = 1; i <= ENT_WINDOW_MAX; i++)
+    xlogx[i] = (float) (i * log2((double) i));
+}
+
+
+/*  _histogram:
+ *    counts the bytes of p. consecutive bytes go to four separate tables,
+ *    so increments of the same bin don't wait on each other, and the
+ *    tables are summed up at the end.
+ */
+static void
+_histogram(const uint8_t *p, size_t len, uint32_t hist[256])
+{
+  uint32_t h[4][256];
+  uint64_t v;
+  size_t i;
+  int b;
+
+  memset(h, 0, sizeof(h));
+
+  for (i = 0; i + 8 <= len; i += 8)
+  {
+    memcpy(&v, p + i, sizeof(v));
+    h[0][v & 0xff]++;
+    h[1][(v >> 8) & 0xff]++;
+    h[2][(v >> 16) & 0xff]++;
+    h[3][(v >> 24) & 0xff]++;
+    h[0][(v >> 32) & 0xff]++;
+    h[1][(v >> 40) & 0xff]++;
+    h[2][(v >> 48) & 0xff]++;
+    h[3][v >> 56]++;
+  }
+
+  for (; i < len; i++)
+    h[0][p[i]]++;
+
+  for (b = 0; b < 256; b++)
+    hist[b] = h[0][b] + h[1][b] + h[2][b] + h[3][b];
+}
+
+
+/*  ent_window_stats:
+ *    shannon entropy and byte class shares of a window of at most
+ *    ENT_WINDOW_MAX bytes. zeroed windows, common in untouched memory,
+ *    are found with the vector compare kernel and skip the histogram.
+ *
+ *    const uint8_t *p:   window contents
+ *    size_t len:         window length
+ *    ent_window *w:      receives the statistics
+ */
+void
+ent_window_stats(const uint8_t *p, size_t len, ent_window *w)
+{
+  uint32_t hist[256], text = 0, high = 0;
+  double sum = 0.0, bits;
+  int b;
+
+  pthread_once(&xlogx_once, _xlogx_init);
+
+  if (len == 0 || hostk.mismatch(p, zeroes, len) == len) {
+    w->entropy = 0;
+    w->zero = 255;
+    w->text = w->high = 0;
+    return;
+  }
+
+  _histogram(p, len, hist);
+
+  for (b = 0; b < 256; b++)
+    sum += xlogx[hist[b]];
+  for (b = 0x80; b < 256; b++)
+    high += hist[b];
+  for (b = 0x20; b < 0x7f; b++)
+    text += hist[b];
+  text += hist['\t'] + hist['\n'] + hist['\r'];
+
+  /* H = log2(n) - sum(c * log2(c)) / n */
+  bits = log2((double) len) - sum / len;
+  if (bits < 0.0)
+    bits = 0.0;
+
+  w->entropy = (uint8_t) (bits * ENT_SCALE + 0.5);
+  w->zero = (uint8_t) ((uint64_t) hist[0] * 255 / len);
+  w->text = (uint8_t) ((uint64_t) text * 255 / len);
+  w->high = (uint8_t) ((uint64_t) high * 255 / len);
+}
+
+
+/*  ent_classify:
+ *    what a window most likely holds, an enum ent_class. packed data sits
+ *    close to 8 bits per byte, machine code and structured data rarely
+ *    exceed 6.5.
+ */
+int
+ent_classify(const ent_window *w)
+{
+  if (w->entropy == ENT_UNREADABLE)
+    return ENT_UNREAD;
+  if (w->zero >= 250)
+    return ENT_ZERO;
+  if (w->entropy >= 7.2 * ENT_SCALE)
+    return ENT_PACKED;
+  if (w->text >= 230)
+    return ENT_TEXT;
+  return ENT_DATA;
+}
+
+
+/*  _ent_worker:
+ *    reads one item and computes its windows. if the read comes back
+ *    short, the remaining windows are read one by one, so a single bad
+ *    page only costs its own window.
+ */
+static void
+_ent_worker(int item, int worker, void *arg)
+{
+  struct _ent_job *job = arg;
+  struct _ent_item *it = &job->items[item];
+  ent_region *r = &job->m->regions[it->region];
+  size_t win = job->m->window, i, len;
+  uintptr_t start = r->start + it->first * win;
+  uint8_t *buf;
+  ssize_t got;
+
+  if (job->bufs[worker] == NULL)
+    job->bufs[worker] = malloc(ENT_ITEM);
+  buf = job->bufs[worker];
+
+  len = r->end - start < it->count * win ? r->end - start : it->count * win;
+  got = mem_read(&job->readers[worker], (void *) start, buf, len);
+  if (got < 0)
+    got = 0;
+
+  for (i = 0; i < it->count; i++)
+  {
+    len = r->end - start - i * win < win ? r->end - start - i * win : win;
+
+    if ((size_t) got < i * win + len
+        && mem_read(&job->readers[worker], (void *) (start + i * win),
+                    buf + i * win, len) != (ssize_t) len) {
+      r->windows[it->first + i].entropy = ENT_UNREADABLE;
+      r->windows[it->first + i].zero = 0;
+      r->windows[it->first + i].text = 0;
+      r->windows[it->first + i].high = 0;
+      continue;
+    }
+
+    ent_window_stats(buf + i * win, len, &r->windows[it->first + i]);
+  }
+}
+
+
+/*  ent_map_build:
+ *    computes the windows of every mapping matching mode_mask. regions are
+ *    cut into items of 1 MiB which are spread over the worker threads.
+ *    returns the amount of windows.
+ *
+ *    ent_map *m:             receives the map, free with ent_map_free
+ *    int pid:                process to read
+ *    ll_memmap_file *maps:   its maps
+ *    uint8_t mode_mask:      MODE_* bits a mapping needs
+ *    size_t window:          window size, a power of two up to
+ *                            ENT_WINDOW_MAX, 0 for ENT_WINDOW
+ *    int nthreads:           worker threads, 0 for one per cpu
+ */
+int
+ent_map_build(ent_map *m, int pid, ll_memmap_file *maps, uint8_t mode_mask,
+              size_t window, int nthreads)
+{
+  ll_memmap_file *mmf;
+  ent_region *r;
+  struct _ent_job job;
+  size_t i, w, per, nitems = 0, total = 0;
+  int t;
+
+  if (window == 0 || window > ENT_WINDOW_MAX || (window & (window - 1)))
+    window = ENT_WINDOW;
+
+  memset(m, 0, sizeof(ent_map));
+  m->window = window;
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    if ((mmf->mode & mode_mask) != mode_mask)
+      continue;
+
+    m->regions = realloc(m->regions, (m->nregions + 1) * sizeof(ent_region));
+    r = &m->regions[m->nregions++];
+    r->start = (uintptr_t) mmf->start_addr;
+    r->end = (uintptr_t) mmf->end_addr;
+    r->mmf = mmf;
+    r->count = (r->end - r->start + window - 1) / window;
+    r->windows = calloc(r->count ? r->count : 1, sizeof(ent_window));
+    total += r->count;
+  }
+
+  per = ENT_ITEM / window;
+  memset(&job, 0, sizeof(job));
+  job.m = m;
+  job.pid = pid;
+  job.items = malloc((total / per + m->nregions + 1)
+                     * sizeof(struct _ent_item));
+
+  for (i = 0; i < m->nregions; i++)
+    for (w = 0; w < m->regions[i].count; w += per)
+    {
+      job.items[nitems].region = i;
+      job.items[nitems].first = w;
+      job.items[nitems].count = m->regions[i].count - w < per
+                                ? m->regions[i].count - w : per;
+      nitems++;
+    }
+
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+
+  job.readers = malloc(nthreads * sizeof(mem_reader));
+  job.bufs = calloc(nthreads, sizeof(uint8_t*));
+  for (t = 0; t < nthreads; t++)
+    mem_reader_init(&job.readers[t], pid, MEM_BACKEND_VM_READV);
+
+  parallel_for((int) nitems, nthreads, _ent_worker, &job);
+
+  for (t = 0; t < nthreads; t++)
+  {
+    mem_reader_close(&job.readers[t]);
+    free(job.bufs[t]);
+  }
+  free(job.readers);
+  free(job.bufs);
+  free(job.items);
+
+  return (int) total;
+}
+
+
+/*  ent_map_free:
+ *    frees a map filled by ent_map_build.
+ */
+void
+ent_map_free(ent_map *m)
+{
+  size_t i;
+
+  for (i = 0; i < m->nregions; i++)
+    free(m->regions[i].windows);
+
+  free(m->regions);
+  memset(m, 0, sizeof(ent_map));
+}
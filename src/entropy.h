@@ -0,0 +1,69 @@
+#ifndef __ENTROPY_H
+#define __ENTROPY_H
+
+#include "mem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define ENT_WINDOW      4096        /* default window size               */
+#define ENT_WINDOW_MAX  65536
+#define ENT_SCALE       31          /* entropy units per bit             */
+#define ENT_UNREADABLE  0xff        /* entropy of a window that failed   */
+
+/* what a window most likely holds, see ent_classify */
+enum ent_class {
+  ENT_UNREAD = 0,
+  ENT_ZERO,                         /* zeroed memory                     */
+  ENT_TEXT,                         /* printable ascii                   */
+  ENT_DATA,                         /* code and ordinary data            */
+  ENT_PACKED,                       /* compressed or encrypted           */
+  ENT_CLASSES,
+};
+
+
+/*  _entropy_window:
+ *    statistics of one window. entropy is in 1/ENT_SCALE bits per byte,
+ *    the byte class shares are in 1/255 of the window.
+ */
+typedef struct _entropy_window
+{
+  uint8_t entropy;
+  uint8_t zero;                     /* 0x00                              */
+  uint8_t text;                     /* 0x20-0x7e, tab, newline, return   */
+  uint8_t high;                     /* 0x80-0xff                         */
+} ent_window;
+
+
+/*  _entropy_region:
+ *    the windows of one mapping, the last one may be shorter.
+ */
+typedef struct _entropy_region
+{
+  uintptr_t start, end;
+  const ll_memmap_file *mmf;
+  ent_window *windows;
+  size_t count;
+} ent_region;
+
+
+/*  _entropy_map:
+ *    the windows of every mapping of a process.
+ */
+typedef struct _entropy_map
+{
+  ent_region *regions;
+  size_t nregions;
+  size_t window;
+} ent_map;
+
+
+extern const char *ent_class_names[ENT_CLASSES];
+
+/* function definitions */
+void ent_window_stats(const uint8_t*, size_t, ent_window*);
+int  ent_classify(const ent_window*);
+int  ent_map_build(ent_map*, int, ll_memmap_file*, uint8_t, size_t, int);
+void ent_map_free(ent_map*);
+
+#endif /* __ENTROPY_H */
@@ -0,0 +1,131 @@
+#include "hash.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+/* bits each lane accumulator is rotated by before a stripe is added, so
+ * the hash depends on the order of the stripes */
+#define HASH_ROT  27
+
+/* per-lane keys, xored into the input before the multiply step */
+static const uint64_t lane_keys[4] = {
+  0xbe4ba423396cfeb8ULL, 0x1cad21f72c81017cULL,
+  0xdb979083e96dd4deULL, 0x1f67b3b7a4a44072ULL,
+};
+
+
+/*  _fmix64:
+ *    murmur3 finalizer, spreads every input bit over the output.
+ */
+static inline uint64_t
+_fmix64(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+
+/*  _hash_finish:
+ *    folds the four lane accumulators and the bytes that didn't fill a
+ *    whole stripe into the final hash.
+ */
+static inline uint64_t
+_hash_finish(const uint64_t acc[4], const uint8_t *tail, size_t len)
+{
+  uint64_t h;
+  size_t i;
+  int l;
+
+  h = len * 0x9e3779b97f4a7c15ULL;
+  for (l = 0; l < 4; l++)
+    h = (h ^ _fmix64(acc[l])) * 0x9fb21c651e98df25ULL;
+
+  for (i = 0; i < len % 32; i++)
+    h = (h ^ tail[i]) * 0x100000001b3ULL;
+
+  return _fmix64(h);
+}
+
+
+/*  hash_bytes64:
+ *    hashes a buffer into 64 bits. the input is consumed in 32 byte stripes
+ *    split over four independent 64-bit lanes (a 32x32->64 multiply plus the
+ *    raw word per lane), which keeps the loop free of dependencies between
+ *    lanes so it maps directly onto SIMD registers. each lane's accumulator
+ *    is rotated before a stripe is added, so moving a stripe to another
+ *    position changes the hash.
+ *
+ *    const void *data:   buffer to hash
+ *    size_t len:         length of the buffer in bytes
+ */
+uint64_t
+hash_bytes64(const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  uint64_t acc[4], w, k;
+  size_t i, stripes;
+  int l;
+
+  for (l = 0; l < 4; l++)
+    acc[l] = HASH_SEED + l;
+
+  stripes = len / 32;
+  for (i = 0; i < stripes; i++, p += 32)
+  {
+    for (l = 0; l < 4; l++)
+    {
+      memcpy(&w, p + l * 8, 8);
+      k = w ^ lane_keys[l];
+      acc[l] = (acc[l] << HASH_ROT | acc[l] >> (64 - HASH_ROT))
+               + (k & 0xffffffffULL) * (k >> 32) + w;
+    }
+  }
+
+  return _hash_finish(acc, p, len);
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*  hash_bytes64_avx2:
+ *    hash_bytes64 with the four lanes held in one AVX2 register. produces
+ *    the same hashes as the portable version.
+ */
+__attribute__((target("avx2"))) uint64_t
+hash_bytes64_avx2(const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  uint64_t acc[4];
+  size_t i, stripes;
+  __m256i vacc, vkey, w, k;
+
+  vacc = _mm256_set_epi64x(HASH_SEED + 3, HASH_SEED + 2, HASH_SEED + 1,
+                           HASH_SEED);
+  vkey = _mm256_loadu_si256((const __m256i *) lane_keys);
+
+  stripes = len / 32;
+  for (i = 0; i < stripes; i++, p += 32)
+  {
+    w = _mm256_loadu_si256((const __m256i *) p);
+    k = _mm256_xor_si256(w, vkey);
+    vacc = _mm256_or_si256(_mm256_slli_epi64(vacc, HASH_ROT),
+                           _mm256_srli_epi64(vacc, 64 - HASH_ROT));
+    vacc = _mm256_add_epi64(vacc,
+             _mm256_add_epi64(_mm256_mul_epu32(k, _mm256_srli_epi64(k, 32)),
+                              w));
+  }
+
+  _mm256_storeu_si256((__m256i *) acc, vacc);
+  return _hash_finish(acc, p, len);
+}
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef __HASH_H
+#define __HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* hashes are seeded so that a zeroed page doesn't hash to zero */
+#define HASH_SEED 0x9e3779b97f4a7c15ULL
+
+/* function definitions */
+uint64_t hash_bytes64(const void*, size_t);   /* 64-bit content hash */
+
+#if defined(__x86_64__) || defined(__i386__)
+uint64_t hash_bytes64_avx2(const void*, size_t);
+#endif
+
+#endif /* __HASH_H */
@@ -0,0 +1,853 @@
+#include "heap.h"
+#include "hostutil.h"
+#include "symbols.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define PREV_INUSE    0x1
+#define IS_MMAPPED    0x2
+#define SIZE_BITS     0x7
+#define NFASTBINS     10
+#define NBINS         128
+#define HEAP_MAX      (64 * 1024 * 1024)  /* secondary arena heap size and
+                                           * alignment on 64-bit          */
+#define MAX_ARENAS    1024
+#define WINDOW        (1024 * 1024)       /* bytes read at once by walks  */
+#define LIST_MAX      (1 << 20)           /* longest free list followed   */
+#define TCACHE_BINS   64
+
+
+/*  _heap_layout:
+ *    member offsets of struct malloc_state. glibc 2.27 added
+ *    have_fastchunks, moving everything after it by 8 bytes.
+ */
+struct _heap_layout
+{
+  size_t fastbins, top, bins, next, system_mem, size;
+};
+
+static const struct _heap_layout layouts[] = {
+  { 16, 96, 112, 2160, 2184, 2200 },      /* glibc 2.27 and later */
+  {  8, 88, 104, 2152, 2176, 2192 },      /* before 2.27          */
+};
+
+#define LAYOUTS (int) (sizeof(layouts) / sizeof(layouts[0]))
+
+
+/*  _heap_addrs:
+ *    a growing array of addresses.
+ */
+struct _heap_addrs
+{
+  uintptr_t *a;
+  size_t n, cap;
+};
+
+
+/*  _heap_job:
+ *    shared state of the parallel segment walks.
+ */
+struct _heap_job
+{
+  heap_table *t;
+  int pid;
+  struct _heap_addrs *tcache;       /* tcache candidates, one per segment */
+};
+
+
+
+static void
+_addrs_push(struct _heap_addrs *v, uintptr_t p)
+{
+  if (v->n == v->cap) {
+    v->cap = v->cap ? v->cap * 2 : 64;
+    v->a = realloc(v->a, v->cap * sizeof(uintptr_t));
+  }
+  v->a[v->n++] = p;
+}
+
+
+static int
+_cmp_addr(const void *a, const void *b)
+{
+  uintptr_t x = *(const uintptr_t *) a, y = *(const uintptr_t *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+
+static int
+_cmp_seg(const void *a, const void *b)
+{
+  const heap_segment *x = a, *y = b;
+
+  return x->start < y->start ? -1 : x->start > y->start;
+}
+
+
+static uint64_t
+_u64(const uint8_t *p)
+{
+  uint64_t v;
+
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+
+/*  _read_u64:
+ *    reads a single pointer sized value. returns -1 on failure.
+ */
+static int
+_read_u64(mem_reader *r, uintptr_t addr, uint64_t *v)
+{
+  return mem_read(r, (void *) addr, v, sizeof(*v)) == sizeof(*v) ? 0 : -1;
+}
+
+
+/*  _arena_valid:
+ *    whether a copy of memory looks like a malloc_state at addr. every
+ *    bin has to be either empty, linking to itself, or link to two
+ *    aligned chunks, and most bins of a live heap are empty.
+ */
+static int
+_arena_valid(const uint8_t *buf, uintptr_t addr, const struct _heap_layout *l)
+{
+  uint64_t fd, bk, self, top, next;
+  int i, empty = 0;
+
+  if (*(const uint32_t *) buf > 2)
+    return 0;
+
+  top = _u64(buf + l->top);
+  next = _u64(buf + l->next);
+  if (top == 0 || (top & 15) || next == 0 || (next & 7))
+    return 0;
+
+  for (i = 0; i < NBINS - 1; i++)
+  {
+    fd = _u64(buf + l->bins + i * 16);
+    bk = _u64(buf + l->bins + i * 16 + 8);
+    self = addr + l->bins + i * 16 - 16;
+
+    if ((fd == self) != (bk == self))
+      return 0;
+
+    if (fd == self)
+      empty++;
+    else if (fd == 0 || bk == 0 || (fd & 15) || (bk & 15))
+      return 0;
+  }
+
+  return empty >= 32;
+}
+
+
+/*  _arena_ring:
+ *    whether following the next pointers from addr comes back to it.
+ */
+static int
+_arena_ring(mem_reader *r, uintptr_t addr, const struct _heap_layout *l)
+{
+  uint64_t next = addr;
+  int i;
+
+  for (i = 0; i < MAX_ARENAS; i++)
+  {
+    if (_read_u64(r, next + l->next, &next) < 0 || next == 0 || (next & 7))
+      return 0;
+    if (next == addr)
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/*  _main_arena_cb:
+ *    takes the main_arena symbol if libc isn't stripped.
+ */
+static void
+_main_arena_cb(const sym_record *rec, void *arg)
+{
+  if (strcmp(rec->name, "main_arena") == 0)
+    *(uintptr_t *) arg = rec->addr;
+}
+
+
+/*  _is_libc:
+ *    whether a mapping belongs to the C library.
+ */
+static int
+_is_libc(const ll_memmap_file *mmf)
+{
+  const char *base;
+
+  if (mmf->fpath == NULL || mmf->fpath[0] != '/')
+    return 0;
+
+  base = strrchr(mmf->fpath, '/') + 1;
+  return strncmp(base, "libc.so", 7) == 0 || strncmp(base, "libc-", 5) == 0;
+}
+
+
+/*  _find_main_arena:
+ *    finds main_arena and the malloc_state layout in use. the symbol is
+ *    used if there is one, otherwise the writable data of libc, or of the
+ *    executable if it's static, is searched for a malloc_state. returns
+ *    the layout index or -1.
+ */
+static int
+_find_main_arena(mem_reader *r, ll_memmap_file *maps, uintptr_t *arena)
+{
+  ll_memmap_file *mmf, *libc = NULL;
+  uintptr_t sym = 0, lo = 0, hi = 0, a;
+  uint8_t *buf;
+  ssize_t got;
+  int l, found = -1;
+
+  sym_enumerate(maps, NULL, "main_arena", _main_arena_cb, &sym);
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+    if (_is_libc(mmf)) {
+      libc = mmf;
+      break;
+    }
+  if (libc == NULL)
+    libc = maps;
+
+  /* the module's writable mappings and the bss following them */
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    if (mmf->fpath != NULL && libc->fpath != NULL
+        && strcmp(mmf->fpath, libc->fpath) == 0 && (mmf->mode & MODE_WRITE)) {
+      if (lo == 0)
+        lo = (uintptr_t) mmf->start_addr;
+      hi = (uintptr_t) mmf->end_addr;
+    } else if (hi != 0 && (uintptr_t) mmf->start_addr == hi
+               && (mmf->fpath == NULL || mmf->fpath[0] == '\0')
+               && (mmf->mode & MODE_WRITE)) {
+      hi = (uintptr_t) mmf->end_addr;
+      break;
+    } else if (hi != 0) {
+      break;
+    }
+  }
+
+  if (sym != 0) {
+    lo = sym;
+    hi = sym + layouts[0].size;
+  }
+
+  if (hi <= lo)
+    return -1;
+
+  buf = malloc(hi - lo);
+  got = mem_read(r, (void *) lo, buf, hi - lo);
+
+  for (a = 0; got > 0 && found < 0 && a + layouts[0].size <= (size_t) got;
+       a += 8)
+    for (l = 0; l < LAYOUTS; l++)
+      if (_arena_valid(buf + a, lo + a, &layouts[l])
+          && _arena_ring(r, lo + a, &layouts[l])) {
+        *arena = lo + a;
+        found = l;
+        break;
+      }
+
+  free(buf);
+  return found;
+}
+
+
+/*  _add_segment:
+ *    adds a range to walk.
+ */
+static void
+_add_segment(heap_table *t, uintptr_t start, uintptr_t end, int arena)
+{
+  heap_segment *seg;
+
+  t->segs = realloc(t->segs, (t->nsegs + 1) * sizeof(heap_segment));
+  seg = &t->segs[t->nsegs++];
+  memset(seg, 0, sizeof(*seg));
+  seg->start = start;
+  seg->end = end;
+  seg->arena = arena;
+}
+
+
+/*  _arena_heaps:
+ *    adds the heaps of a secondary arena. every heap starts with a
+ *    heap_info linking to the one before, the first one holds the arena
+ *    itself.
+ */
+static void
+_arena_heaps(heap_table *t, mem_reader *r, int arena)
+{
+  const struct _heap_layout *l = &layouts[t->layout];
+  uintptr_t h, heaps[4096];
+  uint64_t info[3], hinfo;
+  int n = 0, i;
+
+  /* ar_ptr, prev, size */
+  for (h = t->arenas[arena].top & ~((uintptr_t) HEAP_MAX - 1);
+       h != 0 && n < 4096; h = info[1])
+  {
+    if (mem_read(r, (void *) h, info, sizeof(info)) != sizeof(info)
+        || info[0] != t->arenas[arena].addr || (info[1] & (HEAP_MAX - 1)))
+      break;
+    heaps[n++] = h;
+    if (info[1] == 0)
+      break;
+  }
+
+  if (n == 0)
+    return;
+
+  /* heap_info grew from 32 to 48 bytes in glibc 2.35, the arena follows
+   * it in the first heap */
+  hinfo = t->arenas[arena].addr - heaps[n - 1];
+  if (hinfo != 32 && hinfo != 48)
+    return;
+
+  for (i = n - 1; i >= 0; i--)
+  {
+    if (mem_read(r, (void *) heaps[i], info, sizeof(info)) != sizeof(info))
+      continue;
+
+    if (i == n - 1)
+      _add_segment(t, (t->arenas[arena].addr + l->size + 15) & ~15UL,
+                   heaps[i] + info[2], arena);
+    else
+      _add_segment(t, heaps[i] + hinfo, heaps[i] + info[2], arena);
+  }
+}
+
+
+/*  _push_chunk:
+ *    appends a chunk to a segment's table.
+ */
+static void
+_push_chunk(heap_segment *seg, uint64_t size, int inuse)
+{
+  if (seg->count == seg->cap) {
+    seg->cap = seg->cap ? seg->cap * 2 : 4096;
+    seg->chunks = realloc(seg->chunks, seg->cap * sizeof(uint32_t));
+  }
+  seg->chunks[seg->count++] = (uint32_t) (size >> 4 << 1) | (inuse != 0);
+}
+
+
+/*  _walk:
+ *    walks the chunks of a segment from its first chunk, reading a window
+ *    at a time. a chunk is in use if the next one has PREV_INUSE set, the
+ *    walk stops at the arena's top chunk or at the first header that
+ *    can't be right. mmap'd chunks are all in use and their headers are
+ *    read on their own since they're at least a page apart.
+ */
+static void
+_walk(heap_segment *seg, mem_reader *r, heap_arena *arena,
+      struct _heap_addrs *tcache)
+{
+  uint8_t *buf;
+  uintptr_t p, lo = 0, hi = 0, prev = 0;
+  uint64_t size, prev_size = 0;
+  size_t want;
+  ssize_t got;
+  int mmapped = seg->arena < 0;
+
+  buf = malloc(WINDOW);
+
+  for (p = seg->start; p + 16 <= seg->end; p += size)
+  {
+    if (p < lo || p + 16 > hi) {
+      want = mmapped ? 16 : seg->end - p < WINDOW ? seg->end - p : WINDOW;
+      got = mem_read(r, (void *) p, buf, want);
+      if (got < 16)
+        break;
+      lo = p;
+      hi = p + got;
+    }
+
+    size = _u64(buf + (p - lo) + 8);
+
+    if (prev != 0) {
+      _push_chunk(seg, prev_size, mmapped || (size & PREV_INUSE));
+
+      /* in use chunks of tcache_perthread_struct size may be tcaches */
+      if ((size & PREV_INUSE) && (prev_size == 0x290 || prev_size == 0x250))
+        _addrs_push(tcache, prev);
+      prev = 0;
+    }
+
+    if (arena != NULL && p == arena->top) {
+      arena->top_size = size & ~(uint64_t) SIZE_BITS;
+      break;
+    }
+
+    if (mmapped && !(size & IS_MMAPPED))
+      break;
+
+    size &= ~(uint64_t) SIZE_BITS;
+    if (size < 16 || (size & 15) || size > seg->end - p
+        || (size >> 4) >= (1ULL << 31))
+      break;
+
+    prev = p;
+    prev_size = size;
+  }
+
+  /* nothing follows the last chunk to tell, it's counted as used */
+  if (prev != 0)
+    _push_chunk(seg, prev_size, 1);
+
+  seg->end = prev != 0 ? prev + prev_size : p;
+  free(buf);
+}
+
+
+/*  _walk_worker:
+ *    walks one segment with its own reader.
+ */
+static void
+_walk_worker(int item, int worker, void *arg)
+{
+  struct _heap_job *job = arg;
+  heap_segment *seg = &job->t->segs[item];
+  mem_reader r;
+
+  (void) worker;
+
+  mem_reader_init(&r, job->pid, MEM_BACKEND_VM_READV);
+  _walk(seg, &r, seg->arena >= 0 ? &job->t->arenas[seg->arena] : NULL,
+        &job->tcache[item]);
+  mem_reader_close(&r);
+}
+
+
+/*  _in_heap:
+ *    whether p could be a chunk of an arena. segments are sorted.
+ */
+static int
+_in_heap(const heap_table *t, uint64_t p)
+{
+  int lo = 0, hi = t->nsegs, mid;
+
+  if (p == 0 || (p & 15))
+    return 0;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (t->segs[mid].end <= p)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo < t->nsegs && p >= t->segs[lo].start && t->segs[lo].arena >= 0;
+}
+
+
+/*  _next_link:
+ *    follows a singly linked free list pointer stored at slot. since glibc
+ *    2.32 they're mangled with the slot address, the plain value is tried
+ *    first. returns 0 at the end of the list or if neither makes sense.
+ */
+static uint64_t
+_next_link(const heap_table *t, mem_reader *r, uint64_t slot)
+{
+  uint64_t v;
+
+  if (_read_u64(r, slot, &v) < 0 || v == 0)
+    return 0;
+
+  if (_in_heap(t, v))
+    return v;
+
+  v ^= slot >> 12;
+  return _in_heap(t, v) ? v : 0;
+}
+
+
+/*  _fastbins:
+ *    collects the chunks in the fastbins of every arena. they keep looking
+ *    in use to the chunk walk.
+ */
+static void
+_fastbins(const heap_table *t, mem_reader *r, struct _heap_addrs *free_set)
+{
+  const struct _heap_layout *l = &layouts[t->layout];
+  uint64_t heads[NFASTBINS], p;
+  int a, i, n;
+
+  for (a = 0; a < t->narenas; a++)
+  {
+    if (mem_read(r, (void *) (t->arenas[a].addr + l->fastbins), heads,
+                 sizeof(heads)) != sizeof(heads))
+      continue;
+
+    for (i = 0; i < NFASTBINS; i++)
+      for (p = heads[i], n = 0; _in_heap(t, p) && n < LIST_MAX; n++)
+      {
+        _addrs_push(free_set, p);
+        p = _next_link(t, r, p + 16);
+      }
+  }
+}
+
+
+/*  _tcaches:
+ *    collects the chunks in every thread's tcache. tcaches are found among
+ *    the in use chunks of the right size: every bin with entries must
+ *    have a count and every empty bin none. counts are 16-bit since glibc
+ *    2.30 and 8-bit before, which also changed the struct's size.
+ */
+static void
+_tcaches(const heap_table *t, mem_reader *r, const struct _heap_addrs *cands,
+         struct _heap_addrs *free_set)
+{
+  uint8_t buf[0x290];
+  const uint8_t *entries;
+  uint64_t e, size;
+  size_t c;
+  unsigned count;
+  int i, k, wide, ok;
+
+  for (c = 0; c < cands->n; c++)
+  {
+    if (_read_u64(r, cands->a[c] + 8, &size) < 0)
+      continue;
+
+    wide = (size & ~(uint64_t) SIZE_BITS) == 0x290;
+    if (mem_read(r, (void *) (cands->a[c] + 16), buf, wide ? 0x280 : 0x240)
+        <= 0)
+      continue;
+
+    entries = buf + (wide ? 2 : 1) * TCACHE_BINS;
+
+    for (i = 0, ok = 1; i < TCACHE_BINS && ok; i++)
+    {
+      count = wide ? ((const uint16_t *) buf)[i] : buf[i];
+      e = _u64(entries + i * 8);
+      ok = (count == 0) == (e == 0) && (e == 0 || _in_heap(t, e - 16));
+    }
+    if (!ok)
+      continue;
+
+    for (i = 0; i < TCACHE_BINS; i++)
+    {
+      count = wide ? ((const uint16_t *) buf)[i] : buf[i];
+      e = _u64(entries + i * 8);
+
+      /* entries point at the user data, 16 bytes into the chunk */
+      for (k = 0; k < (int) count && e != 0 && _in_heap(t, e - 16); k++)
+      {
+        _addrs_push(free_set, e - 16);
+        e = _next_link(t, r, e);
+      }
+    }
+  }
+}
+
+
+/*  _mark_free:
+ *    clears the in use bit of every chunk in the sorted free set.
+ */
+static void
+_mark_free(heap_table *t, const struct _heap_addrs *free_set)
+{
+  heap_segment *seg;
+  uintptr_t addr;
+  size_t i, j = 0;
+  int s;
+
+  for (s = 0; s < t->nsegs; s++)
+  {
+    seg = &t->segs[s];
+    if (seg->arena < 0)
+      continue;
+
+    while (j < free_set->n && free_set->a[j] < seg->start)
+      j++;
+
+    for (i = 0, addr = seg->start; i < seg->count && j < free_set->n; i++)
+    {
+      while (j < free_set->n && free_set->a[j] < addr)
+        j++;
+      if (j < free_set->n && free_set->a[j] == addr)
+        seg->chunks[i] &= ~1u;
+
+      addr += (uintptr_t) (seg->chunks[i] >> 1) << 4;
+    }
+  }
+}
+
+
+/*  _mmapped:
+ *    adds every anonymous writable mapping outside the arenas as a
+ *    segment of mmap'd chunks. mappings not starting with an mmap'd chunk
+ *    header end up empty and are dropped after the walk.
+ */
+static void
+_mmapped(heap_table *t, ll_memmap_file *maps)
+{
+  ll_memmap_file *mmf;
+  uintptr_t start;
+  int i, nsegs = t->nsegs;
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    if ((mmf->mode & (MODE_READ | MODE_WRITE)) != (MODE_READ | MODE_WRITE)
+        || (mmf->fpath != NULL && mmf->fpath[0] != '\0'))
+      continue;
+
+    start = (uintptr_t) mmf->start_addr;
+    for (i = 0; i < nsegs; i++)
+      if (start <= t->segs[i].start && t->segs[i].start
+          < (uintptr_t) mmf->end_addr)
+        break;
+
+    if (i == nsegs)
+      _add_segment(t, start, (uintptr_t) mmf->end_addr, -1);
+  }
+}
+
+
+/*  heap_walk:
+ *    finds the glibc malloc arenas of a process and walks all their
+ *    chunks into a table, one segment per worker thread. chunks sitting in
+ *    fastbins and tcaches are marked free. returns the amount of chunks,
+ *    or -1 if no glibc heap was found.
+ *
+ *    heap_table *t:          receives the table, free with heap_table_free
+ *    int pid:                process to walk
+ *    ll_memmap_file *maps:   its maps
+ *    int nthreads:           worker threads, 0 for one per cpu
+ */
+int
+heap_walk(heap_table *t, int pid, ll_memmap_file *maps, int nthreads)
+{
+  const struct _heap_layout *l;
+  struct _heap_job job;
+  struct _heap_addrs free_set, cands;
+  ll_memmap_file *mmf;
+  mem_reader r;
+  uint8_t buf[2200];
+  uintptr_t addr;
+  size_t total = 0;
+  int i, n;
+
+  memset(t, 0, sizeof(heap_table));
+  memset(&free_set, 0, sizeof(free_set));
+  memset(&cands, 0, sizeof(cands));
+  mem_reader_init(&r, pid, MEM_BACKEND_VM_READV);
+
+  t->layout = _find_main_arena(&r, maps, &addr);
+  if (t->layout < 0) {
+    mem_reader_close(&r);
+    return -1;
+  }
+  l = &layouts[t->layout];
+
+  /* every arena, main_arena first */
+  do {
+    if (mem_read(&r, (void *) addr, buf, l->size) != (ssize_t) l->size)
+      break;
+
+    t->arenas = realloc(t->arenas, (t->narenas + 1) * sizeof(heap_arena));
+    t->arenas[t->narenas].addr = addr;
+    t->arenas[t->narenas].top = _u64(buf + l->top);
+    t->arenas[t->narenas].top_size = 0;
+    t->arenas[t->narenas].system_mem = _u64(buf + l->system_mem);
+    t->narenas++;
+
+    addr = _u64(buf + l->next);
+  } while (addr != t->arenas[0].addr && t->narenas < MAX_ARENAS);
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+    if (mmf->fpath != NULL && strcmp(mmf->fpath, "[heap]") == 0)
+      _add_segment(t, (uintptr_t) mmf->start_addr,
+                   (uintptr_t) mmf->end_addr, 0);
+
+  for (i = 1; i < t->narenas; i++)
+    _arena_heaps(t, &r, i);
+
+  _mmapped(t, maps);
+
+  job.t = t;
+  job.pid = pid;
+  job.tcache = calloc(t->nsegs ? t->nsegs : 1, sizeof(struct _heap_addrs));
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+  parallel_for(t->nsegs, nthreads, _walk_worker, &job);
+
+  /* drop what turned out not to hold chunks */
+  for (i = 0, n = 0; i < t->nsegs; i++)
+  {
+    if (job.tcache[i].n)
+      for (total = 0; total < job.tcache[i].n; total++)
+        _addrs_push(&cands, job.tcache[i].a[total]);
+    free(job.tcache[i].a);
+
+    if (t->segs[i].count == 0) {
+      free(t->segs[i].chunks);
+      continue;
+    }
+    t->segs[n++] = t->segs[i];
+  }
+  t->nsegs = n;
+  free(job.tcache);
+
+  qsort(t->segs, t->nsegs, sizeof(heap_segment), _cmp_seg);
+
+  _fastbins(t, &r, &free_set);
+  _tcaches(t, &r, &cands, &free_set);
+  qsort(free_set.a, free_set.n, sizeof(uintptr_t), _cmp_addr);
+  _mark_free(t, &free_set);
+
+  free(free_set.a);
+  free(cands.a);
+  mem_reader_close(&r);
+
+  for (i = 0, total = 0; i < t->nsegs; i++)
+    total += t->segs[i].count;
+  return (int) (total > 0x7fffffff ? 0x7fffffff : total);
+}
+
+
+/*  heap_table_free:
+ *    frees a table filled by heap_walk.
+ */
+void
+heap_table_free(heap_table *t)
+{
+  int i;
+
+  for (i = 0; i < t->nsegs; i++)
+    free(t->segs[i].chunks);
+
+  free(t->segs);
+  free(t->arenas);
+  memset(t, 0, sizeof(heap_table));
+}
+
+
+/*  heap_summarize:
+ *    totals, size histograms and fragmentation of a table.
+ */
+void
+heap_summarize(const heap_table *t, heap_summary *sum)
+{
+  const heap_segment *seg;
+  uint64_t size;
+  size_t i;
+  int s, b, used;
+
+  memset(sum, 0, sizeof(heap_summary));
+
+  for (s = 0; s < t->nsegs; s++)
+  {
+    seg = &t->segs[s];
+
+    for (i = 0; i < seg->count; i++)
+    {
+      size = (uint64_t) (seg->chunks[i] >> 1) << 4;
+      used = seg->chunks[i] & 1;
+
+      b = 63 - __builtin_clzll(size) - 4;
+      if (b >= HEAP_BUCKETS)
+        b = HEAP_BUCKETS - 1;
+
+      sum->count[!used][b]++;
+      sum->bytes[!used][b] += size;
+
+      if (used) {
+        sum->used_count++;
+        sum->used_bytes += size;
+      } else {
+        sum->free_count++;
+        sum->free_bytes += size;
+        if (size > sum->largest_free)
+          sum->largest_free = size;
+      }
+    }
+  }
+
+  for (s = 0; s < t->narenas; s++)
+    sum->top_bytes += t->arenas[s].top_size;
+
+  if (sum->free_bytes)
+    sum->fragmentation = 1.0 - (double) sum->largest_free / sum->free_bytes;
+}
+
+
+/*  heap_largest:
+ *    finds the n largest chunks in use, largest first. returns how many
+ *    were found.
+ *
+ *    const heap_table *t:  walked table
+ *    heap_chunk *out:      receives up to n chunks
+ *    size_t n:             how many to find
+ */
+size_t
+heap_largest(const heap_table *t, heap_chunk *out, size_t n)
+{
+  const heap_segment *seg;
+  heap_chunk c, tmp;
+  uintptr_t addr;
+  size_t i, k, found = 0, j, child;
+  int s;
+
+  if (n == 0)
+    return 0;
+
+  /* min-heap on size of the largest seen so far */
+  for (s = 0; s < t->nsegs; s++)
+  {
+    seg = &t->segs[s];
+
+    for (i = 0, addr = seg->start; i < seg->count; i++)
+    {
+      c.addr = addr;
+      c.size = (size_t) (seg->chunks[i] >> 1) << 4;
+      addr += c.size;
+
+      if (!(seg->chunks[i] & 1) || (found == n && c.size <= out[0].size))
+        continue;
+
+      if (found < n) {
+        for (k = found++; k > 0 && out[(k - 1) / 2].size > c.size;
+             k = (k - 1) / 2)
+          out[k] = out[(k - 1) / 2];
+        out[k] = c;
+        continue;
+      }
+
+      for (k = 0; (child = 2 * k + 1) < n; k = child)
+      {
+        if (child + 1 < n && out[child + 1].size < out[child].size)
+          child++;
+        if (out[child].size >= c.size)
+          break;
+        out[k] = out[child];
+      }
+      out[k] = c;
+    }
+  }
+
+  /* largest first */
+  for (i = 0; i < found; i++)
+    for (j = i + 1; j < found; j++)
+      if (out[j].size > out[i].size) {
+        tmp = out[i];
+        out[i] = out[j];
+        out[j] = tmp;
+      }
+
+  return found;
+}
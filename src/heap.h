@@ -0,0 +1,86 @@
+#ifndef __HEAP_H
+#define __HEAP_H
+
+#include "mem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* histogram buckets, bucket i holds chunks of 2^(i+4) up to 2^(i+5) bytes */
+#define HEAP_BUCKETS 40
+
+
+/*  _heap_arena:
+ *    a glibc malloc arena, main_arena first.
+ */
+typedef struct _heap_arena
+{
+  uintptr_t addr;                   /* struct malloc_state in the process */
+  uintptr_t top;                    /* top chunk, never handed out */
+  size_t top_size;
+  size_t system_mem;                /* bytes the arena got from the kernel */
+} heap_arena;
+
+
+/*  _heap_segment:
+ *    a contiguous run of chunks: the brk heap, one heap of a secondary
+ *    arena or mmap'd chunks. chunks are stored as size / 16 << 1 | in use,
+ *    their addresses follow from start and the sizes before them, so the
+ *    table takes 4 bytes per chunk.
+ */
+typedef struct _heap_segment
+{
+  uintptr_t start, end;             /* first chunk, end of the walked range */
+  int arena;                        /* index into arenas, -1 for mmap'd */
+  uint32_t *chunks;
+  size_t count, cap;
+} heap_segment;
+
+
+/*  _heap_table:
+ *    every chunk of every arena of a process.
+ */
+typedef struct _heap_table
+{
+  heap_arena *arenas;
+  int narenas;
+  heap_segment *segs;
+  int nsegs;
+  int layout;                       /* malloc_state layout, see heap.c */
+} heap_table;
+
+
+/*  _heap_chunk:
+ *    a single chunk, size includes the chunk header.
+ */
+typedef struct _heap_chunk
+{
+  uintptr_t addr;
+  size_t size;
+} heap_chunk;
+
+
+/*  _heap_summary:
+ *    totals of a heap table. the top chunks are left out of the free bytes
+ *    since they were never handed out. fragmentation is the share of free
+ *    bytes outside the largest free chunk.
+ */
+typedef struct _heap_summary
+{
+  uint64_t used_count, used_bytes;
+  uint64_t free_count, free_bytes;
+  uint64_t largest_free;
+  uint64_t top_bytes;
+  double fragmentation;
+  uint64_t count[2][HEAP_BUCKETS];  /* [0] used, [1] free */
+  uint64_t bytes[2][HEAP_BUCKETS];
+} heap_summary;
+
+
+/* function definitions */
+int    heap_walk(heap_table*, int, ll_memmap_file*, int);
+void   heap_table_free(heap_table*);
+void   heap_summarize(const heap_table*, heap_summary*);
+size_t heap_largest(const heap_table*, heap_chunk*, size_t);
+
+#endif /* __HEAP_H */
@@ -0,0 +1,605 @@
+#include "history.h"
+#include "hostutil.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define BLOCK_SHIFT   8                       /* 256 pages per block  */
+#define BLOCK_PAGES   (1 << BLOCK_SHIFT)
+#define BATCH_PAGES   256                     /* pages per batched read */
+#define INDEX_EMPTY   UINT32_MAX
+
+#define PAGE_DOWN(a)  ((a) & ~((uintptr_t) HIST_PAGE_SIZE - 1))
+#define PAGE_UP(a)    PAGE_DOWN((a) + HIST_PAGE_SIZE - 1)
+
+
+/*  _pending_change:
+ *    accumulates adjacent changes of the same kind so the callback is called
+ *    once per contiguous range instead of once per differing byte run.
+ */
+struct _pending_change
+{
+  uintptr_t addr;
+  size_t len;
+  int kind;
+  hist_diff_cb cb;
+  void *arg;
+};
+
+
+
+/*  history_open:
+ *    creates an empty history. if spill_path is given, page data is appended
+ *    to that file instead of being kept in memory. returns NULL on failure.
+ *
+ *    const char *spill_path:   file to store page data in, or NULL
+ */
+history*
+history_open(const char *spill_path)
+{
+  history *h;
+
+  h = calloc(1, sizeof(history));
+  if (h == NULL)
+    return NULL;
+
+  h->spill_fd = -1;
+  if (spill_path) {
+    h->spill_fd = open(spill_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+                       0600);
+    if (h->spill_fd < 0) {
+      free(h);
+      return NULL;
+    }
+  }
+
+  /* one batch of read pages plus two pages for comparing spilled data */
+  h->scratch = malloc((BATCH_PAGES + 2) * HIST_PAGE_SIZE);
+
+  h->index_mask = 4095;
+  h->index = malloc((h->index_mask + 1) * sizeof(uint32_t));
+  memset(h->index, 0xff, (h->index_mask + 1) * sizeof(uint32_t));
+
+  return h;
+}
+
+
+/*  history_close:
+ *    frees all snapshots and the page store.
+ *
+ *    history *h:   history to free
+ */
+void
+history_close(history *h)
+{
+  int i, r;
+
+  for (i = 0; i < h->nsnaps; i++)
+  {
+    for (r = 0; r < h->snaps[i].nregions; r++)
+    {
+      free(h->snaps[i].regions[r].pages);
+      free(h->snaps[i].regions[r].changed);
+      free(h->snaps[i].regions[r].ids);
+    }
+    free(h->snaps[i].regions);
+  }
+
+  for (r = 0; h->nsnaps > 0 && r < h->snaps[h->nsnaps-1].nregions; r++)
+    free(h->last[r]);
+  free(h->last);
+
+  if (h->blocks) {
+    for (i = 0; i < (int) ((h->cap_pages + BLOCK_PAGES - 1) >> BLOCK_SHIFT); i++)
+      free(h->blocks[i]);
+    free(h->blocks);
+  }
+
+  if (h->spill_fd >= 0)
+    close(h->spill_fd);
+
+  free(h->snaps);
+  free(h->hashes);
+  free(h->index);
+  free(h->scratch);
+  free(h);
+}
+
+
+/*  _page_data:
+ *    returns a pointer to the stored bytes of a page. spilled pages are read
+ *    into buf, which must hold HIST_PAGE_SIZE bytes.
+ */
+static const uint8_t *
+_page_data(history *h, uint32_t id, uint8_t *buf)
+{
+  if (h->spill_fd < 0)
+    return h->blocks[id >> BLOCK_SHIFT]
+         + (size_t) (id & (BLOCK_PAGES - 1)) * HIST_PAGE_SIZE;
+
+  if (pread(h->spill_fd, buf, HIST_PAGE_SIZE,
+            (off_t) id * HIST_PAGE_SIZE) != HIST_PAGE_SIZE)
+    memset(buf, 0, HIST_PAGE_SIZE);
+
+  return buf;
+}
+
+
+/*  _index_grow:
+ *    doubles the hash index and reinserts every stored page.
+ */
+static void
+_index_grow(history *h)
+{
+  uint32_t id;
+  size_t slot;
+
+  free(h->index);
+  h->index_mask = h->index_mask * 2 + 1;
+  h->index = malloc((h->index_mask + 1) * sizeof(uint32_t));
+  memset(h->index, 0xff, (h->index_mask + 1) * sizeof(uint32_t));
+
+  for (id = 0; id < h->npages; id++)
+  {
+    slot = h->hashes[id] & h->index_mask;
+    while (h->index[slot] != INDEX_EMPTY)
+      slot = (slot + 1) & h->index_mask;
+    h->index[slot] = id;
+  }
+}
+
+
+/*  _same_page:
+ *    whether a stored page holds exactly the given bytes. spilled pages are
+ *    read back into the compare buffer behind the read batch.
+ */
+static int
+_same_page(history *h, uint32_t id, const uint8_t *data)
+{
+  uint8_t *buf = h->scratch + (size_t) BATCH_PAGES * HIST_PAGE_SIZE;
+
+  return memcmp(_page_data(h, id, buf), data, HIST_PAGE_SIZE) == 0;
+}
+
+
+/*  _store_page:
+ *    returns the id of a page with the given contents and hash, storing it
+ *    first if no identical page is stored yet. hash matches are confirmed
+ *    with a full compare, spilled pages are read back for it.
+ */
+static uint32_t
+_store_page(history *h, const uint8_t *data, uint64_t hash)
+{
+  uint32_t id;
+  size_t slot;
+
+  slot = hash & h->index_mask;
+  while ((id = h->index[slot]) != INDEX_EMPTY)
+  {
+    if (h->hashes[id] == hash && _same_page(h, id, data))
+      return id;
+
+    slot = (slot + 1) & h->index_mask;
+  }
+
+  /* new page, make room for it in the store */
+  if (h->npages == h->cap_pages) {
+    h->cap_pages += BLOCK_PAGES;
+    h->hashes = realloc(h->hashes, h->cap_pages * sizeof(uint64_t));
+
+    if (h->spill_fd < 0) {
+      h->blocks = realloc(h->blocks,
+                          (h->cap_pages >> BLOCK_SHIFT) * sizeof(uint8_t *));
+      h->blocks[(h->cap_pages >> BLOCK_SHIFT) - 1] =
+        malloc((size_t) BLOCK_PAGES * HIST_PAGE_SIZE);
+    }
+  }
+
+  id = h->npages++;
+  h->hashes[id] = hash;
+
+  if (h->spill_fd < 0)
+    memcpy((uint8_t *) _page_data(h, id, NULL), data, HIST_PAGE_SIZE);
+  else if (pwrite(h->spill_fd, data, HIST_PAGE_SIZE,
+                  (off_t) id * HIST_PAGE_SIZE) != HIST_PAGE_SIZE)
+    die(1, "history: failed to write to the spill file");
+
+  h->index[slot] = id;
+
+  /* keep the index at most half full */
+  if (h->npages * 2 > h->index_mask)
+    _index_grow(h);
+
+  return id;
+}
+
+
+/*  _region_cmp:
+ *    qsort comparator ordering regions by start address.
+ */
+static int
+_region_cmp(const void *a, const void *b)
+{
+  const hist_region *ra = a, *rb = b;
+
+  return (ra->start > rb->start) - (ra->start < rb->start);
+}
+
+
+/*  _snapshot_region:
+ *    returns the region of a snapshot covering addr, or NULL.
+ */
+static const hist_region *
+_snapshot_region(const hist_snapshot *s, uintptr_t addr)
+{
+  int lo = 0, hi = s->nregions - 1, mid;
+  const hist_region *reg;
+
+  while (lo <= hi)
+  {
+    mid = (lo + hi) / 2;
+    reg = &s->regions[mid];
+
+    if (addr < reg->start)
+      hi = mid - 1;
+    else if (addr >= reg->start + reg->npages * HIST_PAGE_SIZE)
+      lo = mid + 1;
+    else
+      return reg;
+  }
+
+  return NULL;
+}
+
+
+/*  _read_region:
+ *    reads every page of a region into ids. a page with the hash and bytes
+ *    the previous snapshot had there keeps its id without a store lookup.
+ */
+static void
+_read_region(history *h, mem_reader *r, const hist_region *reg,
+             const uint32_t *prev, uint32_t *ids)
+{
+  int p, cnt;
+  size_t done;
+  uint64_t hash;
+  mem_readreq reqs[BATCH_PAGES];
+
+  /* read the region in batches of single page requests, so a fault only
+   * costs the page it happened on */
+  for (done = 0; done < reg->npages; done += cnt)
+  {
+    cnt = reg->npages - done < BATCH_PAGES ? reg->npages - done : BATCH_PAGES;
+
+    for (p = 0; p < cnt; p++)
+    {
+      reqs[p].addr = (void *) (reg->start + (done + p) * HIST_PAGE_SIZE);
+      reqs[p].buf  = h->scratch + (size_t) p * HIST_PAGE_SIZE;
+      reqs[p].len  = HIST_PAGE_SIZE;
+    }
+
+    mem_read_batch(r, reqs, cnt);
+
+    for (p = 0; p < cnt; p++)
+    {
+      ids[done+p] = HIST_PAGE_NONE;
+      if (reqs[p].nread != HIST_PAGE_SIZE)
+        continue;
+
+      hash = hostk.hash(reqs[p].buf, HIST_PAGE_SIZE);
+      if (prev != NULL && prev[done+p] != HIST_PAGE_NONE
+          && h->hashes[prev[done+p]] == hash
+          && _same_page(h, prev[done+p], reqs[p].buf))
+        ids[done+p] = prev[done+p];
+      else
+        ids[done+p] = _store_page(h, reqs[p].buf, hash);
+    }
+  }
+}
+
+
+/*  history_snapshot:
+ *    reads every page of the given ranges and appends a new snapshot.
+ *    unreadable pages are recorded as HIST_PAGE_NONE. a region that was
+ *    snapshotted before only keeps the pages that changed since, every
+ *    HIST_KEYFRAME snapshots all are kept so lookups stay short. returns
+ *    the index of the new snapshot.
+ *
+ *    history *h:               history to append to
+ *    mem_reader *r:            reader for the target process
+ *    const mem_range *ranges:  ranges to snapshot
+ *    int n:                    number of entries in ranges
+ */
+int
+history_snapshot(history *h, mem_reader *r, const mem_range *ranges, int n)
+{
+  int i, j;
+  size_t p, k;
+  hist_snapshot *s, *prev = NULL;
+  hist_region *reg;
+  const hist_region *old;
+  uint32_t **cur;
+
+  if (h->nsnaps == h->cap_snaps) {
+    h->cap_snaps = h->cap_snaps ? h->cap_snaps * 2 : 16;
+    h->snaps = realloc(h->snaps, h->cap_snaps * sizeof(hist_snapshot));
+  }
+
+  if (h->nsnaps > 0)
+    prev = &h->snaps[h->nsnaps - 1];
+
+  s = &h->snaps[h->nsnaps];
+  clock_gettime(CLOCK_REALTIME, &s->taken);
+  s->nregions = n;
+  s->regions = calloc(n, sizeof(hist_region));
+  cur = calloc(n ? n : 1, sizeof(uint32_t *));
+
+  for (i = 0; i < n; i++)
+  {
+    reg = &s->regions[i];
+    reg->start = PAGE_DOWN((uintptr_t) ranges[i].start);
+    reg->npages = (PAGE_UP((uintptr_t) ranges[i].end) - reg->start)
+                / HIST_PAGE_SIZE;
+  }
+  qsort(s->regions, n, sizeof(hist_region), _region_cmp);
+
+  for (i = 0; i < n; i++)
+  {
+    reg = &s->regions[i];
+    cur[i] = malloc((reg->npages ? reg->npages : 1) * sizeof(uint32_t));
+
+    /* the same range in the previous snapshot */
+    reg->base = -1;
+    old = prev ? _snapshot_region(prev, reg->start) : NULL;
+    if (old != NULL && old->start == reg->start
+        && old->npages == reg->npages)
+      reg->base = old - prev->regions;
+
+    _read_region(h, r, reg, reg->base >= 0 ? h->last[reg->base] : NULL,
+                 cur[i]);
+    h->logical_pages += reg->npages;
+
+    if (reg->base < 0 || h->nsnaps % HIST_KEYFRAME == 0) {
+      reg->base = -1;
+      reg->pages = malloc((reg->npages ? reg->npages : 1)
+                          * sizeof(uint32_t));
+      memcpy(reg->pages, cur[i], reg->npages * sizeof(uint32_t));
+      continue;
+    }
+
+    for (p = 0; p < reg->npages; p++)
+      reg->nchanged += cur[i][p] != h->last[reg->base][p];
+
+    reg->changed = malloc((reg->nchanged + 1) * sizeof(uint32_t));
+    reg->ids = malloc((reg->nchanged + 1) * sizeof(uint32_t));
+    for (p = 0, k = 0; p < reg->npages; p++)
+      if (cur[i][p] != h->last[reg->base][p]) {
+        reg->changed[k] = p;
+        reg->ids[k++] = cur[i][p];
+      }
+  }
+
+  for (j = 0; prev != NULL && j < prev->nregions; j++)
+    free(h->last[j]);
+  free(h->last);
+  h->last = cur;
+
+  return h->nsnaps++;
+}
+
+
+/*  history_record:
+ *    takes count snapshots, interval_ms milliseconds apart, or until *stop is
+ *    set. a count of 0 records until stopped. returns the amount of
+ *    snapshots taken.
+ */
+int
+history_record(history *h, mem_reader *r, const mem_range *ranges, int n,
+               unsigned int interval_ms, int count, volatile int *stop)
+{
+  int taken = 0;
+  struct timespec ts;
+
+  ts.tv_sec = interval_ms / 1000;
+  ts.tv_nsec = (interval_ms % 1000) * 1000000L;
+
+  while ((count == 0 || taken < count) && !(stop && *stop))
+  {
+    if (taken > 0)
+      nanosleep(&ts, NULL);
+
+    history_snapshot(h, r, ranges, n);
+    taken++;
+  }
+
+  return taken;
+}
+
+
+/*  _snapshot_page:
+ *    returns the page id stored for addr in a snapshot, or HIST_PAGE_NONE if
+ *    the address isn't covered.
+ */
+static uint32_t
+_snapshot_page(const hist_snapshot *s, uint32_t **pages, uintptr_t addr)
+{
+  const hist_region *reg = _snapshot_region(s, addr);
+
+  if (reg == NULL)
+    return HIST_PAGE_NONE;
+
+  return pages[reg - s->regions][(addr - reg->start) / HIST_PAGE_SIZE];
+}
+
+
+/*  _region_pages:
+ *    the page ids of every page of a region, from the last full copy of
+ *    it and the changes of every snapshot since.
+ */
+static void
+_region_pages(const history *h, int snap, int i, uint32_t *out)
+{
+  const hist_region *reg = &h->snaps[snap].regions[i];
+  size_t k;
+
+  if (reg->base < 0) {
+    memcpy(out, reg->pages, reg->npages * sizeof(uint32_t));
+    return;
+  }
+
+  _region_pages(h, snap - 1, reg->base, out);
+  for (k = 0; k < reg->nchanged; k++)
+    out[reg->changed[k]] = reg->ids[k];
+}
+
+
+/*  _materialize:
+ *    the page ids of every region of a snapshot, free with _release.
+ */
+static uint32_t **
+_materialize(const history *h, int snap)
+{
+  const hist_snapshot *s = &h->snaps[snap];
+  uint32_t **pages;
+  int i;
+
+  pages = calloc(s->nregions ? s->nregions : 1, sizeof(uint32_t *));
+  for (i = 0; i < s->nregions; i++)
+  {
+    pages[i] = malloc((s->regions[i].npages + 1) * sizeof(uint32_t));
+    _region_pages(h, snap, i, pages[i]);
+  }
+
+  return pages;
+}
+
+
+static void
+_release(uint32_t **pages, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    free(pages[i]);
+  free(pages);
+}
+
+
+/*  _emit:
+ *    adds a change to the pending range, flushing it to the callback when
+ *    the new change isn't adjacent or of another kind. a len of 0 flushes.
+ */
+static void
+_emit(struct _pending_change *pc, uintptr_t addr, size_t len, int kind)
+{
+  if (pc->len && len && pc->kind == kind && pc->addr + pc->len == addr) {
+    pc->len += len;
+    return;
+  }
+
+  if (pc->len)
+    pc->cb(pc->addr, pc->len, pc->kind, pc->arg);
+
+  pc->addr = addr;
+  pc->len = len;
+  pc->kind = kind;
+}
+
+
+/*  _diff_page:
+ *    compares two page images and emits every run of differing bytes. equal
+ *    stretches are skipped with the dispatched mismatch kernel, so only the
+ *    changed bytes themselves are looked at one by one.
+ */
+static void
+_diff_page(struct _pending_change *pc, uintptr_t addr,
+           const uint8_t *a, const uint8_t *b)
+{
+  size_t i = 0, run;
+
+  while ((i += hostk.mismatch(a + i, b + i, HIST_PAGE_SIZE - i))
+         < HIST_PAGE_SIZE)
+  {
+    for (run = 1; i + run < HIST_PAGE_SIZE && a[i+run] != b[i+run]; run++);
+
+    _emit(pc, addr + i, run, HIST_CHANGED);
+    i += run;
+  }
+}
+
+
+/*  history_diff:
+ *    reports what changed between snapshots `from` and `to`. pages with equal
+ *    ids are skipped without touching their data, only pages whose contents
+ *    differ are compared byte-wise. returns -1 for invalid snapshots.
+ *
+ *    history *h:     history containing both snapshots
+ *    int from:       index of the earlier snapshot
+ *    int to:         index of the later snapshot
+ *    hist_diff_cb cb:  called with (address, length, hist_change, arg)
+ *    void *arg:      passed through to cb
+ */
+int
+history_diff(history *h, int from, int to, hist_diff_cb cb, void *arg)
+{
+  int i;
+  size_t p;
+  uintptr_t addr;
+  uint32_t ida, idb, **pa, **pb;
+  const hist_snapshot *sa, *sb;
+  const hist_region *reg;
+  uint8_t *bufa = h->scratch, *bufb = h->scratch + HIST_PAGE_SIZE;
+  struct _pending_change pc = { 0, 0, 0, cb, arg };
+
+  if (from < 0 || to < 0 || from >= h->nsnaps || to >= h->nsnaps)
+    return -1;
+
+  sa = &h->snaps[from];
+  sb = &h->snaps[to];
+  pa = _materialize(h, from);
+  pb = _materialize(h, to);
+
+  /* pages readable in the later snapshot */
+  for (i = 0; i < sb->nregions; i++)
+  {
+    reg = &sb->regions[i];
+    for (p = 0; p < reg->npages; p++)
+    {
+      idb = pb[i][p];
+      addr = reg->start + p * HIST_PAGE_SIZE;
+      ida = _snapshot_page(sa, pa, addr);
+
+      if (ida == idb)
+        continue;
+      else if (ida == HIST_PAGE_NONE)
+        _emit(&pc, addr, HIST_PAGE_SIZE, HIST_MAPPED);
+      else if (idb == HIST_PAGE_NONE)
+        _emit(&pc, addr, HIST_PAGE_SIZE, HIST_UNMAPPED);
+      else
+        _diff_page(&pc, addr, _page_data(h, ida, bufa),
+                   _page_data(h, idb, bufb));
+    }
+  }
+
+  /* pages that were only readable in the earlier snapshot */
+  for (i = 0; i < sa->nregions; i++)
+  {
+    reg = &sa->regions[i];
+    for (p = 0; p < reg->npages; p++)
+    {
+      addr = reg->start + p * HIST_PAGE_SIZE;
+      if (pa[i][p] != HIST_PAGE_NONE
+          && _snapshot_region(sb, addr) == NULL)
+        _emit(&pc, addr, HIST_PAGE_SIZE, HIST_UNMAPPED);
+    }
+  }
+
+  _emit(&pc, 0, 0, 0);
+  _release(pa, sa->nregions);
+  _release(pb, sb->nregions);
+  return 0;
+}
@@ -0,0 +1,90 @@
+#ifndef __HISTORY_H
+#define __HISTORY_H
+
+#include "mem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define HIST_PAGE_SIZE  4096
+#define HIST_PAGE_NONE  UINT32_MAX    /* page wasn't readable at the time */
+#define HIST_KEYFRAME   16            /* every so many snapshots are full */
+
+/* kinds of changes reported by history_diff */
+enum hist_change {
+  HIST_CHANGED = 0,                   /* bytes differ between snapshots   */
+  HIST_MAPPED,                        /* only readable in the later one   */
+  HIST_UNMAPPED,                      /* only readable in the earlier one */
+};
+
+
+/*  _history_region:
+ *    a snapshotted range. a full region stores one page id per page, the
+ *    others only the pages that differ from the same region in the
+ *    previous snapshot.
+ */
+typedef struct _history_region
+{
+  uintptr_t start;                  /* page aligned start address */
+  size_t npages;                    /* pages covered */
+  uint32_t *pages;                  /* page id of every page, or NULL */
+  int base;                         /* region of the previous snapshot the
+                                     * changes apply to, -1 if full */
+  size_t nchanged;                  /* amount of entries in changed */
+  uint32_t *changed;                /* page numbers that differ from base */
+  uint32_t *ids;                    /* their page ids */
+} hist_region;
+
+
+/*  _history_snapshot:
+ *    the state of all selected ranges at a point in time. regions are kept
+ *    sorted by start address.
+ */
+typedef struct _history_snapshot
+{
+  struct timespec taken;            /* CLOCK_REALTIME when the snapshot began */
+  int nregions;
+  hist_region *regions;
+} hist_snapshot;
+
+
+/*  _memory_history:
+ *    a series of snapshots sharing one content addressed page store. every
+ *    distinct page is stored once no matter how many snapshots reference it,
+ *    either in memory or appended to a spill file.
+ */
+typedef struct _memory_history
+{
+  /* page store, indexed by page id */
+  uint64_t *hashes;                 /* content hash of every stored page */
+  uint8_t **blocks;                 /* in-memory page blocks, or NULL */
+  int spill_fd;                     /* page data file, or -1 for memory */
+  uint32_t npages, cap_pages;
+
+  /* open addressing index of hash -> page id */
+  uint32_t *index;
+  size_t index_mask;
+
+  /* snapshots in the order they were taken */
+  hist_snapshot *snaps;
+  int nsnaps, cap_snaps;
+
+  uint64_t logical_pages;           /* pages referenced over all snapshots */
+  uint32_t **last;                  /* page ids of every region of the last
+                                     * snapshot */
+  uint8_t *scratch;                 /* read and compare buffers */
+} history;
+
+
+typedef void (*hist_diff_cb)(uintptr_t, size_t, int, void*);
+
+/* function definitions */
+history* history_open(const char*);
+void     history_close(history*);
+int      history_snapshot(history*, mem_reader*, const mem_range*, int);
+int      history_record(history*, mem_reader*, const mem_range*, int,
+                        unsigned int, int, volatile int*);
+int      history_diff(history*, int, int, hist_diff_cb, void*);
+
+#endif /* __HISTORY_H */
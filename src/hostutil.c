@@ -1,11 +1,339 @@
 #include "hostutil.h"
+#include "hash.h"
+#include "memops.h"
+#include "strscan.h"
 
+#include <dirent.h>
 #include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <unistd.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+
+#define SYSFS_CPU   "/sys/devices/system/cpu"
+#define SYSFS_NODE  "/sys/devices/system/node"
+
+
+/* portable kernels until host_init has picked better ones */
+host_kernels hostk = {
+  mismatch_generic,
+  sigsearch_generic,
+  hash_bytes64,
+  strclass_generic,
+};
+
+static host_info info;
+static struct utsname uts;
+
+
+
+/*  _read_sysfs_long:
+ *    reads a single number from a sysfs file, accepting the K/M suffixes
+ *    used by the cache size files. returns -1 if the file can't be read.
+ */
+static long
+_read_sysfs_long(const char *path)
+{
+  FILE *f;
+  long v;
+  char suffix = '\0';
+
+  f = fopen(path, "r");
+  if (f == NULL)
+    return -1;
+
+  if (fscanf(f, "%ld%c", &v, &suffix) < 1)
+    v = -1;
+  fclose(f);
+
+  if (suffix == 'K')
+    v *= 1024;
+  else if (suffix == 'M')
+    v *= 1024 * 1024;
+
+  return v;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*  _xgetbv:
+ *    reads an extended control register, used to check which register
+ *    states the OS saves on context switches.
+ */
+static inline uint64_t
+_xgetbv(uint32_t reg)
+{
+  uint32_t lo, hi;
+
+  __asm__ volatile ("xgetbv" : "=a" (lo), "=d" (hi) : "c" (reg));
+  return ((uint64_t) hi << 32) | lo;
+}
+
+
+/*  _detect_cpuid:
+ *    fills in the feature bits and brand string. AVX features are only
+ *    reported if the OS also saves the wider registers.
+ */
+static void
+_detect_cpuid(host_info *hi)
+{
+  unsigned int a, b, c, d, max, i;
+  uint64_t xcr0 = 0;
+
+  max = __get_cpuid_max(0, NULL);
+  if (max < 1)
+    return;
+
+  __cpuid(1, a, b, c, d);
+  if (d & bit_SSE2)
+    hi->features |= HOST_SSE2;
+  if (c & bit_SSE4_2)
+    hi->features |= HOST_SSE42;
+  if (c & bit_OSXSAVE)
+    xcr0 = _xgetbv(0);
+
+  if (max >= 7) {
+    __cpuid_count(7, 0, a, b, c, d);
+
+    if (b & bit_BMI2)
+      hi->features |= HOST_BMI2;
+
+    /* xmm and ymm state */
+    if ((b & bit_AVX2) && (xcr0 & 0x6) == 0x6)
+      hi->features |= HOST_AVX2;
+
+    /* additionally opmask and zmm state */
+    if ((b & bit_AVX512BW) && (b & bit_AVX512F) && (xcr0 & 0xe6) == 0xe6)
+      hi->features |= HOST_AVX512BW;
+  }
+
+  if (__get_cpuid_max(0x80000000, NULL) >= 0x80000004) {
+    for (i = 0; i < 3; i++)
+    {
+      __cpuid(0x80000002 + i, a, b, c, d);
+      memcpy(hi->model + i * 16 + 0, &a, 4);
+      memcpy(hi->model + i * 16 + 4, &b, 4);
+      memcpy(hi->model + i * 16 + 8, &c, 4);
+      memcpy(hi->model + i * 16 + 12, &d, 4);
+    }
+    hi->model[48] = '\0';
+  }
+}
+
+#endif
+
+
+/*  _detect_caches:
+ *    reads the cache hierarchy of cpu0 from sysfs.
+ */
+static void
+_detect_caches(host_info *hi)
+{
+  int i;
+  long level, size, line;
+  char path[128], type[16];
+  FILE *f;
+
+  for (i = 0; ; i++)
+  {
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu0/cache/index%d/level", i);
+    if ((level = _read_sysfs_long(path)) < 0)
+      break;
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu0/cache/index%d/size", i);
+    size = _read_sysfs_long(path);
+
+    snprintf(path, sizeof(path),
+             SYSFS_CPU "/cpu0/cache/index%d/coherency_line_size", i);
+    line = _read_sysfs_long(path);
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu0/cache/index%d/type", i);
+    type[0] = '\0';
+    if ((f = fopen(path, "r")) != NULL) {
+      if (fscanf(f, "%15s", type) != 1)
+        type[0] = '\0';
+      fclose(f);
+    }
+
+    if (size <= 0)
+      continue;
+
+    if (level == 1 && strcmp(type, "Instruction") != 0)
+      hi->l1d = size;
+    else if (level == 2)
+      hi->l2 = size;
+    else if (level == 3)
+      hi->l3 = size;
+
+    if (line > 0)
+      hi->cache_line = line;
+  }
+
+  if (hi->cache_line == 0)
+    hi->cache_line = 64;
+}
+
+
+/*  _detect_topology:
+ *    counts logical cpus, physical cores, packages and numa nodes. cores are
+ *    told apart by their (package, core id) pair.
+ */
+static void
+_detect_topology(host_info *hi)
+{
+  int cpu, i, ncores = 0, cap;
+  long pkg, core, maxpkg = -1;
+  long *seen;
+  char path[128];
+  DIR *d;
+  struct dirent *e;
+
+  hi->cpus = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (hi->cpus < 1)
+    hi->cpus = 1;
+
+  cap = (int) sysconf(_SC_NPROCESSORS_CONF);
+  if (cap < hi->cpus)
+    cap = hi->cpus;
+  seen = malloc(cap * 2 * sizeof(long));
+
+  for (cpu = 0; cpu < cap; cpu++)
+  {
+    snprintf(path, sizeof(path),
+             SYSFS_CPU "/cpu%d/topology/physical_package_id", cpu);
+    if ((pkg = _read_sysfs_long(path)) < 0)
+      continue;
+
+    snprintf(path, sizeof(path), SYSFS_CPU "/cpu%d/topology/core_id", cpu);
+    core = _read_sysfs_long(path);
+
+    if (pkg > maxpkg)
+      maxpkg = pkg;
+
+    for (i = 0; i < ncores; i++)
+      if (seen[i*2] == pkg && seen[i*2+1] == core)
+        break;
+
+    if (i == ncores) {
+      seen[ncores*2] = pkg;
+      seen[ncores*2+1] = core;
+      ncores++;
+    }
+  }
+
+  free(seen);
+  hi->cores = ncores ? ncores : hi->cpus;
+  hi->packages = maxpkg >= 0 ? maxpkg + 1 : 1;
+
+  hi->numa_nodes = 0;
+  if ((d = opendir(SYSFS_NODE)) != NULL) {
+    while ((e = readdir(d)) != NULL)
+      if (strncmp(e->d_name, "node", 4) == 0
+          && e->d_name[4] >= '0' && e->d_name[4] <= '9')
+        hi->numa_nodes++;
+    closedir(d);
+  }
+
+  if (hi->numa_nodes == 0)
+    hi->numa_nodes = 1;
+}
+
+
+/*  _resolve_kernels:
+ *    points every dispatch table entry at the fastest implementation the
+ *    detected features allow.
+ */
+static void
+_resolve_kernels(const host_info *hi)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  if (hi->features & HOST_SSE2) {
+    hostk.mismatch = mismatch_sse2;
+    hostk.search = sigsearch_sse2;
+    hostk.strclass = strclass_sse2;
+  }
+
+  if (hi->features & HOST_AVX2) {
+    hostk.mismatch = mismatch_avx2;
+    hostk.search = sigsearch_avx2;
+    hostk.hash = hash_bytes64_avx2;
+    hostk.strclass = strclass_avx2;
+  }
+
+  if (hi->features & HOST_AVX512BW)
+    hostk.mismatch = mismatch_avx512bw;
+#else
+  (void) hi;
+#endif
+}
+
+
+/*  host_init:
+ *    detects the host cpu and resolves the kernel dispatch table. should be
+ *    called once at startup, before any worker threads exist.
+ */
+void
+host_init()
+{
+  static int done = 0;
+
+  if (done)
+    return;
+  done = 1;
+
+  memset(&info, 0, sizeof(info));
+  info.arch = get_host_cpu_arch();
+
+#if defined(__x86_64__) || defined(__i386__)
+  _detect_cpuid(&info);
+#endif
+  _detect_caches(&info);
+  _detect_topology(&info);
+
+  _resolve_kernels(&info);
+}
+
+
+/*  host_get_info:
+ *    returns the detected host information, detecting it on first use.
+ */
+const host_info *
+host_get_info()
+{
+  host_init();
+  return &info;
+}
+
+
+/*  host_has:
+ *    returns whether the host supports all of the given enum host_feature
+ *    bits.
+ *
+ *    uint32_t features:  feature bits to test
+ */
+int
+host_has(uint32_t features)
+{
+  return (host_get_info()->features & features) == features;
+}
+
+
+/*  get_host_cpu_arch:
+ *    returns the machine architecture name (e.g. "x86_64"), or NULL if it
+ *    can't be determined.
+ */
 char *
 get_host_cpu_arch()
 {
+  if (uts.machine[0] == '\0' && uname(&uts) < 0)
+    return NULL;
 
-
-  return NULL;
-}
\ No newline at end of file
+  return uts.machine;
+}
@@ -1,6 +1,72 @@
 #ifndef __HOSTUTIL_H
 #define  __HOSTUTIL_H
 
+#include <stddef.h>
+#include <stdint.h>
 
+/* cpu features relevant to the hot kernels */
+enum host_feature {
+  HOST_SSE2     = 1,
+  HOST_SSE42    = 2,
+  HOST_AVX2     = 4,
+  HOST_AVX512BW = 8,
+  HOST_BMI2     = 16,
+};
 
-#endif /* __HOSTUTIL_H */
\ No newline at end of file
+
+/*  _host_information:
+ *    describes the machine PARDU is running on, filled in once by
+ *    host_init.
+ *
+ *    const char *arch:     machine architecture as reported by uname
+ *    char model[49]:       cpu brand string, empty if unknown
+ *    uint32_t features:    enum host_feature bits usable on this host
+ *    size_t l1d, l2, l3:   data cache sizes in bytes, 0 if unknown
+ *    size_t cache_line:    cache line size in bytes
+ *    int cpus:             online logical cpus
+ *    int cores:            physical cores (unique package/core id pairs)
+ *    int packages:         cpu sockets
+ *    int numa_nodes:       numa nodes, 1 if the kernel exposes none
+ */
+typedef struct _host_information
+{
+  const char *arch;
+  char model[49];
+  uint32_t features;
+  size_t l1d, l2, l3, cache_line;
+  int cpus, cores, packages, numa_nodes;
+} host_info;
+
+
+/*  _host_kernels:
+ *    dispatch table of the hot kernels. every entry points at the best
+ *    implementation for this host once host_init has run; before that the
+ *    portable versions are used.
+ *
+ *    mismatch:   index of the first differing byte of two buffers, or len
+ *    search:     first match of a signature in a buffer, mask bytes of 0x00
+ *                are wildcards, mask may be NULL. returns NULL if not found
+ *    hash:       64-bit content hash, identical on every implementation
+ *    strclass:   per-byte printable/high bit/zero bitmaps of 64 byte words,
+ *                used by the string extractor
+ */
+typedef struct _host_kernels
+{
+  size_t   (*mismatch)(const void*, const void*, size_t);
+  const uint8_t* (*search)(const uint8_t*, size_t, const uint8_t*,
+                           const uint8_t*, size_t);
+  uint64_t (*hash)(const void*, size_t);
+  void     (*strclass)(const uint8_t*, size_t, uint64_t*, uint64_t*,
+                       uint64_t*);
+} host_kernels;
+
+
+extern host_kernels hostk;          /* resolved kernels */
+
+/* function definitions */
+void  host_init(void);
+const host_info* host_get_info(void);
+int   host_has(uint32_t);
+char* get_host_cpu_arch(void);
+
+#endif /* __HOSTUTIL_H */
@@ -0,0 +1,762 @@
+#include "integrity.h"
+#include "hostutil.h"
+#include "util.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+
+#define CHUNK_PAGES   256             /* pages read per batch                */
+#define PAGE_SIZE     4096
+#define PATCH_GAP     8               /* differing runs closer than this are
+                                       * reported as one patch               */
+#define RELOC_SIZE    8               /* bytes a relocation writes           */
+
+#if defined(__x86_64__)
+#define RELOC_RELATIVE  R_X86_64_RELATIVE
+#elif defined(__aarch64__)
+#define RELOC_RELATIVE  R_AARCH64_RELATIVE
+#else
+#define RELOC_RELATIVE  -1
+#endif
+
+
+/*  _integ_entry:
+ *    an integ_cache slot. used is 0 for empty slots.
+ */
+struct _integ_entry
+{
+  uint64_t inode, offset, bias, hash;
+  uint32_t dev, used;
+};
+
+
+/*  _integ_reloc:
+ *    a dynamic relocation inside an executable segment of a module.
+ */
+struct _integ_reloc
+{
+  uint64_t vaddr, addend;
+  int relative;                     /* whether value = load bias + addend */
+};
+
+
+/*  _integ_module:
+ *    the executable mappings of one backing file.
+ */
+struct _integ_module
+{
+  ll_memmap_file **maps;
+  int nmaps;
+};
+
+
+/*  _integ_elf:
+ *    the parts of an ELF file needed to find what a mapped page should
+ *    contain.
+ */
+struct _integ_elf
+{
+  const Elf64_Phdr *phdrs;
+  int nphdrs;
+  struct _integ_reloc *relocs;      /* sorted by vaddr */
+  size_t nrelocs;
+};
+
+
+/*  _integ_job:
+ *    shared state of the workers of one integ_scan call.
+ */
+struct _integ_job
+{
+  int pid;
+  struct _integ_module *mods;
+  integ_cache *cache;
+  integ_report *out;
+  pthread_mutex_t lock;
+};
+
+
+/*  _integ_local:
+ *    per-module results, merged into the report and cache when the module
+ *    is done so the shared locks are taken once per module.
+ */
+struct _integ_local
+{
+  integ_patch *patches;
+  size_t count, cap;
+  integ_patch pending;              /* patch being extended, len 0 if none */
+  struct _integ_entry *clean;
+  size_t nclean, cap_clean;
+  size_t checked, skipped;
+};
+
+
+
+/*  integ_cache_new:
+ *    creates an empty page cache, shareable between scans and threads.
+ */
+integ_cache *
+integ_cache_new()
+{
+  integ_cache *c;
+
+  c = calloc(1, sizeof(integ_cache));
+  c->mask = 4095;
+  c->entries = calloc(c->mask + 1, sizeof(struct _integ_entry));
+  pthread_rwlock_init(&c->lock, NULL);
+
+  return c;
+}
+
+
+/*  integ_cache_free:
+ *    frees a page cache.
+ */
+void
+integ_cache_free(integ_cache *c)
+{
+  pthread_rwlock_destroy(&c->lock);
+  free(c->entries);
+  free(c);
+}
+
+
+/*  _entry_slot:
+ *    hashes an entry key into a start slot.
+ */
+static inline size_t
+_entry_slot(const integ_cache *c, const struct _integ_entry *e)
+{
+  uint64_t k;
+
+  k = e->inode * 0x9e3779b97f4a7c15ULL ^ e->offset ^ e->bias * 31 ^ e->dev;
+  k ^= k >> 29;
+  k *= 0xbf58476d1ce4e5b9ULL;
+
+  return (k ^ (k >> 32)) & c->mask;
+}
+
+
+/*  _entry_find:
+ *    returns the slot holding the key of e, or the empty slot it would go
+ *    into.
+ */
+static struct _integ_entry *
+_entry_find(const integ_cache *c, const struct _integ_entry *e)
+{
+  size_t slot = _entry_slot(c, e);
+  struct _integ_entry *s;
+
+  for (;; slot = (slot + 1) & c->mask)
+  {
+    s = &c->entries[slot];
+    if (!s->used || (s->inode == e->inode && s->offset == e->offset
+                     && s->bias == e->bias && s->dev == e->dev))
+      return s;
+  }
+}
+
+
+/*  _cache_insert:
+ *    adds or updates entries, growing the table to stay at most half full.
+ *    the caller holds the write lock.
+ */
+static void
+_cache_insert(integ_cache *c, const struct _integ_entry *e, size_t n)
+{
+  size_t i, old_mask;
+  struct _integ_entry *old, *s;
+
+  for (i = 0; i < n; i++)
+  {
+    if ((c->used + 1) * 2 > c->mask) {
+      old = c->entries;
+      old_mask = c->mask;
+
+      c->mask = c->mask * 2 + 1;
+      c->entries = calloc(c->mask + 1, sizeof(struct _integ_entry));
+      for (s = old; s <= old + old_mask; s++)
+        if (s->used)
+          *_entry_find(c, s) = *s;
+      free(old);
+    }
+
+    s = _entry_find(c, &e[i]);
+    if (!s->used)
+      c->used++;
+    *s = e[i];
+    s->used = 1;
+  }
+}
+
+
+/*  _reloc_cmp:
+ *    qsort comparator ordering relocations by address.
+ */
+static int
+_reloc_cmp(const void *a, const void *b)
+{
+  const struct _integ_reloc *ra = a, *rb = b;
+
+  return (ra->vaddr > rb->vaddr) - (ra->vaddr < rb->vaddr);
+}
+
+
+/*  _elf_exec_vaddr:
+ *    returns whether vaddr lies in an executable PT_LOAD segment.
+ */
+static int
+_elf_exec_vaddr(const struct _integ_elf *ei, uint64_t vaddr)
+{
+  int i;
+
+  for (i = 0; i < ei->nphdrs; i++)
+    if (ei->phdrs[i].p_type == PT_LOAD && (ei->phdrs[i].p_flags & PF_X)
+        && vaddr >= ei->phdrs[i].p_vaddr
+        && vaddr < ei->phdrs[i].p_vaddr + ei->phdrs[i].p_memsz)
+      return 1;
+
+  return 0;
+}
+
+
+/*  _elf_vaddr_to_off:
+ *    converts a virtual address of the file to a file offset, or returns
+ *    (uint64_t) -1 if it isn't backed by the file.
+ */
+static uint64_t
+_elf_vaddr_to_off(const struct _integ_elf *ei, uint64_t vaddr)
+{
+  int i;
+  const Elf64_Phdr *ph;
+
+  for (i = 0; i < ei->nphdrs; i++)
+  {
+    ph = &ei->phdrs[i];
+    if (ph->p_type == PT_LOAD && vaddr >= ph->p_vaddr
+        && vaddr < ph->p_vaddr + ph->p_filesz)
+      return vaddr - ph->p_vaddr + ph->p_offset;
+  }
+
+  return (uint64_t) -1;
+}
+
+
+/*  _elf_load:
+ *    parses the program headers and the relocations that land in executable
+ *    segments. files that aren't 64-bit ELF are compared without any
+ *    relocation info. returns 0 if the file isn't usable ELF.
+ */
+static int
+_elf_load(const uint8_t *f, size_t size, struct _integ_elf *ei)
+{
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *) f;
+  const Elf64_Dyn *dyn = NULL;
+  const Elf64_Rela *rela;
+  uint64_t rela_off = 0, rela_sz = 0;
+  size_t i, ndyn = 0, n, cap = 0;
+  int p;
+
+  memset(ei, 0, sizeof(*ei));
+
+  if (size < sizeof(Elf64_Ehdr) || memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0
+      || eh->e_ident[EI_CLASS] != ELFCLASS64
+      || eh->e_phoff + (uint64_t) eh->e_phnum * sizeof(Elf64_Phdr) > size)
+    return 0;
+
+  ei->phdrs = (const Elf64_Phdr *) (f + eh->e_phoff);
+  ei->nphdrs = eh->e_phnum;
+
+  for (p = 0; p < ei->nphdrs; p++)
+    if (ei->phdrs[p].p_type == PT_DYNAMIC
+        && ei->phdrs[p].p_offset + ei->phdrs[p].p_filesz <= size) {
+      dyn = (const Elf64_Dyn *) (f + ei->phdrs[p].p_offset);
+      ndyn = ei->phdrs[p].p_filesz / sizeof(Elf64_Dyn);
+    }
+
+  for (i = 0; i < ndyn && dyn[i].d_tag != DT_NULL; i++)
+  {
+    if (dyn[i].d_tag == DT_RELA)
+      rela_off = _elf_vaddr_to_off(ei, dyn[i].d_un.d_ptr);
+    else if (dyn[i].d_tag == DT_RELASZ)
+      rela_sz = dyn[i].d_un.d_val;
+  }
+
+  if (rela_sz == 0 || rela_off == (uint64_t) -1 || rela_off + rela_sz > size)
+    return 1;
+
+  /* only relocations patching code matter, text relocations are rare */
+  rela = (const Elf64_Rela *) (f + rela_off);
+  n = rela_sz / sizeof(Elf64_Rela);
+  for (i = 0; i < n; i++)
+  {
+    if (!_elf_exec_vaddr(ei, rela[i].r_offset))
+      continue;
+
+    if (ei->nrelocs == cap) {
+      cap = cap ? cap * 2 : 64;
+      ei->relocs = realloc(ei->relocs, cap * sizeof(struct _integ_reloc));
+    }
+
+    ei->relocs[ei->nrelocs].vaddr = rela[i].r_offset;
+    ei->relocs[ei->nrelocs].addend = rela[i].r_addend;
+    ei->relocs[ei->nrelocs].relative =
+      (int) ELF64_R_TYPE(rela[i].r_info) == RELOC_RELATIVE;
+    ei->nrelocs++;
+  }
+
+  qsort(ei->relocs, ei->nrelocs, sizeof(struct _integ_reloc), _reloc_cmp);
+
+  return 1;
+}
+
+
+/*  _reloc_first:
+ *    index of the first relocation at or above vaddr.
+ */
+static size_t
+_reloc_first(const struct _integ_elf *ei, uint64_t vaddr)
+{
+  size_t lo = 0, hi = ei->nrelocs, mid;
+
+  while (lo < hi)
+  {
+    mid = (lo + hi) / 2;
+    if (ei->relocs[mid].vaddr < vaddr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo;
+}
+
+
+/*  _classify:
+ *    guesses what kind of patch starts at page[off]. a jump or call whose
+ *    instruction covers the first differing byte counts as a hook, even if
+ *    its opcode byte matched the original.
+ */
+static int
+_classify(const uint8_t *page, size_t off)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  size_t back, avail;
+  const uint8_t *p;
+
+  if (page[off] == 0xcc)
+    return INTEG_BREAKPOINT;
+
+  for (back = 0; back < 6 && back <= off; back++)
+  {
+    p = page + off - back;
+    avail = PAGE_SIZE - (off - back);
+
+    if ((p[0] == 0xe9 || p[0] == 0xe8) && back < 5)         /* jmp/call rel32 */
+      return INTEG_HOOK;
+    if (avail >= 2 && p[0] == 0xff && (p[1] == 0x25 || p[1] == 0x15))
+      return INTEG_HOOK;                                  /* jmp/call [rip]  */
+    if (back == 0 && avail >= 2 && (p[0] & 0xf8) == 0x48 && p[1] >= 0xb8
+        && p[1] <= 0xbf)
+      return INTEG_HOOK;                                  /* movabs r, imm64 */
+    if (back == 0 && avail >= 6 && p[0] == 0x68 && p[5] == 0xc3)
+      return INTEG_HOOK;                                  /* push imm; ret   */
+  }
+#else
+  (void) page;
+  (void) off;
+#endif
+
+  return INTEG_MODIFIED;
+}
+
+
+/*  _patch_flush:
+ *    moves the pending patch into the local results.
+ */
+static void
+_patch_flush(struct _integ_local *l)
+{
+  if (l->pending.len == 0)
+    return;
+
+  if (l->pending.kind == INTEG_BREAKPOINT && l->pending.len > 1)
+    l->pending.kind = INTEG_MODIFIED;
+
+  if (l->count == l->cap) {
+    l->cap = l->cap ? l->cap * 2 : 32;
+    l->patches = realloc(l->patches, l->cap * sizeof(integ_patch));
+  }
+
+  l->patches[l->count++] = l->pending;
+  l->pending.len = 0;
+}
+
+
+/*  _patch_add:
+ *    records a differing run, extending the pending patch if it's close.
+ */
+static void
+_patch_add(struct _integ_local *l, const ll_memmap_file *map, uintptr_t addr,
+           size_t len, const uint8_t *page, size_t off)
+{
+  if (l->pending.len && l->pending.map == map
+      && addr <= l->pending.addr + l->pending.len + PATCH_GAP) {
+    l->pending.len = addr + len - l->pending.addr;
+    return;
+  }
+
+  _patch_flush(l);
+  l->pending.addr = addr;
+  l->pending.len = len;
+  l->pending.kind = _classify(page, off);
+  l->pending.map = map;
+}
+
+
+/*  _check_mapping:
+ *    compares every page of an executable mapping with the bytes the file
+ *    puts there, after relocation.
+ */
+static void
+_check_mapping(struct _integ_job *job, struct _integ_local *l,
+               mem_reader *r, const ll_memmap_file *map,
+               const uint8_t *file, size_t fsize, const struct _integ_elf *ei,
+               uint8_t *buf, uint8_t *expect)
+{
+  uintptr_t start = (uintptr_t) map->start_addr, addr;
+  uint64_t seg_base = 0, bias = 0, fo, vaddr, kbias = 0, value;
+  size_t npages, done, i, j, ri, n, k, at, w, from;
+  int pg, cnt, p, known;
+  const uint8_t *exp, *live;
+  struct _integ_entry key, *hit;
+  mem_readreq reqs[CHUNK_PAGES];
+
+  /* find the load bias from the segment containing the mapping */
+  for (p = 0; p < ei->nphdrs; p++)
+    if (ei->phdrs[p].p_type == PT_LOAD
+        && map->offset >= (ei->phdrs[p].p_offset & ~(uint64_t) (PAGE_SIZE-1))
+        && map->offset < ei->phdrs[p].p_offset + ei->phdrs[p].p_filesz) {
+      seg_base = ei->phdrs[p].p_vaddr - ei->phdrs[p].p_offset;
+      bias = start - (map->offset + seg_base);
+    }
+
+  npages = ((uintptr_t) map->end_addr - start) / PAGE_SIZE;
+
+  /* pages only depend on the bias if relocations patch them */
+  vaddr = map->offset + seg_base;
+  ri = _reloc_first(ei, vaddr >= RELOC_SIZE - 1
+                            ? vaddr - (RELOC_SIZE - 1) : 0);
+  if (ri < ei->nrelocs
+      && ei->relocs[ri].vaddr < map->offset + seg_base + npages * PAGE_SIZE)
+    kbias = bias;
+
+  memset(&key, 0, sizeof(key));
+  key.dev = (uint32_t) map->dev_major << 8 | map->dev_minor;
+  key.inode = (uint64_t) (unsigned int) map->inode;
+  key.bias = kbias;
+
+  for (done = 0; done < npages; done += cnt)
+  {
+    cnt = npages - done < CHUNK_PAGES ? npages - done : CHUNK_PAGES;
+
+    for (pg = 0; pg < cnt; pg++)
+    {
+      reqs[pg].addr = (void *) (start + (done + pg) * PAGE_SIZE);
+      reqs[pg].buf = buf + (size_t) pg * PAGE_SIZE;
+      reqs[pg].len = PAGE_SIZE;
+    }
+
+    mem_read_batch(r, reqs, cnt);
+
+    for (pg = 0; pg < cnt; pg++)
+    {
+      if (reqs[pg].nread != PAGE_SIZE)
+        continue;
+
+      addr = start + (done + pg) * PAGE_SIZE;
+      live = reqs[pg].buf;
+      fo = map->offset + (done + pg) * PAGE_SIZE;
+      vaddr = fo + seg_base;
+
+      /* the hash isn't collision resistant, a page the cache knows clean
+       * is still compared, it only isn't added again */
+      known = 0;
+      if (job->cache) {
+        key.offset = fo;
+        key.hash = hostk.hash(live, PAGE_SIZE);
+
+        pthread_rwlock_rdlock(&job->cache->lock);
+        hit = _entry_find(job->cache, &key);
+        known = hit->used && hit->hash == key.hash;
+        pthread_rwlock_unlock(&job->cache->lock);
+      }
+
+      /* the expected page, zero filled past the end of the file */
+      ri = _reloc_first(ei, vaddr >= RELOC_SIZE - 1
+                                ? vaddr - (RELOC_SIZE - 1) : 0);
+      k = ri < ei->nrelocs && ei->relocs[ri].vaddr < vaddr + PAGE_SIZE;
+
+      if (fo + PAGE_SIZE <= fsize && !k)
+        exp = file + fo;
+      else {
+        n = fo < fsize ? (fsize - fo < PAGE_SIZE ? fsize - fo : PAGE_SIZE)
+                       : 0;
+        memcpy(expect, file + fo, n);
+        memset(expect + n, 0, PAGE_SIZE - n);
+
+        /* relative relocations get their value, anything referring to a
+         * symbol is taken from the live page since it can't be resolved */
+        for (; ri < ei->nrelocs && ei->relocs[ri].vaddr < vaddr + PAGE_SIZE;
+             ri++)
+        {
+          value = bias + ei->relocs[ri].addend;
+
+          /* one starting on the previous page only patches our first
+           * bytes with the rest of its value */
+          from = ei->relocs[ri].vaddr < vaddr
+                 ? vaddr - ei->relocs[ri].vaddr : 0;
+          at = ei->relocs[ri].vaddr + from - vaddr;
+          w = RELOC_SIZE - from;
+          if (w > PAGE_SIZE - at)
+            w = PAGE_SIZE - at;
+
+          if (ei->relocs[ri].relative)
+            memcpy(expect + at, (uint8_t *) &value + from, w);
+          else
+            memcpy(expect + at, live + at, w);
+        }
+        exp = expect;
+      }
+
+      for (i = 0, k = 0; (i += hostk.mismatch(exp + i, live + i,
+                                               PAGE_SIZE - i)) < PAGE_SIZE;
+           i = j, k++)
+      {
+        for (j = i + 1; j < PAGE_SIZE && exp[j] != live[j]; j++);
+        _patch_add(l, map, addr + i, j - i, live, i);
+      }
+
+      if (k == 0 && known) {
+        l->skipped++;
+        continue;
+      }
+
+      l->checked++;
+      if (k == 0 && job->cache) {
+        if (l->nclean == l->cap_clean) {
+          l->cap_clean = l->cap_clean ? l->cap_clean * 2 : 256;
+          l->clean = realloc(l->clean,
+                             l->cap_clean * sizeof(struct _integ_entry));
+        }
+        l->clean[l->nclean++] = key;
+      }
+    }
+  }
+
+  _patch_flush(l);
+}
+
+
+/*  _integ_stale:
+ *    reports every mapping of a module as stale.
+ */
+static void
+_integ_stale(struct _integ_local *l, const struct _integ_module *mod)
+{
+  int i;
+
+  for (i = 0; i < mod->nmaps; i++)
+  {
+    l->pending.addr = (uintptr_t) mod->maps[i]->start_addr;
+    l->pending.len = (uintptr_t) mod->maps[i]->end_addr
+                   - (uintptr_t) mod->maps[i]->start_addr;
+    l->pending.kind = INTEG_STALE;
+    l->pending.map = mod->maps[i];
+    _patch_flush(l);
+  }
+}
+
+
+/*  _same_file:
+ *    whether the file opened for a module is the one that is mapped. the
+ *    mapped file is stat'ed through map_files where that's allowed, which
+ *    also catches a file rewritten in place, else its device and inode
+ *    from the maps are compared.
+ */
+static int
+_same_file(int pid, const ll_memmap_file *map, const struct stat *st)
+{
+  struct stat mapped;
+  char path[80];
+
+  snprintf(path, sizeof(path), "/proc/%d/map_files/%lx-%lx", pid,
+           (unsigned long) map->start_addr, (unsigned long) map->end_addr);
+
+  if (stat(path, &mapped) == 0)
+    return mapped.st_dev == st->st_dev && mapped.st_ino == st->st_ino
+           && mapped.st_size == st->st_size
+           && mapped.st_mtim.tv_sec == st->st_mtim.tv_sec
+           && mapped.st_mtim.tv_nsec == st->st_mtim.tv_nsec;
+
+  return (unsigned int) st->st_ino == (unsigned int) map->inode
+         && (uint8_t) major(st->st_dev) == map->dev_major
+         && (uint8_t) minor(st->st_dev) == map->dev_minor;
+}
+
+
+/*  _integ_worker:
+ *    parallel_for callback checking one module.
+ */
+static void
+_integ_worker(int item, int worker, void *arg)
+{
+  struct _integ_job *job = arg;
+  struct _integ_module *mod = &job->mods[item];
+  struct _integ_local l;
+  struct _integ_elf ei;
+  struct stat st;
+  const char *path = mod->maps[0]->fpath;
+  uint8_t *file = MAP_FAILED, *buf, *expect;
+  mem_reader r;
+  integ_report *out = job->out;
+  int fd, i;
+
+  (void) worker;
+  memset(&l, 0, sizeof(l));
+  memset(&ei, 0, sizeof(ei));
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat(fd, &st) < 0
+      || !_same_file(job->pid, mod->maps[0], &st)
+      || st.st_size == 0
+      || (file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+         == MAP_FAILED) {
+    _integ_stale(&l, mod);
+    goto integ_worker_merge;
+  }
+
+  _elf_load(file, st.st_size, &ei);
+
+  buf = malloc((size_t) (CHUNK_PAGES + 1) * PAGE_SIZE);
+  expect = buf + (size_t) CHUNK_PAGES * PAGE_SIZE;
+  mem_reader_init(&r, job->pid, MEM_BACKEND_VM_READV);
+
+  for (i = 0; i < mod->nmaps; i++)
+    _check_mapping(job, &l, &r, mod->maps[i], file, st.st_size, &ei, buf,
+                   expect);
+
+  mem_reader_close(&r);
+  free(buf);
+  free(ei.relocs);
+  munmap(file, st.st_size);
+
+integ_worker_merge:
+  if (fd >= 0)
+    close(fd);
+
+  if (l.nclean) {
+    pthread_rwlock_wrlock(&job->cache->lock);
+    _cache_insert(job->cache, l.clean, l.nclean);
+    pthread_rwlock_unlock(&job->cache->lock);
+  }
+
+  pthread_mutex_lock(&job->lock);
+  if (out->count + l.count > out->cap) {
+    out->cap = (out->count + l.count) * 2;
+    out->patches = realloc(out->patches, out->cap * sizeof(integ_patch));
+  }
+  memcpy(out->patches + out->count, l.patches, l.count * sizeof(integ_patch));
+  out->count += l.count;
+  out->pages_checked += l.checked;
+  out->pages_skipped += l.skipped;
+  pthread_mutex_unlock(&job->lock);
+
+  free(l.patches);
+  free(l.clean);
+}
+
+
+/*  integ_scan:
+ *    compares the executable file-backed mappings of a process against their
+ *    backing files, one module per worker thread, and appends every patched
+ *    range to out. returns the number of modules checked.
+ *
+ *    int pid:              process to check
+ *    ll_memmap_file *maps: the process' maps from parse_proc_maps
+ *    integ_cache *cache:   clean page cache to use and update, or NULL
+ *    int nthreads:         worker threads, 0 for one per cpu
+ *    integ_report *out:    report to fill, zeroed by the caller
+ */
+int
+integ_scan(int pid, ll_memmap_file *maps, integ_cache *cache, int nthreads,
+           integ_report *out)
+{
+  struct _integ_job job;
+  struct _integ_module *mods = NULL, *m;
+  ll_memmap_file *mmf;
+  int nmods = 0, cap = 0, i;
+
+  /* group the executable mappings by backing file */
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    if (!(mmf->mode & MODE_EXECUTE) || mmf->fpath == NULL
+        || mmf->fpath[0] != '/' || mmf->inode == 0)
+      continue;
+
+    for (i = 0; i < nmods; i++)
+      if (mods[i].maps[0]->inode == mmf->inode
+          && mods[i].maps[0]->dev_major == mmf->dev_major
+          && mods[i].maps[0]->dev_minor == mmf->dev_minor)
+        break;
+
+    if (i == nmods) {
+      if (nmods == cap) {
+        cap = cap ? cap * 2 : 64;
+        mods = realloc(mods, cap * sizeof(struct _integ_module));
+      }
+      memset(&mods[nmods++], 0, sizeof(struct _integ_module));
+    }
+
+    m = &mods[i];
+    m->maps = realloc(m->maps, (m->nmaps + 1) * sizeof(ll_memmap_file *));
+    m->maps[m->nmaps++] = mmf;
+  }
+
+  job.pid = pid;
+  job.mods = mods;
+  job.cache = cache;
+  job.out = out;
+  pthread_mutex_init(&job.lock, NULL);
+
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+
+  parallel_for(nmods, nthreads, _integ_worker, &job);
+
+  pthread_mutex_destroy(&job.lock);
+  for (i = 0; i < nmods; i++)
+    free(mods[i].maps);
+  free(mods);
+
+  return nmods;
+}
+
+
+/*  integ_report_free:
+ *    frees the patches of a report and empties it.
+ */
+void
+integ_report_free(integ_report *rep)
+{
+  free(rep->patches);
+  memset(rep, 0, sizeof(integ_report));
+}
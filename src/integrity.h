@@ -0,0 +1,68 @@
+#ifndef __INTEGRITY_H
+#define __INTEGRITY_H
+
+#include "mem.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* kinds of differences between live code and its backing file */
+enum integ_kind {
+  INTEG_MODIFIED = 0,               /* code bytes differ                  */
+  INTEG_BREAKPOINT,                 /* a single int3 (0xcc) byte          */
+  INTEG_HOOK,                       /* a jump or call redirecting control */
+  INTEG_STALE,                      /* the backing file was replaced or
+                                     * deleted, nothing to compare with   */
+};
+
+
+/*  _integrity_patch:
+ *    a patched range of an executable mapping. map points into the list
+ *    passed to integ_scan and stays valid as long as that list does.
+ */
+typedef struct _integrity_patch
+{
+  uintptr_t addr;
+  size_t len;
+  int kind;                         /* enum integ_kind */
+  const ll_memmap_file *map;
+} integ_patch;
+
+
+/*  _integrity_report:
+ *    the result of an integ_scan call.
+ */
+typedef struct _integrity_report
+{
+  integ_patch *patches;
+  size_t count, cap;
+  size_t pages_checked;             /* pages compared that the cache didn't
+                                     * know */
+  size_t pages_skipped;             /* pages the cache knew clean, still
+                                     * compared but not cached again */
+} integ_report;
+
+
+/*  _integrity_cache:
+ *    hashes of live code pages that were verified clean, keyed by the
+ *    backing file page and load bias, in this process or any other mapping
+ *    the same file. the hash only finds known pages, every page is still
+ *    compared against the file.
+ */
+typedef struct _integrity_cache
+{
+  struct _integ_entry *entries;
+  size_t mask, used;
+  pthread_rwlock_t lock;
+} integ_cache;
+
+
+/* function definitions */
+integ_cache* integ_cache_new(void);
+void         integ_cache_free(integ_cache*);
+int          integ_scan(int, ll_memmap_file*, integ_cache*, int,
+                        integ_report*);
+void         integ_report_free(integ_report*);
+
+#endif /* __INTEGRITY_H */
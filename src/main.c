@@ -1,12 +1,19 @@
 #include "termui.h"
+#include "batch.h"
+#include "coverage.h"
+#include "hostutil.h"
 #include "proc.h"
+#include "stacks.h"
 #include "mem.h"
+#include "stats.h"
 #include "util.h"
 
 #include <curses.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 //#include <sys/types.h>
 
 /* global variables */
@@ -15,6 +22,237 @@ extern int LINES, COLS;
 /* forward declarations */
 int start_ui();
 
+/* set by signals to end tracing */
+static volatile sig_atomic_t stop_tracing = 0;
+
+
+/*  usage:
+ *    prints the command line help.
+ */
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr,
+    "usage: %s <process>\n"
+    "       %s -j [-a] [-f fields] [-B bytes] [-T threads] <process>\n"
+    "          [operation args...]\n"
+    "\n"
+    "  process        executable name, path or pid\n"
+    "  -j             headless mode, results are written to stdout as\n"
+    "                 newline delimited JSON. without an operation, one\n"
+    "                 query per line is read from stdin\n"
+    "  -a             attach to every process matching the name, implies\n"
+    "                 -j. records carry the pid they belong to\n"
+    "  -f fields      comma separated fields to write, e.g. addr,path\n"
+    "  -B bytes       output buffer size\n"
+    "  -T threads     scan threads, one per cpu by default\n"
+    "\n"
+    "       %s -C [-M module] [-d seconds] [-o file] <process>\n"
+    "       %s -C -x [-M module] [-d seconds] [-o file] <program> [args...]\n"
+    "\n"
+    "  -C             basic block coverage, until the process exits, the\n"
+    "                 time is up or on ctrl-c\n"
+    "  -x             start program instead of attaching to a process\n"
+    "  -M module      only cover modules whose path contains module\n"
+    "  -d seconds     stop after this long\n"
+    "  -o file        write the report to file instead of stdout\n"
+    "\n"
+    "       %s -S [-T threads] [-o file] <process>\n"
+    "\n"
+    "  -S             backtrace of every thread, identical stacks grouped\n"
+    "\n"
+    "operations:\n"
+    "  maps | refresh | scan <type> <value> [<max>] [unaligned]\n"
+    "  sig <hex bytes, ?? wildcards>\n"
+    "  strings [min] [ascii|utf8|utf16] [contains <text>] [match <regex>]\n"
+    "  symbols [substring] | heap [largest] | smaps [all]\n"
+    "  entropy [window] | stacks [bytes] | integrity\n"
+    "  capture [rw|all] [auto|freezer|stop]\n"
+    "  dups [top] | snap [rw|all] [<spill file>] | diff <from> <to>\n"
+    "  first <type> <value> [<max>] [unaligned] | results [max]\n"
+    "  next <value> [<max>] | changed | unchanged | increased | decreased\n"
+    "  save <file> | load <file>\n",
+    argv0, argv0, argv0, argv0, argv0);
+}
+
+
+/*  resolve_pid:
+ *    takes a pid as is, looks anything else up by executable name.
+ */
+static int
+resolve_pid(const char *s)
+{
+  const char *c;
+
+  for (c = s; *c >= '0' && *c <= '9'; c++)
+    ;
+  if (*s != '\0' && *c == '\0')
+    return atoi(s);
+
+  return lookup_pid((char *) s);
+}
+
+
+/*  run_headless:
+ *    attaches a batch session to the given processes and runs the
+ *    operation given on the command line, or serves queries from stdin.
+ *    returns the exit status.
+ */
+static int
+run_headless(const int *pids, int npids, int nthreads, int argc,
+             char *argv[], size_t bufsize, uint32_t fields)
+{
+  int i, failed;
+  size_t len = 0;
+  char *line;
+  ndj_writer w;
+  batch_session s;
+
+  ndj_init(&w, STDOUT_FILENO, bufsize, fields);
+
+  if (batch_open(&s, pids, npids, &w) < 0) {
+    fprintf(stderr, "couldn't attach to process %d\n", pids[0]);
+    ndj_free(&w);
+    return EXIT_FAILURE;
+  }
+  s.nthreads = nthreads;
+
+  if (argc > 0) {
+    for (i = 0; i < argc; i++)
+      len += strlen(argv[i]) + 1;
+
+    line = malloc(len + 1);
+    line[0] = '\0';
+    for (i = 0; i < argc; i++)
+    {
+      strcat(line, argv[i]);
+      strcat(line, " ");
+    }
+
+    failed = batch_query(&s, 1, line) < 0;
+    free(line);
+  } else {
+    failed = batch_serve(&s, stdin);
+  }
+
+  batch_close(&s);
+  ndj_free(&w);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+/*  on_stop_signal:
+ *    ends tracing at the next event.
+ */
+static void
+on_stop_signal(int signo)
+{
+  (void) signo;
+  stop_tracing = 1;
+}
+
+
+/*  run_coverage:
+ *    traces a process, or starts program if launch is set, and writes the
+ *    blocks it ran to the report. returns the exit status.
+ */
+static int
+run_coverage(char *argv[], int launch, const char *filter, int seconds,
+             const char *report)
+{
+  cov_session s;
+  struct sigaction sa;
+  FILE *f;
+  int pid, ret;
+
+  if (launch) {
+    ret = cov_launch(&s, argv, filter);
+  } else {
+    pid = resolve_pid(argv[0]);
+    if (pid < 0) {
+      fprintf(stderr, "no process matching '%s'\n", argv[0]);
+      return EXIT_FAILURE;
+    }
+    ret = cov_attach(&s, pid, filter);
+  }
+
+  if (ret < 0) {
+    perror(launch ? "couldn't start program" : "couldn't attach");
+    return EXIT_FAILURE;
+  }
+
+  /* no SA_RESTART, waitpid has to return for the flag to be seen */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_stop_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGALRM, &sa, NULL);
+  if (seconds > 0)
+    alarm(seconds);
+
+  if (!launch)
+    fprintf(stderr, "%zu breakpoints in %d modules\n", s.armed, s.nmodules);
+
+  cov_run(&s, &stop_tracing);
+  cov_detach(&s);
+
+  f = report != NULL ? fopen(report, "w") : stdout;
+  if (f == NULL) {
+    perror(report);
+    cov_free(&s);
+    return EXIT_FAILURE;
+  }
+
+  cov_report(&s, f);
+  if (f != stdout)
+    fclose(f);
+
+  cov_free(&s);
+  return EXIT_SUCCESS;
+}
+
+
+/*  run_stacks:
+ *    dumps the stacks of every thread of a process to the report.
+ *    returns the exit status.
+ */
+static int
+run_stacks(const char *process, int nthreads, const char *report)
+{
+  stk_dump d;
+  ll_memmap_file *maps;
+  FILE *f;
+  int pid;
+
+  pid = resolve_pid(process);
+  if (pid < 0) {
+    fprintf(stderr, "no process matching '%s'\n", process);
+    return EXIT_FAILURE;
+  }
+
+  maps = parse_proc_maps(pid);
+  if (maps == NULL || stk_capture(&d, pid, maps, 0, nthreads) < 0) {
+    perror("couldn't attach");
+    if (maps != NULL)
+      free_proc_maps(maps);
+    return EXIT_FAILURE;
+  }
+
+  f = report != NULL ? fopen(report, "w") : stdout;
+  if (f == NULL) {
+    perror(report);
+  } else {
+    stk_report(&d, f);
+    if (f != stdout)
+      fclose(f);
+  }
+
+  stk_free(&d);
+  free_proc_maps(maps);
+  return f != NULL ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 
 int
 main (int argc, char *argv[])
@@ -22,15 +260,111 @@ main (int argc, char *argv[])
   //if(start_ui() != 0)
   //  perror("Couldn't initialize ncurses");
 
-  int pid;
+  int pid, opt, headless = 0, all = 0, nthreads = 0, npids, status;
+  int coverage = 0, launch = 0, seconds = 0, stacks = 0;
+  int *pids;
+  const char *filter = NULL, *report = NULL;
+  size_t bufsize = 1 << 20;
+  uint32_t fields = NDJ_ALL;
   ll_memmap_file *ll_mmf;
 
-  if (argc < 2) {
-    puts("Please provide a process to open");
+  host_init();
+
+  /* kill -USR1 <pid> prints the instrumentation counters to stderr */
+  stats_signal(SIGUSR1, NULL);
+
+  /* stop at the process name, operation arguments may look like options */
+  while ((opt = getopt(argc, argv, "+jaf:B:T:CxM:d:o:S")) != -1)
+  {
+    switch (opt)
+    {
+      case 'j':
+        headless = 1;
+        break;
+
+      case 'a':
+        headless = all = 1;
+        break;
+
+      case 'f':
+        if (ndj_fields_parse(optarg, &fields) < 0) {
+          fprintf(stderr, "unknown field in '%s'\n", optarg);
+          exit(1);
+        }
+        break;
+
+      case 'B':
+        bufsize = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'T':
+        nthreads = atoi(optarg);
+        break;
+
+      case 'C':
+        coverage = 1;
+        break;
+
+      case 'x':
+        coverage = launch = 1;
+        break;
+
+      case 'M':
+        filter = optarg;
+        break;
+
+      case 'd':
+        seconds = atoi(optarg);
+        break;
+
+      case 'o':
+        report = optarg;
+        break;
+
+      case 'S':
+        stacks = 1;
+        break;
+
+      default:
+        usage(argv[0]);
+        exit(1);
+    }
+  }
+
+  if (optind >= argc) {
+    usage(argv[0]);
     exit(1);
   } 
 
-  pid = lookup_pid(argv[1]);
+  if (coverage)
+    return run_coverage(argv + optind, launch, filter, seconds, report);
+
+  if (stacks)
+    return run_stacks(argv[optind], nthreads, report);
+
+  if (all) {
+    npids = lookup_pids(argv[optind], &pids);
+    if (npids <= 0) {
+      fprintf(stderr, "no process matching '%s'\n", argv[optind]);
+      exit(1);
+    }
+
+    status = run_headless(pids, npids, nthreads, argc - optind - 1,
+                          argv + optind + 1, bufsize, fields);
+    free(pids);
+    return status;
+  }
+
+  pid = resolve_pid(argv[optind]);
+  if (pid < 0) {
+    fprintf(stderr, "no process matching '%s'\n", argv[optind]);
+    exit(1);
+  }
+
+  if (headless)
+    return run_headless(&pid, 1, nthreads, argc - optind - 1,
+                        argv + optind + 1, bufsize, fields);
+
   printf("pid: %d\n", pid);
 
   ll_mmf = parse_proc_maps(pid);
@@ -95,6 +429,7 @@ start_ui()
 
   draw_menubar(0, items);
   draw_bar(LINES-1, COLOR_RED);
+  draw_memmap(w_memmap, 0);
 
   waitasecwillya(w_disassembly);
 
@@ -1,16 +1,27 @@
+#define _GNU_SOURCE   /* process_vm_readv */
+
 #include "mem.h"
+#include "snapshot.h"
+#include "stats.h"
+#include "uring.h"
 #include "util.h"
 
 #include <error.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <regex.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include <linux/limits.h>
 
 #define MAPS_LINE_LEN PATH_MAX+75   /* 75 chars for info + file path         */
 #define MAPS_FIELDS_NO 9            /* 8 fields in /proc/<id>/maps + match 0 */
+#define URING_DEPTH 512             /* reads queued per reader at most       */
 
 
 
@@ -29,6 +40,7 @@ free_proc_maps(ll_memmap_file *first)
 
   do {
     next = mmf->next;
+    free(mmf->fpath);
     free(mmf);
     mmf = next;
   }
@@ -79,7 +91,7 @@ _parse_proc_map_line(char *s, regex_t *re, ll_memmap_file *mmf)
       case 3:
         for (m = 0; m < 4; m++)
         {
-          switch (s[m])
+          switch (parse_str[m])
           {
             case 'r':
               mmf->mode |= MODE_READ;
@@ -138,7 +150,8 @@ _parse_proc_map_line(char *s, regex_t *re, ll_memmap_file *mmf)
 ll_memmap_file*
 parse_proc_maps(int pid)
 {
-  int i, m, len;
+  int i, m, len, n = 0;
+  uint64_t t0 = stat_now();
   FILE *f;
   char line[MAPS_LINE_LEN];
 
@@ -173,12 +186,13 @@ parse_proc_maps(int pid)
 
   while (nreadline(line, MAPS_LINE_LEN, f) > 0)
   {
-    mmf = malloc(sizeof(ll_memmap_file));
+    mmf = calloc(1, sizeof(ll_memmap_file));
     /* init the first entry in the linked list */
     if (!first)
       first = mmf;
 
     _parse_proc_map_line(line, &re_comp, mmf);
+    n++;
 
     /* update the previous linked token's pointers */
     if (prev)
@@ -195,6 +209,439 @@ parse_maps_end:
   regfree(&re_comp);
   fclose(f);
 
+  stat_add(STAT_MAPS_PARSED, 1);
+  stat_add(STAT_MAPS_ENTRIES, n);
+  stat_time(STAT_T_MAPS, t0);
+
   return first;
 }
 
+
+/*  mem_ranges_from_maps:
+ *    builds a range array out of every mapping whose mode contains all bits
+ *    of mode_mask. the caller frees *out. returns the number of ranges.
+ *
+ *    ll_memmap_file *maps:   first entry from parse_proc_maps
+ *    uint8_t mode_mask:      enum module_perms bits a mapping must have
+ *    mem_range **out:        receives the allocated array
+ */
+int
+mem_ranges_from_maps(ll_memmap_file *maps, uint8_t mode_mask,
+                     mem_range **out)
+{
+  int n = 0, cap = 0;
+  ll_memmap_file *mmf;
+
+  *out = NULL;
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    if ((mmf->mode & mode_mask) != mode_mask)
+      continue;
+
+    if (n == cap) {
+      cap = cap ? cap * 2 : 64;
+      *out = realloc(*out, cap * sizeof(mem_range));
+    }
+
+    (*out)[n].start = mmf->start_addr;
+    (*out)[n].end = mmf->end_addr;
+    n++;
+  }
+
+  return n;
+}
+
+
+/*  mem_reader_init:
+ *    prepares a reader for the given process. no resources are acquired
+ *    until the first read.
+ *
+ *    mem_reader *r:  reader to initialize
+ *    int pid:        process id to read memory from
+ *    int backend:    one of enum mem_backend
+ */
+void
+mem_reader_init(mem_reader *r, int pid, int backend)
+{
+  r->pid = pid;
+  r->backend = backend;
+  r->mem_fd = -1;
+  r->ring = NULL;
+  r->snap = NULL;
+}
+
+
+/*  mem_reader_snapshot:
+ *    serves every further read from a snapshot instead of the live
+ *    process, until the reader is initialized again. the snapshot has to
+ *    outlive the reader's use.
+ *
+ *    mem_reader *r:            reader to switch
+ *    const snapshot *snap:     copy taken by snap_capture
+ */
+void
+mem_reader_snapshot(mem_reader *r, const struct _snapshot *snap)
+{
+  r->backend = MEM_BACKEND_SNAPSHOT;
+  r->snap = snap;
+}
+
+
+/*  mem_reader_close:
+ *    releases any file descriptors held by the reader. submitted reads must
+ *    have been completed.
+ *
+ *    mem_reader *r:  reader to close
+ */
+void
+mem_reader_close(mem_reader *r)
+{
+  uring_close(r->ring);
+  r->ring = NULL;
+
+  if (r->mem_fd >= 0)
+    close(r->mem_fd);
+
+  r->mem_fd = -1;
+}
+
+
+/*  _procfs_fd:
+ *    returns the (lazily opened) fd to /proc/<pid>/mem, or -1 on failure.
+ */
+static int
+_procfs_fd(mem_reader *r)
+{
+  char path[32];
+
+  if (r->mem_fd < 0) {
+    snprintf(path, sizeof(path), "/proc/%d/mem", r->pid);
+    r->mem_fd = open(path, O_RDONLY | O_CLOEXEC);
+  }
+
+  return r->mem_fd;
+}
+
+
+/*  _read_batch_procfs:
+ *    services a batch with one pread(2) per request.
+ */
+static size_t
+_read_batch_procfs(mem_reader *r, mem_readreq *reqs, int n)
+{
+  int i, fd, faults = 0;
+  uint64_t t0;
+  size_t total = 0;
+
+  fd = _procfs_fd(r);
+
+  for (i = 0; i < n; i++)
+  {
+    if (fd < 0) {
+      reqs[i].nread = -1;
+      continue;
+    }
+
+    t0 = stat_now();
+    reqs[i].nread = pread(fd, reqs[i].buf, reqs[i].len,
+                          (off_t) (uintptr_t) reqs[i].addr);
+    stat_time(STAT_T_READ, t0);
+
+    if (reqs[i].nread > 0)
+      total += reqs[i].nread;
+    else
+      reqs[i].nread = -1;
+
+    if (reqs[i].nread != (ssize_t) reqs[i].len)
+      faults++;
+  }
+
+  stat_add(STAT_READ_SYSCALLS, fd < 0 ? 0 : n);
+  stat_add(STAT_READ_BYTES, total);
+  stat_add(STAT_READ_FAULTS, faults);
+  return total;
+}
+
+
+/*  _read_batch_vm:
+ *    services a batch with as few process_vm_readv(2) calls as possible.
+ *    the kernel stops at the first range that faults, so after a short read
+ *    the failing request is marked and the batch resumes right after it.
+ */
+static size_t
+_read_batch_vm(mem_reader *r, mem_readreq *reqs, int n)
+{
+  int i, cnt, done, calls = 0, faults = 0;
+  uint64_t t0;
+  ssize_t got;
+  size_t total = 0;
+  struct iovec local[IOV_MAX], remote[IOV_MAX];
+
+  done = 0;
+  while (done < n)
+  {
+    cnt = n - done;
+    if (cnt > IOV_MAX)
+      cnt = IOV_MAX;
+
+    for (i = 0; i < cnt; i++)
+    {
+      local[i].iov_base  = reqs[done+i].buf;
+      local[i].iov_len   = reqs[done+i].len;
+      remote[i].iov_base = reqs[done+i].addr;
+      remote[i].iov_len  = reqs[done+i].len;
+    }
+
+    t0 = stat_now();
+    got = process_vm_readv(r->pid, local, cnt, remote, cnt, 0);
+    stat_time(STAT_T_READ, t0);
+    calls++;
+
+    /* the backend isn't usable at all, let procfs handle the rest */
+    if (got < 0 && (errno == ENOSYS || errno == EPERM)) {
+      r->backend = MEM_BACKEND_PROCFS;
+      stat_add(STAT_READ_SYSCALLS, calls);
+      stat_add(STAT_READ_BYTES, total);
+      stat_add(STAT_READ_FAULTS, faults);
+      return total + _read_batch_procfs(r, reqs + done, n - done);
+    }
+
+    if (got < 0)
+      got = 0;
+
+    total += got;
+
+    /* hand out the copied bytes to the requests in order */
+    for (i = 0; i < cnt; i++)
+    {
+      if ((size_t) got >= reqs[done+i].len) {
+        reqs[done+i].nread = reqs[done+i].len;
+        got -= reqs[done+i].len;
+        continue;
+      }
+
+      /* short request: keep the partial bytes, fail it if there were none */
+      reqs[done+i].nread = got > 0 ? got : -1;
+      faults++;
+      i++;
+      break;
+    }
+
+    done += i;
+  }
+
+  stat_add(STAT_READ_SYSCALLS, calls);
+  stat_add(STAT_READ_BYTES, total);
+  stat_add(STAT_READ_FAULTS, faults);
+  return total;
+}
+
+
+/*  _uring_ready:
+ *    sets up the io_uring instance on first use. if io_uring or the procfs
+ *    fd isn't available the reader permanently switches to procfs reads.
+ */
+static int
+_uring_ready(mem_reader *r)
+{
+  if (r->ring != NULL)
+    return 1;
+
+  if (_procfs_fd(r) >= 0)
+    r->ring = uring_open(URING_DEPTH);
+
+  if (r->ring == NULL)
+    r->backend = MEM_BACKEND_PROCFS;
+
+  return r->ring != NULL;
+}
+
+
+/*  _uring_reap:
+ *    stores the result of every finished read in its request.
+ */
+static void
+_uring_reap(mem_reader *r)
+{
+  int res, faults = 0;
+  size_t total = 0;
+  void *user;
+  mem_readreq *req;
+
+  while (uring_reap(r->ring, &user, &res))
+  {
+    req = user;
+    req->nread = res > 0 ? res : -1;
+
+    if (res > 0)
+      total += res;
+    if (res != (ssize_t) req->len)
+      faults++;
+  }
+
+  stat_add(STAT_READ_BYTES, total);
+  stat_add(STAT_READ_FAULTS, faults);
+}
+
+
+/*  _uring_enter:
+ *    submits queued reads and waits for wait completions. if the kernel
+ *    refuses the submission the reads it didn't take are dropped from the
+ *    queue and failed, and the reader permanently switches to procfs reads.
+ *    reads the kernel already took still complete into their buffers and
+ *    are waited for as before. returns -1 if the submission failed.
+ */
+static int
+_uring_enter(mem_reader *r, unsigned wait)
+{
+  int ret;
+  void *user;
+  uint64_t t0 = stat_now();
+
+  ret = uring_submit(r->ring, wait);
+  if (ret < 0) {
+    while (uring_unqueue(r->ring, &user))
+      ((mem_readreq *) user)->nread = -1;
+    r->backend = MEM_BACKEND_PROCFS;
+  }
+
+  stat_time(STAT_T_READ, t0);
+  stat_add(STAT_READ_SYSCALLS, 1);
+  _uring_reap(r);
+  return ret;
+}
+
+
+/*  mem_read_submit:
+ *    starts reading every request in reqs. with MEM_BACKEND_URING the reads
+ *    are queued and run in the background, nread stays MEM_READ_PENDING
+ *    until mem_read_complete. other backends read right away. reqs and the
+ *    buffers must stay valid until mem_read_complete returns.
+ *
+ *    mem_reader *r:      reader to use
+ *    mem_readreq *reqs:  array of ranges to read
+ *    int n:              number of entries in reqs
+ */
+void
+mem_read_submit(mem_reader *r, mem_readreq *reqs, int n)
+{
+  int i, j;
+
+  if (r->backend != MEM_BACKEND_URING || !_uring_ready(r)) {
+    mem_read_batch(r, reqs, n);
+    return;
+  }
+
+  for (i = 0; i < n; i++)
+  {
+    /* the queue is full, make room by waiting for a completion */
+    while (uring_queue_read(r->ring, r->mem_fd, reqs[i].buf, reqs[i].len,
+                            (uintptr_t) reqs[i].addr, &reqs[i]) < 0)
+      if (_uring_enter(r, 1) < 0)
+        break;
+
+    if (r->backend != MEM_BACKEND_URING)
+      break;
+    reqs[i].nread = MEM_READ_PENDING;
+  }
+
+  if (r->backend == MEM_BACKEND_URING)
+    _uring_enter(r, 0);
+
+  /* the ring failed on the way, read what it didn't take from procfs */
+  if (r->backend != MEM_BACKEND_URING) {
+    for (j = 0; j < i; j++)
+      if (reqs[j].nread == -1)
+        _read_batch_procfs(r, reqs + j, 1);
+
+    if (i < n)
+      _read_batch_procfs(r, reqs + i, n - i);
+  }
+}
+
+
+/*  mem_read_complete:
+ *    waits until every request of an earlier mem_read_submit is done.
+ *    completions of other submissions are stored along the way.
+ *
+ *    mem_reader *r:      reader to use
+ *    mem_readreq *reqs:  the array passed to mem_read_submit
+ *    int n:              number of entries in reqs
+ */
+void
+mem_read_complete(mem_reader *r, mem_readreq *reqs, int n)
+{
+  int i = 0;
+
+  while (i < n)
+  {
+    if (reqs[i].nread != MEM_READ_PENDING) {
+      i++;
+      continue;
+    }
+
+    _uring_enter(r, 1);
+  }
+}
+
+
+/*  mem_read_batch:
+ *    reads every request in reqs, setting each request's nread field.
+ *    unreadable ranges don't abort the batch. returns the total amount of
+ *    bytes copied.
+ *
+ *    mem_reader *r:      reader to use
+ *    mem_readreq *reqs:  array of ranges to read
+ *    int n:              number of entries in reqs
+ */
+size_t
+mem_read_batch(mem_reader *r, mem_readreq *reqs, int n)
+{
+  int i;
+  size_t total = 0;
+
+  if (r->backend == MEM_BACKEND_URING && _uring_ready(r)) {
+    mem_read_submit(r, reqs, n);
+    mem_read_complete(r, reqs, n);
+
+    for (i = 0; i < n; i++)
+      if (reqs[i].nread > 0)
+        total += reqs[i].nread;
+    return total;
+  }
+
+  if (r->backend == MEM_BACKEND_PROCFS)
+    return _read_batch_procfs(r, reqs, n);
+
+  if (r->backend == MEM_BACKEND_SNAPSHOT) {
+    for (i = 0; i < n; i++)
+    {
+      reqs[i].nread = snap_read(r->snap, (uintptr_t) reqs[i].addr,
+                                reqs[i].buf, reqs[i].len);
+      if (reqs[i].nread > 0)
+        total += reqs[i].nread;
+    }
+    return total;
+  }
+
+  return _read_batch_vm(r, reqs, n);
+}
+
+
+/*  mem_read:
+ *    reads a single range from the process. returns the amount of bytes read
+ *    or -1 on failure.
+ *
+ *    mem_reader *r:  reader to use
+ *    void *addr:     remote address to read from
+ *    void *buf:      local buffer, at least len bytes
+ *    size_t len:     amount of bytes to read
+ */
+ssize_t
+mem_read(mem_reader *r, void *addr, void *buf, size_t len)
+{
+  mem_readreq req = { addr, buf, len, -1 };
+
+  mem_read_batch(r, &req, 1);
+  return req.nread;
+}
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <sys/types.h>
 
 enum module_perms {
   MODE_READ = 1,
@@ -46,8 +47,72 @@ typedef struct _process_memory_pointer
 } mem_;
 
 
+/*  _memory_range:
+ *    an address range in a process, usually taken from an ll_memmap_file
+ *    entry.
+ */
+typedef struct _memory_range
+{
+  void *start, *end;
+} mem_range;
+
+
+/*  mem_backend:
+ *    the mechanism used to copy bytes out of another process' address space
+ */
+enum mem_backend {
+  MEM_BACKEND_VM_READV = 0,         /* process_vm_readv(2), no fd required   */
+  MEM_BACKEND_PROCFS,               /* pread(2) on /proc/<pid>/mem           */
+  MEM_BACKEND_URING,                /* queued io_uring reads on the procfs fd,
+                                     * procfs is used if io_uring isn't
+                                     * available                             */
+  MEM_BACKEND_SNAPSHOT,             /* copies from a snapshot taken earlier,
+                                     * see mem_reader_snapshot               */
+};
+
+/* mem_readreq.nread of a request submitted but not completed yet */
+#define MEM_READ_PENDING  (-2)
+
+
+/*  _memory_reader:
+ *    reads memory of a single process through one of the mem_backend
+ *    mechanisms. the procfs fd and io_uring instance are set up on first
+ *    use.
+ */
+typedef struct _memory_reader
+{
+  int pid;                          /* process to read from */
+  int backend;                      /* one of enum mem_backend */
+  int mem_fd;                       /* fd to /proc/<pid>/mem or -1 */
+  struct _io_uring *ring;           /* MEM_BACKEND_URING queue or NULL */
+  const struct _snapshot *snap;     /* MEM_BACKEND_SNAPSHOT source or NULL */
+} mem_reader;
+
+
+/*  _memory_read_request:
+ *    a single range in a batched read. nread is filled in by mem_read_batch
+ *    with the amount of bytes copied, or -1 if the range couldn't be read.
+ */
+typedef struct _memory_read_request
+{
+  void *addr;                       /* remote address to read from */
+  void *buf;                        /* local buffer to copy into */
+  size_t len;                       /* amount of bytes to read */
+  ssize_t nread;                    /* bytes read, -1 on failure */
+} mem_readreq;
+
+
 /* function definitions */
 ll_memmap_file* parse_proc_maps(int);
 void free_proc_maps(ll_memmap_file*);
+int  mem_ranges_from_maps(ll_memmap_file*, uint8_t, mem_range**);
+
+void    mem_reader_init(mem_reader*, int, int);
+void    mem_reader_close(mem_reader*);
+void    mem_reader_snapshot(mem_reader*, const struct _snapshot*);
+ssize_t mem_read(mem_reader*, void*, void*, size_t);
+size_t  mem_read_batch(mem_reader*, mem_readreq*, int);
+void    mem_read_submit(mem_reader*, mem_readreq*, int);
+void    mem_read_complete(mem_reader*, mem_readreq*, int);
 
 #endif /* __MEM_H */
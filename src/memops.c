@@ -0,0 +1,243 @@
+#include "memops.h"
+
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+/*  _sig_verify:
+ *    checks a signature against the bytes at p, skipping wildcard bytes
+ *    (mask byte 0x00). a NULL mask means every byte has to match.
+ */
+static inline int
+_sig_verify(const uint8_t *p, const uint8_t *sig, const uint8_t *mask,
+            size_t slen)
+{
+  size_t i;
+
+  if (mask == NULL)
+    return memcmp(p, sig, slen) == 0;
+
+  for (i = 0; i < slen; i++)
+    if ((p[i] ^ sig[i]) & mask[i])
+      return 0;
+
+  return 1;
+}
+
+
+/*  _sig_anchors:
+ *    finds the first and last non-wildcard bytes of a signature, these are
+ *    compared first to rule out most positions. returns 0 if every byte is
+ *    a wildcard.
+ */
+static inline int
+_sig_anchors(const uint8_t *mask, size_t slen, size_t *first, size_t *last)
+{
+  size_t i;
+
+  if (mask == NULL) {
+    *first = 0;
+    *last = slen - 1;
+    return 1;
+  }
+
+  for (i = 0; i < slen && mask[i] != 0xff; i++);
+  if (i == slen)
+    return 0;
+  *first = i;
+
+  for (i = slen - 1; mask[i] != 0xff; i--);
+  *last = i;
+
+  return 1;
+}
+
+
+/*  mismatch_generic:
+ *    returns the index of the first byte that differs between a and b, or
+ *    len if both are equal. compares a word at a time.
+ */
+size_t
+mismatch_generic(const void *a, const void *b, size_t len)
+{
+  const uint8_t *pa = a, *pb = b;
+  uint64_t wa, wb;
+  size_t i = 0;
+
+  for (; i + 8 <= len; i += 8)
+  {
+    memcpy(&wa, pa + i, 8);
+    memcpy(&wb, pb + i, 8);
+    if (wa != wb)
+      return i + __builtin_ctzll(wa ^ wb) / 8;
+  }
+
+  for (; i < len; i++)
+    if (pa[i] != pb[i])
+      return i;
+
+  return len;
+}
+
+
+/*  sigsearch_generic:
+ *    returns the first position in hay matching sig under mask, or NULL.
+ *    candidates are located with memchr on the first fixed signature byte.
+ *
+ *    const uint8_t *hay:   buffer to search
+ *    size_t hlen:          length of hay
+ *    const uint8_t *sig:   signature bytes
+ *    const uint8_t *mask:  0xff for bytes that must match, 0x00 for wildcards,
+ *                          or NULL
+ *    size_t slen:          length of sig and mask
+ */
+const uint8_t *
+sigsearch_generic(const uint8_t *hay, size_t hlen, const uint8_t *sig,
+                  const uint8_t *mask, size_t slen)
+{
+  const uint8_t *p, *end;
+  size_t first, last;
+
+  if (slen == 0 || slen > hlen)
+    return NULL;
+
+  if (!_sig_anchors(mask, slen, &first, &last))
+    return hay;
+
+  end = hay + hlen - slen;
+  for (p = hay; p <= end; p++)
+  {
+    p = memchr(p + first, sig[first], end - p + 1);
+    if (p == NULL)
+      return NULL;
+
+    p -= first;
+    if (p[last] == sig[last] && _sig_verify(p, sig, mask, slen))
+      return p;
+  }
+
+  return NULL;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*  SIGSEARCH_SIMD:
+ *    generates a signature search for one vector width. each step compares
+ *    the first and last fixed byte of the signature at W positions at once
+ *    and only verifies the positions where both match.
+ */
+#define SIGSEARCH_SIMD(name, attr, W, vec, set1, loadu, cmpeq, and, movemask) \
+attr const uint8_t *                                                          \
+name(const uint8_t *hay, size_t hlen, const uint8_t *sig,                     \
+     const uint8_t *mask, size_t slen)                                        \
+{                                                                             \
+  size_t first, last, pos, npos;                                              \
+  uint32_t bits;                                                              \
+  vec vf, vl;                                                                 \
+                                                                              \
+  if (slen == 0 || slen > hlen)                                               \
+    return NULL;                                                              \
+                                                                              \
+  if (!_sig_anchors(mask, slen, &first, &last))                               \
+    return hay;                                                               \
+                                                                              \
+  vf = set1((char) sig[first]);                                               \
+  vl = set1((char) sig[last]);                                                \
+  npos = hlen - slen + 1;                                                     \
+                                                                              \
+  for (pos = 0; pos + W <= npos; pos += W)                                    \
+  {                                                                           \
+    bits = movemask(and(cmpeq(vf, loadu((const vec *) (hay + pos + first))),  \
+                        cmpeq(vl, loadu((const vec *) (hay + pos + last))))); \
+    while (bits)                                                              \
+    {                                                                         \
+      if (_sig_verify(hay + pos + __builtin_ctz(bits), sig, mask, slen))      \
+        return hay + pos + __builtin_ctz(bits);                               \
+      bits &= bits - 1;                                                       \
+    }                                                                         \
+  }                                                                           \
+                                                                              \
+  return sigsearch_generic(hay + pos, hlen - pos, sig, mask, slen);           \
+}
+
+SIGSEARCH_SIMD(sigsearch_sse2, , 16, __m128i, _mm_set1_epi8, _mm_loadu_si128,
+               _mm_cmpeq_epi8, _mm_and_si128, _mm_movemask_epi8)
+
+SIGSEARCH_SIMD(sigsearch_avx2, __attribute__((target("avx2"))), 32, __m256i,
+               _mm256_set1_epi8, _mm256_loadu_si256, _mm256_cmpeq_epi8,
+               _mm256_and_si256, _mm256_movemask_epi8)
+
+
+/*  mismatch_sse2:
+ *    mismatch_generic comparing 16 bytes per step.
+ */
+size_t
+mismatch_sse2(const void *a, const void *b, size_t len)
+{
+  const uint8_t *pa = a, *pb = b;
+  uint32_t ne;
+  size_t i;
+
+  for (i = 0; i + 16 <= len; i += 16)
+  {
+    ne = ~_mm_movemask_epi8(
+           _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (pa + i)),
+                          _mm_loadu_si128((const __m128i *) (pb + i))))
+         & 0xffff;
+    if (ne)
+      return i + __builtin_ctz(ne);
+  }
+
+  return i + mismatch_generic(pa + i, pb + i, len - i);
+}
+
+
+/*  mismatch_avx2:
+ *    mismatch_generic comparing 32 bytes per step.
+ */
+__attribute__((target("avx2"))) size_t
+mismatch_avx2(const void *a, const void *b, size_t len)
+{
+  const uint8_t *pa = a, *pb = b;
+  uint32_t ne;
+  size_t i;
+
+  for (i = 0; i + 32 <= len; i += 32)
+  {
+    ne = ~(uint32_t) _mm256_movemask_epi8(
+           _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (pa + i)),
+                             _mm256_loadu_si256((const __m256i *) (pb + i))));
+    if (ne)
+      return i + __builtin_ctz(ne);
+  }
+
+  return i + mismatch_generic(pa + i, pb + i, len - i);
+}
+
+
+/*  mismatch_avx512bw:
+ *    mismatch_generic comparing 64 bytes per step.
+ */
+__attribute__((target("avx512f,avx512bw"))) size_t
+mismatch_avx512bw(const void *a, const void *b, size_t len)
+{
+  const uint8_t *pa = a, *pb = b;
+  uint64_t ne;
+  size_t i;
+
+  for (i = 0; i + 64 <= len; i += 64)
+  {
+    ne = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(pa + i),
+                                 _mm512_loadu_si512(pb + i));
+    if (ne)
+      return i + __builtin_ctzll(ne);
+  }
+
+  return i + mismatch_generic(pa + i, pb + i, len - i);
+}
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef __MEMOPS_H
+#define __MEMOPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* memory compare and signature search kernels, one set per instruction set.
+ * callers go through the hostk dispatch table in hostutil.h instead of
+ * calling these directly. */
+
+size_t mismatch_generic(const void*, const void*, size_t);
+const uint8_t* sigsearch_generic(const uint8_t*, size_t, const uint8_t*,
+                                 const uint8_t*, size_t);
+
+#if defined(__x86_64__) || defined(__i386__)
+size_t mismatch_sse2(const void*, const void*, size_t);
+size_t mismatch_avx2(const void*, const void*, size_t);
+size_t mismatch_avx512bw(const void*, const void*, size_t);
+
+const uint8_t* sigsearch_sse2(const uint8_t*, size_t, const uint8_t*,
+                              const uint8_t*, size_t);
+const uint8_t* sigsearch_avx2(const uint8_t*, size_t, const uint8_t*,
+                              const uint8_t*, size_t);
+#endif
+
+#endif /* __MEMOPS_H */
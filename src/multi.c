@@ -0,0 +1,330 @@
+#include "multi.h"
+#include "hostutil.h"
+#include "util.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+#define MULTI_CHUNK   (8 * 1024 * 1024)   /* bytes per work item           */
+#define MULTI_OVERLAP 8                   /* bytes an item reads past its
+                                           * end for unaligned values     */
+
+
+/*  _multi_item:
+ *    a piece of one target's memory, the unit handed to workers.
+ */
+struct _multi_item
+{
+  int target;
+  mem_range range;
+  uintptr_t limit;                  /* hits at or above this belong to the
+                                     * next item */
+};
+
+
+/*  _multi_job:
+ *    shared state of the workers of one multi_scan call.
+ */
+struct _multi_job
+{
+  multi_session *m;
+  const scan_params *p;
+  struct _multi_item *items;
+  multi_scan_cb cb;
+  void *arg;
+  long hits;
+  pthread_mutex_t lock;
+  mem_reader *readers;              /* one per worker */
+  int *reader_target;               /* target each reader is set up for,
+                                     * -1 if none yet */
+};
+
+
+
+/*  _maps_readable:
+ *    whether a process' maps can be read, parse_proc_maps exits otherwise.
+ */
+static int
+_maps_readable(int pid)
+{
+  char path[32];
+  FILE *f;
+
+  snprintf(path, sizeof(path), "/proc/%d/maps", pid);
+  if ((f = fopen(path, "r")) == NULL)
+    return 0;
+
+  fclose(f);
+  return 1;
+}
+
+
+/*  multi_attach:
+ *    attaches to every given process whose maps can be read, processes
+ *    that exited or can't be accessed are skipped. returns the amount of
+ *    processes attached.
+ *
+ *    multi_session *m:   session to initialize
+ *    const int *pids:    processes to attach to
+ *    int n:              number of entries in pids
+ *    int backend:        enum mem_backend to read memory with
+ */
+int
+multi_attach(multi_session *m, const int *pids, int n, int backend)
+{
+  int i;
+  multi_target *t;
+
+  m->targets = calloc(n ? n : 1, sizeof(multi_target));
+  m->count = 0;
+  m->backend = backend;
+  m->modules = sym_cache_new();
+
+  for (i = 0; i < n; i++)
+  {
+    if (!_maps_readable(pids[i]))
+      continue;
+
+    t = &m->targets[m->count];
+    t->pid = pids[i];
+    t->maps = parse_proc_maps(pids[i]);
+    if (t->maps == NULL)
+      continue;
+
+    mem_reader_init(&t->reader, pids[i], backend);
+    m->count++;
+  }
+
+  return m->count;
+}
+
+
+/*  multi_detach:
+ *    releases every target and the shared module cache.
+ */
+void
+multi_detach(multi_session *m)
+{
+  int i;
+
+  for (i = 0; i < m->count; i++)
+  {
+    free_proc_maps(m->targets[i].maps);
+    mem_reader_close(&m->targets[i].reader);
+  }
+
+  sym_cache_free(m->modules);
+  free(m->targets);
+  m->targets = NULL;
+  m->count = 0;
+}
+
+
+/*  multi_refresh:
+ *    parses the maps of every target again. targets that exited keep
+ *    their last maps, reads from them simply fail.
+ */
+void
+multi_refresh(multi_session *m)
+{
+  int i;
+  ll_memmap_file *maps;
+
+  for (i = 0; i < m->count; i++)
+  {
+    if (!_maps_readable(m->targets[i].pid)
+        || (maps = parse_proc_maps(m->targets[i].pid)) == NULL)
+      continue;
+
+    free_proc_maps(m->targets[i].maps);
+    m->targets[i].maps = maps;
+  }
+}
+
+
+/*  _trim:
+ *    drops the hits at or above limit, which are in the last blocks since
+ *    hits are stored in address order.
+ */
+static void
+_trim(scan_results *res, uintptr_t limit)
+{
+  while (res->count && scan_results_get(res, res->count - 1) >= limit)
+  {
+    res->count--;
+    if (--res->blocks[res->nblocks - 1].count == 0)
+      res->nblocks--;
+  }
+}
+
+
+/*  _multi_worker:
+ *    scans one work item with the worker's own reader, so workers never
+ *    share a reader's fds or queues. the reader is only set up again when
+ *    the worker moves on to another target.
+ */
+static void
+_multi_worker(int item, int worker, void *arg)
+{
+  struct _multi_job *job = arg;
+  struct _multi_item *it = &job->items[item];
+  const multi_target *t = &job->m->targets[it->target];
+  mem_reader *r = &job->readers[worker];
+  scan_results res;
+
+  if (job->reader_target[worker] != it->target) {
+    if (job->reader_target[worker] >= 0)
+      mem_reader_close(r);
+
+    mem_reader_init(r, t->pid, job->m->backend);
+    if (t->reader.snap != NULL)
+      mem_reader_snapshot(r, t->reader.snap);
+    job->reader_target[worker] = it->target;
+  }
+
+  scan_results_init(&res);
+
+  scan_first(&res, r, job->p, &it->range, 1);
+  _trim(&res, it->limit);
+
+  if (res.count) {
+    pthread_mutex_lock(&job->lock);
+    job->cb(t, &res, job->arg);
+    job->hits += res.count;
+    pthread_mutex_unlock(&job->lock);
+  }
+
+  scan_results_free(&res);
+}
+
+
+/*  _build_items:
+ *    splits every target's ranges into work items of at most MULTI_CHUNK
+ *    bytes, taking one item from each target in turn. workers claim items
+ *    in order, so all targets progress at the same pace instead of one
+ *    process being finished before the next is started. for unaligned
+ *    scans items overlap so values crossing a split are still found.
+ */
+static int
+_build_items(multi_session *m, uint8_t mode, int aligned,
+             struct _multi_item **out)
+{
+  int i, n = 0, cap = 0, left;
+  int *nranges, *cur;
+  uintptr_t *pos, end;
+  mem_range **ranges;
+  struct _multi_item *it;
+
+  ranges = calloc(m->count, sizeof(mem_range *));
+  nranges = calloc(m->count, sizeof(int));
+  cur = calloc(m->count, sizeof(int));
+  pos = calloc(m->count, sizeof(uintptr_t));
+
+  for (i = 0; i < m->count; i++)
+  {
+    nranges[i] = mem_ranges_from_maps(m->targets[i].maps, mode, &ranges[i]);
+    if (nranges[i] > 0)
+      pos[i] = (uintptr_t) ranges[i][0].start;
+  }
+
+  *out = NULL;
+  do {
+    left = 0;
+
+    for (i = 0; i < m->count; i++)
+    {
+      if (cur[i] >= nranges[i])
+        continue;
+
+      if (n == cap) {
+        cap = cap ? cap * 2 : 256;
+        *out = realloc(*out, cap * sizeof(struct _multi_item));
+      }
+
+      end = (uintptr_t) ranges[i][cur[i]].end;
+      if (end - pos[i] > MULTI_CHUNK)
+        end = pos[i] + MULTI_CHUNK;
+
+      it = &(*out)[n++];
+      it->target = i;
+      it->range.start = (void *) pos[i];
+      it->range.end = (void *) end;
+      it->limit = end;
+
+      if (!aligned && end < (uintptr_t) ranges[i][cur[i]].end)
+        it->range.end = (void *) (end + MULTI_OVERLAP);
+
+      pos[i] = end;
+      if (end == (uintptr_t) ranges[i][cur[i]].end && ++cur[i] < nranges[i])
+        pos[i] = (uintptr_t) ranges[i][cur[i]].start;
+
+      left |= cur[i] < nranges[i];
+    }
+  } while (left);
+
+  for (i = 0; i < m->count; i++)
+    free(ranges[i]);
+  free(ranges);
+  free(nranges);
+  free(cur);
+  free(pos);
+
+  return n;
+}
+
+
+/*  multi_scan:
+ *    scans the memory of every target in one pass on a shared pool of
+ *    worker threads. hits are passed to cb per work item, tagged with the
+ *    target they belong to. returns the total amount of hits, or -1 for
+ *    invalid parameters.
+ *
+ *    multi_session *m:       attached targets
+ *    const scan_params *p:   what to look for
+ *    uint8_t mode:           enum module_perms bits a mapping must have
+ *    int nthreads:           worker threads, 0 for one per cpu
+ *    multi_scan_cb cb:       receives the hits
+ *    void *arg:              passed through to cb
+ */
+long
+multi_scan(multi_session *m, const scan_params *p, uint8_t mode,
+           int nthreads, multi_scan_cb cb, void *arg)
+{
+  int n, i;
+  struct _multi_job job;
+
+  if (scan_kernel_select(p) == NULL)
+    return -1;
+
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+
+  memset(&job, 0, sizeof(job));
+  job.m = m;
+  job.p = p;
+  job.cb = cb;
+  job.arg = arg;
+  pthread_mutex_init(&job.lock, NULL);
+
+  job.readers = malloc(nthreads * sizeof(mem_reader));
+  job.reader_target = malloc(nthreads * sizeof(int));
+  for (i = 0; i < nthreads; i++)
+    job.reader_target[i] = -1;
+
+  n = _build_items(m, mode, p->aligned, &job.items);
+  parallel_for(n, nthreads, _multi_worker, &job);
+
+  for (i = 0; i < nthreads; i++)
+    if (job.reader_target[i] >= 0)
+      mem_reader_close(&job.readers[i]);
+
+  pthread_mutex_destroy(&job.lock);
+  free(job.readers);
+  free(job.reader_target);
+  free(job.items);
+
+  return job.hits;
+}
@@ -0,0 +1,49 @@
+#ifndef __MULTI_H
+#define __MULTI_H
+
+#include "mem.h"
+#include "scan.h"
+#include "symbols.h"
+
+#include <stdint.h>
+
+/*  _multi_target:
+ *    one attached process of a multi-target session.
+ */
+typedef struct _multi_target
+{
+  int pid;
+  ll_memmap_file *maps;
+  mem_reader reader;                /* for single threaded operations */
+} multi_target;
+
+
+/*  _multi_session:
+ *    a set of processes worked on together, usually every instance of one
+ *    binary. module symbol tables are parsed once and shared between all
+ *    targets.
+ */
+typedef struct _multi_session
+{
+  multi_target *targets;
+  int count;
+  int backend;                      /* enum mem_backend used for reads */
+  sym_cache *modules;
+} multi_session;
+
+
+/*  multi_scan_cb:
+ *    receives the hits of one chunk of one target. calls are serialized,
+ *    but come from the worker threads in no particular order.
+ */
+typedef void (*multi_scan_cb)(const multi_target*, const scan_results*,
+                              void*);
+
+/* function definitions */
+int  multi_attach(multi_session*, const int*, int, int);
+void multi_detach(multi_session*);
+void multi_refresh(multi_session*);
+long multi_scan(multi_session*, const scan_params*, uint8_t, int,
+                multi_scan_cb, void*);
+
+#endif /* __MULTI_H */
@@ -0,0 +1,269 @@
+#include "ndjson.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* member names, indexed by enum ndj_field */
+static const char *field_names[NDJ_FIELDS] = {
+  "q", "op", "pid", "addr", "end", "len", "perms", "offset", "dev",
+  "inode", "path", "type", "encoding", "text", "name", "size", "module",
+  "used", "free", "frag", "rss", "pss", "swap", "huge", "dirty", "entropy",
+  "dup", "ns", "count", "done", "error",
+};
+
+
+
+/*  ndj_init:
+ *    prepares a writer.
+ *
+ *    ndj_writer *w:    writer to initialize
+ *    int fd:           file descriptor to write to
+ *    size_t cap:       buffer size, output is written once it fills up or
+ *                      on ndj_flush
+ *    uint32_t fields:  fields to write, NDJ_ALL for every field
+ */
+void
+ndj_init(ndj_writer *w, int fd, size_t cap, uint32_t fields)
+{
+  w->fd = fd;
+  w->cap = cap < 4096 ? 4096 : cap;
+  w->buf = malloc(w->cap);
+  w->len = 0;
+  w->fields = fields | NDJ_ALWAYS;
+  w->first = 1;
+}
+
+
+/*  ndj_free:
+ *    flushes and releases the writer's buffer.
+ */
+void
+ndj_free(ndj_writer *w)
+{
+  ndj_flush(w);
+  free(w->buf);
+  w->buf = NULL;
+}
+
+
+/*  ndj_fields_parse:
+ *    parses a comma separated list of field names into a field mask.
+ *    returns 0 on success or -1 if a name is unknown.
+ *
+ *    const char *list:   e.g. "addr,path"
+ *    uint32_t *out:      receives the mask
+ */
+int
+ndj_fields_parse(const char *list, uint32_t *out)
+{
+  int i;
+  size_t len;
+  const char *p, *comma;
+
+  *out = NDJ_ALWAYS;
+
+  for (p = list; *p; p = *comma ? comma + 1 : comma)
+  {
+    comma = strchr(p, ',');
+    if (comma == NULL)
+      comma = p + strlen(p);
+    len = comma - p;
+
+    for (i = 0; i < NDJ_FIELDS; i++)
+      if (strlen(field_names[i]) == len
+          && strncmp(field_names[i], p, len) == 0)
+        break;
+
+    if (i == NDJ_FIELDS)
+      return -1;
+
+    *out |= 1u << i;
+  }
+
+  return 0;
+}
+
+
+/*  _write_all:
+ *    writes len bytes to fd, retrying on short writes.
+ */
+static void
+_write_all(int fd, const char *s, size_t len)
+{
+  size_t off = 0;
+  ssize_t n;
+
+  while (off < len)
+  {
+    n = write(fd, s + off, len - off);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    off += n;
+  }
+}
+
+
+/*  ndj_flush:
+ *    writes out everything buffered so far.
+ */
+void
+ndj_flush(ndj_writer *w)
+{
+  _write_all(w->fd, w->buf, w->len);
+  w->len = 0;
+}
+
+
+/*  _put:
+ *    appends len bytes, writing the buffer out first if they don't fit.
+ */
+static inline void
+_put(ndj_writer *w, const char *s, size_t len)
+{
+  if (w->len + len > w->cap) {
+    ndj_flush(w);
+
+    /* larger than the whole buffer, pass it straight through */
+    if (len > w->cap) {
+      _write_all(w->fd, s, len);
+      return;
+    }
+  }
+
+  memcpy(w->buf + w->len, s, len);
+  w->len += len;
+}
+
+
+/*  _key:
+ *    writes the separator and member name. returns 0 if the field isn't
+ *    selected and should be skipped.
+ */
+static int
+_key(ndj_writer *w, int field)
+{
+  if (!(w->fields & (1u << field)))
+    return 0;
+
+  if (!w->first)
+    _put(w, ",", 1);
+  w->first = 0;
+
+  _put(w, "\"", 1);
+  _put(w, field_names[field], strlen(field_names[field]));
+  _put(w, "\":", 2);
+  return 1;
+}
+
+
+/*  ndj_begin:
+ *    starts a record.
+ */
+void
+ndj_begin(ndj_writer *w)
+{
+  _put(w, "{", 1);
+  w->first = 1;
+}
+
+
+/*  ndj_end:
+ *    ends a record. records stay buffered until the buffer fills or
+ *    ndj_flush is called.
+ */
+void
+ndj_end(ndj_writer *w)
+{
+  _put(w, "}\n", 2);
+}
+
+
+void
+ndj_u64(ndj_writer *w, int field, uint64_t v)
+{
+  char tmp[24];
+
+  if (_key(w, field))
+    _put(w, tmp, snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long) v));
+}
+
+
+/*  ndj_hex:
+ *    writes a number as a "0x..." string, used for addresses so they don't
+ *    lose precision in parsers using doubles.
+ */
+void
+ndj_hex(ndj_writer *w, int field, uint64_t v)
+{
+  char tmp[24];
+
+  if (_key(w, field))
+    _put(w, tmp, snprintf(tmp, sizeof(tmp), "\"0x%llx\"",
+                          (unsigned long long) v));
+}
+
+
+/*  ndj_raw:
+ *    writes a value that's already valid JSON, e.g. true or a number.
+ */
+void
+ndj_raw(ndj_writer *w, int field, const char *json)
+{
+  if (_key(w, field))
+    _put(w, json, strlen(json));
+}
+
+
+/*  ndj_bytes:
+ *    writes len bytes as a JSON string, escaping quotes, backslashes and
+ *    control characters. bytes above 0x7f are passed through, so valid
+ *    UTF-8 stays readable.
+ */
+void
+ndj_bytes(ndj_writer *w, int field, const uint8_t *s, size_t len)
+{
+  size_t i, start;
+  char esc[8];
+
+  if (!_key(w, field))
+    return;
+
+  _put(w, "\"", 1);
+
+  for (i = start = 0; i < len; i++)
+  {
+    if (s[i] >= 0x20 && s[i] != '"' && s[i] != '\\' && s[i] != 0x7f)
+      continue;
+
+    _put(w, (const char *) s + start, i - start);
+    start = i + 1;
+
+    switch (s[i])
+    {
+      case '"':  _put(w, "\\\"", 2); break;
+      case '\\': _put(w, "\\\\", 2); break;
+      case '\n': _put(w, "\\n", 2); break;
+      case '\r': _put(w, "\\r", 2); break;
+      case '\t': _put(w, "\\t", 2); break;
+      default:
+        _put(w, esc, snprintf(esc, sizeof(esc), "\\u%04x", s[i]));
+        break;
+    }
+  }
+
+  _put(w, (const char *) s + start, len - start);
+  _put(w, "\"", 1);
+}
+
+
+void
+ndj_str(ndj_writer *w, int field, const char *s)
+{
+  ndj_bytes(w, field, (const uint8_t *) s, strlen(s));
+}
@@ -0,0 +1,79 @@
+#ifndef __NDJSON_H
+#define __NDJSON_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* fields a record can carry, selectable with ndj_fields_parse. q, op,
+ * pid, count, done and error are always written */
+enum ndj_field {
+  NDJ_Q = 0,                        /* query number                      */
+  NDJ_OP,                           /* operation that produced a record  */
+  NDJ_PID,                          /* process a record belongs to       */
+  NDJ_ADDR,
+  NDJ_END,
+  NDJ_LEN,
+  NDJ_PERMS,
+  NDJ_OFFSET,
+  NDJ_DEV,
+  NDJ_INODE,
+  NDJ_PATH,
+  NDJ_TYPE,
+  NDJ_ENCODING,
+  NDJ_TEXT,
+  NDJ_NAME,
+  NDJ_SIZE,
+  NDJ_MODULE,
+  NDJ_USED,                         /* bytes in use                      */
+  NDJ_FREE,                         /* bytes free                        */
+  NDJ_FRAG,
+  NDJ_RSS,                          /* resident bytes                    */
+  NDJ_PSS,                          /* proportional set size in bytes    */
+  NDJ_SWAP,
+  NDJ_HUGE,                         /* bytes in transparent huge pages   */
+  NDJ_DIRTY,
+  NDJ_ENTROPY,                      /* bits per byte                     */
+  NDJ_DUP,                          /* duplicated bytes                  */
+  NDJ_NS,                           /* nanoseconds                       */
+  NDJ_COUNT,
+  NDJ_DONE,
+  NDJ_ERROR,
+  NDJ_FIELDS,
+};
+
+#define NDJ_ALWAYS  ((1u << NDJ_Q) | (1u << NDJ_OP) | (1u << NDJ_PID)         \
+                     | (1u << NDJ_COUNT) | (1u << NDJ_DONE)                   \
+                     | (1u << NDJ_ERROR))
+#define NDJ_ALL     ((1u << NDJ_FIELDS) - 1)
+
+
+/*  _ndjson_writer:
+ *    buffered newline delimited JSON output. records are only split across
+ *    writes if a single record is larger than the buffer.
+ */
+typedef struct _ndjson_writer
+{
+  int fd;
+  char *buf;
+  size_t len, cap;
+  uint32_t fields;                  /* 1 << enum ndj_field bits to write */
+  int first;                        /* no member written in this record  */
+} ndj_writer;
+
+
+/* function definitions */
+void ndj_init(ndj_writer*, int, size_t, uint32_t);
+void ndj_free(ndj_writer*);
+int  ndj_fields_parse(const char*, uint32_t*);
+
+void ndj_begin(ndj_writer*);
+void ndj_end(ndj_writer*);
+void ndj_flush(ndj_writer*);
+
+void ndj_u64(ndj_writer*, int, uint64_t);
+void ndj_hex(ndj_writer*, int, uint64_t);
+void ndj_raw(ndj_writer*, int, const char*);
+void ndj_str(ndj_writer*, int, const char*);
+void ndj_bytes(ndj_writer*, int, const uint8_t*, size_t);
+
+#endif /* __NDJSON_H */
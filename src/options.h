@@ -14,6 +14,9 @@ class Options {
      *    0 = start in detached mode
      *    1 = open process with id (userland)
      *    2 = wrap process 
+     *    4 = consistent capture, the process is paused only while the
+     *        selected regions are copied and is analysed from the copy
+     *        (see snapshot.h)
      */
     uint8_t m_attach_mode = 0;
 
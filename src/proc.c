@@ -60,6 +60,40 @@ validate_proc_dir(int fd, char *entry)
 }
 
 
+/*  _match_proc_entry:
+ *    returns whether the /proc entry is a process whose executable's name
+ *    or full path is proc_name.
+ *
+ *    DIR *proc_dirp:         open handle to /proc
+ *    char *entry:            name of the entry in /proc
+ *    const char *proc_name:  name or path to match
+ */
+static int
+_match_proc_entry(DIR *proc_dirp, char *entry, const char *proc_name)
+{
+  char *exe_name,
+       link_path[PATHLEN], /* TODO: can limit to max amount of pids instead */
+       exe_path[PATHLEN];
+
+  /* if the file isn't what we're looking for */
+  if (!validate_proc_dir(dirfd(proc_dirp), entry))
+    return false;
+
+  /* try to get the exe file path from the proc entry */
+  snprintf(link_path, PATHLEN, "/proc/%s/exe", entry);
+
+  memset(exe_path, '\0', PATHLEN);  /* zero out exe_path because readlink
+                                     * doesn't terminate it correctly */
+  if (readlink(link_path, exe_path, PATHLEN) == -1)
+    return false;
+
+  exe_name = basename(exe_path);
+
+  /* TODO: fuzzy match */
+  return strcmp(exe_name, proc_name) == 0 || strcmp(exe_path, proc_name) == 0;
+}
+
+
 /*  lookup_pid:
  *    returns the first process id (pid) matching proc_name, or -1 on failure
  *    TODO: return the last procid
@@ -69,9 +103,6 @@ lookup_pid (char *proc_name)
 {
   int pid;
   DIR *proc_dirp;
-  char *exe_name,
-       link_path[PATHLEN], /* TODO: can limit to max amount of pids instead */
-       exe_path[PATHLEN];
   struct dirent *entry;
 
   proc_dirp = opendir((char *) "/proc");
@@ -80,22 +111,7 @@ lookup_pid (char *proc_name)
 
   while ((entry = readdir(proc_dirp)) != NULL)
   {
-    /* if the file isn't what we're looking for */
-    if (!validate_proc_dir(dirfd(proc_dirp), entry->d_name))
-      continue;
-
-    /* try to get the exe file path from the proc entry */
-    snprintf(link_path, PATHLEN, "/proc/%s/exe", entry->d_name);
-    
-    memset(exe_path, '\0', PATHLEN);  /* zero out exe_path because readlink
-                                       * doesn't terminate it correctly */
-    if (readlink(link_path, exe_path, PATHLEN) == -1)
-      continue;
-    
-    exe_name = basename(exe_path);
-    
-    /* TODO: fuzzy match */
-    if (strcmp(exe_name, proc_name) == 0 || strcmp(exe_path, proc_name) == 0) {
+    if (_match_proc_entry(proc_dirp, entry->d_name, proc_name)) {
       pid = atoi(entry->d_name);
       closedir(proc_dirp);
       return pid;
@@ -105,3 +121,41 @@ lookup_pid (char *proc_name)
   closedir(proc_dirp);
   return -1;
 }
+
+
+/*  lookup_pids:
+ *    finds every process id matching proc_name. the caller frees *pids.
+ *    returns the amount of matches, or -1 if /proc can't be read.
+ *
+ *    const char *proc_name:  executable name or full path to match
+ *    int **pids:             receives the array of matching pids
+ */
+int
+lookup_pids(const char *proc_name, int **pids)
+{
+  int n = 0, cap = 0;
+  DIR *proc_dirp;
+  struct dirent *entry;
+
+  *pids = NULL;
+
+  proc_dirp = opendir((char *) "/proc");
+  if (proc_dirp == NULL)
+    return -1;
+
+  while ((entry = readdir(proc_dirp)) != NULL)
+  {
+    if (!_match_proc_entry(proc_dirp, entry->d_name, proc_name))
+      continue;
+
+    if (n == cap) {
+      cap = cap ? cap * 2 : 64;
+      *pids = realloc(*pids, cap * sizeof(int));
+    }
+
+    (*pids)[n++] = atoi(entry->d_name);
+  }
+
+  closedir(proc_dirp);
+  return n;
+}
@@ -9,10 +9,12 @@
 typedef struct _open_process
 {
   int pid;                      /* pid of the process to interact with    */
-  FILE *mem;                    /* handle to interact with the memory     */
+  mem_reader mem;               /* reads the process' memory, through any
+                                 * of the mem_backend mechanisms          */
   ll_memmap_file *ll_files;     /* start of the linked list of open files */
 } process;
 
 int lookup_pid(char*);
+int lookup_pids(const char*, int**);
 
 #endif /* __PROC_H */
@@ -0,0 +1,451 @@
+#include "scan.h"
+#include "hostutil.h"
+#include "stats.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+#define SCAN_BLOCK    256             /* elements compared per inner loop */
+#define CHUNK_PAGES   256             /* pages read per batch             */
+#define PAGE_SIZE     4096
+#define CHUNK_SIZE    (CHUNK_PAGES * PAGE_SIZE)
+#define CARRY_MAX     8               /* bytes carried between chunks     */
+
+#define PAGE_DOWN(a)  ((a) & ~((uintptr_t) PAGE_SIZE - 1))
+#define PAGE_UP(a)    PAGE_DOWN((a) + PAGE_SIZE - 1)
+
+/* instruction sets kernels are compiled for */
+enum scan_isa {
+  ISA_BASE = 0,                       /* build target, SSE2 on x86-64 */
+  ISA_AVX2,
+  ISA_COUNT,
+};
+
+
+/*  _collect:
+ *    turns blocks of 0/1 compare flags into hit offsets, one flag block per
+ *    phase (byte offset into a value). hits are emitted in address order.
+ *    eight flags of every phase are tested at a time so stretches without
+ *    hits cost a single compare.
+ *
+ *    flags:      SCAN_BLOCK flags for each phase
+ *    phases:     1 for aligned scans, the value size for unaligned ones
+ *    base:       offset of the block in the scanned buffer
+ *    size:       value size in bytes, the distance between flags of a phase
+ *    out:        receives the offsets
+ */
+static inline __attribute__((always_inline)) size_t
+_collect(uint8_t flags[][SCAN_BLOCK], size_t phases, size_t base, size_t size,
+         uint32_t *out)
+{
+  size_t j, k, m, hits = 0;
+  uint64_t w, any;
+
+  for (j = 0; j < SCAN_BLOCK; j += 8)
+  {
+    for (any = 0, k = 0; k < phases; k++)
+    {
+      memcpy(&w, flags[k] + j, 8);
+      any |= w;
+    }
+
+    if (!any)
+      continue;
+
+    for (m = j; m < j + 8; m++)
+      for (k = 0; k < phases; k++)
+        if (flags[k][m])
+          out[hits++] = base + m * size + k;
+  }
+
+  return hits;
+}
+
+
+/* compare predicates, lo/hi/tol are locals of the generated kernel */
+#define PRED_exact(v)       ((v) == lo)
+#define PRED_range(v)       (((v) >= lo) & ((v) <= hi))
+#define PRED_tolerance(v)   ((((v) - lo) <= tol) & ((lo - (v)) <= tol))
+
+
+/*  SCAN_KERNEL:
+ *    generates one kernel for a given instruction set, value type, compare
+ *    and stride. values are compared a block at a time into a flag array
+ *    with no branches, which lets the compiler vectorize the loop for the
+ *    target, then _collect extracts the hits. unaligned scans run the same
+ *    naturally strided loop once per phase (byte offset into a value) rather
+ *    than loading overlapping values, which doesn't vectorize. the tail is
+ *    done one value at a time.
+ */
+#define SCAN_KERNEL(isa, attr, tname, T, field, cmp, sname, phases)           \
+static attr size_t                                                            \
+scan_##isa##_##tname##_##cmp##_##sname(const uint8_t *buf, size_t len,        \
+                                       const scan_params *p, uint32_t *out)   \
+{                                                                             \
+  const T lo = p->lo.field, hi = p->hi.field, tol = (T) p->tolerance;         \
+  const size_t span = SCAN_BLOCK * sizeof(T);                                 \
+  uint8_t flags[phases][SCAN_BLOCK];                                          \
+  size_t i, j, k, hits = 0;                                                   \
+  T v;                                                                        \
+                                                                              \
+  (void) hi; (void) tol;                                                      \
+  for (i = 0; i + span + (phases) - 1 <= len; i += span)                      \
+  {                                                                           \
+    for (k = 0; k < (phases); k++)                                            \
+    {                                                                         \
+      for (j = 0; j < SCAN_BLOCK; j++)                                        \
+      {                                                                       \
+        memcpy(&v, buf + i + k + j * sizeof(T), sizeof(T));                   \
+        flags[k][j] = PRED_##cmp(v);                                          \
+      }                                                                       \
+    }                                                                         \
+    hits += _collect(flags, (phases), i, sizeof(T), out + hits);              \
+  }                                                                           \
+                                                                              \
+  for (; i + sizeof(T) <= len; i += sizeof(T) / (phases))                     \
+  {                                                                           \
+    memcpy(&v, buf + i, sizeof(T));                                           \
+    if (PRED_##cmp(v))                                                        \
+      out[hits++] = i;                                                        \
+  }                                                                           \
+                                                                              \
+  return hits;                                                                \
+}
+
+/* both strides of one compare */
+#define SCAN_KERNEL_STRIDES(isa, attr, tname, T, field, cmp)                  \
+  SCAN_KERNEL(isa, attr, tname, T, field, cmp, aligned, 1)                    \
+  SCAN_KERNEL(isa, attr, tname, T, field, cmp, unaligned, sizeof(T))
+
+/* integer types have no tolerance compare */
+#define SCAN_KERNELS_INT(isa, attr, tname, T, field)                          \
+  SCAN_KERNEL_STRIDES(isa, attr, tname, T, field, exact)                      \
+  SCAN_KERNEL_STRIDES(isa, attr, tname, T, field, range)
+
+#define SCAN_KERNELS_FLOAT(isa, attr, tname, T, field)                        \
+  SCAN_KERNELS_INT(isa, attr, tname, T, field)                                \
+  SCAN_KERNEL_STRIDES(isa, attr, tname, T, field, tolerance)
+
+/* every kernel for one instruction set */
+#define SCAN_KERNELS_ISA(isa, attr)                                           \
+  SCAN_KERNELS_INT(isa, attr, int8, int8_t, i8)                               \
+  SCAN_KERNELS_INT(isa, attr, int16, int16_t, i16)                            \
+  SCAN_KERNELS_INT(isa, attr, int32, int32_t, i32)                            \
+  SCAN_KERNELS_INT(isa, attr, int64, int64_t, i64)                            \
+  SCAN_KERNELS_FLOAT(isa, attr, float, float, f32)                            \
+  SCAN_KERNELS_FLOAT(isa, attr, double, double, f64)
+
+
+/* dispatch table rows, [cmp][stride] for one type */
+#define ROW_INT(isa, tname)                                                   \
+  { { scan_##isa##_##tname##_exact_unaligned,                                 \
+      scan_##isa##_##tname##_exact_aligned },                                 \
+    { scan_##isa##_##tname##_range_unaligned,                                 \
+      scan_##isa##_##tname##_range_aligned },                                 \
+    { NULL, NULL } }
+
+#define ROW_FLOAT(isa, tname)                                                 \
+  { { scan_##isa##_##tname##_exact_unaligned,                                 \
+      scan_##isa##_##tname##_exact_aligned },                                 \
+    { scan_##isa##_##tname##_range_unaligned,                                 \
+      scan_##isa##_##tname##_range_aligned },                                 \
+    { scan_##isa##_##tname##_tolerance_unaligned,                             \
+      scan_##isa##_##tname##_tolerance_aligned } }
+
+#define ROWS_ISA(isa)                                                         \
+  { ROW_INT(isa, int8), ROW_INT(isa, int16), ROW_INT(isa, int32),             \
+    ROW_INT(isa, int64), ROW_FLOAT(isa, float), ROW_FLOAT(isa, double) }
+
+
+SCAN_KERNELS_ISA(base, )
+
+#if defined(__x86_64__) || defined(__i386__)
+SCAN_KERNELS_ISA(avx2, __attribute__((target("avx2"))))
+#endif
+
+static const scan_kernel kernels[ISA_COUNT][SCAN_TYPES][SCAN_CMPS][2] = {
+  ROWS_ISA(base),
+#if defined(__x86_64__) || defined(__i386__)
+  ROWS_ISA(avx2),
+#endif
+};
+
+
+
+/*  scan_type_size:
+ *    returns the size in bytes of a scan type, or 0 for an invalid type.
+ *
+ *    int type:   enum scan_type
+ */
+size_t
+scan_type_size(int type)
+{
+  static const size_t sizes[SCAN_TYPES] = { 1, 2, 4, 8, 4, 8 };
+
+  if (type < 0 || type >= SCAN_TYPES)
+    return 0;
+
+  return sizes[type];
+}
+
+
+/*  scan_kernel_select:
+ *    picks the kernel for the given parameters and the best instruction set
+ *    the cpu supports. this is meant to be called once per scan, the kernel
+ *    doesn't branch on the parameters itself. returns NULL for unsupported
+ *    combinations.
+ *
+ *    const scan_params *p:   parameters of the scan
+ */
+scan_kernel
+scan_kernel_select(const scan_params *p)
+{
+  int isa = ISA_BASE;
+
+  if (p->type < 0 || p->type >= SCAN_TYPES || p->cmp < 0
+      || p->cmp >= SCAN_CMPS)
+    return NULL;
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (host_has(HOST_AVX2))
+    isa = ISA_AVX2;
+#endif
+
+  return kernels[isa][p->type][p->cmp][p->aligned ? 1 : 0];
+}
+
+
+/*  scan_results_init:
+ *    initializes an empty result buffer.
+ */
+void
+scan_results_init(scan_results *res)
+{
+  memset(res, 0, sizeof(scan_results));
+}
+
+
+/*  scan_results_free:
+ *    frees the memory held by a result buffer and empties it.
+ */
+void
+scan_results_free(scan_results *res)
+{
+  free(res->blocks);
+  free(res->offsets);
+  scan_results_init(res);
+}
+
+
+/*  scan_results_get:
+ *    returns the address of the i-th hit, or 0 if i is out of range.
+ *
+ *    const scan_results *res:  result buffer
+ *    size_t i:                 index of the hit
+ */
+uintptr_t
+scan_results_get(const scan_results *res, size_t i)
+{
+  size_t lo = 0, hi = res->nblocks, mid;
+
+  if (i >= res->count)
+    return 0;
+
+  /* find the last block starting at or before i */
+  while (hi - lo > 1)
+  {
+    mid = (lo + hi) / 2;
+    if (res->blocks[mid].first <= i)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  return res->blocks[lo].base + res->offsets[i];
+}
+
+
+/*  _scan_run:
+ *    runs the kernel over a contiguous buffer of readable memory starting at
+ *    addr and appends its hits as a new block.
+ */
+static void
+_scan_run(scan_results *res, scan_kernel k, const scan_params *p,
+          const uint8_t *buf, size_t len, uintptr_t addr)
+{
+  size_t hits;
+  uint64_t t0;
+  scan_block *b;
+
+  /* worst case every byte is a hit */
+  if (res->count + len > res->cap) {
+    res->cap = (res->count + len) * 2;
+    res->offsets = realloc(res->offsets, res->cap * sizeof(uint32_t));
+    if (res->offsets == NULL)
+      die(1, "scan: failed to grow result buffer");
+  }
+
+  t0 = stat_now();
+  hits = k(buf, len, p, res->offsets + res->count);
+  stat_time(STAT_T_SCAN, t0);
+
+  stat_add(STAT_SCAN_CHUNKS, 1);
+  stat_add(STAT_SCAN_BYTES, len);
+  stat_add(STAT_SCAN_HITS, hits);
+
+  if (hits == 0)
+    return;
+
+  if (res->nblocks == res->cap_blocks) {
+    res->cap_blocks = res->cap_blocks ? res->cap_blocks * 2 : 256;
+    res->blocks = realloc(res->blocks, res->cap_blocks * sizeof(scan_block));
+  }
+
+  b = &res->blocks[res->nblocks++];
+  b->base = addr;
+  b->first = res->count;
+  b->count = hits;
+  res->count += hits;
+}
+
+
+/*  _scan_chunk:
+ *    up to CHUNK_PAGES pages of a range. while one chunk is scanned the
+ *    next one is already being read, which overlaps the reads with the
+ *    compares on backends that read in the background.
+ */
+struct _scan_chunk
+{
+  int range, cnt;
+  uintptr_t addr;
+  uint8_t *buf;                       /* CARRY_MAX bytes, then the data */
+  mem_readreq reqs[CHUNK_PAGES];
+};
+
+
+/*  _chunk_start:
+ *    submits the reads of the first chunk at or after addr in range, moving
+ *    on to the next ranges once a range is done. returns 0 if there is
+ *    nothing left to read.
+ */
+static int
+_chunk_start(struct _scan_chunk *c, mem_reader *r, const mem_range *ranges,
+             int n, int range, uintptr_t addr)
+{
+  int pg;
+  uintptr_t start, end;
+
+  for (; range < n; range++, addr = 0)
+  {
+    start = PAGE_DOWN((uintptr_t) ranges[range].start);
+    end = PAGE_UP((uintptr_t) ranges[range].end);
+    if (addr < start)
+      addr = start;
+    if (addr >= end)
+      continue;
+
+    c->range = range;
+    c->addr = addr;
+    c->cnt = (end - addr) / PAGE_SIZE;
+    if (c->cnt > CHUNK_PAGES)
+      c->cnt = CHUNK_PAGES;
+
+    for (pg = 0; pg < c->cnt; pg++)
+    {
+      c->reqs[pg].addr = (void *) (addr + (size_t) pg * PAGE_SIZE);
+      c->reqs[pg].buf = c->buf + CARRY_MAX + (size_t) pg * PAGE_SIZE;
+      c->reqs[pg].len = PAGE_SIZE;
+    }
+
+    mem_read_submit(r, c->reqs, c->cnt);
+    return 1;
+  }
+
+  return 0;
+}
+
+
+/*  scan_first:
+ *    the initial scan over a set of ranges. memory is read in batches of
+ *    single page requests, and every run of readable pages is handed to the
+ *    kernel in one go. the next batch is submitted before the current one
+ *    is scanned. for unaligned scans the last bytes of a run are carried
+ *    over so values crossing a chunk boundary aren't missed. returns the
+ *    amount of hits added, or -1 for invalid parameters.
+ *
+ *    scan_results *res:        buffer to append hits to
+ *    mem_reader *r:            reader for the target process
+ *    const scan_params *p:     what to look for
+ *    const mem_range *ranges:  ranges to scan
+ *    int n:                    number of entries in ranges
+ */
+int
+scan_first(scan_results *res, mem_reader *r, const scan_params *p,
+           const mem_range *ranges, int n)
+{
+  int pg, cnt, run, more;
+  size_t carry = 0, before = res->count, tsize;
+  uintptr_t addr;
+  uint8_t *data;
+  scan_kernel k;
+  struct _scan_chunk *chunks, *cur, *next, *tmp;
+
+  k = scan_kernel_select(p);
+  if (k == NULL)
+    return -1;
+
+  tsize = scan_type_size(p->type);
+  chunks = malloc(2 * sizeof(struct _scan_chunk));
+  chunks[0].buf = malloc(2 * (CARRY_MAX + CHUNK_SIZE));
+  chunks[1].buf = chunks[0].buf + CARRY_MAX + CHUNK_SIZE;
+
+  cur = &chunks[0];
+  next = &chunks[1];
+  more = _chunk_start(cur, r, ranges, n, 0, 0);
+
+  while (more)
+  {
+    addr = cur->addr;
+    cnt = cur->cnt;
+    data = cur->buf + CARRY_MAX;
+
+    more = _chunk_start(next, r, ranges, n, cur->range,
+                        addr + (size_t) cnt * PAGE_SIZE);
+    mem_read_complete(r, cur->reqs, cnt);
+
+    /* scan every run of readable pages */
+    for (pg = 0; pg < cnt; pg += run ? run : 1)
+    {
+      for (run = 0; pg + run < cnt && cur->reqs[pg+run].nread == PAGE_SIZE;)
+        run++;
+
+      if (run == 0) {
+        carry = 0;
+        continue;
+      }
+
+      _scan_run(res, k, p, data + (size_t) pg * PAGE_SIZE - carry,
+                (size_t) run * PAGE_SIZE + carry,
+                addr + (size_t) pg * PAGE_SIZE - carry);
+
+      /* a run reaching the end of the chunk continues in the next one */
+      carry = 0;
+      if (pg + run == cnt && !p->aligned && tsize > 1 && more
+          && next->range == cur->range) {
+        carry = tsize - 1;
+        memcpy(next->buf + CARRY_MAX - carry,
+               data + (size_t) cnt * PAGE_SIZE - carry, carry);
+      }
+    }
+
+    tmp = cur;
+    cur = next;
+    next = tmp;
+  }
+
+  free(chunks[0].buf);
+  free(chunks);
+  return res->count - before;
+}
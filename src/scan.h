@@ -0,0 +1,100 @@
+#ifndef __SCAN_H
+#define __SCAN_H
+
+#include "mem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* value types the scanner can search for */
+enum scan_type {
+  SCAN_INT8 = 0,
+  SCAN_INT16,
+  SCAN_INT32,
+  SCAN_INT64,
+  SCAN_FLOAT,
+  SCAN_DOUBLE,
+  SCAN_TYPES,                       /* amount of types, not a type */
+};
+
+/* how candidate values are compared against the scan parameters */
+enum scan_cmp {
+  SCAN_EXACT = 0,                   /* value == lo                    */
+  SCAN_RANGE,                       /* lo <= value <= hi              */
+  SCAN_TOLERANCE,                   /* |value - lo| <= tolerance,
+                                     * float and double only          */
+  SCAN_CMPS,
+};
+
+
+/*  _scan_value:
+ *    a value of any of the scan types, the member used is picked by
+ *    scan_params.type.
+ */
+typedef union _scan_value
+{
+  int8_t  i8;
+  int16_t i16;
+  int32_t i32;
+  int64_t i64;
+  float   f32;
+  double  f64;
+} scan_value;
+
+
+/*  _scan_parameters:
+ *    describes what a scan looks for.
+ */
+typedef struct _scan_parameters
+{
+  int type;                         /* enum scan_type */
+  int cmp;                          /* enum scan_cmp */
+  int aligned;                      /* only check naturally aligned values */
+  scan_value lo, hi;                /* value, or the bounds of a range */
+  double tolerance;                 /* allowed difference for SCAN_TOLERANCE */
+} scan_params;
+
+
+/*  _scan_block:
+ *    a run of hits sharing a base address. hits are stored as 32-bit offsets
+ *    from base, offsets[first] through offsets[first+count-1].
+ */
+typedef struct _scan_block
+{
+  uintptr_t base;
+  size_t first;
+  uint32_t count;
+} scan_block;
+
+
+/*  _scan_results:
+ *    compact result buffer filled by the scan kernels, 4 bytes per hit plus
+ *    one scan_block per scanned chunk with hits.
+ */
+typedef struct _scan_results
+{
+  scan_block *blocks;
+  size_t nblocks, cap_blocks;
+  uint32_t *offsets;
+  size_t count, cap;
+} scan_results;
+
+
+/*  scan_kernel:
+ *    searches len bytes of buf and writes the offset of every match to out,
+ *    which must have room for len entries. returns the amount of matches.
+ */
+typedef size_t (*scan_kernel)(const uint8_t*, size_t, const scan_params*,
+                              uint32_t*);
+
+/* function definitions */
+size_t      scan_type_size(int);
+scan_kernel scan_kernel_select(const scan_params*);
+int         scan_first(scan_results*, mem_reader*, const scan_params*,
+                       const mem_range*, int);
+
+void        scan_results_init(scan_results*);
+void        scan_results_free(scan_results*);
+uintptr_t   scan_results_get(const scan_results*, size_t);
+
+#endif /* __SCAN_H */
@@ -0,0 +1,843 @@
+#include "session.h"
+#include "hostutil.h"
+#include "util.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+#define SPAN_GAP      4096            /* candidates closer than this are
+                                       * read with a single request      */
+#define ALIGN8(n)     (((n) + 7) & ~(uint64_t) 7)
+
+
+/*  _sess_item:
+ *    a window of a mapping handed to a worker by sess_first, and its hits.
+ */
+struct _sess_item
+{
+  int target;
+  const ll_memmap_file *mmf;
+  uintptr_t start, end;
+  scan_results res;
+  uint8_t *values;                  /* value of every hit */
+};
+
+
+/*  _sess_job:
+ *    shared state of the workers of sess_first and sess_next.
+ */
+struct _sess_job
+{
+  multi_session *m;
+  const scan_params *p;
+  int cmp;                          /* enum sess_cmp of sess_next */
+  struct _sess_item *items;         /* sess_first */
+  scan_session *s;                  /* sess_next */
+  uint8_t **bufs;                   /* one window per worker */
+};
+
+
+/*  _strings:
+ *    the string table while a session is built.
+ */
+struct _strings
+{
+  char *buf;
+  size_t len, cap;
+};
+
+
+
+/*  _reader:
+ *    a reader of one target for a worker, reading the target's capture
+ *    if it has one, like the scans do.
+ */
+static void
+_reader(mem_reader *r, const multi_session *m, int target)
+{
+  const multi_target *t = &m->targets[target];
+
+  mem_reader_init(r, t->pid, m->backend);
+  if (t->reader.snap != NULL)
+    mem_reader_snapshot(r, t->reader.snap);
+}
+
+
+/*  _window:
+ *    the read buffer of a worker, allocated on first use.
+ */
+static uint8_t *
+_window(struct _sess_job *job, int worker)
+{
+  if (job->bufs[worker] == NULL)
+    job->bufs[worker] = malloc(SESS_WINDOW + 8);
+
+  return job->bufs[worker];
+}
+
+
+/*  _read_values:
+ *    reads the current value of every candidate of a window. candidates
+ *    close to each other are read with one request, all requests in one
+ *    batch. ok is set for every value that could be read. a value starting
+ *    in the window is read whole, past the window's end if it crosses it;
+ *    only windows that don't end their mapping have such candidates.
+ *
+ *    mem_reader *r:        reader of the target
+ *    uintptr_t base:       start of the window
+ *    size_t len:           length of the window
+ *    const uint32_t *offs: sorted offsets of the candidates
+ *    size_t n:             amount of candidates
+ *    size_t vsize:         value size
+ *    uint8_t *buf:         buffer of len + vsize bytes
+ *    uint8_t *out:         receives n values
+ *    uint8_t *ok:          receives n flags, or NULL
+ */
+static void
+_read_values(mem_reader *r, uintptr_t base, size_t len, const uint32_t *offs,
+             size_t n, size_t vsize, uint8_t *buf, uint8_t *out, uint8_t *ok)
+{
+  mem_readreq *reqs;
+  size_t i, k = 0, nreqs = 0, first = 0, last = 0;
+  int got;
+
+  reqs = malloc((n + 1) * sizeof(mem_readreq));
+  for (i = 0; i < n && offs[i] < len; i++)
+  {
+    if (nreqs > 0 && offs[i] < last + SPAN_GAP) {
+      last = offs[i] + vsize;
+      reqs[nreqs-1].len = last - first;
+      continue;
+    }
+
+    first = offs[i];
+    last = first + vsize;
+    reqs[nreqs].addr = (void *) (base + first);
+    reqs[nreqs].buf = buf + first;
+    reqs[nreqs++].len = vsize;
+  }
+
+  mem_read_batch(r, reqs, (int) nreqs);
+
+  for (i = 0; i < n; i++)
+  {
+    while (k < nreqs && offs[i] + vsize > (size_t) ((uint8_t *) reqs[k].buf
+                                                    - buf) + reqs[k].len)
+      k++;
+
+    /* a partial read keeps the bytes it got */
+    got = k < nreqs && reqs[k].nread >= 0
+          && offs[i] + vsize <= (size_t) ((uint8_t *) reqs[k].buf - buf)
+                                + (size_t) reqs[k].nread;
+    if (got)
+      memcpy(out + i * vsize, buf + offs[i], vsize);
+    else
+      memset(out + i * vsize, 0, vsize);
+    if (ok != NULL)
+      ok[i] = got;
+  }
+
+  free(reqs);
+}
+
+
+/*  _first_worker:
+ *    scans one window and reads the values of its hits, exact scans
+ *    already know them.
+ */
+static void
+_first_worker(int item, int worker, void *arg)
+{
+  struct _sess_job *job = arg;
+  struct _sess_item *it = &job->items[item];
+  size_t vsize = scan_type_size(job->p->type), i, b, k;
+  uint32_t *offs;
+  mem_range range;
+  mem_reader r;
+
+  range.start = (void *) it->start;
+  range.end = (void *) it->end;
+  if (!job->p->aligned && it->end < (uintptr_t) it->mmf->end_addr)
+    range.end = (void *) (it->end + vsize - 1);
+
+  _reader(&r, job->m, it->target);
+  scan_first(&it->res, &r, job->p, &range, 1);
+
+  /* hits starting past the window belong to the next one */
+  while (it->res.count
+         && scan_results_get(&it->res, it->res.count - 1) >= it->end)
+  {
+    it->res.count--;
+    if (--it->res.blocks[it->res.nblocks - 1].count == 0)
+      it->res.nblocks--;
+  }
+
+  if (it->res.count == 0) {
+    mem_reader_close(&r);
+    return;
+  }
+
+  /* offsets relative to the window, in place */
+  for (b = 0, i = 0; b < it->res.nblocks; b++)
+    for (k = 0; k < it->res.blocks[b].count; k++, i++)
+      it->res.offsets[i] += it->res.blocks[b].base - it->start;
+
+  offs = it->res.offsets;
+  it->values = malloc(it->res.count * vsize);
+  if (job->p->cmp == SCAN_EXACT) {
+    for (i = 0; i < it->res.count; i++)
+      memcpy(it->values + i * vsize, &job->p->lo, vsize);
+  } else {
+    _read_values(&r, it->start, it->end - it->start, offs, it->res.count,
+                 vsize, _window(job, worker), it->values, NULL);
+  }
+
+  mem_reader_close(&r);
+}
+
+
+/*  _string:
+ *    adds a string to the table, reusing the last one if it's the same.
+ *    returns its offset.
+ */
+static uint32_t
+_string(struct _strings *st, const char *s, uint32_t *last)
+{
+  size_t len = strlen(s) + 1;
+
+  if (st->len > 0 && strcmp(st->buf + *last, s) == 0)
+    return *last;
+
+  if (st->len + len > st->cap) {
+    st->cap = st->cap * 2 > st->len + len ? st->cap * 2 : st->len + len;
+    st->buf = realloc(st->buf, st->cap);
+  }
+
+  memcpy(st->buf + st->len, s, len);
+  *last = st->len;
+  st->len += len;
+
+  return *last;
+}
+
+
+/*  _anchor_of:
+ *    the anchor a window is found by in another maps layout. returns the
+ *    anchor's path.
+ */
+static const char *
+_anchor_of(sess_region *r, const ll_memmap_file *mmf)
+{
+  const ll_memmap_file *prev;
+  const char *path = mmf->fpath ? mmf->fpath : "";
+
+  if (*path != '\0' && *path != '[') {
+    r->kind = SESS_FILE;
+    r->offset = mmf->offset + (r->start - (uintptr_t) mmf->start_addr);
+    return path;
+  }
+
+  if (*path == '[') {
+    r->kind = SESS_NAMED;
+    r->offset = r->start - (uintptr_t) mmf->start_addr;
+    return path;
+  }
+
+  /* anonymous memory follows the closest named mapping before it */
+  r->kind = SESS_ANON;
+  for (prev = mmf->prev; prev != NULL; prev = prev->prev)
+    if (prev->fpath != NULL && *prev->fpath != '\0') {
+      r->offset = r->start - (uintptr_t) prev->end_addr;
+      return prev->fpath;
+    }
+
+  r->offset = r->start;
+  return "";
+}
+
+
+/*  sess_first:
+ *    starts a session with a scan of every target, replacing whatever the
+ *    session held. the scan runs on a pool of workers, a window of a
+ *    mapping at a time. returns the amount of candidates, or -1 for
+ *    invalid parameters.
+ *
+ *    scan_session *s:        session to fill, free with sess_free
+ *    multi_session *m:       attached targets
+ *    const scan_params *p:   what to look for
+ *    uint8_t mode:           enum module_perms bits a mapping must have
+ *    int nthreads:           worker threads, 0 for one per cpu
+ */
+long
+sess_first(scan_session *s, multi_session *m, const scan_params *p,
+           uint8_t mode, int nthreads)
+{
+  struct _sess_job job;
+  struct _sess_item *it;
+  struct _strings st = { NULL, 0, 0 };
+  const ll_memmap_file *mmf;
+  sess_region *r;
+  uintptr_t addr;
+  size_t n = 0, cap = 0, i, nregions = 0, count = 0, vsize;
+  uint32_t last = 0;
+  int t;
+
+  if (scan_kernel_select(p) == NULL)
+    return -1;
+
+  memset(&job, 0, sizeof(job));
+  job.m = m;
+  job.p = p;
+  vsize = scan_type_size(p->type);
+
+  for (t = 0; t < m->count; t++)
+    for (mmf = m->targets[t].maps; mmf != NULL; mmf = mmf->next)
+    {
+      if ((mmf->mode & mode) != mode)
+        continue;
+
+      for (addr = (uintptr_t) mmf->start_addr;
+           addr < (uintptr_t) mmf->end_addr; addr += SESS_WINDOW)
+      {
+        if (n == cap) {
+          cap = cap ? cap * 2 : 256;
+          job.items = realloc(job.items, cap * sizeof(struct _sess_item));
+        }
+
+        it = &job.items[n++];
+        memset(it, 0, sizeof(struct _sess_item));
+        it->target = t;
+        it->mmf = mmf;
+        it->start = addr;
+        it->end = (uintptr_t) mmf->end_addr - addr > SESS_WINDOW
+                  ? addr + SESS_WINDOW : (uintptr_t) mmf->end_addr;
+      }
+    }
+
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+  job.bufs = calloc(nthreads, sizeof(uint8_t*));
+
+  parallel_for((int) n, nthreads, _first_worker, &job);
+
+  for (t = 0; t < nthreads; t++)
+    free(job.bufs[t]);
+  free(job.bufs);
+
+  for (i = 0; i < n; i++)
+    if (job.items[i].res.count) {
+      nregions++;
+      count += job.items[i].res.count;
+    }
+
+  sess_free(s);
+  s->hdr = calloc(1, sizeof(sess_header));
+  s->regions = calloc(nregions + 1, sizeof(sess_region));
+  s->offsets = malloc((count + 1) * sizeof(uint32_t));
+  s->values = malloc((count + 1) * vsize);
+
+  memcpy(s->hdr->magic, SESS_MAGIC, sizeof(s->hdr->magic));
+  s->hdr->version = SESS_VERSION;
+  s->hdr->header_size = sizeof(sess_header);
+  s->hdr->params = *p;
+  s->hdr->value_size = vsize;
+  s->hdr->steps = 1;
+  s->hdr->nregions = nregions;
+  s->hdr->count = count;
+
+  for (i = 0, count = 0, r = s->regions; i < n; i++)
+  {
+    it = &job.items[i];
+    if (it->res.count) {
+      r->start = it->start;
+      r->end = it->end;
+      r->inode = (unsigned int) it->mmf->inode;
+      r->dev = it->mmf->dev_major << 8 | it->mmf->dev_minor;
+      r->target = it->target;
+      r->path = _string(&st, _anchor_of(r, it->mmf), &last);
+      r->first = count;
+      r->count = it->res.count;
+
+      memcpy(s->offsets + count, it->res.offsets,
+             it->res.count * sizeof(uint32_t));
+      memcpy(s->values + count * vsize, it->values, it->res.count * vsize);
+      count += it->res.count;
+      r++;
+    }
+
+    scan_results_free(&it->res);
+    free(it->values);
+  }
+  free(job.items);
+
+  s->strings = st.buf ? st.buf : calloc(1, 1);
+  s->hdr->strings_len = st.len;
+
+  return (long) count;
+}
+
+
+/*  SESS_TEST:
+ *    compares a candidate's value of type T, cur, against its last value
+ *    or the parameters. returns from the enclosing function.
+ */
+#define SESS_TEST(T)                                                        \
+  do {                                                                      \
+    T o, c, lo, hi;                                                         \
+                                                                            \
+    memcpy(&o, old, sizeof(T));                                             \
+    memcpy(&c, cur, sizeof(T));                                             \
+    memcpy(&lo, &p->lo, sizeof(T));                                         \
+    memcpy(&hi, &p->hi, sizeof(T));                                         \
+                                                                            \
+    switch (cmp)                                                            \
+    {                                                                       \
+      case SESS_CHANGED:   return c != o;                                   \
+      case SESS_UNCHANGED: return c == o;                                   \
+      case SESS_INCREASED: return c > o;                                    \
+      case SESS_DECREASED: return c < o;                                    \
+    }                                                                       \
+                                                                            \
+    if (p->cmp == SCAN_RANGE)                                               \
+      return c >= lo && c <= hi;                                            \
+    if (p->cmp == SCAN_TOLERANCE)                                           \
+      return (double) c - lo <= p->tolerance                                \
+             && (double) lo - c <= p->tolerance;                            \
+    return c == lo;                                                         \
+  } while (0)
+
+
+/*  _match:
+ *    whether a candidate survives a further scan.
+ */
+static int
+_match(int type, int cmp, const scan_params *p, const uint8_t *old,
+       const uint8_t *cur)
+{
+  switch (type)
+  {
+    case SCAN_INT8:   SESS_TEST(int8_t);
+    case SCAN_INT16:  SESS_TEST(int16_t);
+    case SCAN_INT32:  SESS_TEST(int32_t);
+    case SCAN_INT64:  SESS_TEST(int64_t);
+    case SCAN_FLOAT:  SESS_TEST(float);
+    case SCAN_DOUBLE: SESS_TEST(double);
+  }
+
+  return 0;
+}
+
+
+/*  _next_worker:
+ *    reads the candidates of one region and keeps those that match, with
+ *    their current values. regions are only touched by their worker.
+ */
+static void
+_next_worker(int item, int worker, void *arg)
+{
+  struct _sess_job *job = arg;
+  scan_session *s = job->s;
+  sess_region *r = &s->regions[item];
+  size_t vsize = s->hdr->value_size, i, kept = 0;
+  uint32_t *offs = s->offsets + r->first;
+  uint8_t *vals = s->values + r->first * vsize, *cur, *ok;
+  mem_reader rd;
+
+  if (r->count == 0)
+    return;
+
+  cur = malloc(r->count * vsize);
+  ok = malloc(r->count);
+
+  _reader(&rd, job->m, r->target);
+  _read_values(&rd, r->start, r->end - r->start, offs, r->count, vsize,
+               _window(job, worker), cur, ok);
+  mem_reader_close(&rd);
+
+  for (i = 0; i < r->count; i++)
+  {
+    if (!ok[i] || !_match(s->hdr->params.type, job->cmp, job->p,
+                          vals + i * vsize, cur + i * vsize))
+      continue;
+
+    offs[kept] = offs[i];
+    memcpy(vals + kept * vsize, cur + i * vsize, vsize);
+    kept++;
+  }
+
+  r->count = kept;
+  free(cur);
+  free(ok);
+}
+
+
+/*  sess_next:
+ *    narrows a session down to the candidates whose current value matches,
+ *    and stores their current values. returns the amount of candidates
+ *    left, or -1 for invalid parameters.
+ *
+ *    scan_session *s:        session to narrow
+ *    multi_session *m:       attached targets, the ones it was made with
+ *    int cmp:                enum sess_cmp
+ *    const scan_params *p:   the value or range for SESS_VALUE, of the
+ *                            session's type
+ *    int nthreads:           worker threads, 0 for one per cpu
+ */
+long
+sess_next(scan_session *s, multi_session *m, int cmp, const scan_params *p,
+          int nthreads)
+{
+  struct _sess_job job;
+  uint64_t i, count = 0;
+  int t;
+
+  if (s->hdr == NULL || cmp < 0 || cmp >= SESS_CMPS
+      || (cmp == SESS_VALUE && (p == NULL || p->type != s->hdr->params.type
+                                || scan_kernel_select(p) == NULL)))
+    return -1;
+
+  memset(&job, 0, sizeof(job));
+  job.m = m;
+  job.p = cmp == SESS_VALUE ? p : &s->hdr->params;
+  job.cmp = cmp;
+  job.s = s;
+
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+  job.bufs = calloc(nthreads, sizeof(uint8_t*));
+
+  parallel_for((int) s->hdr->nregions, nthreads, _next_worker, &job);
+
+  for (t = 0; t < nthreads; t++)
+    free(job.bufs[t]);
+  free(job.bufs);
+
+  for (i = 0; i < s->hdr->nregions; i++)
+    count += s->regions[i].count;
+
+  s->hdr->count = count;
+  s->hdr->steps++;
+
+  return (long) count;
+}
+
+
+/*  _find:
+ *    where a region is in the current maps of its target, or 0 if its
+ *    anchor is gone or doesn't cover it anymore.
+ */
+static uintptr_t
+_find(const sess_region *r, const char *path, const ll_memmap_file *maps)
+{
+  const ll_memmap_file *mmf, *named = NULL;
+  uintptr_t start, len = r->end - r->start;
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    start = 0;
+
+    if (r->kind == SESS_FILE && mmf->fpath != NULL
+        && strcmp(mmf->fpath, path) == 0
+        && (unsigned int) mmf->inode == r->inode
+        && r->offset >= mmf->offset)
+      start = (uintptr_t) mmf->start_addr + (r->offset - mmf->offset);
+    else if (r->kind == SESS_NAMED && mmf->fpath != NULL
+             && strcmp(mmf->fpath, path) == 0)
+      start = (uintptr_t) mmf->start_addr + r->offset;
+    else if (r->kind == SESS_ANON && (mmf->fpath == NULL
+                                      || *mmf->fpath == '\0')) {
+      if (*path == '\0')
+        start = r->offset;
+      else if (named != NULL && strcmp(named->fpath, path) == 0)
+        start = (uintptr_t) named->end_addr + r->offset;
+    }
+
+    if (mmf->fpath != NULL && *mmf->fpath != '\0')
+      named = mmf;
+
+    if (start >= (uintptr_t) mmf->start_addr && start + len > start
+        && start + len <= (uintptr_t) mmf->end_addr
+        && (mmf->mode & MODE_READ))
+      return start;
+  }
+
+  return 0;
+}
+
+
+/*  sess_rebase:
+ *    moves every region to where its anchor is in the current maps, by
+ *    module and offset, after the targets or pardu were restarted or the
+ *    maps changed. candidates of regions that can't be found are dropped.
+ *    returns the amount of candidates left.
+ *
+ *    scan_session *s:    session to rebase
+ *    multi_session *m:   attached targets, by the index they had
+ */
+long
+sess_rebase(scan_session *s, multi_session *m)
+{
+  sess_region *r;
+  uintptr_t start;
+  uint64_t i, count = 0;
+
+  if (s->hdr == NULL)
+    return -1;
+
+  for (i = 0; i < s->hdr->nregions; i++)
+  {
+    r = &s->regions[i];
+    if (r->count == 0)
+      continue;
+
+    start = 0;
+    if (r->target >= 0 && r->target < m->count)
+      start = _find(r, s->strings + r->path, m->targets[r->target].maps);
+
+    if (start == 0) {
+      r->count = 0;
+      continue;
+    }
+
+    r->end = start + (r->end - r->start);
+    r->start = start;
+    count += r->count;
+  }
+
+  s->hdr->count = count;
+  return (long) count;
+}
+
+
+/*  _write:
+ *    writes len bytes to fd and advances pos. returns -1 on failure.
+ */
+static int
+_write(int fd, const void *buf, size_t len, uint64_t *pos)
+{
+  const uint8_t *p = buf;
+  ssize_t n;
+
+  *pos += len;
+  while (len > 0)
+  {
+    if ((n = write(fd, p, len)) <= 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+
+  return 0;
+}
+
+
+/*  _pad:
+ *    zero pads fd to the next multiple of 8.
+ */
+static int
+_pad(int fd, uint64_t *pos)
+{
+  static const uint8_t zero[8];
+
+  return _write(fd, zero, ALIGN8(*pos) - *pos, pos);
+}
+
+
+/*  sess_save:
+ *    writes a session to a file, without the regions that have no
+ *    candidates left. the file is written next to path and renamed over
+ *    it, so a session loaded from path stays intact. returns 0 on
+ *    success, -1 on failure.
+ *
+ *    const scan_session *s:  session to save
+ *    const char *path:       file to write
+ */
+int
+sess_save(const scan_session *s, const char *path)
+{
+  sess_header hdr;
+  sess_region r;
+  uint64_t i, pos = 0, count = 0;
+  size_t vsize;
+  char *tmp;
+  int fd, err = 0;
+
+  if (s->hdr == NULL)
+    return -1;
+
+  hdr = *s->hdr;
+  vsize = hdr.value_size;
+  hdr.nregions = 0;
+  for (i = 0; i < s->hdr->nregions; i++)
+    if (s->regions[i].count) {
+      hdr.nregions++;
+      count += s->regions[i].count;
+    }
+
+  hdr.count = count;
+  hdr.regions_off = ALIGN8(sizeof(sess_header));
+  hdr.offsets_off = hdr.regions_off + hdr.nregions * sizeof(sess_region);
+  hdr.values_off = ALIGN8(hdr.offsets_off + count * sizeof(uint32_t));
+  hdr.strings_off = ALIGN8(hdr.values_off + count * vsize);
+
+  tmp = malloc(strlen(path) + 5);
+  sprintf(tmp, "%s.tmp", path);
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+    free(tmp);
+    return -1;
+  }
+
+  err |= _write(fd, &hdr, sizeof(hdr), &pos);
+  err |= _pad(fd, &pos);
+
+  for (i = 0, count = 0; i < s->hdr->nregions; i++)
+  {
+    if (s->regions[i].count == 0)
+      continue;
+
+    r = s->regions[i];
+    r.first = count;
+    count += r.count;
+    err |= _write(fd, &r, sizeof(r), &pos);
+  }
+
+  for (i = 0; i < s->hdr->nregions; i++)
+    err |= _write(fd, s->offsets + s->regions[i].first,
+                  s->regions[i].count * sizeof(uint32_t), &pos);
+  err |= _pad(fd, &pos);
+
+  for (i = 0; i < s->hdr->nregions; i++)
+    err |= _write(fd, s->values + s->regions[i].first * vsize,
+                  s->regions[i].count * vsize, &pos);
+  err |= _pad(fd, &pos);
+
+  err |= _write(fd, s->strings, hdr.strings_len, &pos);
+
+  if (close(fd) < 0 || err || rename(tmp, path) < 0) {
+    unlink(tmp);
+    free(tmp);
+    return -1;
+  }
+
+  free(tmp);
+  return 0;
+}
+
+
+/*  _valid:
+ *    whether the tables a mapped header describes are inside the file and
+ *    every region inside the tables. each table is checked against the
+ *    room left after its offset, sums of header fields could wrap.
+ */
+static int
+_valid(const sess_header *h, const sess_region *regions, uint64_t size)
+{
+  uint64_t i;
+
+  if (memcmp(h->magic, SESS_MAGIC, sizeof(h->magic)) != 0
+      || h->version != SESS_VERSION
+      || h->header_size != sizeof(sess_header)
+      || h->value_size == 0
+      || h->value_size != scan_type_size(h->params.type)
+      || h->regions_off > size || h->offsets_off > size
+      || h->values_off > size || h->strings_off > size
+      || h->nregions > (size - h->regions_off) / sizeof(sess_region)
+      || h->count > (size - h->offsets_off) / sizeof(uint32_t)
+      || h->count > (size - h->values_off) / h->value_size
+      || h->strings_len > size - h->strings_off
+      || h->regions_off % 8 || h->offsets_off % 8 || h->values_off % 8)
+    return 0;
+
+  /* a session without candidates has no strings */
+  if (h->strings_len > 0
+      && ((const char *) h + h->strings_off)[h->strings_len - 1] != '\0')
+    return 0;
+
+  for (i = 0; i < h->nregions; i++)
+    if (regions[i].first > h->count
+        || regions[i].count > h->count - regions[i].first
+        || regions[i].path >= h->strings_len
+        || regions[i].end < regions[i].start
+        || regions[i].end - regions[i].start > SESS_WINDOW)
+      return 0;
+
+  return 1;
+}
+
+
+/*  sess_load:
+ *    maps a session file copy on write, the session points into the
+ *    mapping, nothing is parsed or copied. only the region table is
+ *    checked. the regions still have the addresses they had when saved,
+ *    sess_rebase moves them to the current layout. returns 0 on success,
+ *    -1 if the file can't be mapped or isn't a session.
+ *
+ *    scan_session *s:    receives the session, free with sess_free
+ *    const char *path:   file written by sess_save
+ */
+int
+sess_load(scan_session *s, const char *path)
+{
+  struct stat st;
+  sess_header *h;
+  void *map;
+  int fd;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  if (fstat(fd, &st) < 0 || (size_t) st.st_size < sizeof(sess_header)) {
+    close(fd);
+    return -1;
+  }
+
+  map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return -1;
+
+  h = map;
+  if (h->regions_off > (uint64_t) st.st_size
+      || !_valid(h, (sess_region *) ((uint8_t *) map + h->regions_off),
+                 st.st_size)) {
+    munmap(map, st.st_size);
+    return -1;
+  }
+
+  sess_free(s);
+  s->map = map;
+  s->map_len = st.st_size;
+  s->hdr = h;
+  s->regions = (sess_region *) ((uint8_t *) map + h->regions_off);
+  s->offsets = (uint32_t *) ((uint8_t *) map + h->offsets_off);
+  s->values = (uint8_t *) map + h->values_off;
+  s->strings = (char *) map + h->strings_off;
+
+  return 0;
+}
+
+
+/*  sess_free:
+ *    releases a session and empties it.
+ */
+void
+sess_free(scan_session *s)
+{
+  if (s->map != NULL) {
+    munmap(s->map, s->map_len);
+  } else {
+    free(s->hdr);
+    free(s->regions);
+    free(s->offsets);
+    free(s->values);
+    free(s->strings);
+  }
+
+  memset(s, 0, sizeof(scan_session));
+}
@@ -0,0 +1,101 @@
+#ifndef __SESSION_H
+#define __SESSION_H
+
+#include "mem.h"
+#include "multi.h"
+#include "scan.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SESS_MAGIC    "PARDUSES"
+#define SESS_VERSION  1
+#define SESS_WINDOW   (16 * 1024 * 1024)  /* bytes per region, at most    */
+
+/* how next compares a candidate's current value */
+enum sess_cmp {
+  SESS_VALUE = 0,                   /* against the scan parameters       */
+  SESS_CHANGED,                     /* against the value stored, !=      */
+  SESS_UNCHANGED,                   /* ==                                */
+  SESS_INCREASED,                   /* >                                 */
+  SESS_DECREASED,                   /* <                                 */
+  SESS_CMPS,
+};
+
+/* what a region's anchor is, to find it again in another maps layout */
+enum sess_kind {
+  SESS_FILE = 0,                    /* offset is the file offset         */
+  SESS_NAMED,                       /* [heap], [stack]..., offset from
+                                     * the mapping's start               */
+  SESS_ANON,                        /* offset from the end of the named
+                                     * mapping before it, in path        */
+};
+
+
+/*  _session_header:
+ *    start of a session file, describing the tables that follow. every
+ *    table is 8 byte aligned and addressed by its file offset.
+ */
+typedef struct _session_header
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;             /* sizeof(sess_header) when written */
+  scan_params params;               /* of the first scan */
+  uint32_t value_size;
+  uint32_t steps;                   /* scans done, the first included */
+  uint64_t nregions, count;         /* regions, candidates */
+  uint64_t regions_off, offsets_off, values_off, strings_off;
+  uint64_t strings_len;
+} sess_header;
+
+
+/*  _session_region:
+ *    a window of a mapping of one target and its range of candidates.
+ *    stored in the file as is.
+ */
+typedef struct _session_region
+{
+  uint64_t start, end;              /* where the window is now */
+  uint64_t offset;                  /* position relative to the anchor,
+                                     * see enum sess_kind */
+  uint64_t inode;
+  uint32_t dev;                     /* major << 8 | minor */
+  uint32_t path;                    /* anchor path in the string table */
+  int32_t target;                   /* index of the attached target */
+  uint32_t kind;                    /* enum sess_kind */
+  uint64_t first;                   /* index of the first candidate */
+  uint64_t count;                   /* candidates left */
+} sess_region;
+
+
+/*  _scan_session:
+ *    the candidates of a scan that can be narrowed down by further scans,
+ *    saved and loaded again. candidates are 32-bit offsets into their
+ *    region with the value they had at the last scan. a loaded session
+ *    points into the file mapped copy on write, so loading doesn't depend
+ *    on the amount of candidates.
+ */
+typedef struct _scan_session
+{
+  sess_header *hdr;
+  sess_region *regions;
+  uint32_t *offsets;
+  uint8_t *values;
+  char *strings;
+  void *map;                        /* mapped file, or NULL if every table
+                                     * is allocated */
+  size_t map_len;
+} scan_session;
+
+
+/* function definitions */
+long sess_first(scan_session*, multi_session*, const scan_params*, uint8_t,
+                int);
+long sess_next(scan_session*, multi_session*, int, const scan_params*, int);
+long sess_rebase(scan_session*, multi_session*);
+int  sess_save(const scan_session*, const char*);
+int  sess_load(scan_session*, const char*);
+void sess_free(scan_session*);
+
+#endif /* __SESSION_H */
@@ -0,0 +1,383 @@
+#include "smaps.h"
+#include "stats.h"
+
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+
+#define SMAPS_BUF     (64 * 1024)     /* initial smaps buffer size       */
+#define ROLLUP_BUF    4096            /* smaps_rollup is about 1 KiB     */
+
+
+/* fields taken from every region, the rest are skipped */
+static const struct
+{
+  const char *name;
+  size_t len, off;
+} fields[] = {
+  { "Rss:",           4,  offsetof(smaps_counts, rss)           },
+  { "Pss:",           4,  offsetof(smaps_counts, pss)           },
+  { "Swap:",          5,  offsetof(smaps_counts, swap)          },
+  { "AnonHugePages:", 14, offsetof(smaps_counts, anon_huge)     },
+  { "Shared_Dirty:",  13, offsetof(smaps_counts, shared_dirty)  },
+  { "Private_Dirty:", 14, offsetof(smaps_counts, private_dirty) },
+};
+
+#define NFIELDS (int) (sizeof(fields) / sizeof(fields[0]))
+
+
+
+/*  _line:
+ *    terminates the line at *p in place and moves *p past it. returns NULL
+ *    at the end of the buffer.
+ */
+static char *
+_line(char **p, char *end)
+{
+  char *line = *p, *nl;
+
+  if (line >= end)
+    return NULL;
+
+  nl = memchr(line, '\n', end - line);
+  if (nl == NULL)
+    nl = end;
+
+  *nl = '\0';
+  *p = nl + 1;
+  return line;
+}
+
+
+/*  _is_header:
+ *    whether a line starts a region, field names start in upper case.
+ */
+static int
+_is_header(const char *line)
+{
+  return (line[0] >= '0' && line[0] <= '9') || (line[0] >= 'a'
+                                                && line[0] <= 'f');
+}
+
+
+/*  _header:
+ *    parses "start-end perms offset dev inode path" into r.
+ */
+static void
+_header(char *line, smaps_region *r)
+{
+  char *q;
+  int i;
+
+  memset(r, 0, sizeof(smaps_region));
+  r->start = strtoull(line, &q, 16);
+  r->end = strtoull(q + 1, &q, 16);
+
+  /* perms, offset, dev, inode */
+  for (i = 0; i < 4; i++)
+  {
+    while (*q == ' ')
+      q++;
+    while (*q != '\0' && *q != ' ')
+      q++;
+  }
+
+  while (*q == ' ')
+    q++;
+  r->path = q;
+}
+
+
+/*  _field:
+ *    stores the value of a "Name:   123 kB" line if it's one of fields.
+ */
+static void
+_field(const char *line, smaps_counts *c)
+{
+  const char *q;
+  uint64_t v = 0;
+  int i;
+
+  for (i = 0; i < NFIELDS; i++)
+    if (line[0] == fields[i].name[0]
+        && strncmp(line, fields[i].name, fields[i].len) == 0)
+      break;
+
+  if (i == NFIELDS)
+    return;
+
+  for (q = line + fields[i].len; *q == ' '; q++)
+    ;
+  for (; *q >= '0' && *q <= '9'; q++)
+    v = v * 10 + (*q - '0');
+
+  *(uint64_t *) ((char *) c + fields[i].off) = v;
+}
+
+
+/*  _read_all:
+ *    reads a procfs file from the start into a buffer grown as needed, one
+ *    byte is kept free past the end. returns the length or -1.
+ */
+static ssize_t
+_read_all(int fd, char **buf, size_t *cap)
+{
+  size_t len = 0;
+  ssize_t n;
+
+  if (lseek(fd, 0, SEEK_SET) < 0)
+    return -1;
+
+  for (;;)
+  {
+    if (*cap - len < 2) {
+      *cap = *cap ? *cap * 2 : SMAPS_BUF;
+      *buf = realloc(*buf, *cap);
+    }
+
+    n = read(fd, *buf + len, *cap - len - 1);
+    if (n < 0)
+      return -1;
+    if (n == 0)
+      break;
+    len += n;
+  }
+
+  return len;
+}
+
+
+/*  _rollup:
+ *    reads the process' totals. returns -1 if there's no smaps_rollup.
+ */
+static int
+_rollup(smaps_session *s, smaps_counts *c)
+{
+  char buf[ROLLUP_BUF], *p = buf, *line;
+  ssize_t n;
+
+  if (s->rollup_fd < 0 || lseek(s->rollup_fd, 0, SEEK_SET) < 0)
+    return -1;
+
+  n = read(s->rollup_fd, buf, sizeof(buf) - 1);
+  if (n <= 0)
+    return -1;
+
+  memset(c, 0, sizeof(smaps_counts));
+  while ((line = _line(&p, buf + n)) != NULL)
+    if (!_is_header(line))
+      _field(line, c);
+
+  return 0;
+}
+
+
+static int
+_cmp_path(const void *a, const void *b)
+{
+  return strcmp((*(const smaps_region **) a)->path,
+                (*(const smaps_region **) b)->path);
+}
+
+
+static int
+_cmp_pss(const void *a, const void *b)
+{
+  const smaps_module *x = a, *y = b;
+
+  if (x->c.pss != y->c.pss)
+    return x->c.pss < y->c.pss ? 1 : -1;
+  return x->c.rss < y->c.rss ? 1 : x->c.rss > y->c.rss ? -1 : 0;
+}
+
+
+/*  _aggregate:
+ *    sums the regions of every path into modules.
+ */
+static void
+_aggregate(smaps_session *s)
+{
+  smaps_region **sorted;
+  smaps_module *m = NULL;
+  size_t i;
+  int k;
+
+  sorted = malloc((s->nregions ? s->nregions : 1) * sizeof(smaps_region*));
+  for (i = 0; i < s->nregions; i++)
+    sorted[i] = &s->regions[i];
+  qsort(sorted, s->nregions, sizeof(smaps_region*), _cmp_path);
+
+  s->nmodules = 0;
+  for (i = 0; i < s->nregions; i++)
+  {
+    if (m == NULL || strcmp(m->path, sorted[i]->path) != 0) {
+      if (s->nmodules == s->cap_modules) {
+        s->cap_modules = s->cap_modules ? s->cap_modules * 2 : 64;
+        s->modules = realloc(s->modules,
+                             s->cap_modules * sizeof(smaps_module));
+      }
+      m = &s->modules[s->nmodules++];
+      memset(m, 0, sizeof(smaps_module));
+      m->path = sorted[i]->path;
+    }
+
+    m->nregions++;
+    m->size += sorted[i]->end - sorted[i]->start;
+    for (k = 0; k < (int) (sizeof(smaps_counts) / sizeof(uint64_t)); k++)
+      ((uint64_t *) &m->c)[k] += ((const uint64_t *) &sorted[i]->c)[k];
+  }
+
+  qsort(s->modules, s->nmodules, sizeof(smaps_module), _cmp_pss);
+  free(sorted);
+}
+
+
+/*  _parse:
+ *    parses smaps in place, paths point into the buffer afterwards.
+ */
+static void
+_parse(smaps_session *s, char *p, char *end)
+{
+  char *line;
+  smaps_region *r = NULL;
+
+  s->nregions = 0;
+
+  while ((line = _line(&p, end)) != NULL)
+  {
+    if (_is_header(line)) {
+      if (s->nregions == s->cap_regions) {
+        s->cap_regions = s->cap_regions ? s->cap_regions * 2 : 256;
+        s->regions = realloc(s->regions,
+                             s->cap_regions * sizeof(smaps_region));
+      }
+      r = &s->regions[s->nregions++];
+      _header(line, r);
+    } else if (r != NULL) {
+      _field(line, &r->c);
+    }
+  }
+}
+
+
+/*  smaps_open:
+ *    opens the accounting files of a process. nothing is read until the
+ *    first smaps_refresh. returns 0 on success, -1 if smaps can't be
+ *    opened.
+ *
+ *    smaps_session *s:   session to initialize
+ *    int pid:            process to account
+ */
+int
+smaps_open(smaps_session *s, int pid)
+{
+  char path[64];
+
+  memset(s, 0, sizeof(smaps_session));
+  s->pid = pid;
+  s->fd = s->rollup_fd = -1;
+
+  snprintf(path, sizeof(path), "/proc/%d/smaps", pid);
+  if ((s->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0)
+    return -1;
+
+  /* smaps_rollup appeared in linux 4.14, smaps is read every time without
+   * it */
+  snprintf(path, sizeof(path), "/proc/%d/smaps_rollup", pid);
+  s->rollup_fd = open(path, O_RDONLY | O_CLOEXEC);
+
+  return 0;
+}
+
+
+/*  smaps_close:
+ *    closes the files and frees everything held by the session.
+ */
+void
+smaps_close(smaps_session *s)
+{
+  if (s->fd >= 0)
+    close(s->fd);
+  if (s->rollup_fd >= 0)
+    close(s->rollup_fd);
+
+  free(s->buf);
+  free(s->regions);
+  free(s->modules);
+  memset(s, 0, sizeof(smaps_session));
+  s->fd = s->rollup_fd = -1;
+}
+
+
+/*  smaps_refresh:
+ *    reads the process' totals and, if they changed since the last call,
+ *    every region. a region may change without the totals changing, e.g.
+ *    by mapping memory that isn't touched yet, which is missed until the
+ *    totals move or force is set. returns 1 if the regions were read, 0 if
+ *    they were still current and -1 on failure.
+ *
+ *    smaps_session *s:   opened session
+ *    int force:          read the regions even if the totals are the same
+ */
+int
+smaps_refresh(smaps_session *s, int force)
+{
+  smaps_counts c;
+  ssize_t len;
+  uint64_t t0 = stat_now();
+  size_t i;
+  int have_rollup, k;
+
+  have_rollup = _rollup(s, &c) == 0;
+  if (have_rollup && !force && s->valid
+      && memcmp(&c, &s->total, sizeof(smaps_counts)) == 0)
+    return 0;
+
+  s->valid = 0;
+  if ((len = _read_all(s->fd, &s->buf, &s->cap)) < 0)
+    return -1;
+
+  _parse(s, s->buf, s->buf + len);
+  _aggregate(s);
+
+  if (have_rollup) {
+    s->total = c;
+    s->valid = 1;
+  } else {
+    memset(&s->total, 0, sizeof(smaps_counts));
+    for (i = 0; i < s->nmodules; i++)
+      for (k = 0; k < (int) (sizeof(smaps_counts) / sizeof(uint64_t)); k++)
+        ((uint64_t *) &s->total)[k] += ((uint64_t *) &s->modules[i].c)[k];
+  }
+
+  stat_add(STAT_SMAPS_READS, 1);
+  stat_time(STAT_T_SMAPS, t0);
+  return 1;
+}
+
+
+/*  smaps_find:
+ *    the region containing addr or NULL.
+ */
+const smaps_region*
+smaps_find(const smaps_session *s, uintptr_t addr)
+{
+  size_t lo = 0, hi = s->nregions, mid;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (s->regions[mid].end <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo < s->nregions && addr >= s->regions[lo].start)
+    return &s->regions[lo];
+  return NULL;
+}
@@ -0,0 +1,69 @@
+#ifndef __SMAPS_H
+#define __SMAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  _smaps_counts:
+ *    memory accounting of a region or a sum of regions, in kB as the
+ *    kernel reports it.
+ */
+typedef struct _smaps_counts
+{
+  uint64_t rss, pss, swap;
+  uint64_t anon_huge;               /* AnonHugePages */
+  uint64_t shared_dirty, private_dirty;
+} smaps_counts;
+
+
+/*  _smaps_region:
+ *    a mapping with its accounting. path points into the session's buffer
+ *    and is only valid until the smaps are read again.
+ */
+typedef struct _smaps_region
+{
+  uintptr_t start, end;
+  const char *path;                 /* "" for anonymous memory */
+  smaps_counts c;
+} smaps_region;
+
+
+/*  _smaps_module:
+ *    every region mapping the same path, summed up.
+ */
+typedef struct _smaps_module
+{
+  const char *path;
+  int nregions;
+  uint64_t size;                    /* bytes mapped */
+  smaps_counts c;
+} smaps_module;
+
+
+/*  _smaps_session:
+ *    accounting of one process. smaps is only read again once the totals
+ *    of smaps_rollup change, since formatting every mapping costs the
+ *    kernel far more than summing them.
+ */
+typedef struct _smaps_session
+{
+  int pid;
+  int fd, rollup_fd;                /* /proc/<pid>/smaps and smaps_rollup */
+  char *buf;                        /* last smaps contents, parsed in place */
+  size_t cap;
+  smaps_region *regions;            /* sorted by address */
+  size_t nregions, cap_regions;
+  smaps_module *modules;            /* largest pss first */
+  size_t nmodules, cap_modules;
+  smaps_counts total;               /* last rollup */
+  int valid;                        /* regions reflect total */
+} smaps_session;
+
+
+/* function definitions */
+int                 smaps_open(smaps_session*, int);
+void                smaps_close(smaps_session*);
+int                 smaps_refresh(smaps_session*, int);
+const smaps_region* smaps_find(const smaps_session*, uintptr_t);
+
+#endif /* __SMAPS_H */
@@ -0,0 +1,520 @@
+#include "snapshot.h"
+#include "hostutil.h"
+#include "stats.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23        /* linux 5.14 */
+#endif
+
+#define CGROUP_ROOT   "/sys/fs/cgroup"
+#define PAGE          4096
+
+
+const char *snap_method_names[SNAP_METHODS] = {
+  "auto", "freezer", "stop",
+};
+
+
+/*  _snap_item:
+ *    a run of read requests handled by a single worker.
+ */
+struct _snap_item
+{
+  size_t first, count;
+};
+
+
+/*  _snap_job:
+ *    shared state of the parallel copy.
+ */
+struct _snap_job
+{
+  mem_readreq *reqs;
+  struct _snap_item *items;
+  mem_reader *readers;              /* one per worker */
+};
+
+
+/*  _read_small:
+ *    reads a small procfs or cgroupfs file into a string. returns its
+ *    length, -1 on error.
+ */
+static ssize_t
+_read_small(const char *path, char *buf, size_t len)
+{
+  ssize_t n;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  n = read(fd, buf, len - 1);
+  close(fd);
+
+  buf[n > 0 ? n : 0] = '\0';
+  return n;
+}
+
+
+static int
+_write_small(const char *path, const char *s)
+{
+  ssize_t n;
+  int fd;
+
+  fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  n = write(fd, s, strlen(s));
+  close(fd);
+
+  return n == (ssize_t) strlen(s) ? 0 : -1;
+}
+
+
+/*  _cgroup_path:
+ *    the cgroup v2 path of a process, of pardu itself for pid 0. returns
+ *    -1 if it isn't in a v2 hierarchy.
+ */
+static int
+_cgroup_path(int pid, char *path, size_t len)
+{
+  char file[32], buf[PATH_MAX + 64], *line, *nl;
+
+  if (pid > 0)
+    snprintf(file, sizeof(file), "/proc/%d/cgroup", pid);
+  else
+    snprintf(file, sizeof(file), "/proc/self/cgroup");
+
+  if (_read_small(file, buf, sizeof(buf)) <= 0)
+    return -1;
+
+  for (line = buf; line != NULL; line = nl ? nl + 1 : NULL)
+  {
+    nl = strchr(line, '\n');
+    if (nl != NULL)
+      *nl = '\0';
+
+    if (strncmp(line, "0::", 3) == 0 && strlen(line + 3) < len) {
+      strcpy(path, line + 3);
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+
+/*  _freezer_dir:
+ *    the cgroup directory to freeze a process with. the root cgroup can't
+ *    be frozen, and a cgroup pardu itself is in mustn't be. everything
+ *    else in the target's cgroup is paused too.
+ */
+static int
+_freezer_dir(int pid, char *dir, size_t len)
+{
+  char target[PATH_MAX], self[PATH_MAX], file[PATH_MAX + 64];
+  size_t n;
+
+  if (_cgroup_path(pid, target, sizeof(target)) < 0
+      || _cgroup_path(0, self, sizeof(self)) < 0)
+    return -1;
+
+  n = strlen(target);
+  if (n <= 1 || strlen(CGROUP_ROOT "/unified") + n >= len
+      || (strncmp(self, target, n) == 0
+          && (self[n] == '\0' || self[n] == '/')))
+    return -1;
+
+  /* hybrid hierarchies mount v2 below the v1 controllers */
+  strcpy(dir, CGROUP_ROOT);
+  if (access(CGROUP_ROOT "/cgroup.controllers", F_OK) < 0)
+    strcat(dir, "/unified");
+  strcat(dir, target);
+
+  snprintf(file, sizeof(file), "%s/cgroup.freeze", dir);
+  return access(file, W_OK);
+}
+
+
+/*  _freeze:
+ *    freezes a cgroup and waits until cgroup.events reports every task
+ *    frozen. held is set if it was frozen already and has to stay so.
+ */
+static int
+_freeze(const char *dir, int *held)
+{
+  char file[PATH_MAX + 64], buf[256];
+  struct pollfd pfd;
+  uint64_t deadline = monotonic_ns() + SNAP_TIMEOUT_MS * 1000000ULL, now;
+  ssize_t n;
+
+  snprintf(file, sizeof(file), "%s/cgroup.freeze", dir);
+  *held = _read_small(file, buf, sizeof(buf)) > 0 && buf[0] == '1';
+  if (!*held && _write_small(file, "1") < 0)
+    return -1;
+
+  snprintf(file, sizeof(file), "%s/cgroup.events", dir);
+  pfd.fd = open(file, O_RDONLY | O_CLOEXEC);
+  pfd.events = POLLPRI;
+  if (pfd.fd < 0)
+    goto freeze_fail;
+
+  /* changes of cgroup.events are signalled as priority events */
+  for (;;)
+  {
+    n = pread(pfd.fd, buf, sizeof(buf) - 1, 0);
+    buf[n > 0 ? n : 0] = '\0';
+    if (strstr(buf, "frozen 1") != NULL)
+      break;
+
+    now = monotonic_ns();
+    if (n < 0 || now >= deadline) {
+      close(pfd.fd);
+      goto freeze_fail;
+    }
+    poll(&pfd, 1, (int) ((deadline - now) / 1000000) + 1);
+  }
+
+  close(pfd.fd);
+  return 0;
+
+freeze_fail:
+  snprintf(file, sizeof(file), "%s/cgroup.freeze", dir);
+  if (!*held)
+    _write_small(file, "0");
+  return -1;
+}
+
+
+static void
+_thaw(const char *dir)
+{
+  char file[PATH_MAX + 64];
+
+  snprintf(file, sizeof(file), "%s/cgroup.freeze", dir);
+  _write_small(file, "0");
+}
+
+
+/*  _all_stopped:
+ *    whether every thread of a process is in a stop.
+ */
+static int
+_all_stopped(int pid)
+{
+  char path[320], buf[256], *p;
+  DIR *dir;
+  struct dirent *ent;
+  int stopped = 1;
+
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  if ((dir = opendir(path)) == NULL)
+    return 0;
+
+  while (stopped && (ent = readdir(dir)) != NULL)
+  {
+    if (ent->d_name[0] == '.')
+      continue;
+
+    snprintf(path, sizeof(path), "/proc/%d/task/%s/stat", pid, ent->d_name);
+    if (_read_small(path, buf, sizeof(buf)) <= 0)
+      continue;
+
+    p = strrchr(buf, ')');
+    stopped = p != NULL && p[1] != '\0' && (p[2] == 'T' || p[2] == 't'
+                                            || p[2] == 'Z' || p[2] == 'X');
+  }
+
+  closedir(dir);
+  return stopped;
+}
+
+
+/*  _stop:
+ *    stops a process with SIGSTOP and waits until every thread took it.
+ *    held is set if it was stopped already and has to stay so. the
+ *    target's parent sees the stop like any other.
+ */
+static int
+_stop(int pid, int *held)
+{
+  uint64_t deadline = monotonic_ns() + SNAP_TIMEOUT_MS * 1000000ULL;
+  struct timespec ts = { 0, 50000 };
+
+  *held = _all_stopped(pid);
+  if (*held)
+    return 0;
+
+  if (kill(pid, SIGSTOP) < 0)
+    return -1;
+
+  while (!_all_stopped(pid))
+  {
+    if (monotonic_ns() >= deadline) {
+      kill(pid, SIGCONT);
+      return -1;
+    }
+    nanosleep(&ts, NULL);
+  }
+
+  return 0;
+}
+
+
+/*  _snap_worker:
+ *    reads one item's requests in one batch.
+ */
+static void
+_snap_worker(int item, int worker, void *arg)
+{
+  struct _snap_job *job = arg;
+  struct _snap_item *it = &job->items[item];
+
+  mem_read_batch(&job->readers[worker], job->reqs + it->first, it->count);
+}
+
+
+/*  _arena:
+ *    allocates the copy's backing store and faults it in, so the copy
+ *    doesn't page fault while the target is paused. huge pages cut the
+ *    faults and the copy's tlb misses where available.
+ */
+static uint8_t *
+_arena(size_t size)
+{
+  uint8_t *a;
+  size_t off;
+
+  a = mmap(NULL, size ? size : PAGE, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (a == MAP_FAILED)
+    return NULL;
+
+  madvise(a, size, MADV_HUGEPAGE);
+  if (madvise(a, size, MADV_POPULATE_WRITE) < 0)
+    for (off = 0; off < size; off += PAGE)
+      a[off] = 0;
+
+  return a;
+}
+
+
+/*  snap_capture:
+ *    takes a consistent copy of every mapping matching mode_mask. the
+ *    target is paused only while the mappings are read, by all workers at
+ *    once in batches; everything else happens before or after. returns 0
+ *    on success, -1 if the target couldn't be paused or the copy not
+ *    allocated.
+ *
+ *    snapshot *s:            receives the copy, free with snap_free
+ *    int pid:                process to copy
+ *    ll_memmap_file *maps:   its maps
+ *    uint8_t mode_mask:      MODE_* bits a mapping needs
+ *    int method:             enum snap_method
+ *    int nthreads:           copy workers, 0 for one per cpu
+ */
+int
+snap_capture(snapshot *s, int pid, ll_memmap_file *maps, uint8_t mode_mask,
+             int method, int nthreads)
+{
+  char dir[PATH_MAX + sizeof(CGROUP_ROOT)];
+  mem_range *ranges;
+  struct _snap_job job;
+  size_t i, off, len, nreqs = 0, nitems = 0, bytes = 0, r;
+  uint64_t t0;
+  int n, t, held = 0, paused;
+
+  memset(s, 0, sizeof(snapshot));
+  memset(&job, 0, sizeof(job));
+  s->pid = pid;
+
+  n = mem_ranges_from_maps(maps, mode_mask, &ranges);
+  s->nregions = n;
+  s->regions = calloc(n + 1, sizeof(snap_region));
+  for (i = 0; i < s->nregions; i++)
+  {
+    s->regions[i].start = (uintptr_t) ranges[i].start;
+    s->regions[i].end = (uintptr_t) ranges[i].end;
+    s->size += s->regions[i].end - s->regions[i].start;
+  }
+  free(ranges);
+
+  if (method == SNAP_AUTO || method == SNAP_FREEZER) {
+    if (_freezer_dir(pid, dir, sizeof(dir)) == 0)
+      method = SNAP_FREEZER;
+    else if (method == SNAP_FREEZER)
+      goto capture_fail;
+    else
+      method = SNAP_STOP;
+  }
+  s->method = method;
+
+  if ((s->arena = _arena(s->size)) == NULL)
+    goto capture_fail;
+
+  /* requests of at most a chunk, grouped into items of a few chunks */
+  job.reqs = malloc((s->size / SNAP_CHUNK + s->nregions + 1)
+                    * sizeof(mem_readreq));
+  job.items = malloc((s->size / SNAP_ITEM + s->nregions + 1) * 2
+                     * sizeof(struct _snap_item));
+
+  s->filled = calloc(s->size / SNAP_CHUNK + s->nregions + 1,
+                     sizeof(uint32_t));
+
+  for (i = 0, off = 0; i < s->nregions; i++)
+  {
+    s->regions[i].data = s->arena + off;
+    s->regions[i].filled = s->filled + nreqs;
+
+    for (r = s->regions[i].start; r < s->regions[i].end; r += len)
+    {
+      len = s->regions[i].end - r < SNAP_CHUNK ? s->regions[i].end - r
+                                               : SNAP_CHUNK;
+      if (nitems == 0 || bytes + len > SNAP_ITEM) {
+        job.items[nitems].first = nreqs;
+        job.items[nitems++].count = 0;
+        bytes = 0;
+      }
+
+      job.reqs[nreqs].addr = (void *) r;
+      job.reqs[nreqs].buf = s->arena + off;
+      job.reqs[nreqs++].len = len;
+      job.items[nitems-1].count++;
+      bytes += len;
+      off += len;
+    }
+  }
+
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+
+  job.readers = malloc(nthreads * sizeof(mem_reader));
+  for (t = 0; t < nthreads; t++)
+    mem_reader_init(&job.readers[t], pid, MEM_BACKEND_VM_READV);
+
+  t0 = monotonic_ns();
+  paused = method == SNAP_FREEZER ? _freeze(dir, &held) : _stop(pid, &held);
+  s->freeze_ns = monotonic_ns() - t0;
+
+  if (paused == 0) {
+    parallel_for((int) nitems, nthreads, _snap_worker, &job);
+
+    if (!held && method == SNAP_FREEZER)
+      _thaw(dir);
+    else if (!held)
+      kill(pid, SIGCONT);
+
+    s->pause_ns = monotonic_ns() - t0;
+    stat_time(STAT_T_PAUSE, t0);
+  }
+
+  for (t = 0; t < nthreads; t++)
+    mem_reader_close(&job.readers[t]);
+  free(job.readers);
+
+  /* requests were made region by region, in order */
+  for (i = 0, r = 0; i < s->nregions && paused == 0; i++)
+    for (; r < nreqs && (uintptr_t) job.reqs[r].addr < s->regions[i].end;
+         r++)
+    {
+      len = job.reqs[r].nread > 0 ? (size_t) job.reqs[r].nread : 0;
+      s->filled[r] = (uint32_t) len;
+      s->copied += len;
+      s->regions[i].missing += job.reqs[r].len - len;
+    }
+
+  free(job.reqs);
+  free(job.items);
+
+  if (paused == 0)
+    return 0;
+
+capture_fail:
+  snap_free(s);
+  return -1;
+}
+
+
+/*  snap_read:
+ *    copies from the snapshot as if from the process at the time it was
+ *    taken. reads stop at the first address that wasn't captured, either
+ *    outside the regions or in a part of a region that couldn't be read.
+ *    returns the amount of bytes copied or -1 if addr wasn't captured.
+ *
+ *    const snapshot *s:  a captured snapshot
+ *    uintptr_t addr:     address in the process
+ *    void *buf:          local buffer, at least len bytes
+ *    size_t len:         amount of bytes to read
+ */
+ssize_t
+snap_read(const snapshot *s, uintptr_t addr, void *buf, size_t len)
+{
+  size_t lo = 0, hi = s->nregions, mid, n, pos, in, done = 0;
+  const snap_region *r;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (s->regions[mid].end <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  /* adjacent regions read like one, chunk by chunk */
+  while (lo < s->nregions && done < len)
+  {
+    r = &s->regions[lo];
+    if (addr + done < r->start)
+      break;
+
+    pos = addr + done - r->start;
+    in = pos % SNAP_CHUNK;
+    if (r->filled[pos / SNAP_CHUNK] <= in)
+      break;
+
+    n = r->filled[pos / SNAP_CHUNK] - in;
+    if (n > len - done)
+      n = len - done;
+
+    memcpy((uint8_t *) buf + done, r->data + pos, n);
+    done += n;
+
+    /* a chunk read short stops the next pass, at its filled length */
+    if (pos + n == r->end - r->start)
+      lo++;
+  }
+
+  return done > 0 ? (ssize_t) done : -1;
+}
+
+
+/*  snap_free:
+ *    frees a snapshot filled by snap_capture.
+ */
+void
+snap_free(snapshot *s)
+{
+  if (s->arena != NULL)
+    munmap(s->arena, s->size ? s->size : PAGE);
+
+  free(s->filled);
+  free(s->regions);
+  memset(s, 0, sizeof(snapshot));
+}
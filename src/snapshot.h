@@ -0,0 +1,64 @@
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include "mem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SNAP_CHUNK      (1024 * 1024)       /* bytes per read request    */
+#define SNAP_ITEM       (16 * 1024 * 1024)  /* bytes per work item       */
+#define SNAP_TIMEOUT_MS 1000                /* longest wait for a freeze */
+
+/* how the target is paused while it's copied */
+enum snap_method {
+  SNAP_AUTO = 0,                    /* the freezer if usable, else stop  */
+  SNAP_FREEZER,                     /* cgroup v2 cgroup.freeze           */
+  SNAP_STOP,                        /* SIGSTOP, then SIGCONT             */
+  SNAP_METHODS,
+};
+
+
+/*  _snapshot_region:
+ *    the copy of one mapping, read in chunks of SNAP_CHUNK bytes from its
+ *    start. a chunk holds what was read of it from its start, the rest
+ *    wasn't captured and isn't served by snap_read.
+ */
+typedef struct _snapshot_region
+{
+  uintptr_t start, end;
+  uint8_t *data;                    /* inside the arena */
+  uint32_t *filled;                 /* bytes read per chunk */
+  size_t missing;                   /* bytes that couldn't be read */
+} snap_region;
+
+
+/*  _snapshot:
+ *    a consistent copy of the selected mappings of a process, taken while
+ *    all its threads were paused. regions are sorted by address.
+ */
+typedef struct _snapshot
+{
+  int pid;
+  int method;                       /* enum snap_method actually used */
+  snap_region *regions;
+  size_t nregions;
+  uint8_t *arena;                   /* backing store of every region */
+  uint32_t *filled;                 /* backing store of the regions'
+                                     * filled lengths */
+  size_t size;                      /* bytes selected */
+  size_t copied;                    /* bytes read */
+  uint64_t freeze_ns;               /* until every thread was paused */
+  uint64_t pause_ns;                /* from pausing to resuming */
+} snapshot;
+
+
+extern const char *snap_method_names[SNAP_METHODS];
+
+/* function definitions */
+int     snap_capture(snapshot*, int, ll_memmap_file*, uint8_t, int, int);
+ssize_t snap_read(const snapshot*, uintptr_t, void*, size_t);
+void    snap_free(snapshot*);
+
+#endif /* __SNAPSHOT_H */
@@ -0,0 +1,701 @@
+#include "stacks.h"
+#include "hostutil.h"
+#include "stats.h"
+#include "symbols.h"
+#include "util.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/user.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+#define REPORT_TIDS   8               /* tids listed per group in reports */
+
+
+/*  _stk_pc:
+ *    the symbol of a frame. return addresses are looked up as pc - 1, the
+ *    call they return from, which may be the last instruction of a
+ *    function.
+ */
+struct _stk_pc
+{
+  uintptr_t key;                    /* pc, or pc - 1 for return addresses */
+  uintptr_t sym;                    /* symbol start                       */
+  char *name;                       /* NULL if no symbol covers key       */
+  int module;                       /* index into stk_dump.modules or -1  */
+};
+
+
+/*  _stk_range:
+ *    a mapping, to find where a thread's stack ends.
+ */
+struct _stk_range
+{
+  uintptr_t start, end;
+};
+
+
+/*  _stk_job:
+ *    shared state of the parallel unwind.
+ */
+struct _stk_job
+{
+  stk_dump *d;
+  const unw_table *unw;
+};
+
+
+
+#if defined(__x86_64__)
+/*  _get_regs:
+ *    reads the registers a stopped thread is unwound from.
+ */
+static int
+_get_regs(int tid, unw_regs *r)
+{
+  struct user_regs_struct regs;
+
+  if (ptrace(PTRACE_GETREGS, tid, NULL, &regs) < 0)
+    return -1;
+
+  r->pc = regs.rip;
+  r->sp = regs.rsp;
+  r->fp = regs.rbp;
+  return 0;
+}
+#else
+/* the unwinder only knows x86-64 frames */
+static int
+_get_regs(int tid, unw_regs *r)
+{
+  (void) tid;
+  (void) r;
+  return -1;
+}
+#endif
+
+
+static int
+_cmp_int(const void *a, const void *b)
+{
+  return *(const int *) a - *(const int *) b;
+}
+
+
+static int
+_cmp_pc(const void *a, const void *b)
+{
+  uintptr_t x = ((const struct _stk_pc *) a)->key;
+  uintptr_t y = ((const struct _stk_pc *) b)->key;
+
+  return x < y ? -1 : x > y;
+}
+
+
+/*  _cmp_stack:
+ *    orders threads by their frames, so identical stacks end up next to
+ *    each other. the hash decides almost always.
+ */
+static int
+_cmp_stack(const void *a, const void *b)
+{
+  const stk_thread *x = *(stk_thread *const *) a;
+  const stk_thread *y = *(stk_thread *const *) b;
+  int c;
+
+  if (x->hash != y->hash)
+    return x->hash < y->hash ? -1 : 1;
+  if (x->depth != y->depth)
+    return x->depth - y->depth;
+
+  c = memcmp(x->frames, y->frames, x->depth * sizeof(uintptr_t));
+  return c ? c : x->tid - y->tid;
+}
+
+
+static int
+_cmp_group(const void *a, const void *b)
+{
+  const stk_group *x = a, *y = b;
+
+  if (x->count != y->count)
+    return y->count - x->count;
+  return x->first - y->first;
+}
+
+
+/*  _read_file:
+ *    reads up to len bytes of a small procfs file. returns the amount
+ *    read, -1 on error.
+ */
+static ssize_t
+_read_file(const char *path, char *buf, size_t len)
+{
+  ssize_t n;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return -1;
+
+  n = read(fd, buf, len);
+  close(fd);
+  return n;
+}
+
+
+/*  _zombie:
+ *    whether a thread exited but wasn't reaped yet. a thread group leader
+ *    calling pthread_exit stays like this until the process ends, and
+ *    never reports a stop.
+ */
+static int
+_zombie(int pid, int tid)
+{
+  char path[64], buf[256], *p;
+  ssize_t n;
+
+  snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
+  n = _read_file(path, buf, sizeof(buf) - 1);
+  if (n <= 0)
+    return 1;
+
+  buf[n] = '\0';
+  p = strrchr(buf, ')');
+  return p == NULL || p[1] == '\0' || p[2] == 'Z' || p[2] == 'X';
+}
+
+
+/*  _seize_all:
+ *    attaches to every thread without stopping it. threads can be started
+ *    meanwhile, the task list is read until no new one shows up. returns
+ *    the amount of threads.
+ */
+static int
+_seize_all(stk_dump *d)
+{
+  char path[32];
+  DIR *dir;
+  struct dirent *ent;
+  int *known = NULL, nknown, tid, added, cap = 0, i;
+
+  snprintf(path, sizeof(path), "/proc/%d/task", d->pid);
+
+  do {
+    added = 0;
+
+    nknown = d->nthreads;
+    known = realloc(known, (nknown + 1) * sizeof(int));
+    for (i = 0; i < nknown; i++)
+      known[i] = d->threads[i].tid;
+    qsort(known, nknown, sizeof(int), _cmp_int);
+
+    if ((dir = opendir(path)) == NULL)
+      break;
+
+    while ((ent = readdir(dir)) != NULL)
+    {
+      tid = atoi(ent->d_name);
+      if (tid <= 0
+          || bsearch(&tid, known, nknown, sizeof(int), _cmp_int) != NULL
+          || (tid == d->pid && _zombie(d->pid, tid))
+          || ptrace(PTRACE_SEIZE, tid, NULL, NULL) < 0)
+        continue;
+
+      if (d->nthreads == cap) {
+        cap = cap ? cap * 2 : 64;
+        d->threads = realloc(d->threads, cap * sizeof(stk_thread));
+      }
+      memset(&d->threads[d->nthreads], 0, sizeof(stk_thread));
+      d->threads[d->nthreads++].tid = tid;
+      added++;
+    }
+
+    closedir(dir);
+  } while (added);
+
+  free(known);
+  return d->nthreads;
+}
+
+
+/*  _stop_all:
+ *    interrupts every thread, then waits for each one's stop. a thread
+ *    that was about to take a signal stops for it first, the signal is
+ *    given back on detach.
+ */
+static void
+_stop_all(stk_dump *d)
+{
+  stk_thread *t;
+  int i, tid, status;
+
+  for (i = 0; i < d->nthreads; i++)
+    d->threads[i].stopped =
+      ptrace(PTRACE_INTERRUPT, d->threads[i].tid, NULL, NULL) == 0;
+
+  for (i = 0; i < d->nthreads; i++)
+  {
+    t = &d->threads[i];
+    if (!t->stopped)
+      continue;
+
+    do {
+      tid = waitpid(t->tid, &status, __WALL);
+    } while (tid < 0 && errno == EINTR);
+
+    if (tid != t->tid || !WIFSTOPPED(status)) {
+      t->stopped = 0;
+      continue;
+    }
+
+    /* interrupts stop with SIGTRAP, group stops with the stop signal */
+    if (status >> 16 == PTRACE_EVENT_STOP) {
+      t->group = WSTOPSIG(status) != SIGTRAP;
+    } else {
+      t->group = 0;
+      t->sig = WSTOPSIG(status);
+    }
+  }
+}
+
+
+/*  _detach:
+ *    lets a seized thread go. ptrace only detaches a thread in a stop, so
+ *    one whose stop wasn't taken is interrupted and waited for again. one
+ *    that exited meanwhile is reaped by that wait.
+ */
+static void
+_detach(const stk_thread *t)
+{
+  int tid, status, sig = t->group ? 0 : t->sig;
+
+  if (!t->stopped) {
+    if (ptrace(PTRACE_INTERRUPT, t->tid, NULL, NULL) < 0) {
+      waitpid(t->tid, &status, __WALL | WNOHANG);
+      return;
+    }
+
+    do {
+      tid = waitpid(t->tid, &status, __WALL);
+    } while (tid < 0 && errno == EINTR);
+
+    if (tid != t->tid || !WIFSTOPPED(status))
+      return;
+
+    sig = status >> 16 == PTRACE_EVENT_STOP ? 0 : WSTOPSIG(status);
+  }
+
+  ptrace(PTRACE_DETACH, t->tid, NULL, (void *) (long) sig);
+}
+
+
+/*  _stack_end:
+ *    end of the mapping holding sp, 0 if there's none.
+ */
+static uintptr_t
+_stack_end(const struct _stk_range *r, int n, uintptr_t sp)
+{
+  int lo = 0, hi = n, mid;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (r[mid].end <= sp)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return lo < n && sp >= r[lo].start ? r[lo].end : 0;
+}
+
+
+/*  _read_stacks:
+ *    copies the top of every stopped thread's stack in one batch, from its
+ *    stack pointer up to the end of the stack's mapping, at most bytes.
+ */
+static void
+_read_stacks(stk_dump *d, mem_reader *rd, const struct _stk_range *ranges,
+             int nranges, size_t bytes)
+{
+  mem_readreq *reqs;
+  stk_thread *t;
+  uintptr_t end;
+  int i, n = 0;
+
+  reqs = malloc((d->nthreads + 1) * sizeof(mem_readreq));
+
+  for (i = 0; i < d->nthreads; i++)
+  {
+    t = &d->threads[i];
+    if (!t->stopped)
+      continue;
+
+    /* a stack mapped after the maps were read is copied as far as it
+     * can be */
+    end = _stack_end(ranges, nranges, t->regs.sp);
+    reqs[n].addr = (void *) t->regs.sp;
+    reqs[n].buf = d->stacks + (size_t) i * bytes;
+    reqs[n].len = end > t->regs.sp && end - t->regs.sp < bytes
+                  ? end - t->regs.sp : bytes;
+    n++;
+  }
+
+  mem_read_batch(rd, reqs, n);
+
+  for (i = 0, n = 0; i < d->nthreads; i++)
+  {
+    t = &d->threads[i];
+    if (!t->stopped)
+      continue;
+
+    t->stack.base = t->regs.sp;
+    t->stack.data = reqs[n].buf;
+    t->stack.len = reqs[n].nread > 0 ? (size_t) reqs[n].nread : 0;
+    n++;
+  }
+
+  free(reqs);
+}
+
+
+/*  _unwind_worker:
+ *    unwinds and hashes one thread's stack.
+ */
+static void
+_unwind_worker(int item, int worker, void *arg)
+{
+  struct _stk_job *job = arg;
+  stk_thread *t = &job->d->threads[item];
+
+  (void) worker;
+
+  t->frames = job->d->frames + (size_t) item * STK_MAX_DEPTH;
+  t->depth = t->stopped
+             ? unw_backtrace(job->unw, &t->stack, t->regs, t->frames,
+                             STK_MAX_DEPTH)
+             : 0;
+  t->hash = hostk.hash(t->frames, t->depth * sizeof(uintptr_t));
+}
+
+
+/*  _group:
+ *    sorts the threads by their stacks and collects runs of identical
+ *    ones.
+ */
+static void
+_group(stk_dump *d)
+{
+  int i;
+
+  d->order = malloc((d->nthreads + 1) * sizeof(stk_thread*));
+  d->groups = malloc((d->nthreads + 1) * sizeof(stk_group));
+
+  for (i = 0; i < d->nthreads; i++)
+    d->order[i] = &d->threads[i];
+  qsort(d->order, d->nthreads, sizeof(stk_thread*), _cmp_stack);
+
+  for (i = 0; i < d->nthreads; i++)
+  {
+    if (i == 0 || d->order[i]->hash != d->order[i-1]->hash
+        || d->order[i]->depth != d->order[i-1]->depth
+        || memcmp(d->order[i]->frames, d->order[i-1]->frames,
+                  d->order[i]->depth * sizeof(uintptr_t)) != 0) {
+      d->groups[d->ngroups].first = i;
+      d->groups[d->ngroups++].count = 0;
+    }
+    d->groups[d->ngroups-1].count++;
+  }
+
+  qsort(d->groups, d->ngroups, sizeof(stk_group), _cmp_group);
+}
+
+
+/*  _sym_cb:
+ *    names every unique frame a function symbol covers. where symbols
+ *    alias, the first one seen is kept.
+ */
+static void
+_sym_cb(const sym_record *rec, void *arg)
+{
+  stk_dump *d = arg;
+  size_t lo = 0, hi = d->npcs, mid;
+
+  if (rec->type != SYM_FUNC || rec->size == 0)
+    return;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (d->pcs[mid].key < rec->addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  for (; lo < d->npcs && d->pcs[lo].key < rec->addr + rec->size; lo++)
+    if (d->pcs[lo].name == NULL) {
+      d->pcs[lo].name = strdup(rec->name);
+      d->pcs[lo].sym = rec->addr;
+    }
+}
+
+
+/*  _symbolize:
+ *    looks up the frames of one thread per group, identical stacks are
+ *    only resolved once.
+ */
+static void
+_symbolize(stk_dump *d, ll_memmap_file *maps, const unw_table *unw)
+{
+  const stk_thread *t;
+  const unw_module *m;
+  size_t i, n = 0;
+  int g, f;
+
+  for (g = 0; g < d->ngroups; g++)
+    n += d->order[d->groups[g].first]->depth;
+
+  d->pcs = calloc(n + 1, sizeof(struct _stk_pc));
+  for (g = 0; g < d->ngroups; g++)
+  {
+    t = d->order[d->groups[g].first];
+    for (f = 0; f < t->depth; f++)
+      d->pcs[d->npcs++].key = t->frames[f] - (f > 0);
+  }
+
+  qsort(d->pcs, d->npcs, sizeof(struct _stk_pc), _cmp_pc);
+  for (i = n = 0; i < d->npcs; i++)
+    if (n == 0 || d->pcs[i].key != d->pcs[n-1].key)
+      d->pcs[n++] = d->pcs[i];
+  d->npcs = n;
+
+  d->nmodules = unw->count;
+  d->modules = malloc((unw->count + 1) * sizeof(char*));
+  for (i = 0; i < unw->count; i++)
+    d->modules[i] = strdup(unw->mods[i].path);
+
+  for (i = 0; i < d->npcs; i++)
+  {
+    m = unw_module_find(unw, d->pcs[i].key);
+    d->pcs[i].module = m != NULL ? (int) (m - unw->mods) : -1;
+  }
+
+  sym_enumerate(maps, NULL, NULL, _sym_cb, d);
+}
+
+
+/*  _read_names:
+ *    reads the thread names, after the process runs again.
+ */
+static void
+_read_names(stk_dump *d)
+{
+  char path[64];
+  ssize_t n;
+  int i;
+
+  for (i = 0; i < d->nthreads; i++)
+  {
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/comm", d->pid,
+             d->threads[i].tid);
+    n = _read_file(path, d->threads[i].name, sizeof(d->threads[i].name) - 1);
+    if (n < 0)
+      n = 0;
+    if (n > 0 && d->threads[i].name[n-1] == '\n')
+      n--;
+    d->threads[i].name[n] = '\0';
+  }
+}
+
+
+/*  stk_capture:
+ *    stops every thread of a process just long enough to take its
+ *    registers and the top of its stack, lets it run on, then unwinds,
+ *    groups and symbolizes the stacks. returns the amount of threads, -1
+ *    if none could be attached.
+ *
+ *    stk_dump *d:            receives the dump, free with stk_free
+ *    int pid:                process to dump
+ *    ll_memmap_file *maps:   its maps, for stacks, unwind tables and
+ *                            symbols
+ *    size_t bytes:           stack bytes copied per thread, 0 for
+ *                            STK_STACK_BYTES
+ *    int nthreads:           unwind workers, 0 for one per cpu
+ */
+int
+stk_capture(stk_dump *d, int pid, ll_memmap_file *maps, size_t bytes,
+            int nthreads)
+{
+  ll_memmap_file *mmf;
+  struct _stk_range *ranges = NULL;
+  struct _stk_job job;
+  mem_reader rd;
+  unw_table unw;
+  uint64_t t0;
+  int i, nranges = 0;
+
+  memset(d, 0, sizeof(stk_dump));
+  d->pid = pid;
+
+  if (bytes == 0)
+    bytes = STK_STACK_BYTES;
+  bytes = (bytes + 15) & ~(size_t) 15;
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    ranges = realloc(ranges, (nranges + 1) * sizeof(struct _stk_range));
+    ranges[nranges].start = (uintptr_t) mmf->start_addr;
+    ranges[nranges++].end = (uintptr_t) mmf->end_addr;
+  }
+
+  if (_seize_all(d) == 0) {
+    free(ranges);
+    stk_free(d);
+    return -1;
+  }
+
+  /* the copies are touched now, so the reads don't fault while the
+   * process is stopped */
+  d->stacks = malloc((size_t) d->nthreads * bytes);
+  memset(d->stacks, 0, (size_t) d->nthreads * bytes);
+  mem_reader_init(&rd, pid, MEM_BACKEND_VM_READV);
+
+  t0 = monotonic_ns();
+  _stop_all(d);
+
+  for (i = 0; i < d->nthreads; i++)
+    if (d->threads[i].stopped && _get_regs(d->threads[i].tid,
+                                           &d->threads[i].regs) < 0)
+      memset(&d->threads[i].regs, 0, sizeof(unw_regs));
+
+  _read_stacks(d, &rd, ranges, nranges, bytes);
+
+  for (i = 0; i < d->nthreads; i++)
+    _detach(&d->threads[i]);
+
+  d->stop_ns = monotonic_ns() - t0;
+  stat_time(STAT_T_STOP, t0);
+
+  mem_reader_close(&rd);
+  free(ranges);
+
+  _read_names(d);
+
+  unw_table_build(&unw, maps);
+  d->frames = malloc((size_t) d->nthreads * STK_MAX_DEPTH
+                     * sizeof(uintptr_t));
+
+  if (nthreads <= 0)
+    nthreads = host_get_info()->cpus;
+
+  job.d = d;
+  job.unw = &unw;
+  parallel_for(d->nthreads, nthreads, _unwind_worker, &job);
+
+  _group(d);
+  _symbolize(d, maps, &unw);
+  unw_table_free(&unw);
+
+  return d->nthreads;
+}
+
+
+/*  stk_describe:
+ *    writes a frame as symbol+offset, or its address if no symbol covers
+ *    it, to buf. returns the path of its module or NULL.
+ *
+ *    const stk_dump *d:  a captured dump
+ *    uintptr_t pc:       the frame's address
+ *    int frame:          its depth, 0 for the innermost
+ *    char *buf:          receives the description
+ *    size_t len:         size of buf
+ */
+const char*
+stk_describe(const stk_dump *d, uintptr_t pc, int frame, char *buf,
+             size_t len)
+{
+  struct _stk_pc key, *p;
+
+  key.key = pc - (frame > 0);
+  p = bsearch(&key, d->pcs, d->npcs, sizeof(struct _stk_pc), _cmp_pc);
+
+  if (p != NULL && p->name != NULL)
+    snprintf(buf, len, "%s+%#lx", p->name, (unsigned long) (pc - p->sym));
+  else
+    snprintf(buf, len, "%#lx", (unsigned long) pc);
+
+  return p != NULL && p->module >= 0 ? d->modules[p->module] : NULL;
+}
+
+
+/*  stk_report:
+ *    writes every group of identical stacks, largest first, with some of
+ *    its threads and its frames.
+ */
+void
+stk_report(const stk_dump *d, FILE *f)
+{
+  const stk_group *g;
+  const stk_thread *t;
+  const char *mod;
+  char desc[256];
+  int i, j;
+
+  fprintf(f, "pid %d: %d threads, %d distinct stacks, stopped for %.3f ms\n",
+          d->pid, d->nthreads, d->ngroups, d->stop_ns / 1e6);
+
+  for (i = 0; i < d->ngroups; i++)
+  {
+    g = &d->groups[i];
+    fprintf(f, "\n%d thread%s:", g->count, g->count == 1 ? "" : "s");
+
+    for (j = 0; j < g->count && j < REPORT_TIDS; j++)
+      fprintf(f, " %d (%s)", d->order[g->first + j]->tid,
+              d->order[g->first + j]->name);
+    fprintf(f, "%s\n", g->count > REPORT_TIDS ? " ..." : "");
+
+    t = d->order[g->first];
+    if (!t->stopped)
+      fprintf(f, "  not stopped\n");
+
+    for (j = 0; j < t->depth; j++)
+    {
+      mod = stk_describe(d, t->frames[j], j, desc, sizeof(desc));
+      fprintf(f, "  #%-3d %#018lx %s%s%s\n", j, (unsigned long) t->frames[j],
+              desc, mod ? "  " : "", mod ? mod : "");
+    }
+  }
+}
+
+
+/*  stk_free:
+ *    frees a dump filled by stk_capture.
+ */
+void
+stk_free(stk_dump *d)
+{
+  size_t i;
+
+  for (i = 0; i < d->npcs; i++)
+    free(d->pcs[i].name);
+  for (i = 0; i < d->nmodules; i++)
+    free(d->modules[i]);
+
+  free(d->pcs);
+  free(d->modules);
+  free(d->threads);
+  free(d->order);
+  free(d->groups);
+  free(d->stacks);
+  free(d->frames);
+  memset(d, 0, sizeof(stk_dump));
+}
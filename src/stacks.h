@@ -0,0 +1,71 @@
+#ifndef __STACKS_H
+#define __STACKS_H
+
+#include "mem.h"
+#include "unwind.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define STK_STACK_BYTES   (8 * 1024)  /* stack copied per thread, default */
+#define STK_MAX_DEPTH     128         /* frames unwound per thread        */
+
+
+/*  _stack_thread:
+ *    a thread of a dumped process, its registers and stack as they were
+ *    while it was stopped, and the frames unwound from them.
+ */
+typedef struct _stack_thread
+{
+  int tid;
+  char name[16];                    /* comm, read after resuming */
+  int stopped;                      /* registers and stack were taken */
+  int group;                        /* was in a group stop */
+  int sig;                          /* signal to deliver on detach */
+  unw_regs regs;
+  unw_stack stack;
+  uintptr_t *frames;                /* return addresses, innermost first */
+  int depth;
+  uint64_t hash;                    /* of the frames */
+} stk_thread;
+
+
+/*  _stack_group:
+ *    threads with identical stacks, as a range of stk_dump.order.
+ */
+typedef struct _stack_group
+{
+  int first, count;
+} stk_group;
+
+
+/*  _stack_dump:
+ *    the stacks of every thread of a process, grouped by their frames.
+ *    groups are sorted by size, largest first.
+ */
+typedef struct _stack_dump
+{
+  int pid;
+  stk_thread *threads;
+  int nthreads;
+  stk_thread **order;               /* threads sorted by their stacks */
+  stk_group *groups;
+  int ngroups;
+  uint64_t stop_ns;                 /* how long the process was stopped */
+  uint8_t *stacks;                  /* backing store of the stack copies */
+  uintptr_t *frames;                /* backing store of the frames */
+  struct _stk_pc *pcs;              /* symbols of unique frames, sorted */
+  size_t npcs;
+  char **modules;                   /* module paths, by unw_table index */
+  size_t nmodules;
+} stk_dump;
+
+
+/* function definitions */
+int         stk_capture(stk_dump*, int, ll_memmap_file*, size_t, int);
+const char* stk_describe(const stk_dump*, uintptr_t, int, char*, size_t);
+void        stk_report(const stk_dump*, FILE*);
+void        stk_free(stk_dump*);
+
+#endif /* __STACKS_H */
@@ -0,0 +1,365 @@
+#include "stats.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <linux/limits.h>
+
+
+const char *stat_counter_names[STAT_COUNTERS] = {
+  "maps_parsed",
+  "maps_entries",
+  "read_syscalls",
+  "read_bytes",
+  "read_faults",
+  "scan_chunks",
+  "scan_bytes",
+  "scan_hits",
+  "decode_insns",
+  "ui_frames",
+  "smaps_reads",
+};
+
+const char *stat_timer_names[STAT_TIMERS] = {
+  "maps",
+  "read",
+  "scan",
+  "decode",
+  "frame",
+  "smaps",
+  "stop",
+  "pause",
+};
+
+
+__thread stat_block *stat_self;
+
+static stat_block *blocks;          /* every block ever allocated */
+static pthread_key_t release_key;
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static char dump_path[PATH_MAX];
+
+
+
+/*  _stat_release:
+ *    thread exit destructor, hands the block back for reuse.
+ */
+static void
+_stat_release(void *p)
+{
+  stat_block *b = p;
+
+  __atomic_store_n(&b->in_use, 0, __ATOMIC_RELEASE);
+}
+
+
+static void
+_stat_make_key(void)
+{
+  pthread_key_create(&release_key, _stat_release);
+}
+
+
+/*  stat_attach:
+ *    gives the calling thread its counter block, reusing one released by an
+ *    exited thread if there is one. called on a thread's first count.
+ */
+stat_block *
+stat_attach(void)
+{
+  stat_block *b;
+  int zero;
+
+  pthread_once(&key_once, _stat_make_key);
+
+  for (b = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); b; b = b->next)
+  {
+    zero = 0;
+    if (__atomic_compare_exchange_n(&b->in_use, &zero, 1, 0,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      break;
+  }
+
+  if (b == NULL) {
+    b = calloc(1, sizeof(stat_block));
+    b->in_use = 1;
+    b->next = __atomic_load_n(&blocks, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&blocks, &b->next, b, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      ;
+  }
+
+  stat_self = b;
+  pthread_setspecific(release_key, b);
+  return b;
+}
+
+
+/*  stats_collect:
+ *    sums the blocks of all threads into t. values are read without
+ *    locking, so a block being updated may be counted a moment early or
+ *    late, but never torn. safe to call from a signal handler.
+ *
+ *    stat_totals *t:   receives the totals
+ */
+void
+stats_collect(stat_totals *t)
+{
+  int i, j, k;
+  uint64_t v;
+  stat_block *b;
+  struct rusage ru;
+
+  memset(t, 0, sizeof(*t));
+
+  for (b = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE); b; b = b->next)
+  {
+    if (__atomic_load_n(&b->in_use, __ATOMIC_RELAXED))
+      t->threads++;
+
+    for (i = 0; i < STAT_COUNTERS; i++)
+      t->counters[i] += __atomic_load_n(&b->counters[i], __ATOMIC_RELAXED);
+
+    for (j = 0; j < STAT_TIMERS; j++)
+    {
+      t->timers[j].count += __atomic_load_n(&b->timers[j].count,
+                                            __ATOMIC_RELAXED);
+      t->timers[j].total_ns += __atomic_load_n(&b->timers[j].total_ns,
+                                               __ATOMIC_RELAXED);
+      v = __atomic_load_n(&b->timers[j].max_ns, __ATOMIC_RELAXED);
+      if (v > t->timers[j].max_ns)
+        t->timers[j].max_ns = v;
+
+      for (k = 0; k < STAT_BUCKETS; k++)
+        t->timers[j].buckets[k] += __atomic_load_n(&b->timers[j].buckets[k],
+                                                   __ATOMIC_RELAXED);
+    }
+  }
+
+  if (getrusage(RUSAGE_SELF, &ru) == 0) {
+    t->utime_us = ru.ru_utime.tv_sec * 1000000ULL + ru.ru_utime.tv_usec;
+    t->stime_us = ru.ru_stime.tv_sec * 1000000ULL + ru.ru_stime.tv_usec;
+    t->minflt = ru.ru_minflt;
+    t->majflt = ru.ru_majflt;
+  }
+}
+
+
+/*  stat_hist_percentile:
+ *    returns the upper bound in ns of the bucket holding the p-th quantile
+ *    (0 < p <= 1), capped at the largest recorded time. 0 if empty.
+ *
+ *    const stat_hist *h:   histogram to look at
+ *    double p:             quantile, e.g. 0.99
+ */
+uint64_t
+stat_hist_percentile(const stat_hist *h, double p)
+{
+  int i;
+  uint64_t want, seen = 0, bound;
+
+  if (h->count == 0)
+    return 0;
+
+  want = (uint64_t) (p * h->count);
+  if (want == 0)
+    want = 1;
+
+  for (i = 0; i < STAT_BUCKETS - 1; i++)
+  {
+    seen += h->buckets[i];
+    if (seen >= want)
+      break;
+  }
+
+  bound = i ? 1ULL << i : 1;
+  return bound < h->max_ns ? bound : h->max_ns;
+}
+
+
+/*  _json_out:
+ *    minimal buffered writer, only uses write(2) so it can run in a signal
+ *    handler.
+ */
+struct _json_out
+{
+  int fd;
+  size_t len;
+  char buf[4096];
+};
+
+
+static void
+_json_flush(struct _json_out *o)
+{
+  size_t off = 0;
+  ssize_t n;
+
+  while (off < o->len)
+  {
+    n = write(o->fd, o->buf + off, o->len - off);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    off += n;
+  }
+
+  o->len = 0;
+}
+
+
+static void
+_json_str(struct _json_out *o, const char *s)
+{
+  while (*s)
+  {
+    if (o->len == sizeof(o->buf))
+      _json_flush(o);
+    o->buf[o->len++] = *s++;
+  }
+}
+
+
+static void
+_json_u64(struct _json_out *o, uint64_t v)
+{
+  char tmp[21];
+  int i = sizeof(tmp) - 1;
+
+  tmp[i] = '\0';
+  do {
+    tmp[--i] = '0' + v % 10;
+    v /= 10;
+  } while (v);
+
+  _json_str(o, tmp + i);
+}
+
+
+/* writes "name": v followed by sep */
+static void
+_json_member(struct _json_out *o, const char *name, uint64_t v,
+             const char *sep)
+{
+  _json_str(o, "\"");
+  _json_str(o, name);
+  _json_str(o, "\": ");
+  _json_u64(o, v);
+  _json_str(o, sep);
+}
+
+
+/*  stats_dump_json:
+ *    writes the current totals as a single line JSON object to fd. async
+ *    signal safe.
+ *
+ *    int fd:   file descriptor to write to
+ */
+void
+stats_dump_json(int fd)
+{
+  int i, k;
+  stat_totals t;
+  struct _json_out o;
+
+  o.fd = fd;
+  o.len = 0;
+
+  stats_collect(&t);
+
+  _json_str(&o, "{");
+  _json_member(&o, "threads", t.threads, ", ");
+  _json_member(&o, "utime_us", t.utime_us, ", ");
+  _json_member(&o, "stime_us", t.stime_us, ", ");
+  _json_member(&o, "minflt", t.minflt, ", ");
+  _json_member(&o, "majflt", t.majflt, ", ");
+
+  _json_str(&o, "\"counters\": {");
+  for (i = 0; i < STAT_COUNTERS; i++)
+    _json_member(&o, stat_counter_names[i], t.counters[i],
+                 i + 1 < STAT_COUNTERS ? ", " : "");
+
+  _json_str(&o, "}, \"timers\": {");
+  for (i = 0; i < STAT_TIMERS; i++)
+  {
+    _json_str(&o, "\"");
+    _json_str(&o, stat_timer_names[i]);
+    _json_str(&o, "\": {");
+    _json_member(&o, "count", t.timers[i].count, ", ");
+    _json_member(&o, "total_ns", t.timers[i].total_ns, ", ");
+    _json_member(&o, "max_ns", t.timers[i].max_ns, ", ");
+
+    _json_str(&o, "\"buckets\": [");
+    for (k = 0; k < STAT_BUCKETS; k++)
+    {
+      _json_u64(&o, t.timers[i].buckets[k]);
+      if (k + 1 < STAT_BUCKETS)
+        _json_str(&o, ", ");
+    }
+    _json_str(&o, i + 1 < STAT_TIMERS ? "]}, " : "]}");
+  }
+
+  _json_str(&o, "}}\n");
+  _json_flush(&o);
+}
+
+
+/*  _stats_signal_handler:
+ *    dumps the stats to the configured file, or stderr.
+ */
+static void
+_stats_signal_handler(int sig)
+{
+  int fd, saved = errno;
+
+  (void) sig;
+
+  if (dump_path[0] != '\0') {
+    fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+      stats_dump_json(fd);
+      close(fd);
+    }
+  } else {
+    stats_dump_json(STDERR_FILENO);
+  }
+
+  errno = saved;
+}
+
+
+/*  stats_signal:
+ *    dumps the stats as JSON whenever signo is received. returns 0 on
+ *    success, -1 on failure.
+ *
+ *    int signo:          signal to dump on, e.g. SIGUSR1
+ *    const char *path:   file to (over)write on every dump, NULL for stderr
+ */
+int
+stats_signal(int signo, const char *path)
+{
+  struct sigaction sa;
+
+  if (path != NULL && strlen(path) >= sizeof(dump_path))
+    return -1;
+
+  if (path != NULL)
+    strcpy(dump_path, path);
+  else
+    dump_path[0] = '\0';
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = _stats_signal_handler;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+
+  return sigaction(signo, &sa, NULL);
+}
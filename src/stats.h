@@ -0,0 +1,151 @@
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/* event counters, see stat_counter_names for their output names */
+enum stat_counter {
+  STAT_MAPS_PARSED = 0,             /* parse_proc_maps calls              */
+  STAT_MAPS_ENTRIES,                /* mappings parsed                    */
+  STAT_READ_SYSCALLS,               /* process_vm_readv and pread calls   */
+  STAT_READ_BYTES,                  /* bytes copied out of processes      */
+  STAT_READ_FAULTS,                 /* requests hitting unreadable memory */
+  STAT_SCAN_CHUNKS,                 /* scan kernel calls                  */
+  STAT_SCAN_BYTES,                  /* bytes handed to scan kernels       */
+  STAT_SCAN_HITS,                   /* matches found by scan kernels      */
+  STAT_DECODE_INSNS,                /* instructions decoded               */
+  STAT_UI_FRAMES,                   /* UI frames drawn                    */
+  STAT_SMAPS_READS,                 /* full smaps reads                   */
+  STAT_COUNTERS,
+};
+
+/* latency histograms */
+enum stat_timer {
+  STAT_T_MAPS = 0,                  /* a whole parse_proc_maps call  */
+  STAT_T_READ,                      /* a single read syscall         */
+  STAT_T_SCAN,                      /* a scan kernel call            */
+  STAT_T_DECODE,                    /* decoding a run of code        */
+  STAT_T_FRAME,                     /* drawing and handling a frame  */
+  STAT_T_SMAPS,                     /* reading and parsing smaps     */
+  STAT_T_STOP,                      /* threads stopped for a dump    */
+  STAT_T_PAUSE,                     /* a process paused for a copy   */
+  STAT_TIMERS,
+};
+
+/* bucket i counts durations below 2^i ns and at least 2^(i-1) ns, the last
+ * bucket also takes everything longer */
+#define STAT_BUCKETS 32
+
+
+/*  _stat_histogram:
+ *    latency distribution of one timer.
+ */
+typedef struct _stat_histogram
+{
+  uint64_t count, total_ns, max_ns;
+  uint64_t buckets[STAT_BUCKETS];
+} stat_hist;
+
+
+/*  _stat_block:
+ *    counters of a single thread. only the owning thread writes to a block,
+ *    readers sum all blocks without locking. blocks of exited threads are
+ *    reused by new threads and keep their counts.
+ */
+typedef struct _stat_block
+{
+  struct _stat_block *next;
+  int in_use;
+  uint64_t counters[STAT_COUNTERS];
+  stat_hist timers[STAT_TIMERS];
+} stat_block;
+
+
+/*  _stat_totals:
+ *    all blocks summed up, with the process' cpu time and page faults so
+ *    the time spent in the kernel and in faults can be told apart.
+ */
+typedef struct _stat_totals
+{
+  uint64_t counters[STAT_COUNTERS];
+  stat_hist timers[STAT_TIMERS];
+  int threads;                      /* threads currently owning a block */
+  uint64_t utime_us, stime_us;      /* user and system cpu time         */
+  uint64_t minflt, majflt;          /* minor and major page faults      */
+} stat_totals;
+
+
+extern const char *stat_counter_names[STAT_COUNTERS];
+extern const char *stat_timer_names[STAT_TIMERS];
+
+/* function definitions */
+stat_block* stat_attach(void);
+void        stats_collect(stat_totals*);
+uint64_t    stat_hist_percentile(const stat_hist*, double);
+void        stats_dump_json(int);
+int         stats_signal(int, const char*);
+
+
+#ifndef PARDU_NO_STATS
+
+extern __thread stat_block *stat_self;
+
+
+/*  stat_add:
+ *    adds v to a counter of the calling thread.
+ */
+static inline void
+stat_add(int c, uint64_t v)
+{
+  stat_block *b = stat_self ? stat_self : stat_attach();
+
+  __atomic_store_n(&b->counters[c], b->counters[c] + v, __ATOMIC_RELAXED);
+}
+
+
+/*  stat_now:
+ *    timestamp to pass to stat_time.
+ */
+static inline uint64_t
+stat_now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*  stat_time:
+ *    records the time passed since start in a timer of the calling thread.
+ */
+static inline void
+stat_time(int t, uint64_t start)
+{
+  stat_block *b = stat_self ? stat_self : stat_attach();
+  stat_hist *h = &b->timers[t];
+  uint64_t ns = stat_now() - start;
+  int i;
+
+  i = ns ? 64 - __builtin_clzll(ns) : 0;
+  if (i >= STAT_BUCKETS)
+    i = STAT_BUCKETS - 1;
+
+  __atomic_store_n(&h->buckets[i], h->buckets[i] + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->total_ns, h->total_ns + ns, __ATOMIC_RELAXED);
+  if (ns > h->max_ns)
+    __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+}
+
+#else
+
+static inline void     stat_add(int c, uint64_t v) { (void) c; (void) v; }
+static inline uint64_t stat_now(void) { return 0; }
+static inline void     stat_time(int t, uint64_t s) { (void) t; (void) s; }
+
+#endif /* PARDU_NO_STATS */
+
+#endif /* __STATS_H */
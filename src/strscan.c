@@ -0,0 +1,571 @@
+#include "strscan.h"
+#include "hostutil.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+
+#define CHUNK_PAGES   256             /* pages read per batch              */
+#define PAGE_SIZE     4096
+#define WORD_BYTES    64              /* bytes covered by one bitmap word  */
+#define PAGE_WORDS    (PAGE_SIZE / WORD_BYTES)
+#define BATCH_RECORDS 4096            /* records handed to the callback    */
+#define FILTER_MAX    65536           /* bytes of a string used to filter  */
+
+#define PAGE_DOWN(a)  ((a) & ~((uintptr_t) PAGE_SIZE - 1))
+#define PAGE_UP(a)    PAGE_DOWN((a) + PAGE_SIZE - 1)
+
+#define EVEN_BITS     0x5555555555555555ULL
+
+
+/*  _string_state:
+ *    run trackers for every encoding. runs are found from the transitions in
+ *    the per-word class bitmaps, so a tracker only does work where a string
+ *    starts or ends. a run stays open across words and chunks as long as
+ *    the memory is contiguous.
+ *
+ *    the last word of every readable run is held back (pend_*), since
+ *    utf-8 and utf-16 classification needs a few bytes of the word after it.
+ */
+struct _string_state
+{
+  const str_params *p;
+  str_cb cb;
+  void *arg;
+
+  str_record batch[BATCH_RECORDS];
+  size_t nbatch, total;
+
+  /* printable ascii runs */
+  uint64_t a_open;
+  uintptr_t a_start;
+
+  /* utf-8 runs, with running totals of continuation and high bytes */
+  uint64_t u_open, u_carry, u_cont, u_high, u_start_cont, u_start_high;
+  uintptr_t u_start;
+
+  /* utf-16le runs, one per byte parity */
+  uint64_t w_open[2], w_carry;
+  uintptr_t w_start[2];
+
+  /* held back word */
+  int pend;
+  uintptr_t pend_base;
+  uint8_t pend_bytes[WORD_BYTES];
+  uint64_t pend_p, pend_h, pend_z;
+};
+
+
+/*  strclass_generic:
+ *    classifies nwords * 64 bytes, setting one bit per byte in each bitmap:
+ *    printable ascii (0x20-0x7e and tab), high bit set, and zero.
+ *
+ *    const uint8_t *p:   bytes to classify
+ *    size_t nwords:      number of 64 byte words
+ *    uint64_t *print:    printable bitmap, nwords entries
+ *    uint64_t *high:     high bit bitmap, nwords entries
+ *    uint64_t *zero:     zero byte bitmap, nwords entries
+ */
+void
+strclass_generic(const uint8_t *p, size_t nwords, uint64_t *print,
+                 uint64_t *high, uint64_t *zero)
+{
+  size_t w;
+  int i;
+  uint64_t pr, hi, z;
+
+  for (w = 0; w < nwords; w++, p += WORD_BYTES)
+  {
+    pr = hi = z = 0;
+    for (i = 0; i < WORD_BYTES; i++)
+    {
+      pr |= (uint64_t) ((p[i] >= 0x20 && p[i] < 0x7f) || p[i] == '\t') << i;
+      hi |= (uint64_t) (p[i] >> 7) << i;
+      z  |= (uint64_t) (p[i] == 0) << i;
+    }
+
+    print[w] = pr;
+    high[w] = hi;
+    zero[w] = z;
+  }
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*  strclass_sse2:
+ *    strclass_generic classifying 16 bytes per step. the printable range
+ *    check uses signed compares, which rules out high bytes for free.
+ */
+void
+strclass_sse2(const uint8_t *p, size_t nwords, uint64_t *print,
+              uint64_t *high, uint64_t *zero)
+{
+  size_t w;
+  int i;
+  uint64_t pr, hi, z;
+  __m128i v, lo = _mm_set1_epi8(0x1f), top = _mm_set1_epi8(0x7f),
+          tab = _mm_set1_epi8('\t'), nul = _mm_setzero_si128();
+
+  for (w = 0; w < nwords; w++, p += WORD_BYTES)
+  {
+    pr = hi = z = 0;
+    for (i = 0; i < WORD_BYTES; i += 16)
+    {
+      v = _mm_loadu_si128((const __m128i *) (p + i));
+      pr |= (uint64_t) (uint16_t) _mm_movemask_epi8(
+              _mm_or_si128(_mm_and_si128(_mm_cmpgt_epi8(v, lo),
+                                         _mm_cmplt_epi8(v, top)),
+                           _mm_cmpeq_epi8(v, tab))) << i;
+      hi |= (uint64_t) (uint16_t) _mm_movemask_epi8(v) << i;
+      z  |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_cmpeq_epi8(v, nul))
+            << i;
+    }
+
+    print[w] = pr;
+    high[w] = hi;
+    zero[w] = z;
+  }
+}
+
+
+/*  strclass_avx2:
+ *    strclass_generic classifying 32 bytes per step.
+ */
+__attribute__((target("avx2"))) void
+strclass_avx2(const uint8_t *p, size_t nwords, uint64_t *print,
+              uint64_t *high, uint64_t *zero)
+{
+  size_t w;
+  int i;
+  uint64_t pr, hi, z;
+  __m256i v, lo = _mm256_set1_epi8(0x1f), top = _mm256_set1_epi8(0x7f),
+          tab = _mm256_set1_epi8('\t'), nul = _mm256_setzero_si256();
+
+  for (w = 0; w < nwords; w++, p += WORD_BYTES)
+  {
+    pr = hi = z = 0;
+    for (i = 0; i < WORD_BYTES; i += 32)
+    {
+      v = _mm256_loadu_si256((const __m256i *) (p + i));
+      pr |= (uint64_t) (uint32_t) _mm256_movemask_epi8(
+              _mm256_or_si256(_mm256_and_si256(_mm256_cmpgt_epi8(v, lo),
+                                               _mm256_cmpgt_epi8(top, v)),
+                              _mm256_cmpeq_epi8(v, tab))) << i;
+      hi |= (uint64_t) (uint32_t) _mm256_movemask_epi8(v) << i;
+      z  |= (uint64_t) (uint32_t) _mm256_movemask_epi8(
+              _mm256_cmpeq_epi8(v, nul)) << i;
+    }
+
+    print[w] = pr;
+    high[w] = hi;
+    zero[w] = z;
+  }
+}
+
+#endif
+
+
+/*  _below:
+ *    popcount of the bits of m below bit pos.
+ */
+static inline uint64_t
+_below(uint64_t m, int pos)
+{
+  return pos ? __builtin_popcountll(m << (64 - pos)) : 0;
+}
+
+
+/*  _str_emit:
+ *    queues a record, handing the batch to the callback once it's full.
+ */
+static void
+_str_emit(struct _string_state *st, uintptr_t addr, size_t len, int enc)
+{
+  str_record *r;
+
+  r = &st->batch[st->nbatch++];
+  r->addr = addr;
+  r->len = len > UINT32_MAX ? UINT32_MAX : len;
+  r->encoding = enc;
+  st->total++;
+
+  if (st->nbatch == BATCH_RECORDS) {
+    st->cb(st->batch, st->nbatch, st->arg);
+    st->nbatch = 0;
+  }
+}
+
+
+/*  _utf8_seq:
+ *    checks for a valid multibyte sequence starting at cur[i], where bytes
+ *    past the word are taken from next (if there is one). returns the
+ *    sequence length or 0. overlong forms and surrogates are rejected.
+ */
+static int
+_utf8_seq(const uint8_t *cur, const uint8_t *next, int i)
+{
+  int n, k;
+  uint8_t b, c;
+
+  b = cur[i];
+  if (b >= 0xc2 && b <= 0xdf)
+    n = 2;
+  else if (b >= 0xe0 && b <= 0xef)
+    n = 3;
+  else if (b >= 0xf0 && b <= 0xf4)
+    n = 4;
+  else
+    return 0;
+
+  for (k = 1; k < n; k++)
+  {
+    if (i + k < WORD_BYTES)
+      c = cur[i+k];
+    else if (next)
+      c = next[i+k-WORD_BYTES];
+    else
+      return 0;
+
+    if ((c & 0xc0) != 0x80)
+      return 0;
+
+    /* second byte limits of E0, ED, F0 and F4 */
+    if (k == 1 && ((b == 0xe0 && c < 0xa0) || (b == 0xed && c > 0x9f)
+                   || (b == 0xf0 && c < 0x90) || (b == 0xf4 && c > 0x8f)))
+      return 0;
+  }
+
+  return n;
+}
+
+
+/*  _str_word:
+ *    runs every selected tracker over one 64 byte word.
+ *
+ *    struct _string_state *st:   extraction state
+ *    uintptr_t base:             address of the word
+ *    const uint8_t *bytes:       the word's bytes
+ *    uint64_t P, H, Z:           its printable, high and zero bitmaps
+ *    const uint8_t *next:        the following word's bytes, or NULL
+ *    uint64_t next_z:            the following word's zero bitmap
+ */
+static void
+_str_word(struct _string_state *st, uintptr_t base, const uint8_t *bytes,
+          uint64_t P, uint64_t H, uint64_t Z, const uint8_t *next,
+          uint64_t next_z)
+{
+  const str_params *p = st->p;
+  uint64_t t, V, C, valid, cand, R, T, Tp;
+  unsigned int pos, par, n, k;
+  uintptr_t at;
+  size_t len, chars, high;
+
+  /* ascii on its own, with utf-8 selected it's covered by that tracker */
+  if ((p->encodings & (STR_ASCII | STR_UTF8)) == STR_ASCII) {
+    t = P ^ ((P << 1) | st->a_open);
+    while (t)
+    {
+      pos = __builtin_ctzll(t);
+      at = base + pos;
+      if (P >> pos & 1)
+        st->a_start = at;
+      else if (at - st->a_start >= p->min_len)
+        _str_emit(st, st->a_start, at - st->a_start, STR_ASCII);
+      t &= t - 1;
+    }
+    st->a_open = P >> 63;
+  }
+
+  if (p->encodings & STR_UTF8) {
+    /* validate the high bytes, continuations of a sequence that started in
+     * the previous word were already validated there */
+    valid = H & st->u_carry;
+    C = valid;
+    st->u_carry = 0;
+
+    for (cand = H & ~valid; cand; cand &= cand - 1)
+    {
+      pos = __builtin_ctzll(cand);
+      if ((n = _utf8_seq(bytes, next, pos)) == 0)
+        continue;
+
+      for (k = 0; k < n; k++)
+      {
+        if (pos + k < 64) {
+          valid |= 1ULL << (pos + k);
+          if (k)
+            C |= 1ULL << (pos + k);
+        }
+        else
+          st->u_carry |= 1ULL << (pos + k - 64);
+      }
+      cand &= ~(((2ULL << (n - 1)) - 1) << pos);
+      cand |= 1ULL << pos;      /* cleared by the loop */
+    }
+
+    V = P | valid;
+    t = V ^ ((V << 1) | st->u_open);
+    while (t)
+    {
+      pos = __builtin_ctzll(t);
+      at = base + pos;
+      if (V >> pos & 1) {
+        st->u_start = at;
+        st->u_start_cont = st->u_cont + _below(C, pos);
+        st->u_start_high = st->u_high + _below(valid, pos);
+      }
+      else {
+        len = at - st->u_start;
+        chars = len - (st->u_cont + _below(C, pos) - st->u_start_cont);
+        high = st->u_high + _below(valid, pos) - st->u_start_high;
+
+        if (chars >= p->min_len)
+          _str_emit(st, st->u_start, len,
+                    high == 0 && (p->encodings & STR_ASCII) ? STR_ASCII
+                                                            : STR_UTF8);
+      }
+      t &= t - 1;
+    }
+
+    st->u_open = V >> 63;
+    st->u_cont += __builtin_popcountll(C);
+    st->u_high += __builtin_popcountll(valid);
+  }
+
+  if (p->encodings & STR_UTF16LE) {
+    /* a code unit is a printable byte followed by a zero byte, T marks the
+     * low byte of every unit */
+    T = P & ((Z >> 1) | ((next ? next_z & 1 : 0) << 63));
+
+    for (par = 0; par < 2; par++)
+    {
+      /* mark both bytes of every unit of this parity, so consecutive units
+       * form one run of set bits */
+      Tp = T & (EVEN_BITS << par);
+      R = Tp | (Tp << 1);
+      if (par) {
+        R |= st->w_carry;
+        st->w_carry = Tp >> 63;
+      }
+
+      t = R ^ ((R << 1) | st->w_open[par]);
+      while (t)
+      {
+        pos = __builtin_ctzll(t);
+        at = base + pos;
+        if (R >> pos & 1)
+          st->w_start[par] = at;
+        else if ((at - st->w_start[par]) / 2 >= p->min_len)
+          _str_emit(st, st->w_start[par], at - st->w_start[par],
+                    STR_UTF16LE);
+        t &= t - 1;
+      }
+      st->w_open[par] = R >> 63;
+    }
+  }
+}
+
+
+/*  _str_break:
+ *    ends contiguous memory: processes the held back word without a
+ *    successor and closes every open run.
+ */
+static void
+_str_break(struct _string_state *st)
+{
+  uintptr_t end;
+  size_t len, chars;
+  int par;
+
+  if (!st->pend)
+    return;
+
+  _str_word(st, st->pend_base, st->pend_bytes, st->pend_p, st->pend_h,
+            st->pend_z, NULL, 0);
+  st->pend = 0;
+  end = st->pend_base + WORD_BYTES;
+
+  if (st->a_open && end - st->a_start >= st->p->min_len)
+    _str_emit(st, st->a_start, end - st->a_start, STR_ASCII);
+
+  if (st->u_open) {
+    len = end - st->u_start;
+    chars = len - (st->u_cont - st->u_start_cont);
+    if (chars >= st->p->min_len)
+      _str_emit(st, st->u_start, len,
+                st->u_high == st->u_start_high
+                && (st->p->encodings & STR_ASCII) ? STR_ASCII : STR_UTF8);
+  }
+
+  for (par = 0; par < 2; par++)
+    if (st->w_open[par] && (end - st->w_start[par]) / 2 >= st->p->min_len)
+      _str_emit(st, st->w_start[par], end - st->w_start[par], STR_UTF16LE);
+
+  st->a_open = st->u_open = st->u_carry = st->w_carry = 0;
+  st->w_open[0] = st->w_open[1] = 0;
+}
+
+
+/*  _str_run:
+ *    classifies a run of readable memory and feeds it to the trackers. the
+ *    last word is held back until it's known whether memory continues.
+ */
+static void
+_str_run(struct _string_state *st, const uint8_t *buf, size_t nwords,
+         uintptr_t addr, uint64_t *bm)
+{
+  uint64_t *P = bm, *H = bm + nwords, *Z = bm + nwords * 2;
+  size_t w;
+
+  hostk.strclass(buf, nwords, P, H, Z);
+
+  if (st->pend && st->pend_base + WORD_BYTES != addr)
+    _str_break(st);
+
+  if (st->pend)
+    _str_word(st, st->pend_base, st->pend_bytes, st->pend_p, st->pend_h,
+              st->pend_z, buf, Z[0]);
+
+  for (w = 0; w + 1 < nwords; w++)
+    _str_word(st, addr + w * WORD_BYTES, buf + w * WORD_BYTES, P[w], H[w],
+              Z[w], buf + (w + 1) * WORD_BYTES, Z[w+1]);
+
+  st->pend = 1;
+  st->pend_base = addr + w * WORD_BYTES;
+  memcpy(st->pend_bytes, buf + w * WORD_BYTES, WORD_BYTES);
+  st->pend_p = P[w];
+  st->pend_h = H[w];
+  st->pend_z = Z[w];
+}
+
+
+/*  str_extract:
+ *    finds every string in the given ranges. memory is read in batches of
+ *    page requests and classified 16 or 32 bytes per step through the
+ *    dispatched kernel; strings crossing chunk boundaries are kept whole.
+ *    records are passed to cb in batches as they are found. returns the
+ *    total number of records.
+ *
+ *    mem_reader *r:            reader for the target process
+ *    const mem_range *ranges:  ranges to search
+ *    int n:                    number of entries in ranges
+ *    const str_params *p:      minimum length and encodings
+ *    str_cb cb:                receives batches of records
+ *    void *arg:                passed through to cb
+ */
+size_t
+str_extract(mem_reader *r, const mem_range *ranges, int n,
+            const str_params *p, str_cb cb, void *arg)
+{
+  int i, pg, cnt, run;
+  size_t total;
+  uintptr_t start, end, addr;
+  uint8_t *buf;
+  uint64_t *bm;
+  mem_readreq reqs[CHUNK_PAGES];
+  struct _string_state *st;
+
+  st = calloc(1, sizeof(struct _string_state));
+  st->p = p;
+  st->cb = cb;
+  st->arg = arg;
+
+  buf = malloc((size_t) CHUNK_PAGES * PAGE_SIZE);
+  bm = malloc((size_t) CHUNK_PAGES * PAGE_WORDS * 3 * sizeof(uint64_t));
+
+  for (i = 0; i < n; i++)
+  {
+    start = PAGE_DOWN((uintptr_t) ranges[i].start);
+    end = PAGE_UP((uintptr_t) ranges[i].end);
+
+    for (addr = start; addr < end; addr += (size_t) cnt * PAGE_SIZE)
+    {
+      cnt = (end - addr) / PAGE_SIZE;
+      if (cnt > CHUNK_PAGES)
+        cnt = CHUNK_PAGES;
+
+      for (pg = 0; pg < cnt; pg++)
+      {
+        reqs[pg].addr = (void *) (addr + (size_t) pg * PAGE_SIZE);
+        reqs[pg].buf = buf + (size_t) pg * PAGE_SIZE;
+        reqs[pg].len = PAGE_SIZE;
+      }
+
+      mem_read_batch(r, reqs, cnt);
+
+      for (pg = 0; pg < cnt; pg += run ? run : 1)
+      {
+        for (run = 0; pg + run < cnt && reqs[pg+run].nread == PAGE_SIZE;)
+          run++;
+
+        if (run)
+          _str_run(st, buf + (size_t) pg * PAGE_SIZE,
+                   (size_t) run * PAGE_WORDS,
+                   addr + (size_t) pg * PAGE_SIZE, bm);
+      }
+    }
+  }
+
+  _str_break(st);
+  if (st->nbatch)
+    cb(st->batch, st->nbatch, arg);
+
+  total = st->total;
+  free(bm);
+  free(buf);
+  free(st);
+
+  return total;
+}
+
+
+/*  str_filter:
+ *    keeps the records whose text contains substr and/or matches re, moving
+ *    them to the front of recs. utf-16 text is narrowed to its low bytes and
+ *    only the first FILTER_MAX bytes of a string are considered. returns the
+ *    number of records kept.
+ *
+ *    mem_reader *r:        reader for the target process
+ *    str_record *recs:     records to filter, compacted in place
+ *    size_t n:             number of records
+ *    const char *substr:   substring to look for, or NULL
+ *    const regex_t *re:    compiled regex to match, or NULL
+ */
+size_t
+str_filter(mem_reader *r, str_record *recs, size_t n, const char *substr,
+           const regex_t *re)
+{
+  size_t i, j, len, kept = 0;
+  char *text;
+
+  text = malloc(FILTER_MAX + 1);
+
+  for (i = 0; i < n; i++)
+  {
+    len = recs[i].len < FILTER_MAX ? recs[i].len : FILTER_MAX;
+    if (mem_read(r, (void *) recs[i].addr, text, len) != (ssize_t) len)
+      continue;
+
+    if (recs[i].encoding == STR_UTF16LE) {
+      for (j = 0; j < len / 2; j++)
+        text[j] = text[j*2];
+      len /= 2;
+    }
+    text[len] = '\0';
+
+    if (substr && strstr(text, substr) == NULL)
+      continue;
+    if (re && regexec(re, text, 0, NULL, 0) != 0)
+      continue;
+
+    recs[kept++] = recs[i];
+  }
+
+  free(text);
+  return kept;
+}
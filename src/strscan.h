@@ -0,0 +1,63 @@
+#ifndef __STRSCAN_H
+#define __STRSCAN_H
+
+#include "mem.h"
+
+#include <regex.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* string encodings, used as bitflags in str_params.encodings */
+enum str_encoding {
+  STR_ASCII   = 1,                  /* printable ascii and tabs              */
+  STR_UTF8    = 2,                  /* ascii plus valid multibyte sequences  */
+  STR_UTF16LE = 4,                  /* printable ascii code units            */
+};
+
+
+/*  _string_record:
+ *    a string found in the target. the text itself isn't copied, len is the
+ *    length in bytes starting at addr.
+ */
+typedef struct _string_record
+{
+  uintptr_t addr;
+  uint32_t len;
+  uint8_t encoding;                 /* one of enum str_encoding */
+} str_record;
+
+
+/*  _string_parameters:
+ *    unsigned int min_len:   minimum string length in characters
+ *    int encodings:          enum str_encoding bits to extract. with both
+ *                            STR_ASCII and STR_UTF8 set, strings without
+ *                            multibyte sequences are reported as ascii
+ */
+typedef struct _string_parameters
+{
+  unsigned int min_len;
+  int encodings;
+} str_params;
+
+
+/*  str_cb:
+ *    receives records in batches as soon as a batch fills up, so results
+ *    can be shown while the extraction is still running.
+ */
+typedef void (*str_cb)(const str_record*, size_t, void*);
+
+/* function definitions */
+size_t str_extract(mem_reader*, const mem_range*, int, const str_params*,
+                   str_cb, void*);
+size_t str_filter(mem_reader*, str_record*, size_t, const char*,
+                  const regex_t*);
+
+/* byte classification kernels, dispatched through hostk.strclass */
+void   strclass_generic(const uint8_t*, size_t, uint64_t*, uint64_t*,
+                        uint64_t*);
+#if defined(__x86_64__) || defined(__i386__)
+void   strclass_sse2(const uint8_t*, size_t, uint64_t*, uint64_t*, uint64_t*);
+void   strclass_avx2(const uint8_t*, size_t, uint64_t*, uint64_t*, uint64_t*);
+#endif
+
+#endif /* __STRSCAN_H */
@@ -0,0 +1,373 @@
+#include "symbols.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*  _sym_segment:
+ *    a load segment, used to find the load bias of a mapping.
+ */
+struct _sym_segment
+{
+  uint64_t vaddr, offset, filesz;
+};
+
+
+/*  _sym_entry:
+ *    a symbol at its link time address. name is an offset into names.
+ */
+struct _sym_entry
+{
+  uint64_t value, size;
+  uint32_t name;
+  int type;
+};
+
+
+/*  _sym_table:
+ *    what's needed of a module file to list its symbols in any process,
+ *    copied out so the file doesn't stay mapped. files that aren't usable
+ *    ELF get an empty table so they aren't opened again.
+ */
+struct _sym_table
+{
+  uint32_t dev;                     /* major << 8 | minor */
+  int inode;
+  struct _sym_segment *segs;
+  int nsegs;
+  struct _sym_entry *syms;
+  size_t nsyms;
+  char *names;
+};
+
+
+
+/*  sym_cache_new:
+ *    creates an empty symbol cache.
+ */
+sym_cache *
+sym_cache_new()
+{
+  sym_cache *c = calloc(1, sizeof(sym_cache));
+
+  pthread_mutex_init(&c->lock, NULL);
+  return c;
+}
+
+
+static void
+_table_free(struct _sym_table *t)
+{
+  if (t == NULL)
+    return;
+
+  free(t->segs);
+  free(t->syms);
+  free(t->names);
+  free(t);
+}
+
+
+/*  sym_cache_free:
+ *    frees the cache and every table in it.
+ */
+void
+sym_cache_free(sym_cache *c)
+{
+  size_t i;
+
+  if (c == NULL)
+    return;
+
+  for (i = 0; i < c->count; i++)
+    _table_free(c->tables[i]);
+
+  pthread_mutex_destroy(&c->lock);
+  free(c->tables);
+  free(c);
+}
+
+
+/*  _symtab:
+ *    finds the section header of the symbol table to use, .symtab if the
+ *    file isn't stripped and .dynsym otherwise. returns NULL if there is
+ *    none.
+ */
+static const Elf64_Shdr *
+_symtab(const uint8_t *f, size_t size, const Elf64_Shdr **strtab)
+{
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *) f;
+  const Elf64_Shdr *sh, *best = NULL;
+  int i;
+
+  if (eh->e_shoff == 0
+      || eh->e_shoff + (uint64_t) eh->e_shnum * sizeof(Elf64_Shdr) > size)
+    return NULL;
+
+  sh = (const Elf64_Shdr *) (f + eh->e_shoff);
+  for (i = 0; i < eh->e_shnum; i++)
+  {
+    if (sh[i].sh_type == SHT_SYMTAB
+        || (sh[i].sh_type == SHT_DYNSYM && best == NULL))
+      best = &sh[i];
+  }
+
+  if (best == NULL || best->sh_link >= eh->e_shnum
+      || best->sh_offset + best->sh_size > size)
+    return NULL;
+
+  *strtab = &sh[best->sh_link];
+  if ((*strtab)->sh_offset + (*strtab)->sh_size > size)
+    return NULL;
+
+  return best;
+}
+
+
+/*  _table_parse:
+ *    copies the load segments and the function and object symbols out of
+ *    a mapped ELF file.
+ */
+static void
+_table_parse(struct _sym_table *t, const uint8_t *f, size_t size)
+{
+  const Elf64_Ehdr *eh = (const Elf64_Ehdr *) f;
+  const Elf64_Phdr *ph;
+  const Elf64_Shdr *symsh, *strsh = NULL;
+  const Elf64_Sym *syms;
+  size_t i, n;
+  int type;
+
+  if (size < sizeof(Elf64_Ehdr) || memcmp(f, ELFMAG, SELFMAG) != 0
+      || f[EI_CLASS] != ELFCLASS64
+      || eh->e_phoff + (uint64_t) eh->e_phnum * sizeof(Elf64_Phdr) > size
+      || (symsh = _symtab(f, size, &strsh)) == NULL)
+    return;
+
+  ph = (const Elf64_Phdr *) (f + eh->e_phoff);
+  t->segs = malloc(eh->e_phnum * sizeof(struct _sym_segment));
+  for (i = 0; i < eh->e_phnum; i++)
+  {
+    if (ph[i].p_type != PT_LOAD)
+      continue;
+
+    t->segs[t->nsegs].vaddr = ph[i].p_vaddr;
+    t->segs[t->nsegs].offset = ph[i].p_offset;
+    t->segs[t->nsegs].filesz = ph[i].p_filesz;
+    t->nsegs++;
+  }
+
+  t->names = malloc(strsh->sh_size + 1);
+  memcpy(t->names, f + strsh->sh_offset, strsh->sh_size);
+  t->names[strsh->sh_size] = '\0';
+
+  syms = (const Elf64_Sym *) (f + symsh->sh_offset);
+  n = symsh->sh_size / sizeof(Elf64_Sym);
+  t->syms = malloc(n * sizeof(struct _sym_entry));
+
+  for (i = 0; i < n; i++)
+  {
+    if (syms[i].st_shndx == SHN_UNDEF || syms[i].st_value == 0
+        || syms[i].st_name == 0 || syms[i].st_name >= strsh->sh_size)
+      continue;
+
+    type = ELF64_ST_TYPE(syms[i].st_info);
+    if (type == STT_FUNC || type == STT_GNU_IFUNC)
+      type = SYM_FUNC;
+    else if (type == STT_OBJECT || type == STT_TLS)
+      type = SYM_OBJECT;
+    else
+      continue;
+
+    t->syms[t->nsyms].value = syms[i].st_value;
+    t->syms[t->nsyms].size = syms[i].st_size;
+    t->syms[t->nsyms].name = syms[i].st_name;
+    t->syms[t->nsyms].type = type;
+    t->nsyms++;
+  }
+}
+
+
+/*  _table_load:
+ *    reads the symbol table of a module's backing file. a file that was
+ *    replaced since it was mapped gets an empty table.
+ */
+static struct _sym_table *
+_table_load(const ll_memmap_file *map)
+{
+  struct _sym_table *t;
+  struct stat st;
+  uint8_t *f;
+  int fd;
+
+  t = calloc(1, sizeof(struct _sym_table));
+  t->dev = (uint32_t) map->dev_major << 8 | map->dev_minor;
+  t->inode = map->inode;
+
+  fd = open(map->fpath, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return t;
+
+  if (fstat(fd, &st) == 0 && (int) st.st_ino == map->inode
+      && st.st_size > 0
+      && (f = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+         != MAP_FAILED) {
+    _table_parse(t, f, st.st_size);
+    munmap(f, st.st_size);
+  }
+
+  close(fd);
+  return t;
+}
+
+
+/*  _table_get:
+ *    returns the table of a module from the cache, loading it on first
+ *    use. without a cache the table is loaded and owned by the caller.
+ */
+static struct _sym_table *
+_table_get(sym_cache *c, const ll_memmap_file *map)
+{
+  struct _sym_table *t = NULL;
+  uint32_t dev = (uint32_t) map->dev_major << 8 | map->dev_minor;
+  size_t i;
+
+  if (c == NULL)
+    return _table_load(map);
+
+  pthread_mutex_lock(&c->lock);
+
+  for (i = 0; i < c->count; i++)
+    if (c->tables[i]->dev == dev && c->tables[i]->inode == map->inode) {
+      t = c->tables[i];
+      break;
+    }
+
+  if (t == NULL) {
+    t = _table_load(map);
+
+    if (c->count == c->cap) {
+      c->cap = c->cap ? c->cap * 2 : 32;
+      c->tables = realloc(c->tables, c->cap * sizeof(struct _sym_table *));
+    }
+    c->tables[c->count++] = t;
+  }
+
+  pthread_mutex_unlock(&c->lock);
+  return t;
+}
+
+
+/*  _load_bias:
+ *    difference between the live and linked addresses of a module, found
+ *    through the load segment covering the mapping's file offset. returns
+ *    0 if no segment covers it.
+ */
+static int
+_load_bias(const struct _sym_table *t, const ll_memmap_file *map,
+           uintptr_t *bias)
+{
+  uint64_t off = map->offset;
+  int i;
+
+  for (i = 0; i < t->nsegs; i++)
+  {
+    /* the mapping starts on the page holding the segment's first byte */
+    if (off >= (t->segs[i].offset & ~0xfffULL)
+        && off < t->segs[i].offset + t->segs[i].filesz) {
+      *bias = (uintptr_t) map->start_addr
+              - (t->segs[i].vaddr - t->segs[i].offset + off);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+
+/*  _module_symbols:
+ *    reports the symbols of one module. returns the amount reported.
+ */
+static long
+_module_symbols(const ll_memmap_file *map, sym_cache *c, const char *filter,
+                sym_cb cb, void *arg)
+{
+  struct _sym_table *t;
+  uintptr_t bias;
+  size_t i;
+  long count = 0;
+  sym_record rec;
+
+  t = _table_get(c, map);
+  if (!_load_bias(t, map, &bias))
+    goto module_symbols_end;
+
+  rec.module = map;
+
+  for (i = 0; i < t->nsyms; i++)
+  {
+    rec.name = t->names + t->syms[i].name;
+    if (filter != NULL && strstr(rec.name, filter) == NULL)
+      continue;
+
+    rec.addr = bias + t->syms[i].value;
+    rec.size = t->syms[i].size;
+    rec.type = t->syms[i].type;
+    cb(&rec, arg);
+    count++;
+  }
+
+module_symbols_end:
+  if (c == NULL)
+    _table_free(t);
+  return count;
+}
+
+
+/*  sym_enumerate:
+ *    calls cb for every function and object symbol of every mapped ELF
+ *    module, taken from .symtab or, for stripped files, .dynsym. returns the
+ *    amount of symbols reported.
+ *
+ *    ll_memmap_file *maps:   the process' maps from parse_proc_maps
+ *    sym_cache *c:           cache to share parsed modules through, or NULL
+ *    const char *filter:     only report names containing this, or NULL
+ *    sym_cb cb:              receives every symbol
+ *    void *arg:              passed through to cb
+ */
+long
+sym_enumerate(ll_memmap_file *maps, sym_cache *c, const char *filter,
+              sym_cb cb, void *arg)
+{
+  ll_memmap_file *mmf, *prev, *low;
+  long count = 0;
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    if (mmf->inode == 0 || mmf->fpath == NULL || mmf->fpath[0] != '/')
+      continue;
+
+    /* handle every module once, from its lowest file offset */
+    low = mmf;
+    for (prev = maps; prev != mmf; prev = prev->next)
+      if (prev->inode == mmf->inode && prev->dev_major == mmf->dev_major
+          && prev->dev_minor == mmf->dev_minor)
+        break;
+    if (prev != mmf)
+      continue;
+
+    for (prev = mmf->next; prev != NULL; prev = prev->next)
+      if (prev->inode == mmf->inode && prev->dev_major == mmf->dev_major
+          && prev->dev_minor == mmf->dev_minor && prev->offset < low->offset)
+        low = prev;
+
+    count += _module_symbols(low, c, filter, cb, arg);
+  }
+
+  return count;
+}
@@ -0,0 +1,52 @@
+#ifndef __SYMBOLS_H
+#define __SYMBOLS_H
+
+#include "mem.h"
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* kinds of symbols reported */
+enum sym_type {
+  SYM_FUNC = 0,
+  SYM_OBJECT,
+};
+
+
+/*  _symbol_record:
+ *    a defined symbol of a mapped module, relocated to its live address.
+ *    name and module are only valid during the callback.
+ */
+typedef struct _symbol_record
+{
+  uintptr_t addr;
+  size_t size;
+  int type;                         /* enum sym_type */
+  const char *name;
+  const ll_memmap_file *module;     /* lowest mapping of the module */
+} sym_record;
+
+
+/*  _symbol_cache:
+ *    parsed symbol tables of module files, keyed by device and inode so
+ *    every process mapping the same binary shares one table. safe to use
+ *    from several threads.
+ */
+typedef struct _symbol_cache
+{
+  struct _sym_table **tables;
+  size_t count, cap;
+  pthread_mutex_t lock;
+} sym_cache;
+
+
+typedef void (*sym_cb)(const sym_record*, void*);
+
+/* function definitions */
+sym_cache* sym_cache_new(void);
+void       sym_cache_free(sym_cache*);
+long       sym_enumerate(ll_memmap_file*, sym_cache*, const char*, sym_cb,
+                         void*);
+
+#endif /* __SYMBOLS_H */
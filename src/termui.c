@@ -1,4 +1,8 @@
 #include "termui.h"
+#include "entropy.h"
+#include "smaps.h"
+#include "stats.h"
+#include "util.h"
 #include <ncurses.h>
 
 #include <locale.h>
@@ -38,6 +42,22 @@ static bool color_supported = FALSE;
 /* the COLOR_PAIR index to use with ncurses */
 static int color_index = 1;
 
+/* the stats pane, NULL while hidden */
+static window_t *stats_pane = NULL;
+
+/* the memory pane, NULL while hidden, and the process it accounts, 0 for
+ * this one */
+static window_t *memory_pane = NULL;
+static smaps_session memory_smaps;
+static uint64_t memory_refreshed;
+static int memory_pid = 0;
+
+/* first of the color pairs of the entropy classes, 0 until first used */
+static int entropy_pairs = 0;
+
+/* the memory pane checks the totals at most this often */
+#define MEMORY_INTERVAL_NS  1000000000ULL
+
 
 /* forward declarations */
 static void set_window_border(WINDOW*, const winborder_t*);
@@ -363,19 +383,301 @@ draw_bar(int line, short color)
 }
 
 
+/*  toggle_stats_pane:
+ *    shows or hides the instrumentation pane over the lower right quarter
+ *    of the screen.
+ */
+void
+toggle_stats_pane()
+{
+  winprop_t wp;
+
+  if (stats_pane != NULL) {
+    destroy_window(stats_pane);
+    stats_pane = NULL;
+    touchwin(stdscr);
+    refresh();
+    return;
+  }
+
+  init_window(&wp, LINES / 2, COLS / 2, LINES / 2 - 1, COLS / 2, "Stats",
+              COLOR_WHITE, COLOR_BLACK, COLOR_CYAN, NULL);
+  stats_pane = create_window(&wp);
+}
+
+
+/*  draw_stats_pane:
+ *    redraws the instrumentation pane if it's visible. timers show the
+ *    amount of events, mean, p50, p99 and max in microseconds.
+ */
+void
+draw_stats_pane()
+{
+  int i, y = 0;
+  stat_totals t;
+  const stat_hist *h;
+  WINDOW *w;
+
+  if (stats_pane == NULL)
+    return;
+
+  w = stats_pane->subwindow;
+  stats_collect(&t);
+  werase(w);
+
+  mvwprintw(w, y++, 0, "cpu  user %.3fs  sys %.3fs  threads %d",
+            t.utime_us / 1e6, t.stime_us / 1e6, t.threads);
+  mvwprintw(w, y++, 0, "faults  minor %llu  major %llu",
+            (unsigned long long) t.minflt, (unsigned long long) t.majflt);
+  y++;
+
+  for (i = 0; i < STAT_COUNTERS && y < stats_pane->lines; i++)
+    mvwprintw(w, y++, 0, "%-14s %llu", stat_counter_names[i],
+              (unsigned long long) t.counters[i]);
+
+  if (y < stats_pane->lines)
+    mvwprintw(w, ++y, 0, "%-8s %10s %9s %9s %9s %9s", "timer", "count",
+              "mean", "p50", "p99", "max");
+  y++;
+
+  for (i = 0; i < STAT_TIMERS && y < stats_pane->lines; i++)
+  {
+    h = &t.timers[i];
+    mvwprintw(w, y++, 0, "%-8s %10llu %9.1f %9.1f %9.1f %9.1f",
+              stat_timer_names[i], (unsigned long long) h->count,
+              h->count ? h->total_ns / 1e3 / h->count : 0.0,
+              stat_hist_percentile(h, 0.5) / 1e3,
+              stat_hist_percentile(h, 0.99) / 1e3, h->max_ns / 1e3);
+  }
+
+  wrefresh(w);
+}
+
+
+/*  set_memory_target:
+ *    sets the process accounted by the memory pane, 0 for this one. takes
+ *    effect the next time the pane is shown.
+ */
+void
+set_memory_target(int pid)
+{
+  memory_pid = pid;
+}
+
+
+/*  toggle_memory_pane:
+ *    shows or hides the memory pane over the lower left quarter of the
+ *    screen.
+ */
+void
+toggle_memory_pane()
+{
+  winprop_t wp;
+
+  if (memory_pane != NULL) {
+    destroy_window(memory_pane);
+    memory_pane = NULL;
+    smaps_close(&memory_smaps);
+    touchwin(stdscr);
+    refresh();
+    return;
+  }
+
+  if (smaps_open(&memory_smaps, memory_pid ? memory_pid : getpid()) < 0)
+    return;
+
+  init_window(&wp, LINES / 2, COLS / 2, LINES / 2 - 1, 0, "Memory",
+              COLOR_WHITE, COLOR_BLACK, COLOR_CYAN, NULL);
+  memory_pane = create_window(&wp);
+  memory_refreshed = 0;
+}
+
+
+/*  draw_memory_pane:
+ *    redraws the memory pane if it's visible: the process' totals and its
+ *    modules by proportional set size, in KiB. the totals are checked once
+ *    per interval and the modules only read again when they changed.
+ */
+void
+draw_memory_pane()
+{
+  const smaps_module *m;
+  const smaps_counts *c = &memory_smaps.total;
+  uint64_t now = monotonic_ns();
+  size_t i;
+  int y = 0;
+  WINDOW *w;
+
+  if (memory_pane == NULL)
+    return;
+
+  if (memory_refreshed != 0 && now - memory_refreshed < MEMORY_INTERVAL_NS)
+    return;
+
+  memory_refreshed = now;
+  if (smaps_refresh(&memory_smaps, 0) == 0)
+    return;
+
+  w = memory_pane->subwindow;
+  werase(w);
+
+  mvwprintw(w, y++, 0, "pid %d  rss %llu  pss %llu  swap %llu  dirty %llu",
+            memory_smaps.pid, (unsigned long long) c->rss,
+            (unsigned long long) c->pss, (unsigned long long) c->swap,
+            (unsigned long long) (c->private_dirty + c->shared_dirty));
+  mvwprintw(w, ++y, 0, "%9s %9s %9s %9s  %s", "rss", "pss", "swap", "huge",
+            "module");
+  y++;
+
+  for (i = 0; i < memory_smaps.nmodules && y < memory_pane->lines; i++)
+  {
+    m = &memory_smaps.modules[i];
+    mvwprintw(w, y++, 0, "%9llu %9llu %9llu %9llu  %s",
+              (unsigned long long) m->c.rss, (unsigned long long) m->c.pss,
+              (unsigned long long) m->c.swap,
+              (unsigned long long) m->c.anon_huge,
+              m->path[0] ? m->path : "[anon]");
+  }
+
+  wrefresh(w);
+}
+
+
+/*  draw_entropy_strip:
+ *    draws the windows of a region as a strip of cells next to a mapping
+ *    in a list, each cell showing the most entropic class of the windows
+ *    it covers: '#' packed, '+' code and data, 't' text, '.' zeroed and
+ *    blank if unreadable.
+ *
+ *    window win:           window holding the list
+ *    int line:             line of the mapping
+ *    int column:           first column of the strip
+ *    int width:            cells in the strip
+ *    const ent_region *r:  windows of the mapping
+ */
+void
+draw_entropy_strip(window win, int line, int column, int width,
+                   const ent_region *r)
+{
+  static const char cells[ENT_CLASSES] = { ' ', '.', 't', '+', '#' };
+  static const short colors[ENT_CLASSES] = {
+    COLOR_BLACK, COLOR_BLUE, COLOR_GREEN, COLOR_YELLOW, COLOR_RED
+  };
+  WINDOW *w = ((window_t *) win)->subwindow;
+  size_t first, last, i;
+  int c, cls, best;
+
+  if (width <= 0 || r->count == 0)
+    return;
+
+  if (color_supported && entropy_pairs == 0) {
+    entropy_pairs = color_index;
+    for (c = 0; c < ENT_CLASSES; c++)
+      init_pair(color_index++, COLOR_WHITE, colors[c]);
+  }
+
+  for (c = 0; c < width; c++)
+  {
+    first = r->count * c / width;
+    last = r->count * (c + 1) / width;
+    if (last == first)
+      last = first + 1;
+
+    for (i = first, best = ENT_UNREAD; i < last && i < r->count; i++)
+      if ((cls = ent_classify(&r->windows[i])) > best)
+        best = cls;
+
+    if (color_supported)
+      wattron(w, COLOR_PAIR(entropy_pairs + best));
+    mvwaddch(w, line, column + c, cells[best]);
+    if (color_supported)
+      wattroff(w, COLOR_PAIR(entropy_pairs + best));
+  }
+}
+
+
+/*  draw_memmap:
+ *    lists the readable mappings of a process with their start address,
+ *    permissions and file name, and an entropy strip of each mapping in
+ *    the right third of the window. memory is read once per call.
+ *
+ *    window win:   window to draw the list in
+ *    int pid:      process to list, 0 for this one
+ */
+void
+draw_memmap(window win, int pid)
+{
+  window_t *wt = win;
+  WINDOW *w = wt->subwindow;
+  ll_memmap_file *maps;
+  const ent_region *r;
+  const char *name;
+  ent_map m;
+  size_t i;
+  int strip, text;
+
+  if (pid == 0)
+    pid = getpid();
+
+  if ((maps = parse_proc_maps(pid)) == NULL)
+    return;
+
+  ent_map_build(&m, pid, maps, MODE_READ, 0, 0);
+
+  strip = wt->cols / 3;
+  text = wt->cols - strip - 1;
+  werase(w);
+
+  for (i = 0; i < m.nregions && (int) i < wt->lines; i++)
+  {
+    r = &m.regions[i];
+    name = r->mmf->fpath != NULL && r->mmf->fpath[0] ? r->mmf->fpath
+                                                     : "[anon]";
+    if (name[0] == '/' && strrchr(name, '/') != NULL)
+      name = strrchr(name, '/') + 1;
+
+    mvwprintw(w, (int) i, 0, "%-*.*s", text, text, "");
+    mvwprintw(w, (int) i, 0, "%012lx %c%c%c %.*s",
+              (unsigned long) r->start,
+              r->mmf->mode & MODE_READ ? 'r' : '-',
+              r->mmf->mode & MODE_WRITE ? 'w' : '-',
+              r->mmf->mode & MODE_EXECUTE ? 'x' : '-',
+              text > 17 ? text - 17 : 0, name);
+    draw_entropy_strip(win, (int) i, text + 1, strip, r);
+  }
+
+  wrefresh(w);
+  ent_map_free(&m);
+  free_proc_maps(maps);
+}
+
+
 void waitasecwillya(window win)
 {
   char line[50] = {0};
-  int rand = 23123444;
+  int rand = 23123444, ch;
+  uint64_t t0;
+
+  /* wait up to 50ms for a key per frame */
+  timeout(50);
+
+  while ((ch = getch()) != 'q')
+  {
+    t0 = stat_now();
+
+    if (ch == 's')
+      toggle_stats_pane();
+    if (ch == 'm')
+      toggle_memory_pane();
 
-  //while(getch() != 'q')
-  //{
-  while(true) {
     srandom(rand++);
     snprintf(line, 50, "%#10x", (unsigned int) random());
     winputl(win, line);
-    usleep(50000);
+    draw_stats_pane();
+    draw_memory_pane();
+
+    stat_add(STAT_UI_FRAMES, 1);
+    stat_time(STAT_T_FRAME, t0);
   }
-  //}
 }
 
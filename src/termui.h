@@ -83,6 +83,22 @@ int   winputl(const void *, const char *);
 void  draw_menubar(int, const char *[]);
 void  draw_bar(int, short);
 
+/* live instrumentation pane, toggled with 's' */
+void  toggle_stats_pane(void);
+void  draw_stats_pane(void);
+
+/* live per-module memory pane, toggled with 'm' */
+void  set_memory_target(int);
+void  toggle_memory_pane(void);
+void  draw_memory_pane(void);
+
+/* entropy heat strip of a region, see entropy.h */
+struct _entropy_region;
+void  draw_entropy_strip(window, int, int, int, const struct _entropy_region*);
+
+/* mapped libraries list with an entropy strip per mapping */
+void  draw_memmap(window, int);
+
 void waitasecwillya(window win);
 
 #endif /* __TERMUI_H */
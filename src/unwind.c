@@ -0,0 +1,862 @@
+#include "unwind.h"
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/* pointer encodings of .eh_frame and .eh_frame_hdr */
+#define DW_EH_PE_absptr   0x00
+#define DW_EH_PE_uleb128  0x01
+#define DW_EH_PE_udata2   0x02
+#define DW_EH_PE_udata4   0x03
+#define DW_EH_PE_udata8   0x04
+#define DW_EH_PE_sleb128  0x09
+#define DW_EH_PE_sdata2   0x0a
+#define DW_EH_PE_sdata4   0x0b
+#define DW_EH_PE_sdata8   0x0c
+#define DW_EH_PE_pcrel    0x10
+#define DW_EH_PE_datarel  0x30
+#define DW_EH_PE_indirect 0x80
+#define DW_EH_PE_omit     0xff
+
+/* x86-64 dwarf register numbers, only these are tracked */
+#define REG_FP        6
+#define REG_SP        7
+#define REG_RA        16
+#define NREGS         17
+
+#define STATE_DEPTH   8               /* remember_state nesting          */
+
+
+/* how a register of the caller is recovered */
+enum unw_how {
+  RULE_SAME = 0,                    /* unchanged, the default          */
+  RULE_UNDEF,                       /* gone, for the return address the
+                                     * end of the stack                */
+  RULE_OFFSET,                      /* saved at cfa + off              */
+  RULE_VAL_OFFSET,                  /* is cfa + off                    */
+  RULE_REG,                         /* is in register off              */
+  RULE_BAD,                         /* described by an expression      */
+};
+
+
+struct _unw_rule
+{
+  int how;
+  int64_t off;
+};
+
+
+/*  _unw_state:
+ *    a row of the unwind table: how to find the canonical frame address
+ *    and the registers of the caller.
+ */
+struct _unw_state
+{
+  int cfa_reg;
+  int64_t cfa_off;
+  int cfa_bad;                      /* set by def_cfa_expression */
+  struct _unw_rule regs[NREGS];
+};
+
+
+/*  _unw_ctx:
+ *    state of running the instructions of a CIE and an FDE.
+ */
+struct _unw_ctx
+{
+  struct _unw_state cur, init;
+  struct _unw_state saved[STATE_DEPTH];
+  int nsaved;
+};
+
+
+/*  _unw_cie:
+ *    the parts of a common information entry an FDE needs.
+ */
+struct _unw_cie
+{
+  uint64_t code_align;
+  int64_t data_align;
+  uint64_t ra;
+  uint8_t fde_enc;
+  int aug;                          /* FDEs carry augmentation data */
+  const uint8_t *insns, *end;
+};
+
+
+/*  _unw_cur:
+ *    a bounds checked reader over part of a section. vaddr is the link time
+ *    address of start, for pc relative pointers.
+ */
+struct _unw_cur
+{
+  const uint8_t *start, *p, *end;
+  uint64_t vaddr, datarel;
+  int bad;
+};
+
+
+
+static uint64_t
+_fixed(struct _unw_cur *c, int n)
+{
+  uint64_t v = 0;
+
+  if (c->end - c->p < n) {
+    c->bad = 1;
+    c->p = c->end;
+    return 0;
+  }
+
+  memcpy(&v, c->p, n);
+  c->p += n;
+  return v;
+}
+
+
+static uint64_t
+_uleb(struct _unw_cur *c)
+{
+  uint64_t v = 0;
+  int shift = 0;
+  uint8_t b;
+
+  do {
+    if (c->p >= c->end) {
+      c->bad = 1;
+      return 0;
+    }
+    b = *c->p++;
+    if (shift < 64)
+      v |= (uint64_t) (b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+
+  return v;
+}
+
+
+static int64_t
+_sleb(struct _unw_cur *c)
+{
+  uint64_t v = 0;
+  int shift = 0;
+  uint8_t b;
+
+  do {
+    if (c->p >= c->end) {
+      c->bad = 1;
+      return 0;
+    }
+    b = *c->p++;
+    if (shift < 64)
+      v |= (uint64_t) (b & 0x7f) << shift;
+    shift += 7;
+  } while (b & 0x80);
+
+  if (shift < 64 && (b & 0x40))
+    v |= ~0ULL << shift;
+
+  return (int64_t) v;
+}
+
+
+/*  _ptr:
+ *    reads an encoded pointer. indirect pointers would need the target's
+ *    memory and aren't supported.
+ */
+static uint64_t
+_ptr(struct _unw_cur *c, uint8_t enc)
+{
+  uint64_t base = 0, v;
+
+  if (enc == DW_EH_PE_omit)
+    return 0;
+
+  switch (enc & 0x70)
+  {
+    case 0:                 break;
+    case DW_EH_PE_pcrel:    base = c->vaddr + (c->p - c->start); break;
+    case DW_EH_PE_datarel:  base = c->datarel; break;
+    default:                c->bad = 1; return 0;
+  }
+
+  switch (enc & 0x0f)
+  {
+    case DW_EH_PE_absptr:
+    case DW_EH_PE_udata8:
+    case DW_EH_PE_sdata8:   v = _fixed(c, 8); break;
+    case DW_EH_PE_uleb128:  v = _uleb(c); break;
+    case DW_EH_PE_sleb128:  v = (uint64_t) _sleb(c); break;
+    case DW_EH_PE_udata2:   v = _fixed(c, 2); break;
+    case DW_EH_PE_sdata2:   v = (uint64_t) (int16_t) _fixed(c, 2); break;
+    case DW_EH_PE_udata4:   v = _fixed(c, 4); break;
+    case DW_EH_PE_sdata4:   v = (uint64_t) (int32_t) _fixed(c, 4); break;
+    default:                c->bad = 1; return 0;
+  }
+
+  if (enc & DW_EH_PE_indirect)
+    c->bad = 1;
+
+  return base + v;
+}
+
+
+/*  _seg_ptr:
+ *    file contents at a link time address inside a load segment, with the
+ *    bytes left in the segment. returns NULL if no segment holds it.
+ */
+static const uint8_t *
+_seg_ptr(const unw_module *m, const Elf64_Phdr *ph, int n, uint64_t addr,
+         size_t *left)
+{
+  int i;
+
+  for (i = 0; i < n; i++)
+    if (ph[i].p_type == PT_LOAD && addr >= ph[i].p_vaddr
+        && addr < ph[i].p_vaddr + ph[i].p_filesz
+        && ph[i].p_offset + ph[i].p_filesz <= m->file_len) {
+      *left = ph[i].p_vaddr + ph[i].p_filesz - addr;
+      return m->file + ph[i].p_offset + (addr - ph[i].p_vaddr);
+    }
+
+  return NULL;
+}
+
+
+/*  _module_tables:
+ *    maps a module's file and finds its unwind tables through the
+ *    PT_GNU_EH_FRAME header, so stripped files work too. only the binary
+ *    search table glibc's own unwinder relies on is supported.
+ */
+static void
+_module_tables(unw_module *m, const ll_memmap_file *map)
+{
+  const Elf64_Ehdr *eh;
+  const Elf64_Phdr *ph, *gnu = NULL;
+  struct _unw_cur c;
+  struct stat st;
+  uint8_t ver, frame_enc, count_enc, table_enc;
+  uint64_t count, off = map->offset;
+  size_t left;
+  int fd, i, biased = 0;
+
+  fd = open(map->fpath, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return;
+
+  if (fstat(fd, &st) < 0 || (int) st.st_ino != map->inode
+      || st.st_size < (off_t) sizeof(Elf64_Ehdr)
+      || (m->file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+         == MAP_FAILED) {
+    m->file = NULL;
+    close(fd);
+    return;
+  }
+  close(fd);
+  m->file_len = st.st_size;
+
+  eh = (const Elf64_Ehdr *) m->file;
+  if (memcmp(m->file, ELFMAG, SELFMAG) != 0
+      || m->file[EI_CLASS] != ELFCLASS64
+      || eh->e_phoff + (uint64_t) eh->e_phnum * sizeof(Elf64_Phdr)
+         > m->file_len)
+    goto module_tables_fail;
+
+  ph = (const Elf64_Phdr *) (m->file + eh->e_phoff);
+  for (i = 0; i < eh->e_phnum; i++)
+  {
+    if (ph[i].p_type == PT_GNU_EH_FRAME)
+      gnu = &ph[i];
+
+    /* the mapping starts on the page holding the segment's first byte */
+    if (ph[i].p_type == PT_LOAD && !biased
+        && off >= (ph[i].p_offset & ~0xfffULL)
+        && off < ph[i].p_offset + ph[i].p_filesz) {
+      m->bias = m->start - (ph[i].p_vaddr - ph[i].p_offset + off);
+      biased = 1;
+    }
+  }
+
+  if (gnu == NULL || !biased
+      || (m->hdr = _seg_ptr(m, ph, eh->e_phnum, gnu->p_vaddr, &left))
+         == NULL)
+    goto module_tables_fail;
+
+  memset(&c, 0, sizeof(c));
+  c.start = c.p = m->hdr;
+  c.end = m->hdr + left;
+  c.vaddr = c.datarel = m->hdr_addr = gnu->p_vaddr;
+
+  ver = (uint8_t) _fixed(&c, 1);
+  frame_enc = (uint8_t) _fixed(&c, 1);
+  count_enc = (uint8_t) _fixed(&c, 1);
+  table_enc = (uint8_t) _fixed(&c, 1);
+  m->eh_frame_addr = _ptr(&c, frame_enc);
+  count = _ptr(&c, count_enc);
+
+  if (c.bad || ver != 1 || table_enc != (DW_EH_PE_datarel | DW_EH_PE_sdata4)
+      || count > (uint64_t) (c.end - c.p) / 8)
+    goto module_tables_fail;
+
+  m->fdes = c.p;
+  m->nfdes = count;
+
+  m->eh_frame = _seg_ptr(m, ph, eh->e_phnum, m->eh_frame_addr,
+                         &m->eh_frame_len);
+  if (m->eh_frame != NULL)
+    return;
+
+module_tables_fail:
+  munmap(m->file, m->file_len);
+  m->file = NULL;
+  m->hdr = NULL;
+}
+
+
+/*  unw_table_build:
+ *    collects the executable mappings of a process and the unwind tables
+ *    of their files. module paths point into maps, which has to outlive
+ *    the table. returns the amount of modules.
+ *
+ *    unw_table *t:           table to fill, free with unw_table_free
+ *    ll_memmap_file *maps:   the process' maps
+ */
+int
+unw_table_build(unw_table *t, ll_memmap_file *maps)
+{
+  ll_memmap_file *mmf;
+  unw_module *m;
+
+  memset(t, 0, sizeof(unw_table));
+
+  for (mmf = maps; mmf != NULL; mmf = mmf->next)
+  {
+    if (!(mmf->mode & MODE_EXECUTE))
+      continue;
+
+    t->mods = realloc(t->mods, (t->count + 1) * sizeof(unw_module));
+    m = &t->mods[t->count++];
+    memset(m, 0, sizeof(unw_module));
+    m->start = (uintptr_t) mmf->start_addr;
+    m->end = (uintptr_t) mmf->end_addr;
+    m->path = mmf->fpath ? mmf->fpath : "";
+
+    if (mmf->inode != 0 && m->path[0] == '/')
+      _module_tables(m, mmf);
+  }
+
+  return (int) t->count;
+}
+
+
+/*  unw_table_free:
+ *    unmaps the module files and frees the table.
+ */
+void
+unw_table_free(unw_table *t)
+{
+  size_t i;
+
+  for (i = 0; i < t->count; i++)
+    if (t->mods[i].file != NULL)
+      munmap(t->mods[i].file, t->mods[i].file_len);
+
+  free(t->mods);
+  memset(t, 0, sizeof(unw_table));
+}
+
+
+/*  unw_module_find:
+ *    the executable mapping holding addr or NULL.
+ */
+const unw_module*
+unw_module_find(const unw_table *t, uintptr_t addr)
+{
+  size_t lo = 0, hi = t->count, mid;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    if (t->mods[mid].end <= addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo < t->count && addr >= t->mods[lo].start)
+    return &t->mods[lo];
+  return NULL;
+}
+
+
+/*  _parse_cie:
+ *    reads the common information entry at p.
+ */
+static int
+_parse_cie(const unw_module *m, const uint8_t *p, struct _unw_cie *cie)
+{
+  struct _unw_cur c;
+  const char *aug;
+  const uint8_t *aug_end;
+  uint32_t len;
+  uint8_t ver, enc;
+
+  if (p < m->eh_frame || p + 8 > m->eh_frame + m->eh_frame_len)
+    return -1;
+
+  memset(&c, 0, sizeof(c));
+  c.start = m->eh_frame;
+  c.p = p;
+  c.end = m->eh_frame + m->eh_frame_len;
+  c.vaddr = m->eh_frame_addr;
+
+  len = (uint32_t) _fixed(&c, 4);
+  if (len == 0 || len == 0xffffffff || len > (size_t) (c.end - c.p))
+    return -1;
+  c.end = c.p + len;
+
+  if (_fixed(&c, 4) != 0)
+    return -1;
+
+  ver = (uint8_t) _fixed(&c, 1);
+  aug = (const char *) c.p;
+  while (c.p < c.end && *c.p != '\0')
+    c.p++;
+  c.p++;
+
+  if (c.p > c.end || (ver != 1 && ver != 3) || strstr(aug, "eh") != NULL)
+    return -1;
+
+  cie->code_align = _uleb(&c);
+  cie->data_align = _sleb(&c);
+  cie->ra = ver == 1 ? _fixed(&c, 1) : _uleb(&c);
+  cie->fde_enc = DW_EH_PE_absptr;
+  cie->aug = aug[0] == 'z';
+
+  if (cie->aug) {
+    len = (uint32_t) _uleb(&c);
+    aug_end = c.p + len;
+
+    for (aug++; *aug != '\0' && !c.bad; aug++)
+    {
+      switch (*aug)
+      {
+        case 'R': cie->fde_enc = (uint8_t) _fixed(&c, 1); break;
+        case 'L': _fixed(&c, 1); break;
+        case 'S': break;
+
+        /* the personality routine is skipped, not followed */
+        case 'P':
+          enc = (uint8_t) _fixed(&c, 1);
+          _ptr(&c, enc & ~DW_EH_PE_indirect);
+          break;
+
+        default:  return -1;
+      }
+    }
+
+    if (aug_end > c.end)
+      return -1;
+    c.p = aug_end;
+  }
+
+  cie->insns = c.p;
+  cie->end = c.end;
+  return c.bad ? -1 : 0;
+}
+
+
+/*  _find_fde:
+ *    finds the FDE covering a link time pc through the search table and
+ *    reads its CIE. returns the FDE's first address, its instructions in c.
+ */
+static int
+_find_fde(const unw_module *m, uint64_t pc, struct _unw_cie *cie,
+          struct _unw_cur *c, uint64_t *loc)
+{
+  size_t lo = 0, hi = m->nfdes, mid;
+  int32_t rel[2];
+  uint64_t fde, begin, range;
+  const uint8_t *cie_at;
+  uint32_t len;
+
+  /* the last entry starting at or before pc */
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    memcpy(rel, m->fdes + mid * 8, sizeof(rel));
+    if (m->hdr_addr + rel[0] <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo == 0)
+    return -1;
+
+  memcpy(rel, m->fdes + (lo - 1) * 8, sizeof(rel));
+  fde = m->hdr_addr + rel[1];
+  if (fde < m->eh_frame_addr || fde - m->eh_frame_addr + 8 > m->eh_frame_len)
+    return -1;
+
+  memset(c, 0, sizeof(struct _unw_cur));
+  c->start = m->eh_frame;
+  c->p = m->eh_frame + (fde - m->eh_frame_addr);
+  c->end = m->eh_frame + m->eh_frame_len;
+  c->vaddr = m->eh_frame_addr;
+
+  len = (uint32_t) _fixed(c, 4);
+  if (len == 0 || len == 0xffffffff || len > (size_t) (c->end - c->p))
+    return -1;
+  c->end = c->p + len;
+
+  /* the CIE pointer counts back from its own position */
+  cie_at = c->p - (uint32_t) _fixed(c, 4);
+  if (_parse_cie(m, cie_at, cie) < 0)
+    return -1;
+
+  begin = _ptr(c, cie->fde_enc);
+  range = _ptr(c, cie->fde_enc & 0x0f);
+  if (c->bad || pc < begin || pc >= begin + range)
+    return -1;
+
+  if (cie->aug)
+    c->p += _uleb(c);
+
+  *loc = begin;
+  return c->bad || c->p > c->end ? -1 : 0;
+}
+
+
+static void
+_rule(struct _unw_state *st, uint64_t reg, int how, int64_t off)
+{
+  if (reg < NREGS) {
+    st->regs[reg].how = how;
+    st->regs[reg].off = off;
+  }
+}
+
+
+/*  _run:
+ *    runs call frame instructions until the row covering pc is reached.
+ *    returns -1 on an unknown instruction.
+ */
+static int
+_run(struct _unw_ctx *x, const struct _unw_cie *cie, struct _unw_cur *c,
+     uint64_t loc, uint64_t pc)
+{
+  struct _unw_state *st = &x->cur;
+  uint64_t reg, n;
+  int64_t da = cie->data_align;
+  uint64_t ca = cie->code_align;
+  uint8_t op;
+
+  while (c->p < c->end && !c->bad)
+  {
+    op = *c->p++;
+
+    switch (op & 0xc0)
+    {
+      case 0x40:
+        loc += (op & 0x3f) * ca;
+        if (loc > pc)
+          return 0;
+        continue;
+
+      case 0x80:
+        _rule(st, op & 0x3f, RULE_OFFSET, (int64_t) _uleb(c) * da);
+        continue;
+
+      case 0xc0:
+        if ((op & 0x3f) < NREGS)
+          st->regs[op & 0x3f] = x->init.regs[op & 0x3f];
+        continue;
+    }
+
+    switch (op)
+    {
+      case 0x00:                      /* nop */
+        break;
+
+      case 0x01:                      /* set_loc */
+        loc = _ptr(c, cie->fde_enc);
+        if (loc > pc)
+          return 0;
+        break;
+
+      case 0x02:                      /* advance_loc1, 2 and 4 */
+      case 0x03:
+      case 0x04:
+        loc += _fixed(c, op == 0x02 ? 1 : op == 0x03 ? 2 : 4) * ca;
+        if (loc > pc)
+          return 0;
+        break;
+
+      case 0x05:                      /* offset_extended */
+        reg = _uleb(c);
+        _rule(st, reg, RULE_OFFSET, (int64_t) _uleb(c) * da);
+        break;
+
+      case 0x06:                      /* restore_extended */
+        reg = _uleb(c);
+        if (reg < NREGS)
+          st->regs[reg] = x->init.regs[reg];
+        break;
+
+      case 0x07:                      /* undefined */
+        _rule(st, _uleb(c), RULE_UNDEF, 0);
+        break;
+
+      case 0x08:                      /* same_value */
+        _rule(st, _uleb(c), RULE_SAME, 0);
+        break;
+
+      case 0x09:                      /* register */
+        reg = _uleb(c);
+        _rule(st, reg, RULE_REG, (int64_t) _uleb(c));
+        break;
+
+      case 0x0a:                      /* remember_state */
+        if (x->nsaved == STATE_DEPTH)
+          return -1;
+        x->saved[x->nsaved++] = *st;
+        break;
+
+      case 0x0b:                      /* restore_state */
+        if (x->nsaved == 0)
+          return -1;
+        *st = x->saved[--x->nsaved];
+        break;
+
+      case 0x0c:                      /* def_cfa */
+        st->cfa_reg = (int) _uleb(c);
+        st->cfa_off = (int64_t) _uleb(c);
+        st->cfa_bad = 0;
+        break;
+
+      case 0x0d:                      /* def_cfa_register */
+        st->cfa_reg = (int) _uleb(c);
+        break;
+
+      case 0x0e:                      /* def_cfa_offset */
+        st->cfa_off = (int64_t) _uleb(c);
+        break;
+
+      case 0x0f:                      /* def_cfa_expression */
+        n = _uleb(c);
+        c->p += n;
+        st->cfa_bad = 1;
+        break;
+
+      case 0x10:                      /* expression */
+      case 0x16:                      /* val_expression */
+        reg = _uleb(c);
+        n = _uleb(c);
+        c->p += n;
+        _rule(st, reg, RULE_BAD, 0);
+        break;
+
+      case 0x11:                      /* offset_extended_sf */
+        reg = _uleb(c);
+        _rule(st, reg, RULE_OFFSET, _sleb(c) * da);
+        break;
+
+      case 0x12:                      /* def_cfa_sf */
+        st->cfa_reg = (int) _uleb(c);
+        st->cfa_off = _sleb(c) * da;
+        st->cfa_bad = 0;
+        break;
+
+      case 0x13:                      /* def_cfa_offset_sf */
+        st->cfa_off = _sleb(c) * da;
+        break;
+
+      case 0x14:                      /* val_offset */
+        reg = _uleb(c);
+        _rule(st, reg, RULE_VAL_OFFSET, (int64_t) _uleb(c) * da);
+        break;
+
+      case 0x15:                      /* val_offset_sf */
+        reg = _uleb(c);
+        _rule(st, reg, RULE_VAL_OFFSET, _sleb(c) * da);
+        break;
+
+      case 0x2e:                      /* GNU_args_size */
+        _uleb(c);
+        break;
+
+      case 0x2f:                      /* GNU_negative_offset_extended */
+        reg = _uleb(c);
+        _rule(st, reg, RULE_OFFSET, -(int64_t) _uleb(c) * da);
+        break;
+
+      default:
+        return -1;
+    }
+  }
+
+  return c->bad ? -1 : 0;
+}
+
+
+/*  _load:
+ *    a word from the stack copy. returns 0 outside of it.
+ */
+static int
+_load(const unw_stack *s, uintptr_t addr, uintptr_t *v)
+{
+  if (addr < s->base || addr + sizeof(uintptr_t) > s->base + s->len)
+    return 0;
+
+  memcpy(v, s->data + (addr - s->base), sizeof(uintptr_t));
+  return 1;
+}
+
+
+/*  _reg:
+ *    recovers a caller's register by its rule. returns 0 if it can't be.
+ */
+static int
+_reg(const struct _unw_rule *rule, const unw_stack *s, const unw_regs *r,
+     uintptr_t cfa, uintptr_t now, uintptr_t *v)
+{
+  switch (rule->how)
+  {
+    case RULE_SAME:       *v = now; return 1;
+    case RULE_UNDEF:      *v = 0; return 1;
+    case RULE_OFFSET:     return _load(s, cfa + rule->off, v);
+    case RULE_VAL_OFFSET: *v = cfa + rule->off; return 1;
+
+    case RULE_REG:
+      if (rule->off != REG_SP && rule->off != REG_FP)
+        return 0;
+      *v = rule->off == REG_SP ? r->sp : r->fp;
+      return 1;
+  }
+
+  return 0;
+}
+
+
+/*  _step_cfi:
+ *    unwinds one frame with the module's call frame information. return
+ *    addresses point after the call, so pc - 1 is looked up for every frame
+ *    but the innermost. returns 1 if stepped, 0 at the outermost frame and
+ *    -1 if the tables don't describe pc.
+ */
+static int
+_step_cfi(const unw_module *m, const unw_stack *s, unw_regs *r, int inner)
+{
+  struct _unw_ctx x;
+  struct _unw_cie cie;
+  struct _unw_cur c, ci;
+  uint64_t pc = r->pc - m->bias - (inner ? 0 : 1), loc;
+  uintptr_t cfa, ra, fp;
+
+  if (_find_fde(m, pc, &cie, &c, &loc) < 0)
+    return -1;
+
+  memset(&x, 0, sizeof(x));
+  memset(&ci, 0, sizeof(ci));
+  ci.start = m->eh_frame;
+  ci.p = cie.insns;
+  ci.end = cie.end;
+  ci.vaddr = m->eh_frame_addr;
+
+  if (_run(&x, &cie, &ci, 0, ~0ULL) < 0)
+    return -1;
+  x.init = x.cur;
+  if (_run(&x, &cie, &c, loc, pc) < 0 || x.cur.cfa_bad
+      || cie.ra >= NREGS)
+    return -1;
+
+  if (x.cur.cfa_reg == REG_SP)
+    cfa = r->sp + x.cur.cfa_off;
+  else if (x.cur.cfa_reg == REG_FP)
+    cfa = r->fp + x.cur.cfa_off;
+  else
+    return -1;
+
+  if (x.cur.regs[cie.ra].how == RULE_UNDEF)
+    return 0;
+
+  if (x.cur.regs[cie.ra].how != RULE_OFFSET
+      || !_load(s, cfa + x.cur.regs[cie.ra].off, &ra)
+      || !_reg(&x.cur.regs[REG_FP], s, r, cfa, r->fp, &fp))
+    return -1;
+
+  r->pc = ra;
+  r->sp = cfa;
+  r->fp = fp;
+  return ra != 0;
+}
+
+
+/*  _step_fp:
+ *    unwinds one frame through the saved frame pointer chain.
+ */
+static int
+_step_fp(const unw_stack *s, unw_regs *r)
+{
+  uintptr_t next, ra;
+
+  if (r->fp < r->sp || (r->fp & 7) || !_load(s, r->fp, &next)
+      || !_load(s, r->fp + 8, &ra))
+    return -1;
+
+  if (ra == 0)
+    return 0;
+
+  r->sp = r->fp + 16;
+  r->fp = next;
+  r->pc = ra;
+  return 1;
+}
+
+
+/*  unw_backtrace:
+ *    the return addresses of a stopped thread, innermost first. frames in
+ *    modules with unwind tables are stepped by them, anything else, e.g.
+ *    jit code or modules without tables, through frame pointers. returns
+ *    the amount of frames.
+ *
+ *    const unw_table *t:   the process' modules
+ *    const unw_stack *s:   copy of the thread's stack
+ *    unw_regs r:           the thread's registers
+ *    uintptr_t *pcs:       receives up to max addresses
+ *    int max:              frames to unwind at most
+ */
+int
+unw_backtrace(const unw_table *t, const unw_stack *s, unw_regs r,
+              uintptr_t *pcs, int max)
+{
+  const unw_module *m;
+  uintptr_t sp;
+  int n = 0, res;
+
+  while (n < max && r.pc != 0)
+  {
+    pcs[n++] = r.pc;
+    sp = r.sp;
+
+    m = unw_module_find(t, r.pc);
+    res = -1;
+    if (m != NULL && m->hdr != NULL)
+      res = _step_cfi(m, s, &r, n == 1);
+    if (res < 0)
+      res = _step_fp(s, &r);
+
+    /* the stack grows down, callers are always higher up */
+    if (res <= 0 || r.sp <= sp)
+      break;
+  }
+
+  return n;
+}
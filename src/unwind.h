@@ -0,0 +1,68 @@
+#ifndef __UNWIND_H
+#define __UNWIND_H
+
+#include "mem.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  _unwind_regs:
+ *    the registers a frame is described by.
+ */
+typedef struct _unwind_regs
+{
+  uintptr_t pc, sp, fp;
+} unw_regs;
+
+
+/*  _unwind_stack:
+ *    a copy of the top of a thread's stack, from its stack pointer up.
+ */
+typedef struct _unwind_stack
+{
+  uintptr_t base;                   /* address of data[0] */
+  const uint8_t *data;
+  size_t len;
+} unw_stack;
+
+
+/*  _unwind_module:
+ *    an executable file mapping and its .eh_frame unwind tables. the file
+ *    stays mapped while the table exists, hdr is NULL if the file has no
+ *    usable tables.
+ */
+typedef struct _unwind_module
+{
+  uintptr_t start, end;             /* the executable mapping */
+  uintptr_t bias;                   /* live minus link time addresses */
+  const char *path;
+  uint8_t *file;
+  size_t file_len;
+  const uint8_t *hdr;               /* .eh_frame_hdr */
+  uint64_t hdr_addr;                /* its link time address */
+  const uint8_t *eh_frame;
+  uint64_t eh_frame_addr;
+  size_t eh_frame_len;              /* upper bound, to the segment end */
+  const uint8_t *fdes;              /* hdr search table */
+  size_t nfdes;
+} unw_module;
+
+
+/*  _unwind_table:
+ *    the executable modules of a process, sorted by address.
+ */
+typedef struct _unwind_table
+{
+  unw_module *mods;
+  size_t count;
+} unw_table;
+
+
+/* function definitions */
+int               unw_table_build(unw_table*, ll_memmap_file*);
+void              unw_table_free(unw_table*);
+const unw_module* unw_module_find(const unw_table*, uintptr_t);
+int               unw_backtrace(const unw_table*, const unw_stack*, unw_regs,
+                                uintptr_t*, int);
+
+#endif /* __UNWIND_H */
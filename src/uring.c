@@ -0,0 +1,279 @@
+#include "uring.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+
+
+static inline int
+_sys_setup(unsigned entries, struct io_uring_params *p)
+{
+  return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static inline int
+_sys_enter(int fd, unsigned submit, unsigned wait, unsigned flags)
+{
+  return (int) syscall(__NR_io_uring_enter, fd, submit, wait, flags, NULL, 0);
+}
+
+
+static inline int
+_sys_register(int fd, unsigned op, void *arg, unsigned n)
+{
+  return (int) syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+
+/*  _read_supported:
+ *    asks the kernel whether IORING_OP_READ exists (linux 5.6+), older
+ *    kernels have io_uring but no plain read operation.
+ */
+static int
+_read_supported(int fd)
+{
+  struct io_uring_probe *probe;
+  size_t sz;
+  int ok;
+
+  sz = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+  probe = calloc(1, sz);
+
+  ok = _sys_register(fd, IORING_REGISTER_PROBE, probe, 256) == 0
+       && probe->last_op >= IORING_OP_READ
+       && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED);
+
+  free(probe);
+  return ok;
+}
+
+
+/*  uring_open:
+ *    sets up an instance with room for entries queued reads. returns NULL
+ *    if the kernel doesn't support io_uring reads or forbids them, callers
+ *    are expected to fall back to synchronous reads.
+ *
+ *    unsigned entries:   submission queue size, rounded up to a power of 2
+ */
+io_uring *
+uring_open(unsigned entries)
+{
+  io_uring *u;
+  struct io_uring_params p;
+  uint8_t *sq, *cq;
+
+  u = calloc(1, sizeof(io_uring));
+  memset(&p, 0, sizeof(p));
+
+  u->fd = _sys_setup(entries, &p);
+  if (u->fd < 0 || !_read_supported(u->fd))
+    goto uring_open_fail;
+
+  u->entries = p.sq_entries;
+  u->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  /* newer kernels map both rings with a single mmap */
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (u->cq_ring_sz > u->sq_ring_sz)
+      u->sq_ring_sz = u->cq_ring_sz;
+    u->cq_ring_sz = u->sq_ring_sz;
+  }
+
+  u->sq_ring = mmap(NULL, u->sq_ring_sz, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ring == MAP_FAILED)
+    goto uring_open_fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    u->cq_ring = u->sq_ring;
+  else
+    u->cq_ring = mmap(NULL, u->cq_ring_sz, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+  if (u->cq_ring == MAP_FAILED)
+    goto uring_open_unmap;
+
+  u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED)
+    goto uring_open_unmap;
+
+  sq = u->sq_ring;
+  u->sq_head  = (unsigned *) (sq + p.sq_off.head);
+  u->sq_tail  = (unsigned *) (sq + p.sq_off.tail);
+  u->sq_mask  = (unsigned *) (sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *) (sq + p.sq_off.array);
+
+  cq = u->cq_ring;
+  u->cq_head = (unsigned *) (cq + p.cq_off.head);
+  u->cq_tail = (unsigned *) (cq + p.cq_off.tail);
+  u->cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+  u->cqes    = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+  return u;
+
+uring_open_unmap:
+  if (u->cq_ring != MAP_FAILED && u->cq_ring != NULL
+      && u->cq_ring != u->sq_ring)
+    munmap(u->cq_ring, u->cq_ring_sz);
+  munmap(u->sq_ring, u->sq_ring_sz);
+
+uring_open_fail:
+  if (u->fd >= 0)
+    close(u->fd);
+  free(u);
+  return NULL;
+}
+
+
+/*  uring_close:
+ *    tears down the instance. reads still running are cancelled by the
+ *    kernel, their buffers must stay valid until this returns.
+ */
+void
+uring_close(io_uring *u)
+{
+  if (u == NULL)
+    return;
+
+  munmap(u->sqes, u->sqes_sz);
+  if (u->cq_ring != u->sq_ring)
+    munmap(u->cq_ring, u->cq_ring_sz);
+  munmap(u->sq_ring, u->sq_ring_sz);
+  close(u->fd);
+  free(u);
+}
+
+
+/*  uring_queue_read:
+ *    queues a read of len bytes at off into buf. nothing is sent to the
+ *    kernel until uring_submit. returns -1 if the submission queue is full
+ *    or as many reads as it holds are already running.
+ *
+ *    io_uring *u:    instance to queue on
+ *    int fd:         file to read from
+ *    void *buf:      destination
+ *    size_t len:     amount of bytes to read
+ *    uint64_t off:   file offset
+ *    void *user:     returned by uring_reap with the result
+ */
+int
+uring_queue_read(io_uring *u, int fd, void *buf, size_t len, uint64_t off,
+                 void *user)
+{
+  unsigned tail, idx;
+  struct io_uring_sqe *sqe;
+
+  if (u->inflight >= u->entries)
+    return -1;
+
+  tail = *u->sq_tail;
+  if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->entries)
+    return -1;
+
+  idx = tail & *u->sq_mask;
+  sqe = &u->sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = (uintptr_t) buf;
+  sqe->len = (uint32_t) len;
+  sqe->off = off;
+  sqe->user_data = (uintptr_t) user;
+
+  u->sq_array[idx] = idx;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  u->sq_pending++;
+  u->inflight++;
+  return 0;
+}
+
+
+/*  uring_submit:
+ *    hands every queued read to the kernel and waits until at least wait
+ *    reads have completed. returns 0 on success or -1 with errno set.
+ *
+ *    io_uring *u:      instance to submit
+ *    unsigned wait:    completions to wait for, 0 to return right away
+ */
+int
+uring_submit(io_uring *u, unsigned wait)
+{
+  int n;
+  unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+
+  do {
+    n = _sys_enter(u->fd, u->sq_pending, wait, flags);
+  } while (n < 0 && errno == EINTR);
+
+  if (n < 0)
+    return -1;
+
+  u->sq_pending -= (unsigned) n < u->sq_pending ? (unsigned) n
+                                                : u->sq_pending;
+  return 0;
+}
+
+
+/*  uring_unqueue:
+ *    takes back the last read that was queued but not taken by the kernel,
+ *    to drop reads a failed uring_submit left in the submission queue.
+ *    returns 1 and sets user if there was one, 0 if not.
+ *
+ *    io_uring *u:  instance to take the read from
+ *    void **user:  receives the user pointer passed to uring_queue_read
+ */
+int
+uring_unqueue(io_uring *u, void **user)
+{
+  unsigned tail = *u->sq_tail;
+
+  if (u->sq_pending == 0
+      || tail == __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE))
+    return 0;
+
+  tail--;
+  *user = (void *) (uintptr_t) u->sqes[tail & *u->sq_mask].user_data;
+  __atomic_store_n(u->sq_tail, tail, __ATOMIC_RELEASE);
+
+  u->sq_pending--;
+  u->inflight--;
+  return 1;
+}
+
+
+/*  uring_reap:
+ *    takes one completion off the queue without blocking. returns 1 and
+ *    sets user and res (bytes read or -errno) if there was one, 0 if not.
+ *
+ *    io_uring *u:  instance to reap from
+ *    void **user:  receives the user pointer passed to uring_queue_read
+ *    int *res:     receives the result
+ */
+int
+uring_reap(io_uring *u, void **user, int *res)
+{
+  unsigned head;
+  struct io_uring_cqe *cqe;
+
+  head = *u->cq_head;
+  if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+    return 0;
+
+  cqe = &u->cqes[head & *u->cq_mask];
+  *user = (void *) (uintptr_t) cqe->user_data;
+  *res = cqe->res;
+
+  __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+  u->inflight--;
+  return 1;
+}
@@ -0,0 +1,39 @@
+#ifndef __URING_H
+#define __URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*  _io_uring:
+ *    a minimal io_uring instance for queueing reads, set up with the raw
+ *    syscalls so no liburing is needed.
+ */
+typedef struct _io_uring
+{
+  int fd;
+  unsigned entries;                 /* submission queue size            */
+  unsigned inflight;                /* queued or running, not yet reaped */
+
+  /* submission ring */
+  unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+  struct io_uring_sqe *sqes;
+  unsigned sq_pending;              /* queued but not yet submitted */
+
+  /* completion ring */
+  unsigned *cq_head, *cq_tail, *cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ring, *cq_ring;
+  size_t sq_ring_sz, cq_ring_sz, sqes_sz;
+} io_uring;
+
+
+/* function definitions */
+io_uring* uring_open(unsigned);
+void      uring_close(io_uring*);
+int       uring_queue_read(io_uring*, int, void*, size_t, uint64_t, void*);
+int       uring_submit(io_uring*, unsigned);
+int       uring_unqueue(io_uring*, void**);
+int       uring_reap(io_uring*, void**, int*);
+
+#endif /* __URING_H */
@@ -1,8 +1,10 @@
 #include "util.h"
 
+#include <pthread.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 /*  nreadline:
  *    copies characters into buf until it reaches a newline or the characters
@@ -53,3 +55,103 @@ scharpos(const char *s, char c)
   
   return -1;
 }
+
+
+/*  monotonic_ns:
+ *    returns the monotonic clock in nanoseconds, for measuring intervals.
+ */
+uint64_t
+monotonic_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/*  _parallel_job:
+ *    shared state of a parallel_for call, workers claim items from next.
+ */
+struct _parallel_job
+{
+  int n, next;
+  parallel_fn fn;
+  void *arg;
+};
+
+struct _parallel_worker
+{
+  struct _parallel_job *job;
+  int id;
+};
+
+
+/*  _parallel_worker_main:
+ *    claims and runs items until none are left.
+ */
+static void *
+_parallel_worker_main(void *p)
+{
+  struct _parallel_worker *w = p;
+  int item;
+
+  while ((item = __atomic_fetch_add(&w->job->next, 1, __ATOMIC_RELAXED))
+         < w->job->n)
+    w->job->fn(item, w->id, w->job->arg);
+
+  return NULL;
+}
+
+
+/*  parallel_for:
+ *    calls fn(item, worker, arg) for every item in [0, n) on up to nthreads
+ *    threads and returns once all items are done. items are handed out one
+ *    at a time, so uneven items balance out. worker ids are in
+ *    [0, nthreads).
+ *
+ *    int n:            amount of items
+ *    int nthreads:     maximum amount of threads to use
+ *    parallel_fn fn:   function to call for every item
+ *    void *arg:        passed through to fn
+ */
+void
+parallel_for(int n, int nthreads, parallel_fn fn, void *arg)
+{
+  int i, started;
+  struct _parallel_job job = { n, 0, fn, arg };
+  struct _parallel_worker *workers;
+  pthread_t *threads;
+
+  if (nthreads > n)
+    nthreads = n;
+
+  if (nthreads <= 1) {
+    for (i = 0; i < n; i++)
+      fn(i, 0, arg);
+    return;
+  }
+
+  workers = malloc(nthreads * sizeof(struct _parallel_worker));
+  threads = malloc(nthreads * sizeof(pthread_t));
+
+  /* the calling thread works as worker 0 */
+  for (i = 0; i < nthreads; i++)
+  {
+    workers[i].job = &job;
+    workers[i].id = i;
+  }
+
+  for (started = 1; started < nthreads; started++)
+    if (pthread_create(&threads[started], NULL, _parallel_worker_main,
+                       &workers[started]) != 0)
+      break;
+
+  _parallel_worker_main(&workers[0]);
+
+  for (i = 1; i < started; i++)
+    pthread_join(threads[i], NULL);
+
+  free(threads);
+  free(workers);
+}
@@ -16,7 +16,7 @@
  *    int status:   status code to exit with
  *    char *msg:    message to print (pass to perror)
  */
-inline void
+static inline void
 die(int status, char *msg)
 {
   perror(msg);
@@ -30,5 +30,12 @@ int nreadline(char *, int, FILE*);
 /* string helper functions */
 int scharpos(const char*, char);
 
+/* time helper functions */
+uint64_t monotonic_ns(void);
+
+/* threading helper functions */
+typedef void (*parallel_fn)(int, int, void*);   /* (item, worker, arg) */
+void parallel_for(int, int, parallel_fn, void*);
+
 
 #endif /* __UTIL_H */
\ No newline at end of file
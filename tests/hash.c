@@ -0,0 +1,61 @@
+/*  hash:
+ *    checks that page hashes depend on where each stripe is, and that the
+ *    portable and AVX2 versions agree.
+ */
+#include "hash.h"
+#include "hostutil.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PAGE  4096
+
+
+static int failed = 0;
+
+
+static void
+_check(int ok, const char *what)
+{
+  printf("%s  %s\n", ok ? "ok  " : "FAIL", what);
+  failed |= !ok;
+}
+
+
+int
+main(void)
+{
+  static uint8_t a[PAGE], b[PAGE], c[PAGE];
+  int i;
+
+  host_init();
+
+  /* the same non-zero stripe at two different offsets */
+  for (i = 0; i < 32; i++)
+    a[i] = b[64 + i] = (uint8_t) (i * 37 + 1);
+  _check(hash_bytes64(a, PAGE) != hash_bytes64(b, PAGE),
+         "a stripe moved to another offset");
+
+  /* two stripes swapped */
+  for (i = 0; i < PAGE; i++)
+    c[i] = (uint8_t) (i * 131 + i / 32);
+  memcpy(a, c, PAGE);
+  memcpy(b, c, PAGE);
+  memcpy(b, c + 32, 32);
+  memcpy(b + 32, c, 32);
+  _check(hash_bytes64(a, PAGE) != hash_bytes64(b, PAGE),
+         "two stripes swapped");
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (host_get_info()->features & HOST_AVX2) {
+    for (i = 1; i <= PAGE; i += 97)
+      if (hash_bytes64(c, i) != hash_bytes64_avx2(c, i))
+        break;
+    _check(i > PAGE, "avx2 matches the portable version");
+    _check(hash_bytes64_avx2(a, PAGE) != hash_bytes64_avx2(b, PAGE),
+           "avx2, two stripes swapped");
+  }
+#endif
+
+  return failed;
+}